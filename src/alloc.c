@@ -89,6 +89,12 @@ void lmn_delete_atom(LmnSAtom ap)
 
   arity = LMN_FUNCTOR_ARITY(LMN_SATOM_GET_FUNCTOR(ap));
   cid = env_my_thread_id();
+  /* 別スレッドが確保したアトムを解放する場合(状態空間の並列解放など)は,
+   * 自スレッドのプールが未作成の場合がある */
+  if (atom_memory_pools[arity][cid] == 0) {
+    atom_memory_pools[arity][cid] =
+      memory_pool_new(sizeof(LmnWord) * LMN_SATOM_WORDS(arity));
+  }
   memory_pool_free(atom_memory_pools[arity][cid], ap);
 }
 
@@ -172,13 +172,22 @@ void env_init()
   lmn_env.property_dump          = FALSE;
   lmn_env.enable_compress_mem    = TRUE;
   lmn_env.z_compress             = FALSE;
+  lmn_env.z_dict                 = FALSE;
+  lmn_env.z_dict_train           = 256;
+  lmn_env.z_dict_rebuild         = 0;
   lmn_env.d_compress             = FALSE;
+  lmn_env.memory_limit           = 0;
+  lmn_env.d_chain_max            = 16;
+  lmn_env.collapse               = FALSE;
+  lmn_env.d_ref_best             = FALSE;
   lmn_env.r_compress             = FALSE;
   lmn_env.enable_parallel        = FALSE;
   lmn_env.core_num               = 1;
   lmn_env.cutoff_depth           = 7;
   lmn_env.optimize_lock          = FALSE;
   lmn_env.optimize_hash          = TRUE;
+  lmn_env.enable_lockfree_tbl    = FALSE;
+  lmn_env.numa                   = FALSE;
   lmn_env.optimize_loadbalancing = TRUE;
 
   lmn_env.opt_mode               = OPT_NONE;
@@ -196,13 +205,19 @@ void env_init()
   lmn_env.enable_map             = FALSE;
   lmn_env.enable_bledge          = FALSE;
   lmn_env.bfs_layer_sync         = FALSE;
+  lmn_env.bfs_partition          = FALSE;
+  lmn_env.bfs_small_layer        = 0;
 
   lmn_env.enable_map_heuristic   = TRUE;
 
   lmn_env.show_reduced_graph     = FALSE;
 
   lmn_env.hash_compaction        = FALSE;
+  lmn_env.hash_compaction_mb     = 256;
   lmn_env.hash_depth             = 2;
+  lmn_env.bitstate_mb            = 0;
+  lmn_env.bitstate_k             = 3;
+  lmn_env.spill_dir              = NULL;
 #ifdef PROFILE
   lmn_env.optimize_hash_old      = FALSE;
   lmn_env.prof_no_memeq          = FALSE;
@@ -227,6 +227,13 @@ LMN_EXTERN void lmn_free (void *p);
 # define LMN_ASSERT(expr)   ((void)0)/* nothing */
 #endif
 
+/* Prefetch (読み込み用. 効果のないコンパイラでは何もしない) */
+#ifdef __GNUC__
+# define LMN_PREFETCH(addr) __builtin_prefetch((addr))
+#else
+# define LMN_PREFETCH(addr) ((void)0)
+#endif
+
 
 /*----------------------------------------------------------------------
  * Global data
@@ -267,7 +274,14 @@ struct LmnEnv {
 
   BOOL delta_mem;
   BOOL z_compress;
+  BOOL z_dict;                  /* z圧縮に共有辞書を用いる */
+  unsigned int z_dict_train;    /* 辞書の作成に用いる標本(バイナリストリング)の数 */
+  unsigned long z_dict_rebuild; /* 0でなければ, この数だけ圧縮する度に辞書を作り直す */
   BOOL d_compress;
+  unsigned long memory_limit; /* 0でなければ, 状態空間のメモリ量がこの値(byte)に近づくにつれて圧縮方式を強める */
+  unsigned int d_chain_max;   /* 0でなければ, 差分圧縮の参照を辿る回数をこの数までに抑える */
+  BOOL collapse;              /* ルート膜直下の子膜のダンプを大域表に一度だけ格納し, 状態からはIDで参照する */
+  BOOL d_ref_best;            /* 親状態と展開中に登録した兄弟状態のうち, 差分が最小となる状態を参照する */
   BOOL r_compress;
 
   BOOL prop_scc_driven;
@@ -280,6 +294,9 @@ struct LmnEnv {
   BOOL dump;
   BOOL end_dump;
 
+  BOOL enable_lockfree_tbl;
+  BOOL numa;                /* スレッドをNUMAノード毎にまとめて配置し, 同じノード内で仕事を融通する */
+
   BOOL enable_owcty;
   BOOL enable_map;
   BOOL enable_map_heuristic;
@@ -293,6 +310,8 @@ struct LmnEnv {
 
   BOOL show_reduced_graph;
   BOOL bfs_layer_sync;
+  BOOL bfs_partition;       /* 並列BFSで状態空間をスレッド毎に分割し, 状態の登録を担当スレッドへ送る */
+  unsigned int bfs_small_layer; /* 0でなければ, Layer同期BFSで状態数がこの値未満のLayerを1スレッドで展開する */
   BOOL interactive;
   BOOL normal_remain;
 
@@ -309,7 +328,11 @@ struct LmnEnv {
   BOOL benchmark;
 
   BOOL hash_compaction;
+  unsigned int hash_compaction_mb; /* hash compactionのfingerprint表のサイズ(MB) */
   int  hash_depth;
+  unsigned int bitstate_mb; /* bitstate hashingのビット配列サイズ(MB). 0ならば使用しない */
+  unsigned int bitstate_k;  /* bitstate hashingで1状態あたりに立てるビット数 */
+  char *spill_dir;          /* NULLでなければ, 状態のバイナリストリングをこのディレクトリのファイルへ退避する */
 
 #ifdef PROFILE
   BOOL optimize_hash_old;
@@ -354,9 +377,11 @@ void slim_version(FILE *f);
 # define ENABLE_OMP
 # define lmn_OMP_set_thread_num(N) omp_set_num_threads(N)
 # define lmn_OMP_get_my_id()       omp_get_thread_num()
+# define lmn_OMP_get_threads_num() omp_get_num_threads()
 #else
 # define lmn_OMP_set_thread_num(N)
 # define lmn_OMP_get_my_id()       (0U)
+# define lmn_OMP_get_threads_num() (1U)
 #endif
 
 #if defined (HAVE_LIBPTHREAD) || defined (HAVE_WINAPI)
@@ -381,6 +406,7 @@ void slim_version(FILE *f);
 #
   typedef pthread_t         lmn_thread_t;
   typedef pthread_mutex_t   lmn_mutex_t;
+  typedef pthread_cond_t    lmn_cond_t;
   typedef pthread_key_t     lmn_key_t;
 #
 # ifdef HAVE_PTHREAD_BARRIER
@@ -403,6 +429,11 @@ void slim_version(FILE *f);
 # define lmn_mutex_destroy(Pm)                pthread_mutex_destroy(Pm)
 # define lmn_mutex_lock(Pm)                   pthread_mutex_lock(Pm)
 # define lmn_mutex_unlock(Pm)                 pthread_mutex_unlock(Pm)
+# define lmn_cond_init(Pc)                    pthread_cond_init(Pc, NULL)
+# define lmn_cond_destroy(Pc)                 pthread_cond_destroy(Pc)
+# define lmn_cond_wait(Pc, Pm)                pthread_cond_wait(Pc, Pm)
+# define lmn_cond_timedwait(Pc, Pm, Pts)      pthread_cond_timedwait(Pc, Pm, Pts)
+# define lmn_cond_broadcast(Pc)               pthread_cond_broadcast(Pc)
 # define lmn_TLS_key_init(Pk)                 pthread_key_create(Pk, NULL)
 # define lmn_TLS_key_destroy(K)               pthread_key_delete(K)
 # define lmn_TLS_set_value(K, Pval)           pthread_setspecific(K, Pval)
@@ -102,6 +102,11 @@ static void usage(void)
           "  --ltl-all           (MC) Generate full state space and exhaustive search\n"
           "  --bfs               (MC) Use BFS strategy\n"
           "  --bfs-lsync         (MC) Use Layer Synchronized BFS strategy\n"
+          "  --bfs-partition     (MC) Use Layer Synchronized BFS with the state space\n"
+          "                      partitioned among threads (with --use-Ncore)\n"
+          "  --bfs-small-layer=<N>\n"
+          "                      (MC) With --bfs-lsync, expand layers of fewer than <N> states\n"
+          "                      by one thread without synchronizing every layer\n"
           "  --use-owcty         (MC) Use OWCTY algorithm  (LTL model checking)\n"
           "  --use-map           (MC) Use MAP algorithm    (LTL model checking)\n"
           "  --use-mapndfs       (MC) Use Map+NDFS algorithm (LTL model checking)\n"
@@ -112,9 +117,29 @@ static void usage(void)
           "  --disable-map-h     (MC) No use MAP heuristics(LTL model checking)\n"
           "  --pscc-driven       (MC) Use SCC analysis of property automata (LTL model checking)\n"
           "  --use-Ncore=<N>     (MC) Use <N>threads\n"
+          "  --lockfree-tbl      (MC) Use lock-free state table (with --use-Ncore)\n"
+          "  --numa              (MC) Pin threads to NUMA nodes in blocks and prefer stealing\n"
+          "                      within a node (with --use-Ncore)\n"
           "  --delta-mem         (MC) Use delta membrane generator\n"
-          "  --hash-compaction   (MC) Use Hash Compaction\n"
+          "  --hash-compaction[=<MB>]\n"
+          "                      (MC) Use Hash Compaction with <MB> mega bytes fingerprint table (default: 256)\n"
           "  --hash-depth=<N>    (MC) Set <N> Depth of Hash Function\n"
+          "  --bitstate=<MB>     (MC) Use bitstate hashing with <MB> mega bytes bit array\n"
+          "  --bitstate-k=<N>    (MC) Set <N> bits per state for bitstate hashing (default: 3)\n"
+          "  --spill-dir=<dir>   (MC) Spill binary strings of states to mmap'd files in <dir>\n"
+          "  --memory-limit=<N>[K|M|G]\n"
+          "                      (MC) Switch newly stored states to more compact encodings as the state space\n"
+          "                      approaches <N> bytes\n"
+          "  --z-dict[=<N>]      (MC) Compress binary strings with zlib and a dictionary shared by all states,\n"
+          "                      trained from the first <N> states (default: 256)\n"
+          "  --z-dict-rebuild=<N>\n"
+          "                      (MC) Retrain the shared dictionary every <N> compressed states\n"
+          "  --d-chain-max=<N>   (MC) With --d-compress, store a full binary string after <N> chained deltas\n"
+          "                      (default: 16, 0: unlimited)\n"
+          "  --collapse          (MC) Store each distinct child membrane of the root once in a shared table\n"
+          "                      and refer to it by ID from the states\n"
+          "  --d-ref-best        (MC) With --d-compress, encode against the parent or a sibling state,\n"
+          "                      whichever gives the smallest delta\n"
           "  --mem-enc           (MC) Use canonical membrane representation\n"
           "  --ltl-f <ltl>       (MC) Input <ltl> formula directly. (need LTL2BA env)\n"
           "  --visualize         (MC) Output information for visualize\n"
@@ -188,10 +213,17 @@ static void parse_options(int *optid, int argc, char *argv[])
     {"z-compress"             , 0, 0, 2007},
     {"d-compress"             , 0, 0, 2008},
     {"r-compress"             , 0, 0, 2009},
+    {"z-dict"                 , 2, 0, 2010},
+    {"z-dict-rebuild"         , 1, 0, 2011},
+    {"d-chain-max"            , 1, 0, 2012},
+    {"d-ref-best"             , 0, 0, 2013},
+    {"collapse"               , 0, 0, 2014},
     {"use-owcty"              , 0, 0, 3000},
     {"use-map"                , 0, 0, 3001},
     {"use-bledge"             , 0, 0, 3002},
     {"bfs-lsync"              , 0, 0, 3003},
+    {"bfs-partition"          , 0, 0, 3006},
+    {"bfs-small-layer"        , 1, 0, 3007},
     {"use-mapndfs"            , 0, 0, 3004},
 #ifndef MINIMAL_STATE
     {"use-mcndfs"             , 0, 0, 3005},
@@ -203,6 +235,8 @@ static void parse_options(int *optid, int argc, char *argv[])
     {"opt-lock"               , 0, 0, 5025},
     {"disable-opt-hash"       , 0, 0, 5026},
     {"opt-hash-old"           , 0, 0, 5027},
+    {"lockfree-tbl"           , 0, 0, 5030},
+    {"numa"                   , 0, 0, 5031},
     {"no-dump"                , 0, 0, 6000},
     {"benchmark-dump"         , 0, 0, 6001},
     {"property-dump"          , 0, 0, 6002},
@@ -216,8 +250,12 @@ static void parse_options(int *optid, int argc, char *argv[])
     {"debug-tr-dep"           , 0, 0, 6014},
     {"prof-nomemeq"           , 0, 0, 6050},
     {"visualize"              , 0, 0, 6100},
-    {"hash-compaction"        , 0, 0, 6060},
+    {"hash-compaction"        , 2, 0, 6060},
     {"hash-depth"             , 1, 0, 6061},
+    {"bitstate"               , 1, 0, 6062},
+    {"bitstate-k"             , 1, 0, 6063},
+    {"spill-dir"              , 1, 0, 6064},
+    {"memory-limit"           , 1, 0, 6065},
     {"run-test"               , 1, 0, 6070},
     {0, 0, 0, 0}
   };
@@ -384,9 +422,53 @@ static void parse_options(int *optid, int argc, char *argv[])
       exit(EXIT_FAILURE);
 #endif
       break;
+    case 2010:
+#ifdef HAVE_LIBZ
+      lmn_env.z_compress = TRUE;
+      lmn_env.z_dict     = TRUE;
+      if (optarg) {
+        int n = atoi(optarg);
+        if (n <= 0) {
+          fprintf(stderr, "invalid argument: --z-dict=%s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        lmn_env.z_dict_train = n;
+      }
+#else
+      fprintf(stderr, "Sorry, z library cannot be found on your environment\n");
+      fprintf(stderr, "if you installed z library, please re-configure & make slim\n");
+      exit(EXIT_FAILURE);
+#endif
+      break;
+    case 2011:
+    {
+      long n = atol(optarg);
+      if (n < 0) {
+        fprintf(stderr, "invalid argument: --z-dict-rebuild=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.z_dict_rebuild = n;
+      break;
+    }
     case 2008:
       lmn_env.d_compress = TRUE;
       break;
+    case 2012:
+    {
+      int n = atoi(optarg);
+      if (n < 0) {
+        fprintf(stderr, "invalid argument: --d-chain-max=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.d_chain_max = n;
+      break;
+    }
+    case 2013:
+      lmn_env.d_ref_best = TRUE;
+      break;
+    case 2014:
+      lmn_env.collapse = TRUE;
+      break;
     case 2009:
       lmn_env.r_compress = TRUE;
       break;
@@ -406,6 +488,21 @@ static void parse_options(int *optid, int argc, char *argv[])
       lmn_env.bfs = TRUE;
       lmn_env.bfs_layer_sync = TRUE;
       break;
+    case 3006:
+      lmn_env.bfs = TRUE;
+      lmn_env.bfs_layer_sync = TRUE;
+      lmn_env.bfs_partition = TRUE;
+      break;
+    case 3007:
+    {
+      int n = atoi(optarg);
+      if (n <= 0) {
+        fprintf(stderr, "invalid argument: --bfs-small-layer=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.bfs_small_layer = n;
+      break;
+    }
     case 3004:
       lmn_env.enable_parallel = TRUE;
       lmn_env.enable_mapndfs = TRUE;
@@ -446,11 +543,19 @@ static void parse_options(int *optid, int argc, char *argv[])
     case 5025: /* optimize lock under constructions.. */
       lmn_env.optimize_lock      = TRUE;
       break;
+    case 5030: /* lock-free state table */
+      lmn_env.enable_lockfree_tbl = TRUE;
+      break;
+    case 5031: /* NUMA-aware placement */
+      lmn_env.numa = TRUE;
+      break;
 #else
     case 5000:
     case 5001:
     case 5015:
     case 5025:
+    case 5030:
+    case 5031:
       fprintf(stderr, "Sorry, parallel execution is not supported on your environment.\n");
       fprintf(stderr, "Requirement: GCC keyword __thread, pthread library \n");
       exit(EXIT_FAILURE);
@@ -532,6 +637,14 @@ static void parse_options(int *optid, int argc, char *argv[])
       break;
     case 6060:
       lmn_env.hash_compaction = TRUE;
+      if (optarg) {
+        int mb = atoi(optarg);
+        if (mb <= 0) {
+          fprintf(stderr, "invalid argument: --hash-compaction=%s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        lmn_env.hash_compaction_mb = mb;
+      }
       break;
     case 6061:
     {
@@ -541,6 +654,46 @@ static void parse_options(int *optid, int argc, char *argv[])
       }
       break;
     }
+    case 6062:
+    {
+      int mb = atoi(optarg);
+      if (mb <= 0) {
+        fprintf(stderr, "invalid argument: --bitstate=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.bitstate_mb = mb;
+      break;
+    }
+    case 6063:
+    {
+      int k = atoi(optarg);
+      if (k <= 0) {
+        fprintf(stderr, "invalid argument: --bitstate-k=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.bitstate_k = k;
+      break;
+    }
+    case 6064:
+      lmn_env.spill_dir = optarg;
+      break;
+    case 6065:
+    {
+      char *end;
+      unsigned long n = strtoul(optarg, &end, 10);
+      switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10; end++; break;
+        default: break;
+      }
+      if (n == 0 || *end != '\0') {
+        fprintf(stderr, "invalid argument: --memory-limit=%s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      lmn_env.memory_limit = n;
+      break;
+    }
     case 6070:
       lmn_env.run_test = TRUE;
     case 'I':
@@ -579,6 +732,7 @@ void sym_tbl_init();
 /* 処理系内部の初期化処理 */
 static void init_internal(void)
 {
+  lmn_byte_hash_wide_init();
   lmn_profiler_init(lmn_env.core_num);
   sym_tbl_init();
   lmn_functor_tbl_init();
@@ -589,6 +743,7 @@ static void init_internal(void)
     init_default_system_ruleset();
     if (lmn_env.enable_por) dpor_env_init();
     mpool_init();
+    state_mpool_init();
     mem_isom_init();
 /*    ext_init(); */
     sp_atom_init();
@@ -628,6 +783,7 @@ static inline void slim_finalize(void)
     ccallback_finalize();
     sp_atom_finalize();
     free_atom_memory_pools();
+    state_mpool_finalize();
     finalize_so_handles();
   }
 
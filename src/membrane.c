@@ -145,6 +145,8 @@ LmnMembrane *lmn_mem_make(void)
   mem->atom_data_num =  0U;
   mem->name          =  ANONYMOUS;
   mem->id            =  0UL;
+  mem->hash_cache    =  0UL;
+  mem->hash_valid    =  FALSE;
 #ifdef TIME_OPT
   mem->atomset       =  LMN_CALLOC(struct AtomListEntry *, mem->atomset_size);
 #else
@@ -292,6 +294,7 @@ void mem_push_symbol_atom(LmnMembrane *mem, LmnSAtom atom)
   AtomListEntry *as;
   LmnFunctor f = LMN_SATOM_GET_FUNCTOR(atom);
 
+  lmn_mem_hash_invalidate(mem);
   if (LMN_SATOM_ID(atom) == 0) { /* 膜にpushしたならばidを割り当てる */
     LMN_SATOM_SET_ID(atom, env_gen_next_id());
   }
@@ -430,6 +433,7 @@ void lmn_mem_unify_atom_args(LmnMembrane *mem,
   ap2   = LMN_SATOM_GET_LINK(atom2, pos2);
   attr2 = LMN_SATOM_GET_ATTR(atom2, pos2);
 
+  lmn_mem_hash_invalidate(mem);
   if (LMN_ATTR_IS_DATA(attr1) && LMN_ATTR_IS_DATA(attr2)) {
     lmn_mem_link_data_atoms(mem, ap1, attr1, ap2, attr2);
   }
@@ -464,6 +468,7 @@ void lmn_newlink_with_ex(LmnMembrane *mem,
                          LmnSAtom atom0, LmnLinkAttr attr0, int pos0,
                          LmnSAtom atom1, LmnLinkAttr attr1, int pos1)
 {
+  lmn_mem_hash_invalidate(mem);
   /* both symbol */
   LMN_SATOM_SET_LINK(atom0, pos0, atom1);
   LMN_SATOM_SET_LINK(atom1, pos1, atom0);
@@ -518,6 +523,7 @@ void lmn_mem_newlink(LmnMembrane *mem,
                      LmnAtom atom0, LmnLinkAttr attr0, int pos0,
                      LmnAtom atom1, LmnLinkAttr attr1, int pos1)
 {
+  lmn_mem_hash_invalidate(mem);
   if (LMN_ATTR_IS_DATA_WITHOUT_EX(attr0)) {
     if (LMN_ATTR_IS_DATA_WITHOUT_EX(attr1)) { /* both data */
       lmn_mem_link_data_atoms(mem, atom0, attr0, atom1, attr1);
@@ -559,6 +565,7 @@ void lmn_mem_relink_atom_args(LmnMembrane *mem,
   LMN_ASSERT(!LMN_ATTR_IS_DATA(attr0) &&
              !LMN_ATTR_IS_DATA(attr1));
 
+  lmn_mem_hash_invalidate(mem);
   newlink_symbol_and_something(LMN_SATOM(atom0),
                                pos0,
                                LMN_SATOM_GET_LINK(LMN_SATOM(atom1), pos1),
@@ -899,6 +906,9 @@ LmnMembrane *lmn_mem_copy_with_map_inner(LmnMembrane *src,
     vec_push(&new_mem->rulesets,
         (LmnWord)lmn_ruleset_copy((LmnRuleSet)vec_get(&src->rulesets, i)));
   }
+  if (LMN_MEM_NAME_ID(new_mem) == LMN_MEM_NAME_ID(src)) {
+    lmn_mem_hash_copy(new_mem, src);
+  }
   *ret_copymap = copymap;
 
   return new_mem;
@@ -954,6 +964,8 @@ static void lmn_mem_copy_cells_sub(LmnMembrane *destmem,
       vec_push(&new_mem->rulesets,
                (LmnWord)lmn_ruleset_copy((LmnRuleSet)vec_get(&m->rulesets, i)));
     }
+    /* 子膜のハッシュ値はプロキシの外側の接続に依存しないため, そのまま引き継ぐ */
+    lmn_mem_hash_copy(new_mem, m);
   }
 
   /* copy atoms */
@@ -215,6 +215,8 @@ struct LmnMembrane {
   LmnMembrane          *child_head;
   LmnMembrane          *prev, *next;
   struct Vector        rulesets;
+  unsigned long        hash_cache;     /* 膜以下の階層のハッシュ値 (mhash) */
+  BOOL                 hash_valid;     /* hash_cacheが現在の階層と一致するならば真 */
 };
 
 #define LMN_MEM_NAME_ID(MP)          ((MP)->name)
@@ -222,7 +224,7 @@ struct LmnMembrane {
 #define lmn_mem_parent(M)            ((M)->parent)
 #define lmn_mem_is_active(M)         ((M)->is_activated)
 #define lmn_mem_max_functor(M)       ((M)->max_functor)
-#define lmn_mem_set_name(M, N)       ((M)->name = (N))
+#define lmn_mem_set_name(M, N)       (lmn_mem_hash_invalidate(M), (M)->name = (N))
 #define lmn_mem_set_active(M, F)     ((M)->is_activated = (F))
 #define lmn_mem_get_rulesets(M)      (&((M)->rulesets))
 #define lmn_mem_ruleset_num(M)       (vec_num(lmn_mem_get_rulesets(M)))
@@ -353,11 +355,45 @@ static inline void alter_functor(LmnMembrane *mem, LmnSAtom atom, LmnFunctor f);
 static inline void lmn_mem_add_ruleset(LmnMembrane *mem, LmnRuleSet ruleset);
 static inline void lmn_mem_copy_rules(LmnMembrane *dest, LmnMembrane *src);
 static inline void lmn_mem_clearrules(LmnMembrane *src);
+static inline void lmn_mem_hash_invalidate(LmnMembrane *mem);
+static inline BOOL lmn_mem_hash_get(LmnMembrane *mem, unsigned long *ret);
+static inline void lmn_mem_hash_set(LmnMembrane *mem, unsigned long hash);
+static inline void lmn_mem_hash_copy(LmnMembrane *dst, LmnMembrane *src);
+
+/* 膜memとその全ての先祖膜に記録したハッシュ値を無効にする.
+ * 親膜のハッシュ値は全ての子膜のハッシュ値が有効な場合に限り記録するため,
+ * 無効な膜の先祖膜は全て無効である. 従って, 無効な膜に到達した時点で打ち切ってよい. */
+static inline void lmn_mem_hash_invalidate(LmnMembrane *mem) {
+  for (; mem && mem->hash_valid; mem = lmn_mem_parent(mem)) {
+    mem->hash_valid = FALSE;
+  }
+}
+
+/* 膜memに記録したハッシュ値が有効ならば, retに書き込み真を返す. */
+static inline BOOL lmn_mem_hash_get(LmnMembrane *mem, unsigned long *ret) {
+  if (mem->hash_valid) {
+    *ret = mem->hash_cache;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static inline void lmn_mem_hash_set(LmnMembrane *mem, unsigned long hash) {
+  mem->hash_cache = hash;
+  mem->hash_valid = TRUE;
+}
+
+/* 膜srcのコピーdstへ, srcに記録したハッシュ値を引き継ぐ. */
+static inline void lmn_mem_hash_copy(LmnMembrane *dst, LmnMembrane *src) {
+  dst->hash_cache = src->hash_cache;
+  dst->hash_valid = src->hash_valid;
+}
 
 /* 膜parentから膜memを取り除く.
  * memのメモリ管理は呼び出し側で行う. */
 static inline void lmn_mem_remove_mem(LmnMembrane *parent, LmnMembrane *mem) {
   LMN_ASSERT(parent);
+  lmn_mem_hash_invalidate(parent);
   if (lmn_mem_child_head(parent) == mem) parent->child_head = lmn_mem_next(mem);
   if (lmn_mem_prev(mem)) mem->prev->next = lmn_mem_next(mem);
   if (lmn_mem_next(mem)) mem->next->prev = lmn_mem_prev(mem);
@@ -421,6 +457,7 @@ static inline void lmn_mem_add_child_mem(LmnMembrane *parentmem,
   newmem->next   = lmn_mem_child_head(parentmem);
   newmem->parent = parentmem;
   LMN_ASSERT(parentmem);
+  lmn_mem_hash_invalidate(parentmem);
   if (lmn_mem_child_head(parentmem)) {
     parentmem->child_head->prev = newmem;
   }
@@ -483,6 +520,7 @@ static inline void lmn_mem_remove_data_atom(LmnMembrane *mem, LmnAtom atom, LmnL
 
 static inline void mem_remove_symbol_atom(LmnMembrane *mem, LmnSAtom atom) {
   LmnFunctor f = LMN_SATOM_GET_FUNCTOR(atom);
+  lmn_mem_hash_invalidate(mem);
 #ifdef NEW_ATOMLIST
   {
     AtomListEntry *ent = lmn_mem_get_atomlist(mem, f);
@@ -565,6 +603,7 @@ static inline void alter_functor(LmnMembrane *mem, LmnSAtom atom, LmnFunctor f)
 /* ルールセットnewを膜memに追加する */
 static inline void lmn_mem_add_ruleset(LmnMembrane *mem, LmnRuleSet ruleset) {
   LMN_ASSERT(ruleset);
+  lmn_mem_hash_invalidate(mem);
   lmn_mem_add_ruleset_sort(&(mem->rulesets), ruleset);
 }
 
@@ -577,6 +616,7 @@ static inline void lmn_mem_copy_rules(LmnMembrane *dest, LmnMembrane *src) {
 
 static inline void lmn_mem_clearrules(LmnMembrane *src) {
   unsigned int i;
+  lmn_mem_hash_invalidate(src);
   for (i = 0; i < vec_num(&src->rulesets); i++) {
     LmnRuleSet rs = (LmnRuleSet)vec_get(&src->rulesets, i);
     if (lmn_ruleset_is_copy(rs)) {
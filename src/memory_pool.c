@@ -45,11 +45,19 @@
 /* after alignment, X byte object needs ALIGNED_SIZE(X) byte. */
 #define ALIGNED_SIZE(X) (((X + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*))
 
+static const int blocksize = 8;
+
 memory_pool *memory_pool_new(int s)
+{
+  return memory_pool_new_with_blocksize(s, blocksize);
+}
+
+memory_pool *memory_pool_new_with_blocksize(int s, int n)
 {
   memory_pool *res = LMN_MALLOC(memory_pool);
 
   res->sizeof_element = ALIGNED_SIZE(s);
+  res->block_elements = n;
   res->block_head = 0;
   res->free_head = 0;
 
@@ -58,7 +66,6 @@ memory_pool *memory_pool_new(int s)
   return res;
 }
 
-static const int blocksize = 8;
 void *memory_pool_malloc(memory_pool *p)
 {
   void *res;
@@ -70,7 +77,7 @@ void *memory_pool_malloc(memory_pool *p)
     /* fprintf(stderr, "no more free space, so allocate new block\n"); */
 
     /* top of block is used as pointer to head of next block */
-    rawblock = lmn_malloc(ALIGNED_SIZE(sizeof(void*)) + p->sizeof_element * blocksize);
+    rawblock = lmn_malloc(ALIGNED_SIZE(sizeof(void*)) + p->sizeof_element * p->block_elements);
     *(void**)rawblock = p->block_head;
     p->block_head = rawblock;
 
@@ -79,11 +86,11 @@ void *memory_pool_malloc(memory_pool *p)
     rawblock = rawblock + ALIGNED_SIZE(sizeof(void*));
     p->free_head = rawblock;
 
-    for (i = 0; i < (blocksize - 1); i++) {
+    for (i = 0; i < (p->block_elements - 1); i++) {
       /* top of each empty elements is used as pointer to next empty element */
       REF_CAST(void*, rawblock[p->sizeof_element * i]) = &rawblock[p->sizeof_element * (i + 1)];
     }
-    REF_CAST(void*, rawblock[p->sizeof_element * (blocksize - 1)]) = 0;
+    REF_CAST(void*, rawblock[p->sizeof_element * (p->block_elements - 1)]) = 0;
   }
 
   res = p->free_head;
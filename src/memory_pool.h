@@ -41,12 +41,15 @@
 
 typedef struct memory_pool_ {
   int   sizeof_element;
+  int   block_elements; /* 1ブロックあたりの要素数 */
   void *block_head;
   void *free_head;
 } memory_pool;
 
 /* 要素サイズsのメモリプールを作成 */
 memory_pool *memory_pool_new(int s);
+/* 要素サイズs, 1ブロックあたりn要素のメモリプールを作成 */
+memory_pool *memory_pool_new_with_blocksize(int s, int n);
 /* メモリプールから1要素分メモリを取得 */
 void *memory_pool_malloc(memory_pool *p);
 /* メモリプールへメモリを返却 */
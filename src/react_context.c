@@ -67,6 +67,23 @@ void lmn_register_extend(LmnReactCxt *rc, unsigned int new_size)
   warry_size_set(rc, new_size);
 }
 
+/* 作業配列の先頭n要素のうち, 膜を指す要素に記録されたハッシュ値を無効にする.
+ * BODY命令はリンクを膜を経由せずに直接書き換えるため, COMMIT命令の時点で
+ * マッチングした膜(とその先祖膜)を全て無効にしておく.
+ * 要素の種類はTIME_OPT時にのみ記録されるため, それ以外では何もしない
+ * (この場合mhashも膜のハッシュ値を記録しない). */
+void lmn_register_invalidate_mem_hashes(LmnReactCxt *rc, unsigned int n)
+{
+#ifdef TIME_OPT
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    if (tt(rc, i) == TT_MEM && wt(rc, i)) {
+      lmn_mem_hash_invalidate((LmnMembrane *)wt(rc, i));
+    }
+  }
+#endif
+}
+
 void react_context_init(LmnReactCxt *rc, BYTE mode)
 {
   rc->mode          = mode;
@@ -156,6 +173,8 @@ inline static struct McReactCxtData *mc_react_data_make()
   v->opt_mode       = 0x00U;
   v->org_succ_num   = 0;
   v->d_cur          = 0;
+  v->succ_batch     = vec_make(32);
+  v->succ_mems      = vec_make(32);
 
   if (lmn_env.delta_mem) {
     v->mem_deltas = vec_make(32);
@@ -175,6 +194,8 @@ inline static void mc_react_data_free(struct McReactCxtData *v)
   vec_free(v->roots);
   vec_free(v->rules);
   vec_free(v->props);
+  vec_free(v->succ_batch);
+  vec_free(v->succ_mems);
   if (v->mem_deltas) {
     vec_free(v->mem_deltas);
   }
@@ -151,6 +151,7 @@ static inline BOOL rc_hlink_opt(LmnInstrVar atomi, LmnReactCxt *rc) {
 LmnRegister *lmn_register_make(unsigned int size);
 void lmn_register_free(LmnRegister *v);
 void lmn_register_extend(LmnReactCxt *rc, unsigned int new_size);
+void lmn_register_invalidate_mem_hashes(LmnReactCxt *rc, unsigned int n);
 
 /*----------------------------------------------------------------------
  * MC React Context
@@ -162,7 +163,9 @@ struct McReactCxtData {
                                 *    差分: 空
                                 * 2. 遷移先計算後 (mc_gen_successor@mc.c以降)
                                 * 　　通常: struct LmnMembraneへの参照を設定したstruct State
-                                *    差分: 初期化設定のみを行ったstruct State　*/
+                                *    差分: 初期化設定のみを行ったstruct State
+                                *    遅延(RC_MC_USE_LAZY): struct LmnMembraneのまま
+                                *                          (mc_store_successorsで新規の場合に限りStateを生成) */
   Vector       *rules;
   Vector       *props;
   Vector       *mem_deltas;    /* BODY命令の適用を終えたMemDeltaRootオブジェクトを置く */
@@ -172,6 +175,8 @@ struct McReactCxtData {
   BYTE         d_cur;
   unsigned int org_succ_num;
   McDporData   *por;
+  Vector       *succ_batch;    /* statespace_insert_batchによる遷移先状態の登録結果 */
+  Vector       *succ_mems;     /* succ_batchの各状態の登録前の階層グラフ構造 */
 };
 
 #define RC_MC_DREC_MAX                  (3)
@@ -180,6 +185,7 @@ struct McReactCxtData {
 #define RC_MC_DPOR_MASK                 (0x01U << 1)
 #define RC_MC_DPOR_NAIVE_MASK           (0x01U << 2)
 #define RC_MC_D_MASK                    (0x01U << 3)
+#define RC_MC_LAZY_MASK                 (0x01U << 4)
 
 #define RC_MC_OPT_FLAG(RC)              ((RC_ND_DATA(RC))->opt_mode)
 #define RC_MC_USE_DMEM(RC)              (RC_MC_OPT_FLAG(RC) &   RC_MC_DMEM_MASK)
@@ -194,6 +200,9 @@ struct McReactCxtData {
 #define RC_MC_USE_D(RC)                 (RC_MC_OPT_FLAG(RC) &   RC_MC_D_MASK)
 #define RC_MC_SET_D(RC)                 (RC_MC_OPT_FLAG(RC) |=  RC_MC_D_MASK)
 #define RC_MC_UNSET_D(RC)               (RC_MC_OPT_FLAG(RC) &=(~RC_MC_D_MASK))
+#define RC_MC_USE_LAZY(RC)              (RC_MC_OPT_FLAG(RC) &   RC_MC_LAZY_MASK)
+#define RC_MC_SET_LAZY(RC)              (RC_MC_OPT_FLAG(RC) |=  RC_MC_LAZY_MASK)
+#define RC_MC_UNSET_LAZY(RC)            (RC_MC_OPT_FLAG(RC) &=(~RC_MC_LAZY_MASK))
 
 #define RC_ND_DATA(RC)                  ((struct McReactCxtData *)(RC)->v)
 #define RC_SUCC_TBL(RC)                 ((RC_ND_DATA(RC))->succ_tbl)
@@ -206,6 +215,8 @@ struct McReactCxtData {
 #define RC_ND_ORG_SUCC_NUM(RC)          ((RC_ND_DATA(RC))->org_succ_num)
 #define RC_ND_SET_ORG_SUCC_NUM(RC, N)   ((RC_ND_DATA(RC))->org_succ_num = (N))
 #define RC_POR_DATA(RC)                 ((RC_ND_DATA(RC))->por)
+#define RC_SUCC_BATCH(RC)               ((RC_ND_DATA(RC))->succ_batch)
+#define RC_SUCC_BATCH_MEMS(RC)          ((RC_ND_DATA(RC))->succ_mems)
 #define RC_D_CUR(RC)                    ((RC_ND_DATA(RC))->d_cur)
 #define RC_D_COND(RC)                   (RC_D_CUR(RC) > 0)
 #define RC_D_PROGRESS(RC)                                                      \
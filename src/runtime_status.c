@@ -385,7 +385,7 @@ static void profile_state_f(State *s, LmnWord arg)
   succ_num = state_succ_num(s);
 
   /* メモリ */
-  p->state_space += sizeof(State);
+  p->state_space += STATE_OBJ_SPACE;
   if (!is_binstr_user(s) && state_mem(s)) {
     p->membrane_space += lmn_mem_root_space(state_mem(s));
   }
@@ -530,10 +530,11 @@ static void dump_execution_stat(FILE *f)
              , "mem2id"   , lmn_env.mem_enc       ? "ON" : "OFF"
              , "mdelta"   , lmn_env.delta_mem     ? "ON" : "OFF"
              , "p.o.r."   , lmn_env.enable_por    ? "ON" : "OFF");
-    fprintf(f, "%-9s: %-8s=%6s  %-8s=%6s\n"
+    fprintf(f, "%-9s: %-8s=%6s  %-8s=%6s  %-8s=%6s\n"
              , ""
              , "bsZcomp.", lmn_env.z_compress    ? "ON" : "OFF"
-             , "bsDcomp.", lmn_env.d_compress    ? "ON" : "OFF");
+             , "bsDcomp.", lmn_env.d_compress    ? "ON" : "OFF"
+             , "stTbl"   , lmn_env.enable_lockfree_tbl ? "LF" : "CHAIN");
     fprintf(f, "%-9s: %-8s=%6s  %-8s=%6s\n"
              , "EXPLORER"
              , "strtgy"  , expr
@@ -914,6 +915,12 @@ static char *profile_counter_id_to_name(int type)
   case PROFILE_COUNT__HASH_FAIL_TO_INSERT:
     ret = "fail to insert tbl";
     break;
+  case PROFILE_COUNT__STEAL_LOCAL:
+    ret = "steal local node";
+    break;
+  case PROFILE_COUNT__STEAL_REMOTE:
+    ret = "steal remote node";
+    break;
   default:
     ret = "unknown";
     break;
@@ -103,6 +103,8 @@ enum PROFILE_HTABLE_COUNT {
   PROFILE_COUNT__HASH_RESIZE_TRIAL,           /* テーブル拡張の試行回数 */
   PROFILE_COUNT__HASH_RESIZE_APPLY,           /* テーブル拡張の適用回数 */
   PROFILE_COUNT__HASH_FAIL_TO_INSERT,         /* 並列時, 競合によってエントリの追加に失敗した回数 */
+  PROFILE_COUNT__STEAL_LOCAL,                 /* 同じNUMAノードのWorkerからタスクを奪った回数 */
+  PROFILE_COUNT__STEAL_REMOTE,                /* 異なるNUMAノードのWorkerからタスクを奪った回数 */
   PCOUNT_TAIL,                        /* dummy */
 };
 
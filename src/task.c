@@ -978,6 +978,7 @@ static BOOL interpret(LmnReactCxt *rc, LmnRule rule, LmnRuleInstr instr)
           /** 変数配列および属性配列をコピーと入れ換え, コピー側を書き換える */
           tmp = rc_warry(rc);
           rc_warry_set(rc, v);
+          lmn_register_invalidate_mem_hashes(rc, n);
 
 #ifdef PROFILE
           if (lmn_env.profile_level >= 3) {
@@ -1017,6 +1018,16 @@ static BOOL interpret(LmnReactCxt *rc, LmnRule rule, LmnRuleInstr instr)
       else if (RC_GET_MODE(rc, REACT_PROPERTY)) {
         return TRUE;  /* propertyはmatchingのみ */
       }
+      else if (lmn_env.nd) {
+        /* 状態空間中の膜に対するatomic stepなどでは, その場でBODY命令を適用する.
+         * SPEC命令以降に書き込んだレジスタ(warry_cur_size)と, SPECが指定したレジスタ
+         * (warry_use_size)のどちらか一方だけでは, JUMP命令で引き継いだレジスタやSPEC以前に
+         * 設定したレジスタを取りこぼし得る. 古いハッシュ値が残ると異なる状態を同一視するため,
+         * 両者の大きい方まで保守的に無効にする */
+        lmn_register_invalidate_mem_hashes(rc, warry_cur_size(rc) > warry_use_size(rc)
+                                               ? warry_cur_size(rc)
+                                               : warry_use_size(rc));
+      }
 
       break;
     }
@@ -0,0 +1,190 @@
+/*
+ * byte_hash_bench.c
+ *
+ *   Copyright (c) 2008, Ueda Laboratory LMNtal Group
+ *                                         <lmntal@ueda.info.waseda.ac.jp>
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *    3. Neither the name of the Ueda Laboratory LMNtal Group nor the
+ *       names of its contributors may be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+/** バイナリストリングのハッシュ関数と比較関数のマイクロベンチマーク.
+ *  32Bから64KBまでの各長さについて, スカラー実装とCPUに応じて選んだ実装
+ *  (lmn_byte_hash_wide, lmn_byte_cmp)のスループットを比較する.
+ *
+ *  使い方: make -C src/test byte_hash_bench && src/test/byte_hash_bench [総バイト数(MB)]
+ */
+
+#include "lmntal.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define BENCH_LEN_MIN   (32L)
+#define BENCH_LEN_MAX   (64L * 1024L)
+
+/* util.cが使用する唯一の処理系内部関数. ベンチマーク単体でリンクするために用意する */
+void *lmn_malloc(size_t num)
+{
+  void *p = malloc(num);
+  if (!p) {
+    fprintf(stderr, "lmn_malloc: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static double bench_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* 比較関数のスカラー実装 (1byteずつ比較する) */
+static int bench_byte_cmp_scalar(const unsigned char *a, long alen,
+                                 const unsigned char *b, long blen)
+{
+  long i;
+  if (alen != blen) return alen - blen;
+  for (i = 0; i < alen; i++) {
+    if (a[i] != b[i]) return a[i] - b[i];
+  }
+  return 0;
+}
+
+static unsigned long bench_byte_hash_fnv(const unsigned char *str, long len)
+{
+  return lmn_byte_hash(str, len);
+}
+
+typedef unsigned long (*bench_hash_f)(const unsigned char *, long);
+typedef int (*bench_cmp_f)(const unsigned char *, long, const unsigned char *, long);
+
+volatile unsigned long bench_sink; /* 最適化で計算が消されないようにする */
+
+/* ループ不変な呼び出しがまとめられないよう, 毎回バッファが書き換わり得ることにする */
+#define BENCH_CLOBBER(P) __asm__ __volatile__("" : : "r"(P) : "memory")
+
+/* 長さlenのバイト列をiter回ハッシュし, スループット(GB/s)を返す */
+static double bench_hash(bench_hash_f f, const unsigned char *buf, long len, long iter)
+{
+  unsigned long acc = 0;
+  double t;
+  long i;
+
+  t = bench_now();
+  for (i = 0; i < iter; i++) {
+    BENCH_CLOBBER(buf);
+    acc += f(buf, len);
+  }
+  t = bench_now() - t;
+  bench_sink = acc;
+  return t > 0 ? (double)len * iter / t / 1e9 : 0.0;
+}
+
+/* 末尾だけが異なる長さlenのバイト列をiter回比較し, スループット(GB/s)を返す */
+static double bench_cmp(bench_cmp_f f, const unsigned char *a, const unsigned char *b,
+                        long len, long iter)
+{
+  long acc = 0;
+  double t;
+  long i;
+
+  t = bench_now();
+  for (i = 0; i < iter; i++) {
+    BENCH_CLOBBER(a);
+    acc += f(a, len, b, len);
+  }
+  t = bench_now() - t;
+  bench_sink = (unsigned long)acc;
+  return t > 0 ? (double)len * iter / t / 1e9 : 0.0;
+}
+
+/* 全ての長さについて, 選択した実装とスカラー実装が同じ値を返すことを確かめる */
+static int bench_verify(const unsigned char *buf)
+{
+  long len;
+  for (len = 0; len <= BENCH_LEN_MAX; len++) {
+    if (lmn_byte_hash_wide(buf, len) != lmn_byte_hash_wide_scalar(buf, len)) {
+      fprintf(stderr, "mismatch: %s and scalar differ at len=%ld\n",
+              lmn_byte_hash_wide_name(), len);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned char *a, *b;
+  long len, total, i;
+
+  total = (argc > 1 ? atol(argv[1]) : 256L) << 20;
+  if (total <= 0) {
+    fprintf(stderr, "usage: %s [total MB per measurement]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  lmn_byte_hash_wide_init();
+
+  a = (unsigned char *)lmn_malloc(BENCH_LEN_MAX);
+  b = (unsigned char *)lmn_malloc(BENCH_LEN_MAX);
+  srand(1);
+  for (i = 0; i < BENCH_LEN_MAX; i++) {
+    a[i] = b[i] = (unsigned char)rand();
+  }
+
+  if (!bench_verify(a)) return EXIT_FAILURE;
+
+  printf("wide hash implementation: %s\n", lmn_byte_hash_wide_name());
+  printf("%8s %10s %10s %10s %10s %10s\n",
+         "size", "fnv1a", "scalar", lmn_byte_hash_wide_name(), "cmp-byte", "cmp");
+  for (len = BENCH_LEN_MIN; len <= BENCH_LEN_MAX; len <<= 1) {
+    long iter = total / len;
+    b[len - 1] = a[len - 1] ^ 0x1; /* 比較は末尾まで走査させる */
+    printf("%8ld %10.2f %10.2f %10.2f %10.2f %10.2f\n", len,
+           bench_hash(bench_byte_hash_fnv,       a, len, iter),
+           bench_hash(lmn_byte_hash_wide_scalar, a, len, iter),
+           bench_hash(lmn_byte_hash_wide,        a, len, iter),
+           bench_cmp(bench_byte_cmp_scalar, a, b, len, iter),
+           bench_cmp(lmn_byte_cmp,          a, b, len, iter));
+    b[len - 1] = a[len - 1];
+  }
+  printf("(GB/s)\n");
+
+  free(a);
+  free(b);
+  return EXIT_SUCCESS;
+}
@@ -168,6 +168,7 @@ void tr_instr_commit_ready(LmnReactCxt      *rc,
       /** SWAP */
       tmp = rc_warry(rc);
       rc_warry_set(rc, v);
+      lmn_register_invalidate_mem_hashes(rc, warry_use_org);
 #ifdef PROFILE
       if (lmn_env.profile_level >= 3) {
         profile_finish_timer(PROFILE_TIME__STATE_COPY_IN_COMMIT);
@@ -179,6 +180,9 @@ void tr_instr_commit_ready(LmnReactCxt      *rc,
       *p_v_tmp = tmp;
     }
   }
+  else if (lmn_env.nd) {
+    lmn_register_invalidate_mem_hashes(rc, warry_use_size(rc));
+  }
 }
 
 BOOL tr_instr_commit_finish(LmnReactCxt      *rc,
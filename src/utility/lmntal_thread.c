@@ -52,13 +52,124 @@
 # include <sys/types.h>
 # define ENABLE_CPU_AFFINITY
 #endif
+#include <stdio.h>
+
+
+/** ----------------------------------
+ *  NUMA Topology
+ *  ノード構成は/sys/devices/system/node以下から読む. (読めない環境では1ノードとして扱う)
+ *  スレッドはidの連続したブロック毎に同じノードへ割り当て, ノード内のCPUへ順に貼り付ける.
+ *  状態やバイナリストリングは展開したスレッドが確保するため, 貼り付けた後はfirst-touchによって
+ *  スレッドのローカルノードに置かれる.
+ */
+
+#define NUMA_SYSFS_NODE   "/sys/devices/system/node"
+#define NUMA_LIST_MAX     (4096)
+
+static unsigned int  numa_node_n    = 1;
+static unsigned int  numa_thread_n  = 0;
+static unsigned int *numa_thread_node = NULL; /* スレッドidに対応するノード番号 */
+static int          *numa_thread_cpu  = NULL; /* スレッドidに対応するCPU番号 (不明ならば-1) */
+
+/* "0-3,8-11"形式のリストをファイルpathから読み, 要素をbufへ最大max個書き込む.
+ * 書き込んだ要素数を返す. 読めない場合は0を返す */
+static unsigned int numa_read_list(const char *path, int *buf, unsigned int max)
+{
+  FILE *fp;
+  unsigned int n;
+  int lo, hi, c;
+
+  fp = fopen(path, "r");
+  if (!fp) return 0;
+
+  n = 0;
+  while (n < max && fscanf(fp, "%d", &lo) == 1) {
+    hi = lo;
+    c  = fgetc(fp);
+    if (c == '-') {
+      if (fscanf(fp, "%d", &hi) != 1) break;
+      c = fgetc(fp);
+    }
+    for (; lo <= hi && n < max; lo++) {
+      buf[n++] = lo;
+    }
+    if (c != ',') break;
+  }
+
+  fclose(fp);
+  return n;
+}
+
+void lmn_numa_init(unsigned int thread_num)
+{
+  int nodes[NUMA_LIST_MAX], cpus[NUMA_LIST_MAX];
+  unsigned int node_num, i;
+
+  lmn_numa_finalize();
+
+  node_num = numa_read_list(NUMA_SYSFS_NODE "/online", nodes, NUMA_LIST_MAX);
+  if (node_num == 0) {
+    nodes[0] = 0;
+    node_num = 1;
+  }
+  if (node_num > thread_num) node_num = thread_num;
+
+  numa_node_n      = node_num;
+  numa_thread_n    = thread_num;
+  numa_thread_node = LMN_NALLOC(unsigned int, thread_num);
+  numa_thread_cpu  = LMN_NALLOC(int, thread_num);
+
+  for (i = 0; i < thread_num; i++) {
+    char path[64];
+    unsigned int k, cpu_num, first;
+
+    /* ノードk番に, スレッドid [first, first + 担当数) を割り当てる */
+    k     = (unsigned int)(((unsigned long)i * node_num) / thread_num);
+    first = (unsigned int)(((unsigned long)k * thread_num + node_num - 1) / node_num);
+    numa_thread_node[i] = k;
+
+    snprintf(path, sizeof(path), NUMA_SYSFS_NODE "/node%d/cpulist", nodes[k]);
+    cpu_num = numa_read_list(path, cpus, NUMA_LIST_MAX);
+    numa_thread_cpu[i] = cpu_num > 0 ? cpus[(i - first) % cpu_num] : -1;
+  }
+}
+
+void lmn_numa_finalize()
+{
+  if (numa_thread_node) {
+    LMN_FREE(numa_thread_node);
+    LMN_FREE(numa_thread_cpu);
+    numa_thread_node = NULL;
+    numa_thread_cpu  = NULL;
+  }
+  numa_node_n   = 1;
+  numa_thread_n = 0;
+}
+
+/* スレッドidが割り当てられたノードを返す. lmn_numa_initを呼んでいなければ0を返す */
+unsigned int lmn_numa_node_of(unsigned long thread_id)
+{
+  return thread_id < numa_thread_n ? numa_thread_node[thread_id] : 0;
+}
+
+unsigned int lmn_numa_node_num()
+{
+  return numa_node_n;
+}
+
 
 /* 呼び出したスレッドとn番のCPUを貼り付ける */
 void lmn_thread_set_CPU_affinity(unsigned long n)
 {
   /* TODO: マニュアルによればpthread_npライブラリを使った方がよい  */
 #ifdef ENABLE_CPU_AFFINITY
-  if (lmn_env.core_num <= HAVE_PROCESSOR_ELEMENTS) {
+  if (n < numa_thread_n && numa_thread_cpu[n] >= 0) {
+    /* NUMA: 割り当てたノードのCPUに貼り付ける */
+    cpu_set_t  my_mask;
+    CPU_ZERO(&my_mask);
+    CPU_SET(numa_thread_cpu[n], &my_mask);
+    sched_setaffinity(syscall(SYS_gettid), sizeof(my_mask), &my_mask);
+  } else if (lmn_env.core_num <= HAVE_PROCESSOR_ELEMENTS) {
     pid_t      my_pid;
     cpu_set_t  my_mask;
     my_pid = syscall(SYS_gettid);
@@ -172,3 +283,64 @@ void ewlock_permit_enter(EWLock *lock, mtx_data_t my_id)
 }
 
 
+/** ----------------------------------
+ *  Sense-Reversing Barrier
+ */
+
+#if defined(ENABLE_PARALLEL) && defined(HAVE_BUILTIN_MBARRIER)
+# define SPIN_BARRIER_FENCE() MEM_BARRIER()
+#else
+# define SPIN_BARRIER_FENCE()
+#endif
+
+void spin_barrier_init(LmnSpinBarrier *b, unsigned int thread_num)
+{
+  b->thread_num = thread_num;
+  b->reach_num  = thread_num;
+  b->sense      = FALSE;
+  b->sleep_num  = 0;
+  lmn_mutex_init(&b->mutex);
+  lmn_cond_init(&b->cond);
+}
+
+void spin_barrier_destroy(LmnSpinBarrier *b)
+{
+  lmn_mutex_destroy(&b->mutex);
+  lmn_cond_destroy(&b->cond);
+}
+
+void spin_barrier_wait(LmnSpinBarrier *b)
+{
+  BOOL my_sense;
+  unsigned int i;
+
+  /* 全スレッドが到達するまでsenseは反転しないため, 到達前に読めばよい */
+  my_sense = !b->sense;
+
+  if (SUB_AND_FETCH(b->reach_num, 1U) == 0) {
+    /* 最後に到達した. 次の待ち合わせのために計数を戻してからsenseを反転する */
+    b->reach_num = b->thread_num;
+    SPIN_BARRIER_FENCE();
+    b->sense = my_sense;
+    SPIN_BARRIER_FENCE(); /* senseを書いてから休止中のスレッド数を読む */
+    if (b->sleep_num > 0) {
+      lmn_mutex_lock(&b->mutex);
+      lmn_cond_broadcast(&b->cond);
+      lmn_mutex_unlock(&b->mutex);
+    }
+    return;
+  }
+
+  for (i = 0; i < SPIN_BARRIER_SPIN_MAX; i++) {
+    if (b->sense == my_sense) return;
+  }
+
+  lmn_mutex_lock(&b->mutex);
+  b->sleep_num++;
+  SPIN_BARRIER_FENCE(); /* 休止中のスレッド数を書いてからsenseを読む */
+  while (b->sense != my_sense) {
+    lmn_cond_wait(&b->cond, &b->mutex);
+  }
+  b->sleep_num--;
+  lmn_mutex_unlock(&b->mutex);
+}
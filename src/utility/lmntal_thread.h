@@ -80,6 +80,13 @@
 #  define OR_AND_FETCH(A, B)  lmn_fatal("disable ATOMIC OPERATION, unexepcted.")
 # endif /* HAVE_ATOMIC_LOGICAL_OR */
 #
+# ifdef HAVE_ATOMIC_LOGICAL_OR
+   /* OR_AND_FETCHと異なり, 更新前の値を返す */
+#  define FETCH_AND_OR(A, B)  __sync_fetch_and_or(&(A), B)
+# else
+#  define FETCH_AND_OR(A, B)  lmn_fatal("disable ATOMIC OPERATION, unexepcted.")
+# endif /* HAVE_ATOMIC_LOGICAL_OR */
+#
 # ifdef HAVE_BUILTIN_MBARRIER
 #  define MEM_BARRIER()       __sync_synchronize()
 # endif /* HAVE_BUILTIN_MBARRIER */
@@ -91,11 +98,16 @@
 # define SUB_AND_FETCH(A, B)  (A -= B)
 # define AND_AND_FETCH(A, B)  (A &= B)
 # define OR_AND_FETCH(A, B)   (A |= B)
+# define FETCH_AND_OR(A, B)   lmn_fatal("__sync_fetch_and_or is unsupported")
 # define MEM_BARRIER()        lmn_fatal("__sync_synchronize is unsupported")
 #endif /* ENABLE_PARALLEL */
 
 
 void lmn_thread_set_CPU_affinity(unsigned long id);
+void lmn_numa_init(unsigned int thread_num);
+void lmn_numa_finalize(void);
+unsigned int lmn_numa_node_of(unsigned long thread_id);
+unsigned int lmn_numa_node_num(void);
 #ifdef HAVE_SCHED_H
 #
   void thread_yield_CPU(void);
@@ -188,4 +200,27 @@ void    ewlock_reject_enter(EWLock *lock, unsigned long something);
 void    ewlock_permit_enter(EWLock *lock, unsigned long something);
 
 
+/** ----------------------------------
+ *  Sense-Reversing Barrier
+ *  最後に到達したスレッドがsenseを反転し, 他のスレッドはsenseの反転を待つ.
+ *  待ち合わせの多くは短時間で済むため, 一定回数スピンしてから条件変数で休止する.
+ */
+
+#define SPIN_BARRIER_SPIN_MAX  (1U << 12)
+
+typedef struct LmnSpinBarrier LmnSpinBarrier;
+struct LmnSpinBarrier {
+  unsigned int          thread_num;
+  volatile unsigned int reach_num;   /* 未到達のスレッド数 */
+  volatile BOOL         sense;
+  volatile unsigned int sleep_num;   /* 条件変数で休止中のスレッド数 */
+  lmn_mutex_t           mutex;
+  lmn_cond_t            cond;
+};
+
+void spin_barrier_init(LmnSpinBarrier *b, unsigned int thread_num);
+void spin_barrier_destroy(LmnSpinBarrier *b);
+void spin_barrier_wait(LmnSpinBarrier *b);
+
+
 #endif
@@ -303,3 +303,180 @@ Deque *deq_copy(Deque *deq)
   return new_deq;
 }
 
+
+/**=====================
+ *  Work-Stealing DeQue (Chase-Lev)
+ */
+
+/* 底の書き込みと頂上の読み出しの順序を保証する */
+#if defined(ENABLE_PARALLEL) && defined(HAVE_BUILTIN_MBARRIER)
+# define WSDEQ_FENCE() MEM_BARRIER()
+#else
+# define WSDEQ_FENCE()
+#endif
+
+static WSDequeArray *wsdeq_array_make(unsigned long cap)
+{
+  WSDequeArray *a = LMN_MALLOC(WSDequeArray);
+  a->cap  = cap;
+  a->buf  = LMN_NALLOC(LmnWord, cap);
+  a->prev = NULL;
+  return a;
+}
+
+void wsdeq_init(WSDeque *d, unsigned long init_cap)
+{
+  unsigned long cap = 1;
+  while (cap < init_cap) cap <<= 1;
+
+  d->top    = 0;
+  d->bottom = 0;
+  d->arr    = wsdeq_array_make(cap);
+}
+
+void wsdeq_destroy(WSDeque *d)
+{
+  WSDequeArray *a, *prev;
+  for (a = d->arr; a; a = prev) {
+    prev = a->prev;
+    LMN_FREE((LmnWord *)a->buf);
+    LMN_FREE(a);
+  }
+  d->arr = NULL;
+}
+
+/* 配列を2倍に拡張し, [t, b)の要素を移す */
+static WSDequeArray *wsdeq_grow(WSDeque *d, WSDequeArray *a, long b, long t)
+{
+  WSDequeArray *new_a;
+  long i;
+
+  new_a = wsdeq_array_make(a->cap * 2);
+  for (i = t; i < b; i++) {
+    new_a->buf[i & (new_a->cap - 1)] = a->buf[i & (a->cap - 1)];
+  }
+  new_a->prev = a;
+
+  WSDEQ_FENCE();
+  d->arr = new_a;
+  return new_a;
+}
+
+/* 所有者が底に値vを積む */
+void wsdeq_push(WSDeque *d, LmnWord v)
+{
+  WSDequeArray *a;
+  long b, t;
+
+  b = d->bottom;
+  t = d->top;
+  a = d->arr;
+  if (b - t >= (long)a->cap) {
+    a = wsdeq_grow(d, a, b, t);
+  }
+  a->buf[b & (a->cap - 1)] = v;
+
+  WSDEQ_FENCE(); /* 値を書き込んでから底を公開する */
+  d->bottom = b + 1;
+}
+
+/* 所有者が底から値を取り出す. 空の場合や最後の1つをstealに取られた場合は0を返す */
+LmnWord wsdeq_pop(WSDeque *d)
+{
+  WSDequeArray *a;
+  LmnWord ret;
+  long b, t;
+
+  b = d->bottom - 1;
+  a = d->arr;
+  d->bottom = b;
+  WSDEQ_FENCE();
+  t = d->top;
+
+  if (t > b) { /* 空 */
+    d->bottom = b + 1;
+    return 0;
+  }
+
+  ret = a->buf[b & (a->cap - 1)];
+  if (t == b) { /* 最後の1つはstealと取り合う */
+    if (!CAS(d->top, t, t + 1)) {
+      ret = 0;
+    }
+    d->bottom = b + 1;
+  }
+  return ret;
+}
+
+/* 他のスレッドが頂上から値を取り出す. 空の場合や取り合いに負けた場合は0を返す */
+LmnWord wsdeq_steal(WSDeque *d)
+{
+  WSDequeArray *a;
+  LmnWord ret;
+  long b, t;
+
+  t = d->top;
+  WSDEQ_FENCE();
+  b = d->bottom;
+  if (t >= b) return 0;
+
+  a   = d->arr;
+  ret = a->buf[t & (a->cap - 1)];
+  if (!CAS(d->top, t, t + 1)) {
+    return 0;
+  }
+  return ret;
+}
+
+
+/**=====================
+ *  Single-Producer Single-Consumer Ring
+ */
+
+void spscq_init(SpscRing *r, unsigned long cap)
+{
+  unsigned long c = 1;
+  while (c < cap) c <<= 1;
+
+  r->head = 0;
+  r->tail = 0;
+  r->cap  = c;
+  r->buf  = LMN_NALLOC(LmnWord, c);
+}
+
+void spscq_destroy(SpscRing *r)
+{
+  LMN_FREE((LmnWord *)r->buf);
+  r->buf = NULL;
+}
+
+/* 送信側が値vを積む. 満杯の場合は偽を返す */
+BOOL spscq_push(SpscRing *r, LmnWord v)
+{
+  unsigned long t = r->tail;
+  if (t - r->head >= r->cap) {
+    return FALSE;
+  }
+  r->buf[t & (r->cap - 1)] = v;
+
+  WSDEQ_FENCE(); /* 値を書き込んでから末尾を公開する */
+  r->tail = t + 1;
+  return TRUE;
+}
+
+/* 受信側が値を取り出す. 空の場合は0を返す */
+LmnWord spscq_pop(SpscRing *r)
+{
+  unsigned long h = r->head;
+  LmnWord ret;
+
+  if (h == r->tail) {
+    return 0;
+  }
+  WSDEQ_FENCE(); /* 末尾を読んでから値を読む */
+  ret = r->buf[h & (r->cap - 1)];
+
+  WSDEQ_FENCE(); /* 値を読んでから領域を返却する */
+  r->head = h + 1;
+  return ret;
+}
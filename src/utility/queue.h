@@ -249,4 +249,69 @@ static inline void deq_print(Deque *deq) {
   fprintf(f, "]\n");
 }
 
+
+/** ==========
+ *  Work-Stealing DeQue (Chase-Lev)
+ *  所有者のみが底(bottom)に対してpush/popし, 他のスレッドは頂上(top)からstealする.
+ *  ロックもpush毎のmallocも行わない. 値0は空を表すため格納しないこと.
+ */
+
+typedef struct WSDequeArray WSDequeArray;
+typedef struct WSDeque      WSDeque;
+
+struct WSDequeArray {
+  unsigned long    cap;  /* 2のべき乗 */
+  volatile LmnWord *buf;
+  WSDequeArray     *prev; /* 拡張前の配列. stealと競合するため破棄時まで解放しない */
+};
+
+struct WSDeque {
+  volatile long          top;
+  volatile long          bottom;
+  WSDequeArray * volatile arr;
+};
+
+void    wsdeq_init(WSDeque *d, unsigned long init_cap);
+void    wsdeq_destroy(WSDeque *d);
+void    wsdeq_push(WSDeque *d, LmnWord v);
+LmnWord wsdeq_pop(WSDeque *d);
+LmnWord wsdeq_steal(WSDeque *d);
+
+/* デックdに積まれている要素数 (他スレッドからは目安) */
+static inline unsigned long wsdeq_num(WSDeque *d) {
+  long n = d->bottom - d->top;
+  return n > 0 ? (unsigned long)n : 0UL;
+}
+
+static inline BOOL wsdeq_is_empty(WSDeque *d) {
+  return d->bottom <= d->top;
+}
+
+
+/**=====================
+ *  Single-Producer Single-Consumer Ring
+ *  送信側1スレッドのみがpush, 受信側1スレッドのみがpopする固定長のリングバッファ.
+ *  ロックもCASも用いない. 値0は空を表すため格納しないこと.
+ */
+
+typedef struct SpscRing SpscRing;
+
+struct SpscRing {
+  volatile unsigned long head;  /* 受信側のみが更新する */
+  char                   pad0[64 - sizeof(unsigned long)];
+  volatile unsigned long tail;  /* 送信側のみが更新する */
+  char                   pad1[64 - sizeof(unsigned long)];
+  unsigned long          cap;   /* 2のべき乗 */
+  volatile LmnWord       *buf;
+};
+
+void    spscq_init(SpscRing *r, unsigned long cap);
+void    spscq_destroy(SpscRing *r);
+BOOL    spscq_push(SpscRing *r, LmnWord v);
+LmnWord spscq_pop(SpscRing *r);
+
+static inline BOOL spscq_is_empty(SpscRing *r) {
+  return r->head == r->tail;
+}
+
 #endif
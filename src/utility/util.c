@@ -41,6 +41,11 @@
 #include "lmntal.h"
 #include "error.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define LMN_BYTE_X86
+#  include <immintrin.h>
+#endif
+
 char *int_to_str(long n)
 {
   char *s;
@@ -79,3 +84,184 @@ int comp_int_greater_f(const void *a_, const void *b_)
   return a > b ? -1 : (a == b ? 0 : 1);
 }
 
+
+/** ----------------------
+ *  wide byte operation
+ */
+
+/* lmn_byte_hash_wideは, バイト列を64byteのブロック毎に16本の32bitレーンへ分配し,
+ * 各レーンを h = ((h ^ w) * P) ^ (h >> 15) と更新する.
+ * レーン毎の計算は互いに独立であるため, SIMD命令でまとめて計算できる.
+ * ブロックに満たない末尾は4byte単位でレーンへ, 端数はFNV-1aで処理し,
+ * 最後にレーンと長さを混ぜ合わせる. */
+#define BYTE_WIDE_LANES   16
+#define BYTE_WIDE_BLOCK   ((long)(BYTE_WIDE_LANES * sizeof(uint32_t)))
+#define BYTE_WIDE_PRIME   16777619U
+#define BYTE_WIDE_BASIS   2166136261U
+
+#define BYTE_WIDE_STEP(H, W) ((((H) ^ (W)) * BYTE_WIDE_PRIME) ^ ((H) >> 15))
+
+static inline void byte_wide_lanes_init(uint32_t *h)
+{
+  int i;
+  for (i = 0; i < BYTE_WIDE_LANES; i++) {
+    h[i] = BYTE_WIDE_BASIS + (uint32_t)i;
+  }
+}
+
+/* 位置posからの末尾を処理し, ハッシュ値を返す */
+static inline unsigned long byte_wide_finish(uint32_t *h,
+                                             const unsigned char *str,
+                                             long len,
+                                             long pos)
+{
+  uint64_t v;
+  int i;
+
+  for (i = 0; pos + (long)sizeof(uint32_t) <= len; i++, pos += sizeof(uint32_t)) {
+    uint32_t w;
+    memcpy(&w, str + pos, sizeof(uint32_t));
+    h[i] = BYTE_WIDE_STEP(h[i], w);
+  }
+
+  v = 14695981039346656037ULL ^ (uint64_t)len;
+  for (i = 0; i < BYTE_WIDE_LANES; i++) {
+    v = (v ^ h[i]) * 1099511628211ULL;
+  }
+  for (; pos < len; pos++) {
+    v = (v ^ str[pos]) * 1099511628211ULL;
+  }
+
+  /* 上位bitの変化を下位bitへ伝播させる */
+  v ^= v >> 33;
+  v *= 0xff51afd7ed558ccdULL;
+  v ^= v >> 33;
+  v *= 0xc4ceb9fe1a85ec53ULL;
+  v ^= v >> 33;
+
+  return (unsigned long)v;
+}
+
+unsigned long lmn_byte_hash_wide_scalar(const unsigned char *str, long len)
+{
+  uint32_t h[BYTE_WIDE_LANES];
+  long pos;
+  int i;
+
+  byte_wide_lanes_init(h);
+  for (pos = 0; pos + BYTE_WIDE_BLOCK <= len; pos += BYTE_WIDE_BLOCK) {
+    for (i = 0; i < BYTE_WIDE_LANES; i++) {
+      uint32_t w;
+      memcpy(&w, str + pos + i * sizeof(uint32_t), sizeof(uint32_t));
+      h[i] = BYTE_WIDE_STEP(h[i], w);
+    }
+  }
+
+  return byte_wide_finish(h, str, len, pos);
+}
+
+
+#ifdef LMN_BYTE_X86
+
+/* SSE2には32bitの乗算(下位)がないため, 64bit乗算2回から組み立てる */
+__attribute__((target("sse2")))
+static inline __m128i byte_wide_mullo32_sse2(__m128i a, __m128i b)
+{
+  __m128i even, odd;
+  even = _mm_mul_epu32(a, b);
+  odd  = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static unsigned long byte_hash_wide_sse2(const unsigned char *str, long len)
+{
+  uint32_t h[BYTE_WIDE_LANES];
+  __m128i hv[4], p;
+  long pos;
+  int i;
+
+  byte_wide_lanes_init(h);
+  for (i = 0; i < 4; i++) {
+    hv[i] = _mm_loadu_si128((const __m128i *)(h + i * 4));
+  }
+  p = _mm_set1_epi32((int)BYTE_WIDE_PRIME);
+
+  for (pos = 0; pos + BYTE_WIDE_BLOCK <= len; pos += BYTE_WIDE_BLOCK) {
+    for (i = 0; i < 4; i++) {
+      __m128i w = _mm_loadu_si128((const __m128i *)(str + pos + i * 16));
+      hv[i] = _mm_xor_si128(byte_wide_mullo32_sse2(_mm_xor_si128(hv[i], w), p),
+                            _mm_srli_epi32(hv[i], 15));
+    }
+  }
+
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)(h + i * 4), hv[i]);
+  }
+  return byte_wide_finish(h, str, len, pos);
+}
+
+__attribute__((target("avx2")))
+static unsigned long byte_hash_wide_avx2(const unsigned char *str, long len)
+{
+  uint32_t h[BYTE_WIDE_LANES];
+  __m256i h0, h1, p;
+  long pos;
+
+  byte_wide_lanes_init(h);
+  h0 = _mm256_loadu_si256((const __m256i *)h);
+  h1 = _mm256_loadu_si256((const __m256i *)(h + 8));
+  p  = _mm256_set1_epi32((int)BYTE_WIDE_PRIME);
+
+  for (pos = 0; pos + BYTE_WIDE_BLOCK <= len; pos += BYTE_WIDE_BLOCK) {
+    __m256i w0 = _mm256_loadu_si256((const __m256i *)(str + pos));
+    __m256i w1 = _mm256_loadu_si256((const __m256i *)(str + pos + 32));
+    h0 = _mm256_xor_si256(_mm256_mullo_epi32(_mm256_xor_si256(h0, w0), p),
+                          _mm256_srli_epi32(h0, 15));
+    h1 = _mm256_xor_si256(_mm256_mullo_epi32(_mm256_xor_si256(h1, w1), p),
+                          _mm256_srli_epi32(h1, 15));
+  }
+
+  _mm256_storeu_si256((__m256i *)h, h0);
+  _mm256_storeu_si256((__m256i *)(h + 8), h1);
+  return byte_wide_finish(h, str, len, pos);
+}
+
+#endif /* LMN_BYTE_X86 */
+
+
+/* 実行環境のCPUに応じて実装を選ぶ. 選択はlmn_byte_hash_wide_initで(スレッドの起動前に)1度だけ行い,
+ * 以降は選択した実装を直接呼び出す */
+static unsigned long (*byte_hash_wide_impl)(const unsigned char *, long)
+  = lmn_byte_hash_wide_scalar;
+static const char *byte_hash_wide_impl_name = "scalar";
+
+void lmn_byte_hash_wide_init()
+{
+#ifdef LMN_BYTE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    byte_hash_wide_impl      = byte_hash_wide_avx2;
+    byte_hash_wide_impl_name = "avx2";
+    return;
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    byte_hash_wide_impl      = byte_hash_wide_sse2;
+    byte_hash_wide_impl_name = "sse2";
+    return;
+  }
+#endif
+  byte_hash_wide_impl      = lmn_byte_hash_wide_scalar;
+  byte_hash_wide_impl_name = "scalar";
+}
+
+const char *lmn_byte_hash_wide_name()
+{
+  return byte_hash_wide_impl_name;
+}
+
+unsigned long lmn_byte_hash_wide(const unsigned char *str, long len)
+{
+  return byte_hash_wide_impl(str, len);
+}
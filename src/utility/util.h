@@ -142,6 +142,22 @@ static inline int lmn_byte_cmp(const unsigned char *a, long alen,
 
 
 
+/* lmn_byte_hashと同じ用途のハッシュ関数. バイト列を64byte単位で16本の32bitレーンへ分けて
+ * 計算するため, CPUが対応していればSSE2/AVX2で処理する. 同じバイト列に対しては,
+ * どの実装が選ばれても同じ値を返す. (lmn_byte_hashとは異なる値を返す) */
+unsigned long lmn_byte_hash_wide(const unsigned char *str, long len);
+
+/* lmn_byte_hash_wideのスカラー実装 */
+unsigned long lmn_byte_hash_wide_scalar(const unsigned char *str, long len);
+
+/* 実行環境のCPUに応じてlmn_byte_hash_wideの実装を選ぶ. スレッドを起動する前に1度だけ呼ぶ.
+ * (呼ばない場合はスカラー実装を使う) */
+void lmn_byte_hash_wide_init(void);
+
+/* lmn_byte_hash_wideが使用している実装の名前を返す */
+const char *lmn_byte_hash_wide_name(void);
+
+
 /** ----------------------
  *  else
  */
@@ -870,6 +870,7 @@ static inline int  visitlog_get_atom(VisitLog visitlog, LmnSAtom atom, LmnWord *
 static inline int  visitlog_get_mem(VisitLog visitlog, LmnMembrane *mem, LmnWord *value);
 static inline int  visitlog_get_hlink(VisitLog visitlog, HyperLink *hl, LmnWord *value);
 static inline int  visitlog_element_num(VisitLog visitlog);
+static inline int  visitlog_skip_ref(VisitLog visitlog, int n);
 
 
 /**
@@ -941,5 +942,13 @@ static inline int visitlog_element_num(VisitLog visitlog) {
   return visitlog->element_num;
 }
 
+/* ログに記録せずに参照番号をn個分進め, 進める前の参照番号を返す.
+ * 他から参照されないプロセス列を, 既存のバイト列から複写した場合に使用する */
+static inline int visitlog_skip_ref(VisitLog visitlog, int n) {
+  int ret = visitlog->ref_n;
+  visitlog->ref_n += n;
+  return ret;
+}
+
 
 #endif
@@ -39,6 +39,7 @@
 
 #include "binstr_compress.h"
 #include "error.h"
+#include "lmntal_thread.h"
 #include "zdlib.h"
 #ifdef HAVE_LIBZ
 # include <zlib.h>
@@ -94,6 +95,12 @@
  *    "A Massively Spiffy Yet Delicately Unobtrusive Compression Library"
  *    @see http://www.zlib.net/
  */
+
+#ifdef HAVE_LIBZ
+static LmnBinStr bscomp_zdict_encode(const LmnBinStr org);
+static LmnBinStr bscomp_zdict_decode(const LmnBinStr cmp);
+#endif
+
 LmnBinStr lmn_bscomp_z_encode(const LmnBinStr org)
 {
 #ifndef HAVE_LIBZ
@@ -112,17 +119,21 @@ LmnBinStr lmn_bscomp_z_encode(const LmnBinStr org)
 
   LMN_ASSERT(!is_comp_z(org)); /* z圧縮の多重掛けは想定していない */
 
-  org_8len = (org->len + 1) / TAG_IN_BYTE;
-  cmp_8len = org_8len * 2;
-  cmp = lmn_binstr_make(cmp_8len);
-  cmp->type = org->type;
-  ret = compress(cmp->v, &cmp_8len, org->v, org_8len);
-  if (ret != Z_OK) { /* zlib */
-    fprintf(stderr, "%s\n", ret == Z_MEM_ERROR ? "Z_MEM_ERROR" : "Z_BUF_ERROR");
-    lmn_fatal("fail to compress: zlib");
+  if (lmn_bscomp_z_dict_enabled()) {
+    cmp = bscomp_zdict_encode(org);
+  } else {
+    org_8len = (org->len + 1) / TAG_IN_BYTE;
+    cmp_8len = org_8len * 2;
+    cmp = lmn_binstr_make(cmp_8len);
+    cmp->type = org->type;
+    ret = compress(cmp->v, &cmp_8len, org->v, org_8len);
+    if (ret != Z_OK) { /* zlib */
+      fprintf(stderr, "%s\n", ret == Z_MEM_ERROR ? "Z_MEM_ERROR" : "Z_BUF_ERROR");
+      lmn_fatal("fail to compress: zlib");
+    }
+    cmp->len = cmp_8len * TAG_IN_BYTE + ((org->len & 0x1U) ? 1 : 0);
   }
 
-  cmp->len = cmp_8len * TAG_IN_BYTE + ((org->len & 0x1U) ? 1 : 0);
   set_comp_z(cmp);
 
 #ifdef PROFILE
@@ -156,18 +167,23 @@ LmnBinStr lmn_bscomp_z_decode(const LmnBinStr cmp)
 #endif
   LMN_ASSERT(is_comp_z(cmp));
 
-  cmp_8len = cmp->len / TAG_IN_BYTE;
-  org_8len = cmp_8len * 5;
-  org = lmn_binstr_make(org_8len);
-  ret = uncompress(org->v, &org_8len, cmp->v, cmp_8len);
-  if (ret != Z_OK) { /* zlib */
-    fprintf(stderr, "%s\n", ret == Z_MEM_ERROR ? "Z_MEM_ERROR" : "Z_BUF_ERROR");
-    lmn_fatal("fail to uncompress: zlib");
-  }
+  if (is_comp_zdict(cmp)) {
+    org = bscomp_zdict_decode(cmp);
+  } else {
+    cmp_8len = cmp->len / TAG_IN_BYTE;
+    org_8len = cmp_8len * 5;
+    org = lmn_binstr_make(org_8len);
+    ret = uncompress(org->v, &org_8len, cmp->v, cmp_8len);
+    if (ret != Z_OK) { /* zlib */
+      fprintf(stderr, "%s\n", ret == Z_MEM_ERROR ? "Z_MEM_ERROR" : "Z_BUF_ERROR");
+      lmn_fatal("fail to uncompress: zlib");
+    }
 
-  org->type = cmp->type;
-  org->len  = org_8len * TAG_IN_BYTE - ((cmp->len & 0x1U) ? 1 : 0);
+    org->type = cmp->type;
+    org->len  = org_8len * TAG_IN_BYTE - ((cmp->len & 0x1U) ? 1 : 0);
+  }
   unset_comp_z(org);
+  unset_comp_zdict(org);
 
 #ifdef PROFILE
   org_space = lmn_binstr_space(org);
@@ -182,6 +198,283 @@ LmnBinStr lmn_bscomp_z_decode(const LmnBinStr cmp)
 }
 
 
+/** --------------------------
+ *  Method1': zlib + shared dictionary
+ *    状態毎のバイナリストリングは短く, 同じファンクタや膜の並びを繰り返し含むため,
+ *    単独でz圧縮しても殆ど縮まない. そこで, 最初に圧縮するlmn_env.z_dict_train個の
+ *    バイナリストリングを標本として辞書を作り, 以降は全スレッドで共有する辞書を
+ *    プリセットしてz圧縮する.
+ *    lmn_env.z_dict_rebuildが0でなければ, その個数を圧縮する度に再び標本を集めて
+ *    新しい辞書を作る. 古い辞書で圧縮したバイナリストリングを復元するため,
+ *    作成した辞書は解放しない.
+ *
+ *    圧縮後のバイト列は, [辞書ID(1byte)][圧縮前のバイト数(4byte)][zlibストリーム]とする.
+ *    辞書ID 0は辞書なし(辞書を作成する前)を表す.
+ */
+
+#ifdef HAVE_LIBZ
+
+#define ZDICT_SIZE_MAX   (8 * 1024) /* deflateSetDictionaryの処理量は辞書長に比例するため小さめにする */
+#define ZDICT_NUM_MAX    (255)      /* 辞書IDは1byteで記録する */
+#define ZDICT_HEAD_SIZE  (1 + sizeof(uint32_t))
+
+struct ZDict {
+  BYTE         *v;
+  unsigned int len;
+};
+
+/* スレッド毎に使い回すzlibのストリームと圧縮用の作業領域 */
+struct ZDictStream {
+  z_stream      def, inf;
+  BYTE          *buf;
+  unsigned long buf_size;
+};
+
+static struct ZDict       zdicts[ZDICT_NUM_MAX + 1]; /* 添字が辞書ID. zdicts[0]は使わない */
+static volatile unsigned int zdict_num    = 0;       /* 作成済みの辞書の数 (最新の辞書ID) */
+static struct ZDictStream *zdict_streams = NULL;
+
+/* 標本の収集 */
+static lmn_mutex_t        zdict_mtx;
+static volatile BOOL      zdict_training = FALSE;
+static BYTE               *zdict_sample;
+static unsigned int       zdict_sample_len;
+static unsigned long      zdict_sample_num;
+static unsigned long      zdict_comp_num;           /* 最新の辞書で圧縮した数 */
+
+
+void lmn_bscomp_z_dict_init()
+{
+  unsigned int i;
+
+  if (zdict_streams) return;
+
+  zdict_streams = LMN_NALLOC(struct ZDictStream, lmn_env.core_num);
+  for (i = 0; i < lmn_env.core_num; i++) {
+    struct ZDictStream *zs = &zdict_streams[i];
+    memset(zs, 0x00U, sizeof(struct ZDictStream));
+    if (deflateInit(&zs->def, Z_DEFAULT_COMPRESSION) != Z_OK ||
+        inflateInit(&zs->inf) != Z_OK) {
+      lmn_fatal("fail to initialize: zlib");
+    }
+  }
+
+  lmn_mutex_init(&zdict_mtx);
+  zdict_sample     = LMN_NALLOC(BYTE, ZDICT_SIZE_MAX);
+  zdict_sample_len = 0;
+  zdict_sample_num = 0;
+  zdict_comp_num   = 0;
+  zdict_training   = TRUE;
+}
+
+
+void lmn_bscomp_z_dict_finalize()
+{
+  unsigned int i;
+
+  if (!zdict_streams) return;
+
+  for (i = 0; i < lmn_env.core_num; i++) {
+    deflateEnd(&zdict_streams[i].def);
+    inflateEnd(&zdict_streams[i].inf);
+    LMN_FREE(zdict_streams[i].buf);
+  }
+  LMN_FREE(zdict_streams);
+  zdict_streams = NULL;
+
+  for (i = 1; i <= zdict_num; i++) {
+    LMN_FREE(zdicts[i].v);
+  }
+  zdict_num = 0;
+
+  LMN_FREE(zdict_sample);
+  lmn_mutex_destroy(&zdict_mtx);
+}
+
+
+BOOL lmn_bscomp_z_dict_enabled()
+{
+  return zdict_streams != NULL;
+}
+
+
+/* 作成した辞書の数を返す */
+unsigned int lmn_bscomp_z_dict_num()
+{
+  return zdict_num;
+}
+
+
+/* 標本として圧縮前のバイト列v(長さlen)を追加する.
+ * 標本領域が溢れる場合は古い標本から捨てる. (zlibは辞書の末尾ほど一致を探しやすいため,
+ * 新しい標本を末尾に置く) */
+static void zdict_add_sample(const BYTE *v, unsigned int len)
+{
+  if (len > ZDICT_SIZE_MAX) {
+    v  += len - ZDICT_SIZE_MAX;
+    len = ZDICT_SIZE_MAX;
+  }
+  if (zdict_sample_len + len > ZDICT_SIZE_MAX) {
+    unsigned int drop = zdict_sample_len + len - ZDICT_SIZE_MAX;
+    memmove(zdict_sample, zdict_sample + drop, zdict_sample_len - drop);
+    zdict_sample_len -= drop;
+  }
+  memcpy(zdict_sample + zdict_sample_len, v, len);
+  zdict_sample_len += len;
+}
+
+
+/* 集めた標本から新しい辞書を作る. zdict_mtxを獲得して呼び出すこと */
+static void zdict_build()
+{
+  struct ZDict *d;
+  unsigned int id;
+
+  if (zdict_num >= ZDICT_NUM_MAX) { /* 辞書IDを使い切ったら最後の辞書を使い続ける */
+    zdict_training = FALSE;
+    return;
+  }
+
+  id = zdict_num + 1;
+  d  = &zdicts[id];
+  d->len = zdict_sample_len;
+  d->v   = LMN_NALLOC(BYTE, d->len);
+  memcpy(d->v, zdict_sample, d->len);
+
+  /* 辞書の内容を書き込んでからIDを公開する */
+#ifdef HAVE_BUILTIN_MBARRIER
+  if (lmn_env.core_num >= 2) MEM_BARRIER();
+#endif
+  zdict_num = id;
+
+  zdict_sample_len = 0;
+  zdict_sample_num = 0;
+  zdict_comp_num   = 0;
+  zdict_training   = FALSE;
+}
+
+
+/* orgを標本として扱い, 圧縮に使う辞書IDを返す */
+static unsigned int zdict_select(const BYTE *v, unsigned int len)
+{
+  if (!zdict_training && lmn_env.z_dict_rebuild > 0 && zdict_num < ZDICT_NUM_MAX &&
+      ADD_AND_FETCH(zdict_comp_num, 1) >= lmn_env.z_dict_rebuild) {
+    zdict_training = TRUE;
+  }
+
+  if (zdict_training) {
+    if (lmn_env.core_num >= 2) lmn_mutex_lock(&zdict_mtx);
+    if (zdict_training) {
+      zdict_add_sample(v, len);
+      if (++zdict_sample_num >= lmn_env.z_dict_train) {
+        zdict_build();
+      }
+    }
+    if (lmn_env.core_num >= 2) lmn_mutex_unlock(&zdict_mtx);
+  }
+
+  return zdict_num;
+}
+
+
+static LmnBinStr bscomp_zdict_encode(const LmnBinStr org)
+{
+  LmnBinStr cmp;
+  struct ZDictStream *zs;
+  unsigned long org_8len, cmp_8len, bound;
+  unsigned int id;
+  uint32_t n;
+
+  org_8len = (org->len + 1) / TAG_IN_BYTE;
+  id       = zdict_select(org->v, org_8len);
+  zs       = &zdict_streams[env_my_thread_id()];
+
+  if (deflateReset(&zs->def) != Z_OK ||
+      (id > 0 && deflateSetDictionary(&zs->def, zdicts[id].v, zdicts[id].len) != Z_OK)) {
+    lmn_fatal("fail to compress: zlib");
+  }
+
+  /* 作業領域へ圧縮してから, 圧縮後の大きさちょうどのバイナリストリングへ複写する */
+  bound = deflateBound(&zs->def, org_8len);
+  if (zs->buf_size < bound) {
+    LMN_FREE(zs->buf);
+    zs->buf_size = bound;
+    zs->buf      = LMN_NALLOC(BYTE, bound);
+  }
+
+  zs->def.next_in   = org->v;
+  zs->def.avail_in  = org_8len;
+  zs->def.next_out  = zs->buf;
+  zs->def.avail_out = zs->buf_size;
+  if (deflate(&zs->def, Z_FINISH) != Z_STREAM_END) {
+    lmn_fatal("fail to compress: zlib");
+  }
+
+  cmp_8len  = ZDICT_HEAD_SIZE + zs->def.total_out;
+  cmp       = lmn_binstr_make(cmp_8len);
+  cmp->type = org->type;
+  n         = (uint32_t)org_8len;
+  cmp->v[0] = (BYTE)id;
+  memcpy(cmp->v + 1, &n, sizeof(uint32_t));
+  memcpy(cmp->v + ZDICT_HEAD_SIZE, zs->buf, zs->def.total_out);
+
+  cmp->len = cmp_8len * TAG_IN_BYTE + ((org->len & 0x1U) ? 1 : 0);
+  set_comp_zdict(cmp);
+
+  return cmp;
+}
+
+
+static LmnBinStr bscomp_zdict_decode(const LmnBinStr cmp)
+{
+  LmnBinStr org;
+  z_stream *zs;
+  unsigned int id;
+  uint32_t org_8len;
+  int ret;
+
+  id = cmp->v[0];
+  memcpy(&org_8len, cmp->v + 1, sizeof(uint32_t));
+  zs = &zdict_streams[env_my_thread_id()].inf;
+
+  org = lmn_binstr_make(org_8len);
+  if (inflateReset(zs) != Z_OK) {
+    lmn_fatal("fail to uncompress: zlib");
+  }
+
+  zs->next_in   = cmp->v + ZDICT_HEAD_SIZE;
+  zs->avail_in  = cmp->len / TAG_IN_BYTE - ZDICT_HEAD_SIZE;
+  zs->next_out  = org->v;
+  zs->avail_out = org_8len;
+
+  ret = inflate(zs, Z_FINISH);
+  if (ret == Z_NEED_DICT) {
+    LMN_ASSERT(id > 0 && id <= zdict_num);
+    if (inflateSetDictionary(zs, zdicts[id].v, zdicts[id].len) != Z_OK) {
+      lmn_fatal("fail to uncompress: zlib");
+    }
+    ret = inflate(zs, Z_FINISH);
+  }
+  if (ret != Z_STREAM_END || zs->total_out != org_8len) {
+    lmn_fatal("fail to uncompress: zlib");
+  }
+
+  org->type = cmp->type;
+  org->len  = org_8len * TAG_IN_BYTE - ((cmp->len & 0x1U) ? 1 : 0);
+
+  return org;
+}
+
+#else
+
+void lmn_bscomp_z_dict_init() {}
+void lmn_bscomp_z_dict_finalize() {}
+BOOL lmn_bscomp_z_dict_enabled() { return FALSE; }
+unsigned int lmn_bscomp_z_dict_num() { return 0; }
+
+#endif /* HAVE_LIBZ */
+
+
 /** --------------------------
  *  Method2: zdelta
  *    "A General Purpose Lossless Delta Compression Library")
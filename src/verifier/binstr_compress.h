@@ -45,6 +45,10 @@
 
 LmnBinStr lmn_bscomp_z_encode(LmnBinStr org);
 LmnBinStr lmn_bscomp_z_decode(LmnBinStr org);
+void lmn_bscomp_z_dict_init(void);
+void lmn_bscomp_z_dict_finalize(void);
+BOOL lmn_bscomp_z_dict_enabled(void);
+unsigned int lmn_bscomp_z_dict_num(void);
 
 
 LmnBinStr lmn_bscomp_d_encode(LmnBinStr org, LmnBinStr ref);
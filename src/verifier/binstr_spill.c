@@ -0,0 +1,197 @@
+/*
+ * binstr_spill.c
+ *
+ *   Copyright (c) 2008, Ueda Laboratory LMNtal Group
+ *                                         <lmntal@ueda.info.waseda.ac.jp>
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are
+ *   met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *    3. Neither the name of the Ueda Laboratory LMNtal Group nor the
+ *       names of its contributors may be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include "binstr_spill.h"
+#include "error.h"
+#include "vector.h"
+#ifdef HAVE_MMAP
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+/*----------------------------------------------------------------------
+ * Spill Segment
+ *
+ * 状態のバイナリストリング(のバイト列)を, ディスク上のファイルをmmapした
+ * 追記専用のセグメントへ移して物理メモリを空ける.
+ * 移したバイト列への参照は, OSのページングによって透過的に読み戻されるため,
+ * 利用側(状態の比較, 階層グラフ構造の復元, 反例の出力など)は変更しなくてよい.
+ * セグメントはスレッド毎に持ち, 追記は排他制御なしに行う.
+ * 作成したファイルはmmap直後にunlinkするため, 異常終了時にもファイルは残らない.
+ */
+
+#define SPILL_SEGMENT_SIZE   (256UL * 1024UL * 1024UL)
+#define SPILL_PATH_MAX       (4096)
+
+typedef struct SpillArea SpillArea;
+struct SpillArea {
+  BYTE          *head;  /* 追記中のセグメント */
+  unsigned long used;   /* 追記中のセグメントの使用量 */
+  unsigned long total;  /* 退避した総byte数 */
+  Vector        segs;   /* mmapしたセグメントの一覧 */
+};
+
+static char      *spill_dir   = NULL;
+static SpillArea *spill_areas = NULL;
+
+
+void binstr_spill_init(const char *dir)
+{
+#ifndef HAVE_MMAP
+  lmn_fatal("--spill-dir is not supported: mmap is not available");
+#else
+  unsigned int i;
+
+  spill_dir   = strdup(dir);
+  spill_areas = LMN_NALLOC(SpillArea, lmn_env.core_num);
+  for (i = 0; i < lmn_env.core_num; i++) {
+    spill_areas[i].head  = NULL;
+    spill_areas[i].used  = 0;
+    spill_areas[i].total = 0;
+    vec_init(&spill_areas[i].segs, 4);
+  }
+#endif
+}
+
+
+void binstr_spill_finalize()
+{
+#ifdef HAVE_MMAP
+  unsigned int i, j;
+
+  if (!spill_areas) return;
+
+  for (i = 0; i < lmn_env.core_num; i++) {
+    for (j = 0; j < vec_num(&spill_areas[i].segs); j++) {
+      munmap((void *)vec_get(&spill_areas[i].segs, j), SPILL_SEGMENT_SIZE);
+    }
+    vec_destroy(&spill_areas[i].segs);
+  }
+  LMN_FREE(spill_areas);
+  free(spill_dir);
+  spill_areas = NULL;
+  spill_dir   = NULL;
+#endif
+}
+
+
+BOOL binstr_spill_enabled()
+{
+  return spill_areas != NULL;
+}
+
+
+#ifdef HAVE_MMAP
+/* 自スレッド用のセグメントを新たに作成し, 追記先とする */
+static void spill_segment_new(SpillArea *a)
+{
+  char path[SPILL_PATH_MAX];
+  void *p;
+  int fd;
+
+  snprintf(path, SPILL_PATH_MAX, "%s/slim-spill.%d.%u.%u",
+           spill_dir, (int)getpid(), env_my_thread_id(), vec_num(&a->segs));
+
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "%s\n", path);
+    lmn_fatal("cannot create spill segment");
+  }
+
+  /* ディスク容量を先に確保しておく. (書込み時のSIGBUSを避けるため) */
+  if (posix_fallocate(fd, 0, SPILL_SEGMENT_SIZE) != 0) {
+    close(fd);
+    unlink(path);
+    lmn_fatal("cannot allocate spill segment: no space left on device");
+  }
+
+  p = mmap(NULL, SPILL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  unlink(path);
+  if (p == MAP_FAILED) {
+    lmn_fatal("cannot map spill segment");
+  }
+
+  vec_push(&a->segs, (vec_data_t)p);
+  a->head = (BYTE *)p;
+  a->used = 0;
+}
+#endif
+
+
+/* 退避領域からsize byteを確保して返す.
+ * 退避を使用しない場合や, sizeがセグメントより大きい場合はNULLを返す. */
+BYTE *binstr_spill_alloc(unsigned long size)
+{
+#ifndef HAVE_MMAP
+  return NULL;
+#else
+  SpillArea *a;
+  BYTE *ret;
+
+  if (!spill_areas || size > SPILL_SEGMENT_SIZE) return NULL;
+
+  a = &spill_areas[env_my_thread_id()];
+  if (!a->head || a->used + size > SPILL_SEGMENT_SIZE) {
+    spill_segment_new(a);
+  }
+
+  ret       = a->head + a->used;
+  a->used  += size;
+  a->total += size;
+  return ret;
+#endif
+}
+
+
+/* 全スレッドで退避した総byte数を返す */
+unsigned long binstr_spill_space()
+{
+  unsigned long ret = 0;
+  unsigned int i;
+
+  if (!spill_areas) return 0;
+
+  for (i = 0; i < lmn_env.core_num; i++) {
+    ret += spill_areas[i].total;
+  }
+  return ret;
+}
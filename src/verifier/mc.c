@@ -47,6 +47,8 @@
 #include "propositional_symbol.h"
 #include "ltl2ba_adapter.h"
 #include "runtime_status.h"
+#include "binstr_spill.h"
+#include "binstr_compress.h"
 #ifdef DEBUG
 #  include "dumper.h"
 #endif
@@ -107,6 +109,9 @@ static inline void do_mc(LmnMembrane *world_mem_org,
    */
   mhash_set_depth(lmn_env.hash_depth);
   wp = lmn_workergroup_make(a, psyms, thread_num);
+  /* workers_flags_init(lmn_workergroup_make)がdelta_memを無効にする場合があるため,
+   * オプションの整合性を取った後, 初期状態のハッシュ値を求める前に設定する */
+  mhash_set_additive(lmn_env.delta_mem);
   states = worker_states(workers_get_worker(wp, LMN_PRIMARY_ID));
   p_label = a ? automata_get_init_state(a)
               : DEFAULT_STATE_ID;
@@ -165,6 +170,45 @@ static void mc_dump(LmnWorkerGroup *wp)
     if (lmn_env.mc_dump_format == CUI) {
       fprintf(ss->out, "\'# of States\'(stored)   = %lu.\n", statespace_num(ss));
       fprintf(ss->out, "\'# of States\'(end)      = %lu.\n", statespace_end_num(ss));
+      if (statespace_use_bitstate(ss)) {
+        fprintf(ss->out, "\'# of Bits\'(set/total)  = %lu/%lu.\n",
+                statespace_bitstate_set(ss), ss->bits_len);
+        fprintf(ss->out, "\'Omission Probability\'  = %.3e.\n",
+                statespace_bitstate_omission(ss));
+        fprintf(ss->out, "\'Estimated Coverage\'    = %.4f%%.\n",
+                100.0 * statespace_bitstate_coverage(ss));
+      }
+      if (statespace_use_hcompact(ss)) {
+        fprintf(ss->out, "\'# of Fingerprints\'     = %lu/%lu (%.2f%%).\n",
+                statespace_num_raw(ss), ss->fps_cap,
+                100.0 * statespace_hcompact_fill(ss));
+        fprintf(ss->out, "\'Bytes per State\'       = %.2f.\n",
+                statespace_num_raw(ss) > 0
+                ? (double)(ss->fps_cap * sizeof(uint64_t)) / statespace_num_raw(ss)
+                : 0.0);
+        fprintf(ss->out, "\'Omission Probability\'  = %.3e.\n",
+                statespace_hcompact_omission(ss));
+        if (statespace_hcompact_lost(ss) > 0) {
+          fprintf(ss->out, "\'Omitted States\'(max)   = %lu.\n",
+                  statespace_hcompact_lost(ss));
+        }
+      }
+      if (binstr_spill_enabled()) {
+        fprintf(ss->out, "\'Spilled Bytes\'         = %lu.\n", binstr_spill_space());
+      }
+      if (statespace_use_mem_limit(ss)) {
+        static const char *mem_levels[] = { "none", "z", "z+cold", "over" };
+        fprintf(ss->out, "\'Memory Used\'           = %lu/%lu (level: %s).\n",
+                statespace_mem_used(ss), lmn_env.memory_limit,
+                mem_levels[statespace_mem_level(ss)]);
+      }
+      if (lmn_mem_collapse_enabled()) {
+        fprintf(ss->out, "\'Collapsed Mems\'        = %lu (%lu bytes).\n",
+                lmn_mem_collapse_num(), lmn_mem_collapse_space());
+      }
+      if (lmn_bscomp_z_dict_enabled()) {
+        fprintf(ss->out, "\'Z Dictionaries\'        = %u.\n", lmn_bscomp_z_dict_num());
+      }
       if (wp->do_search) {
         fprintf(ss->out, "\'# of States\'(invalid)  = %lu.\n", mc_invalids_get_num(wp));
       }
@@ -192,6 +236,7 @@ static void mc_dump(LmnWorkerGroup *wp)
  */
 
 static inline void mc_gen_successors_inner(LmnReactCxt *rc, LmnMembrane *cur_mem);
+static inline BOOL mc_use_lazy_succ(const StateSpace ss, AutomataState p_s, BOOL f);
 static inline void stutter_extension(State       *s,
                                      LmnMembrane *mem,
                                      BYTE        next_label,
@@ -199,6 +244,20 @@ static inline void stutter_extension(State       *s,
                                      BOOL        flags);
 
 
+/* 遷移先状態(State)の生成を, 遷移先の階層グラフ構造による状態空間の検索後まで遅らせる場合に真を返す.
+ * 既出の遷移先に対してはStateを生成せずに済む.
+ * 遷移先のStateを直接扱う機能(差分/canonical membrane, 遷移オブジェクト, POR, 性質オートマトン)とは併用しない */
+static inline BOOL mc_use_lazy_succ(const StateSpace ss, AutomataState p_s, BOOL f)
+{
+  return !p_s
+      && !mc_use_delta(f)
+      && !mc_use_canonical(f)
+      && !mc_has_trans(f)
+      && !mc_enable_por(f)
+      && statespace_lookup_mem_enable(ss);
+}
+
+
 /* 状態sから1stepで遷移する状態を計算し, 遷移元状態と状態空間に登録を行う
  * 遷移先状態のうち新規状態がnew_statesに積まれる */
 void mc_expand(const StateSpace ss,
@@ -212,7 +271,21 @@ void mc_expand(const StateSpace ss,
   LmnMembrane *mem;
 
   /** restore : 膜の復元 */
-  mem = state_restore_mem(s);
+  if (!state_mem(s) && !s_is_d(s) && mc_use_delta(f) && !mc_use_canonical(f) &&
+      state_binstr(s) && !is_comp_z(state_binstr(s))) {
+    /* 差分を適用したサクセッサのダンプで, sのバイナリストリングを再利用する */
+    mem = lmn_binstr_decode_as_dump_ref(state_binstr(s));
+  } else {
+    mem = state_restore_mem(s);
+  }
+  if (!state_mem(s) && !mc_use_canonical(f) && !mc_use_delta(f)) {
+    mhash_prepare(mem);
+  }
+
+  /* 遷移先状態は, 状態空間を検索して新規と判定してから生成する */
+  if (mc_use_lazy_succ(ss, p_s, f)) {
+    RC_MC_SET_LAZY(rc);
+  }
 
   /** expand  : 状態の展開 */
   if (p_s) {
@@ -224,6 +297,7 @@ void mc_expand(const StateSpace ss,
   if (mc_react_cxt_expanded_num(rc) == 0) {
     /* sを最終状態集合として記録 */
     statespace_add_end_state(ss, s);
+    s_set_end(s);
   }
   else if (mc_enable_por(f) && !s_is_reduced(s)) {
     /* POR: 遷移先状態集合:en(s)からample(s)を計算する.
@@ -242,10 +316,8 @@ void mc_expand(const StateSpace ss,
       profile_add_space(PROFILE_SPACE__REDUCED_MEMSET, lmn_mem_space(mem));
     }
 #endif
+    lmn_mem_dump_ref_clear();
     lmn_mem_free_rec(mem);
-    if (is_binstr_user(s) && lmn_env.hash_compaction) {
-      state_free_binstr(s);
-    }
   }
 
   /* この時点で, sのサクセッサ登録が全て完了->フラグセット
@@ -253,6 +325,7 @@ void mc_expand(const StateSpace ss,
    *  フラグセットのタイミングは重要.) */
 
   set_expanded(s);
+  RC_MC_UNSET_LAZY(rc);
   RC_CLEAR_DATA(rc);
 
 #ifdef PROFILE
@@ -263,6 +336,17 @@ void mc_expand(const StateSpace ss,
 }
 
 
+/* bitstate hashing/hash compaction使用時, 展開を終えた状態sを解放する.
+ * 訪問済みか否かはビット配列(fingerprint表)で判定するため探索済みの状態を保持する必要はないが,
+ * 初期状態と最終状態は結果の出力に用いるため残しておく. */
+void mc_release_closed_state(const StateSpace ss, State *s)
+{
+  if (s != statespace_init_state(ss) && !s_is_end(s)) {
+    state_free(s);
+  }
+}
+
+
 /* 状態sの全ての遷移先状態のコストを可能ならば更新し、updateフラグを立てる.
  * TODO: 排他制御が適当です by kawabata */
 void mc_update_cost(State *s, Vector *new_ss, EWLock *ewlock)
@@ -293,6 +377,55 @@ void mc_update_cost(State *s, Vector *new_ss, EWLock *ewlock)
 }
 
 
+/* 状態空間へ登録する直前に, 遷移先状態src_succの状態データを整える */
+static inline void mc_prepare_successor(LmnReactCxt *rc, State *src_succ)
+{
+  if (RC_MC_USE_D(rc) && RC_D_COND(rc)) {
+    /* delta-stringフラグをこの時点で初めて立てる */
+    s_set_d(src_succ);
+  }
+
+  if (is_encoded(src_succ) && s_is_d(src_succ)) { /* --mem-enc */
+    state_calc_binstr_delta(src_succ);
+  }
+}
+
+
+/* 状態sの全遷移先状態をstatespace_insert_batchで状態空間ssへまとめて登録する.
+ * i番目の遷移先の登録結果をRC_SUCC_BATCH(rc)のi番目に,
+ * 登録前に参照していた階層グラフ構造(バイナリストリングへ置き換わり得るため)を
+ * RC_SUCC_BATCH_MEMS(rc)のi番目に置く. */
+static inline void mc_insert_successors_batch(const StateSpace ss,
+                                              State            *s,
+                                              LmnReactCxt      *rc)
+{
+  Vector *succs, *mems;
+  unsigned int i;
+
+  succs = RC_SUCC_BATCH(rc);
+  mems  = RC_SUCC_BATCH_MEMS(rc);
+  vec_clear(succs);
+  vec_clear(mems);
+
+  for (i = 0; i < mc_react_cxt_expanded_num(rc); i++) {
+    State *src_succ;
+
+    if (!has_trans_obj(s)) {
+      src_succ = (State *)vec_get(RC_EXPANDED(rc), i);
+    } else {
+      src_succ = transition_next_state((Transition)vec_get(RC_EXPANDED(rc), i));
+    }
+
+    mc_prepare_successor(rc, src_succ);
+    vec_push(mems, is_encoded(src_succ) ? (vec_data_t)NULL
+                                        : (vec_data_t)state_mem(src_succ));
+    vec_push(succs, (vec_data_t)src_succ);
+  }
+
+  statespace_insert_batch(ss, (State **)succs->tbl, vec_num(succs));
+}
+
+
 /** 生成した各Successor Stateが既出か否かを検査し, 遷移元の状態sのサクセッサに設定する.
  *   + 多重辺を除去する.
  *   + "新規"状態をnew_ssへ積む.　 */
@@ -303,6 +436,15 @@ void mc_store_successors(const StateSpace ss,
                          BOOL             f)
 {
   unsigned int i, succ_i;
+  BOOL batch;
+
+  /* 遷移先が複数ある場合は, 状態空間への登録をまとめて行う */
+  batch = !RC_MC_USE_DMEM(rc) && !RC_MC_USE_LAZY(rc) &&
+          !statespace_use_partition(ss) &&
+          mc_react_cxt_expanded_num(rc) > 1;
+  if (batch) {
+    mc_insert_successors_batch(ss, s, rc);
+  }
 
   /** 状態登録 */
   succ_i = 0;
@@ -313,7 +455,23 @@ void mc_store_successors(const StateSpace ss,
     LmnMembrane *src_succ_m;
 
     /* 状態sのi番目の遷移src_tと遷移先状態src_succを取得 */
-    if (!has_trans_obj(s)) {
+    if (RC_MC_USE_LAZY(rc)) {
+      /* 遷移先の階層グラフ構造のまま状態空間を検索し, 既出ならば状態を生成しない */
+      LmnMembrane *m;
+      unsigned long h;
+
+      m      = (LmnMembrane *)vec_get(RC_EXPANDED(rc), i);
+      h      = mhash(m);
+      src_t  = NULL;
+      succ   = statespace_lookup_mem(ss, m, h);
+      if (succ) {
+        lmn_mem_free_rec(m);
+        goto STORE_SUCC;
+      }
+      src_succ = state_make_with_hash(m, DEFAULT_STATE_ID, h);
+      state_set_parent(src_succ, s);
+    }
+    else if (!has_trans_obj(s)) {
       /* Transitionオブジェクトを利用しない場合 */
       src_t    = NULL;
       src_succ = (State *)vec_get(RC_EXPANDED(rc), i);
@@ -322,25 +480,42 @@ void mc_store_successors(const StateSpace ss,
       src_succ = transition_next_state(src_t);
     }
 
-    if (RC_MC_USE_D(rc) && RC_D_COND(rc)) {
-      /* delta-stringフラグをこの時点で初めて立てる */
-      s_set_d(src_succ);
-    }
-
     /* 状態空間に状態src_succを記録 */
-    if (RC_MC_USE_DMEM(rc)) {           /* --delta-mem */
+    if (batch) {                        /* mc_insert_successors_batchで登録済み */
+      succ       = (State *)vec_get(RC_SUCC_BATCH(rc), i);
+      src_succ_m = (LmnMembrane *)vec_get(RC_SUCC_BATCH_MEMS(rc), i);
+    }
+    else if (RC_MC_USE_DMEM(rc)) {      /* --delta-mem */
       MemDeltaRoot *d = (struct MemDeltaRoot *)vec_get(RC_MEM_DELTAS(rc), i);
+      if (RC_MC_USE_D(rc) && RC_D_COND(rc)) s_set_d(src_succ);
       succ       = statespace_insert_delta(ss, src_succ, d);
       src_succ_m = NULL;
     }
-    else if (is_encoded(src_succ)) {    /* !--delta-mem && --mem-enc */
-      if (s_is_d(src_succ)) state_calc_binstr_delta(src_succ);
-      succ       = statespace_insert(ss, src_succ);
-      src_succ_m = NULL;
+    else {
+      mc_prepare_successor(rc, src_succ);
+      src_succ_m = is_encoded(src_succ) ? NULL
+                                        : state_mem(src_succ); /* for free mem pointed by src_succ */
+      if (statespace_use_partition(ss) && !statespace_partition_is_mine(ss, src_succ)) {
+        /* 担当外の状態は担当スレッドへ送る. 既出の場合は担当スレッドがsucc_i番目のサクセッサを付け替える */
+        succ = statespace_partition_forward(ss, src_succ, s, succ_i);
+        if (succ == src_succ) {
+          if (mc_use_compress(f) && src_succ_m) {
+            lmn_mem_free_rec(src_succ_m);
+          }
+          goto STORE_SUCC;
+        }
+      } else {
+        succ = statespace_insert(ss, src_succ);
+      }
     }
-    else { /* default */
-      src_succ_m = state_mem(src_succ); /* for free mem pointed by src_succ */
-      succ       = statespace_insert(ss, src_succ);
+
+    if (!succ) {
+      /* bitstate hashing/hash compaction: 既出と判定した状態は保持していないため, 遷移ごと破棄する */
+      state_free(src_succ);
+      if (has_trans_obj(s)) {
+        transition_free(src_t);
+      }
+      continue;
     }
 
     if (succ == src_succ) {
@@ -349,6 +524,7 @@ void mc_store_successors(const StateSpace ss,
       if (mc_use_compress(f) && src_succ_m) {
         lmn_mem_free_rec(src_succ_m);
       }
+      if (RC_MC_USE_D(rc)) state_D_ref_cand_add(succ);
       if (new_ss)        vec_push(new_ss, (vec_data_t)succ);
       if (mc_is_dump(f)) dump_state_data(succ, (LmnWord)stdout, (LmnWord)NULL);
     }
@@ -361,6 +537,7 @@ void mc_store_successors(const StateSpace ss,
       }
     }
 
+  STORE_SUCC:
     /* 多重辺(1stepで合流する遷移関係)を除去 */
     tmp = 0;
     if (!st_lookup(RC_SUCC_TBL(rc), (st_data_t)succ, (st_data_t *)&tmp)) {
@@ -460,7 +637,8 @@ void mc_gen_successors(State       *src,
   expanded_rules   = RC_EXPANDED_RULES(rc);
   n = mc_react_cxt_expanded_num(rc);
 
-  for (i = old; i < n; i++) {
+  /* 遅延時はSuccessor Membraneのまま残し, mc_store_successorsで新規の場合に限り状態を生成する */
+  for (i = RC_MC_USE_LAZY(rc) ? n : old; i < n; i++) {
     State *news;
     vec_data_t data;
 
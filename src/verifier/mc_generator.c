@@ -92,6 +92,7 @@
 #define DFS_WORKER_OBJ(W)                  ((McExpandDFS *)worker_generator_obj(W))
 #define DFS_WORKER_OBJ_SET(W, O)           (worker_generator_obj_set(W, O))
 #define DFS_WORKER_QUEUE(W)                (DFS_WORKER_OBJ(W)->q)
+#define DFS_WORKER_WSQ(W)                  (DFS_WORKER_OBJ(W)->wsq)
 #define DFS_CUTOFF_DEPTH(W)                (DFS_WORKER_OBJ(W)->cutoff_depth)
 #define DFS_WORKER_STACK(W)                (DFS_WORKER_OBJ(W)->stack)
 #define DFS_WORKER_DEQUE(W)                (DFS_WORKER_OBJ(W)->deq)
@@ -144,12 +145,19 @@ void    costed_dfs_loop(LmnWorker *w,
 static inline LmnWord dfs_work_stealing(LmnWorker *w);
 static inline void    dfs_handoff_all_task(LmnWorker *me, Vector *tasks);
 static inline void    dfs_handoff_task(LmnWorker *me,  LmnWord task);
+static inline void    dfs_handoff_chunk(LmnWorker *me, Vector *stack, Vector *tasks);
+
+/* Work-Stealing Deque使用時に, 一度に自身のデックへ公開するタスク数の上限 */
+#define DFS_WSQ_CHUNK_MAX    (64U)
 
 typedef struct McExpandDFS {
   struct Vector stack;
   Deque deq;
   unsigned int cutoff_depth;
   Queue *q;
+  WSDeque *wsq;            /* NULLでなければ, 隣接ワーカーのqではなく自身のwsqにタスクを公開する */
+  unsigned int wsq_chunk;  /* wsqへ一度に公開するタスク数. 盗まれ具合に応じて増減する */
+  unsigned long wsq_seed;  /* 盗む相手を選ぶ乱数の状態 */
 } McExpandDFS;
 
 
@@ -158,6 +166,8 @@ void dfs_worker_init(LmnWorker *w)
 {
   McExpandDFS *mc = LMN_MALLOC(McExpandDFS);
   mc->cutoff_depth = lmn_env.cutoff_depth;
+  mc->q            = NULL;
+  mc->wsq          = NULL;
 
   if (!worker_on_parallel(w)) {
 #ifdef KWBT_OPT
@@ -177,6 +187,13 @@ void dfs_worker_init(LmnWorker *w)
 
     if (lmn_env.core_num == 1) {
       mc->q = new_queue();
+    } else if (worker_on_dynamic_lb(w) &&
+               !worker_use_mapndfs(w) && !worker_use_mcndfs(w)) {
+      /* 各ワーカーが自身のデックにタスクを公開し, 手の空いたワーカーが無作為に選んだ相手から盗む */
+      mc->wsq = LMN_MALLOC(WSDeque);
+      wsdeq_init(mc->wsq, 1024);
+      mc->wsq_chunk = 1;
+      mc->wsq_seed  = worker_id(w) * 2654435761UL + 1;
     } else if (worker_on_dynamic_lb(w)) {
       if(worker_use_mapndfs(w)) mc->q = make_parallel_queue(LMN_Q_MRMW);
       else mc->q = make_parallel_queue(LMN_Q_MRSW);
@@ -192,7 +209,10 @@ void dfs_worker_init(LmnWorker *w)
 /* LmnWorkerのDFS固有データを破棄する */
 void dfs_worker_finalize(LmnWorker *w)
 {
-  if (worker_on_parallel(w)) {
+  if (DFS_WORKER_WSQ(w)) {
+    wsdeq_destroy(DFS_WORKER_WSQ(w));
+    LMN_FREE(DFS_WORKER_WSQ(w));
+  } else if (worker_on_parallel(w)) {
     q_free(DFS_WORKER_QUEUE(w));
   }
 #ifdef KWBT_OPT
@@ -208,10 +228,18 @@ void dfs_worker_finalize(LmnWorker *w)
 /* DFS Worker Queueが空の場合に真を返す */
 BOOL dfs_worker_check(LmnWorker *w)
 {
-  return DFS_WORKER_QUEUE(w) ? is_empty_queue(DFS_WORKER_QUEUE(w))
+  return DFS_WORKER_WSQ(w)   ? wsdeq_is_empty(DFS_WORKER_WSQ(w))
+       : DFS_WORKER_QUEUE(w) ? is_empty_queue(DFS_WORKER_QUEUE(w))
                              : TRUE;
 }
 
+/* ワーカーwのタスクを1つ取り出す. 空の場合は0を返す */
+static inline LmnWord dfs_worker_get_task(LmnWorker *w)
+{
+  return DFS_WORKER_WSQ(w) ? wsdeq_pop(DFS_WORKER_WSQ(w))
+                           : dequeue(DFS_WORKER_QUEUE(w));
+}
+
 /* WorkerにDFSを割り当てる */
 void dfs_env_set(LmnWorker *w)
 {
@@ -223,19 +251,83 @@ void dfs_env_set(LmnWorker *w)
 }
 
 
+/* ワーカーwがワーカーdstからタスクを奪った回数を, NUMAノードの内外に分けて数える */
+static inline void dfs_steal_profile(LmnWorker *w, LmnWorker *dst)
+{
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) {
+    profile_countup(worker_node(w) == worker_node(dst) ? PROFILE_COUNT__STEAL_LOCAL
+                                                       : PROFILE_COUNT__STEAL_REMOTE);
+  }
+#endif
+}
+
+
+/* xorshiftによる擬似乱数 */
+static inline unsigned long dfs_wsq_rand(McExpandDFS *mc)
+{
+  mc->wsq_seed ^= mc->wsq_seed << 13;
+  mc->wsq_seed ^= mc->wsq_seed >> 7;
+  mc->wsq_seed ^= mc->wsq_seed << 17;
+  return mc->wsq_seed;
+}
+
+/* ワーカーwが無作為に選んだ他のワーカーのデックの頂上から未展開状態を盗む.
+ * ワーカー数と同じ回数だけ試み, 盗めなかった場合はNULLを返す */
+static inline LmnWord dfs_wsq_stealing(LmnWorker *w)
+{
+  LmnWorkerGroup *wp;
+  McExpandDFS *mc;
+  unsigned int i, n;
+
+  wp = worker_group(w);
+  mc = DFS_WORKER_OBJ(w);
+  n  = workers_entried_num(wp);
+  for (i = 0; i < n; i++) {
+    LmnWorker *dst;
+    unsigned int j;
+
+    /* --numa: 前半の試行では同じノードのWorkerだけを狙う.
+     * 他ノードのWorkerを引いた場合は試行を消費せずに引き直す(最大n回) */
+    j = 0;
+    do {
+      dst = workers_get_worker(wp, dfs_wsq_rand(mc) % n);
+    } while (lmn_env.numa && i < n / 2 && worker_node(dst) != worker_node(w) && ++j < n);
+
+    if (dst != w && !wsdeq_is_empty(DFS_WORKER_WSQ(dst))) {
+      LmnWord task;
+      worker_set_active(w);
+      task = wsdeq_steal(DFS_WORKER_WSQ(dst));
+      if (task) {
+        dfs_steal_profile(w, dst);
+        return task;
+      }
+    }
+  }
+  return (LmnWord)NULL;
+}
+
+
 /* ワーカーwが輪の方向に沿って, 他のワーカーから未展開状態を奪いに巡回する.
  * 未展開状態を発見した場合, そのワーカーのキューからdequeueして返す.
  * 発見できなかった場合, NULLを返す */
 static inline LmnWord dfs_work_stealing(LmnWorker *w)
 {
   LmnWorker *dst;
+
+  if (DFS_WORKER_WSQ(w)) {
+    return dfs_wsq_stealing(w);
+  }
+
   dst = worker_next(w);
 
   while (w != dst) {
     if (worker_is_active(dst) && !is_empty_queue(DFS_WORKER_QUEUE(dst))) {
+      LmnWord task;
       worker_set_active(w);
-      worker_set_stealer(w);
-      return dequeue(DFS_WORKER_QUEUE(dst));
+      task = dequeue(DFS_WORKER_QUEUE(dst));
+      if (task) dfs_steal_profile(w, dst); /* 他スレッドと競合して盗めなかった場合は数えない */
+      return task;
     }
     else {
       dst = worker_next(dst);
@@ -249,15 +341,23 @@ static inline LmnWord dfs_work_stealing(LmnWorker *w)
 static inline void dfs_handoff_all_task(LmnWorker *me, Vector *expands)
 {
   unsigned long i, n;
-  LmnWorker *rn = worker_next(me);
-  if (worker_id(me) > worker_id(rn)) {
-    worker_set_black(me);
-  }
+  LmnWorker *rn;
 
   n = vec_num(expands);
+  worker_tasks_publish(me, n);
+  if (DFS_WORKER_WSQ(me)) {
+    for (i = 0; i < n; i++) {
+      wsdeq_push(DFS_WORKER_WSQ(me), vec_get(expands, i));
+    }
+    worker_tasks_notify(me);
+    return;
+  }
+
+  rn = worker_next(me);
   for (i = 0; i < n; i++) {
     enqueue(DFS_WORKER_QUEUE(rn), vec_get(expands, i));
   }
+  worker_tasks_notify(me);
 
   ADD_OPEN_PROFILE(sizeof(Node) * n);
 }
@@ -266,15 +366,52 @@ static inline void dfs_handoff_all_task(LmnWorker *me, Vector *expands)
 /* タスクtaskをワーカーmeの隣接ワーカーにハンドオフする */
 static inline void dfs_handoff_task(LmnWorker *me, LmnWord task)
 {
-  LmnWorker *rn = worker_next(me);
-  if (worker_id(me) > worker_id(rn)) {
-    worker_set_black(me);
+  LmnWorker *rn;
+
+  worker_tasks_publish(me, 1);
+  if (DFS_WORKER_WSQ(me)) {
+    wsdeq_push(DFS_WORKER_WSQ(me), task);
+    worker_tasks_notify(me);
+    return;
   }
+
+  rn = worker_next(me);
   enqueue(DFS_WORKER_QUEUE(rn), task);
+  worker_tasks_notify(me);
 
   ADD_OPEN_PROFILE(sizeof(Node));
 }
 
+
+/* ベクタexpandsに積まれたタスクを, 最後の1つを残してチャンク単位でワーカーmeのデックに公開する.
+ * 公開済みのタスクが盗まれて無くなっていればチャンクを倍にし, 残っていれば公開せずにチャンクを半分にする */
+static inline void dfs_handoff_chunk(LmnWorker *me, Vector *stack, Vector *expands)
+{
+  McExpandDFS *mc;
+  unsigned int i, n, k;
+
+  mc = DFS_WORKER_OBJ(me);
+  n  = vec_num(expands);
+  k  = 0;
+  if (n >= 2) {
+    if (wsdeq_is_empty(mc->wsq)) {
+      k = n - 1 < mc->wsq_chunk ? n - 1 : mc->wsq_chunk;
+      if (mc->wsq_chunk < DFS_WSQ_CHUNK_MAX) mc->wsq_chunk *= 2;
+    } else if (mc->wsq_chunk > 1) {
+      mc->wsq_chunk /= 2;
+    }
+  }
+
+  worker_tasks_publish(me, k);
+  for (i = 0; i < k; i++) {
+    wsdeq_push(mc->wsq, vec_get(expands, i));
+  }
+  if (k > 0) worker_tasks_notify(me);
+  for (; i < n; i++) {
+    put_stack(stack, vec_get(expands, i));
+  }
+}
+
 /* ワーカーwが輪の方向に沿って, 他のワーカーから未展開状態を奪いに巡回する.
  * 未展開状態を発見した場合, そのワーカーのキューからdequeueして返す.
  * 発見できなかった場合, NULLを返す */
@@ -288,7 +425,6 @@ static inline LmnWord mapdfs_work_stealing(LmnWorker *w)
   while (w != dst) {
     if (worker_is_active(dst) && !is_empty_queue(DFS_WORKER_QUEUE(dst))) {
       worker_set_active(w);
-      worker_set_stealer(w);
       return  dequeue(DFS_WORKER_QUEUE(dst));
     }
     else {
@@ -304,16 +440,14 @@ static inline void mapdfs_handoff_all_task(LmnWorker *me, Vector *expands)
 {
   unsigned long i, n;
   LmnWorker *rn = worker_next_generator(me);
-   
-  if (worker_id(me) > worker_id(rn)) {
-    worker_set_black(me);
-  }
 
   n = vec_num(expands);
+  worker_tasks_publish(me, n);
   for (i = 0; i < n; i++) {
     enqueue(DFS_WORKER_QUEUE(rn), vec_get(expands, i));
     //enqueue_push_head(DFS_WORKER_QUEUE(rn), vec_get(expands, i));
   }
+  worker_tasks_notify(me);
 
   ADD_OPEN_PROFILE(sizeof(Node) * n);
 }
@@ -324,11 +458,10 @@ static inline void mcdfs_handoff_task(LmnWorker *me, LmnWord task)
 {
   LmnWorker *rn = worker_next_generator(me);
 
-  if (worker_id(me) > worker_id(rn)) {
-    worker_set_black(me);
-  }
+  worker_tasks_publish(me, 1);
   enqueue(DFS_WORKER_QUEUE(rn), task);
   //enqueue_push_head(DFS_WORKER_QUEUE(rn), task);
+  worker_tasks_notify(me);
 
   ADD_OPEN_PROFILE(sizeof(Node));
 }
@@ -365,7 +498,7 @@ void mcdfs_start(LmnWorker *w)
       if (!s && is_empty_queue(DFS_WORKER_QUEUE(w))) {
 	break;
 	/*
-        if (lmn_workers_termination_detection_for_rings(w)) {
+        if (lmn_workers_termination_detection(w)) {
           break;
         } 
 	*/
@@ -437,9 +570,10 @@ void dfs_start(LmnWorker *w)
   }
   else {                        /* Stack-Slicing */
     while (!wp->mc_exit) {
-      if (!s && is_empty_queue(DFS_WORKER_QUEUE(w))) {
+      if (!s && dfs_worker_check(w)) {
         worker_set_idle(w);
-        if (lmn_workers_termination_detection_for_rings(w)) {
+        worker_tasks_exhausted(w);
+        if (lmn_workers_termination_detection(w)) {
           /* termination is detected! */
           break;
         } else if (worker_on_dynamic_lb(w)){
@@ -454,14 +588,20 @@ void dfs_start(LmnWorker *w)
               wp->mc_exit=TRUE;
           } 
         }
+
+        if (!s && !wp->mc_exit) {
+          /* タスクが公開されるまで休止する */
+          lmn_workers_idle_wait(w);
+        }
       } else {
         worker_set_active(w);
 #ifdef DEBUG
-        if(!is_empty_queue(DFS_WORKER_QUEUE(w)) &&  !((Queue*)DFS_WORKER_QUEUE(w))->head->next) {
+        if(DFS_WORKER_QUEUE(w) && !is_empty_queue(DFS_WORKER_QUEUE(w)) &&  !((Queue*)DFS_WORKER_QUEUE(w))->head->next) {
           printf("%d : queue is not empty? %d\n", worker_id(w), queue_entry_num(DFS_WORKER_QUEUE(w)));
         }
 #endif
-        if (s || (s = (State *)dequeue(DFS_WORKER_QUEUE(w)))) {
+        if (s || (s = (State *)dfs_worker_get_task(w))) {
+          worker_task_taken(w);
           EXECUTE_PROFILE_START();
 #ifdef KWBT_OPT
           if (lmn_env.opt_mode != OPT_NONE) {
@@ -528,6 +668,9 @@ static inline void dfs_loop(LmnWorker *w,
         mapndfs_start(w,s);
       }
       pop_stack(stack);
+      if (statespace_is_stateless(worker_states(w))) {
+        mc_release_closed_state(worker_states(w), s);
+      }
       continue;
     } else if (!worker_ltl_none(w) && atmstate_is_end(p_s)) {
       mc_found_invalid_state(worker_group(w), s);
@@ -557,6 +700,8 @@ static inline void dfs_loop(LmnWorker *w,
     else {/* 並列アルゴリズム使用時 */
       if (DFS_HANDOFF_COND_STATIC(w, stack)) {
         dfs_handoff_all_task(w, new_ss);
+      } else if (DFS_WORKER_WSQ(w)) {
+        dfs_handoff_chunk(w, stack, new_ss);
       } else {
         n = vec_num(new_ss);
         for (i = 0; i < n; i++) {
@@ -732,14 +877,14 @@ static inline void mcdfs_loop(LmnWorker *w,
 
     // 同時に状態を展開すると問題が起こるのでロック
     START_LOCK();
-    state_expand_lock(s);
+    workers_expand_lock(worker_group(w), s);
     FINISH_LOCK();
     if (!is_expanded(s)) {
       mc_expand(worker_states(w), s, p_s, &worker_rc(w), new_ss, psyms, worker_flags(w));
       w->expand++;
       state_set_expander_id(s, worker_id(w));
     }
-    state_expand_unlock(s);
+    workers_expand_unlock(worker_group(w), s);
 
 #if 0
     // workerごとにsuccessorをずらして積む
@@ -873,11 +1018,14 @@ void costed_dfs_loop(LmnWorker *w,
 typedef struct McExpandBFS {
   Queue *cur; /* 現在のFront Layer */
   Queue *nxt; /* 次のLayer */
+  unsigned long depth; /* --bfs-small-layer: Primary Workerが1人で展開を終えた深さ */
+  BOOL solo;           /* --bfs-small-layer: 次のLayerをPrimary Workerが1人で展開する場合に真 */
 } McExpandBFS;
 
 
 #define BFS_WORKER_OBJ(W)             ((McExpandBFS *)worker_generator_obj(W))
 #define BFS_WORKER_OBJ_SET(W, O)      (worker_generator_obj_set(W, O))
+#define BFS_PRIMARY_OBJ(W)            (BFS_WORKER_OBJ(workers_get_worker(worker_group(W), LMN_PRIMARY_ID)))
 #define BFS_WORKER_Q_CUR(W)           (BFS_WORKER_OBJ(W)->cur)
 #define BFS_WORKER_Q_NXT(W)           (BFS_WORKER_OBJ(W)->nxt)
 #define BFS_WORKER_Q_SWAP(W) do {             \
@@ -887,6 +1035,13 @@ typedef struct McExpandBFS {
 } while (0) /* ポインタの付け替えはatomicに処理されないので並列処理の際には注意 */
 
 static inline void bfs_loop(LmnWorker *w, Vector *new_states, Automata a, Vector *psyms);
+static void bfs_partition_store(State *ret, State *s, State *parent,
+                                unsigned int idx, LmnWord _w);
+static void bfs_partition_exchange(LmnWorker *w);
+static void bfs_partition_merge(LmnWorker *w);
+static void bfs_layer_end(LmnWorker *w);
+static void bfs_small_layers(LmnWorker *w);
+static inline unsigned long bfs_small_layers_follow(LmnWorker *w, unsigned long d);
 
 
 /* LmnWorker wにBFSのためのデータを割り当てる */
@@ -894,6 +1049,8 @@ void bfs_worker_init(LmnWorker *w)
 {
   McExpandBFS *mc = LMN_MALLOC(McExpandBFS);
 
+  mc->depth = 0;
+  mc->solo  = FALSE;
   if (!worker_on_parallel(w)) {
     mc->cur = new_queue();
     mc->nxt = new_queue();
@@ -994,14 +1151,18 @@ void bfs_start(LmnWorker *w) {
         worker_set_active(w);
         bfs_loop(w, new_ss, statespace_automata(ss), statespace_propsyms(ss));
         worker_set_idle(w);
+        worker_tasks_exhausted(w);
 
         vec_clear(new_ss);
         EXECUTE_PROFILE_FINISH();
       } else {
         worker_set_idle(w);
-        if (lmn_workers_termination_detection_for_rings(w)) {
+        if (lmn_workers_termination_detection(w)) {
           /* termination is detected! */
           break;
+        } else if (!wp->mc_exit) {
+          /* タスクが公開されるまで休止する */
+          lmn_workers_idle_wait(w);
         }
       }
     }
@@ -1020,11 +1181,32 @@ void bfs_start(LmnWorker *w) {
 
       if (BLEDGE_COND(w)) bledge_start(w);
 
+      if (statespace_use_partition(ss)) bfs_partition_exchange(w);
+      worker_tasks_exhausted(w);
+
       BFS_WORKER_Q_SWAP(w);
-      lmn_workers_synchronization(w, (void *)lmn_workers_termination_detection_for_rings);
-      if (d_lim < ++d || wp->mc_exit || lmn_workers_termination_detection_for_rings(w)) {
+      lmn_workers_synchronization(w, bfs_layer_end);
+      if (d_lim < ++d || wp->mc_exit || lmn_workers_termination_detection(w)) {
         break;
       }
+
+      if (BFS_PRIMARY_OBJ(w)->solo) {
+        /* 小さなLayerでは同期のコストが展開のコストを上回るため,
+         * Primary WorkerだけでLayerが大きくなるまで展開し, 他のWorkerは待ち合わせる.
+         * 共有のLayer Queueは他のWorkerが展開を始めると変化するため,
+         * 判定は同期中にPrimary Workerが1度だけ行い, 全Workerがその結果に従う */
+        if (worker_id(w) == LMN_PRIMARY_ID) BFS_WORKER_OBJ(w)->depth = d;
+        lmn_workers_synchronization(w, bfs_small_layers);
+        d = bfs_small_layers_follow(w, d);
+        if (d_lim < d || wp->mc_exit || lmn_workers_termination_detection(w)) {
+          break;
+        }
+      }
+    }
+
+    if (statespace_use_partition(ss)) {
+      /* 部分表を1つの状態管理表にまとめ, 探索後の処理は分割しない場合と共通にする */
+      lmn_workers_synchronization(w, bfs_partition_merge);
     }
   }
 
@@ -1045,6 +1227,7 @@ static inline void bfs_loop(LmnWorker *w, Vector *new_ss, Automata a, Vector *ps
     s = (State *)dequeue(BFS_WORKER_Q_CUR(w));
 
     if (!s) return; /* dequeueはNULLを返すことがある */
+    worker_task_taken(w);
 
     p_s = MC_GET_PROPERTY(s, a);
     if (is_expanded(s)) {
@@ -1060,7 +1243,7 @@ static inline void bfs_loop(LmnWorker *w, Vector *new_ss, Automata a, Vector *ps
     if (MAP_COND(w)) map_start(w, s);
     else if (BLEDGE_COND(w)) bledge_store_layer(w, s);
 
-    if (state_succ_num(s) == 0) {
+    if (s_is_end(s)) {
       if (lmn_env.nd_search_end) {
         /* 最終状態探索モードの場合, 発見次第探索を打ち切る */
         workers_set_exit(wp);
@@ -1068,11 +1251,113 @@ static inline void bfs_loop(LmnWorker *w, Vector *new_ss, Automata a, Vector *ps
       }
     } else {
       /* 展開した状態をnext layer queueに登録する */
+      worker_tasks_publish(w, vec_num(new_ss));
       for (i = 0; i < vec_num(new_ss); i++) {
         enqueue(BFS_WORKER_Q_NXT(w), (LmnWord)vec_get(new_ss, i));
       }
+      if (!vec_is_empty(new_ss)) worker_tasks_notify(w);
     }
 
+    if (statespace_is_stateless(worker_states(w))) {
+      mc_release_closed_state(worker_states(w), s);
+    } else if (statespace_use_partition(worker_states(w))) {
+      /* 担当外のサクセッサを送り, 自身が担当する状態を受け取る */
+      statespace_partition_send(worker_states(w), FALSE);
+      statespace_partition_receive(worker_states(w), bfs_partition_store, (LmnWord)w);
+    }
     vec_clear(new_ss);
   }
 }
+
+
+/* 担当スレッドとして受け取った状態sの登録結果retを反映する.
+ * 新規状態はnext layer queueへ積み, 既出ならば遷移元parentのidx番目のサクセッサをretへ付け替える */
+static void bfs_partition_store(State *ret, State *s, State *parent,
+                                unsigned int idx, LmnWord _w)
+{
+  LmnWorker *w = (LmnWorker *)_w;
+
+  if (ret == s) {
+    state_id_issue(s);
+    worker_tasks_publish(w, 1);
+    enqueue(BFS_WORKER_Q_NXT(w), (LmnWord)s);
+    worker_tasks_notify(w);
+    if (mc_is_dump(worker_flags(w))) dump_state_data(s, (LmnWord)stdout, (LmnWord)NULL);
+  } else {
+    state_succ_replace(parent, idx, ret);
+    state_free(s);
+  }
+}
+
+/* Layerの終わりに, 全Workerの送信待ちの状態を担当スレッドへ受け渡す */
+static void bfs_partition_exchange(LmnWorker *w)
+{
+  StateSpace ss = worker_states(w);
+  BOOL done;
+
+  /* 受信側がLayerの同期を待っている間はリングバッファが空かないため,
+   * 送信と受信を交互に同期させ, 全Workerの送信待ちがなくなるまで繰り返す */
+  do {
+    statespace_partition_send(ss, TRUE);
+    lmn_workers_synchronization(w, NULL);
+    statespace_partition_receive(ss, bfs_partition_store, (LmnWord)w);
+    done = !statespace_partition_has_pending(ss);
+    lmn_workers_synchronization(w, NULL);
+  } while (!done);
+}
+
+/* Layerの終わりの同期中にPrimary Workerが実行する.
+ * 終了検知を行い, 次のLayerを1人で展開するかどうかを決める */
+static void bfs_layer_end(LmnWorker *w)
+{
+  McExpandBFS *mc = BFS_WORKER_OBJ(w);
+
+  lmn_workers_termination_detection(w);
+  mc->solo = lmn_env.bfs_small_layer > 0 &&
+             !statespace_use_partition(worker_states(w)) && !worker_use_ble(w) &&
+             queue_entry_num(BFS_WORKER_Q_CUR(w)) < lmn_env.bfs_small_layer;
+}
+
+/* Layerの状態数が--bfs-small-layerの値に達するまで, Layerを同期せずに展開する.
+ * Primary Workerだけが実行する */
+static void bfs_small_layers(LmnWorker *w)
+{
+  McExpandBFS *mc;
+  StateSpace ss;
+  Vector new_ss;
+
+  mc = BFS_WORKER_OBJ(w);
+  ss = worker_states(w);
+  vec_init(&new_ss, 32);
+
+  do {
+    bfs_loop(w, &new_ss, statespace_automata(ss), statespace_propsyms(ss));
+    vec_clear(&new_ss);
+    worker_tasks_exhausted(w);
+    BFS_WORKER_Q_SWAP(w);
+    mc->depth++;
+  } while (mc->depth <= lmn_env.depth_limits &&
+           !workers_are_exit(worker_group(w)) &&
+           !is_empty_queue(BFS_WORKER_Q_CUR(w)) &&
+           queue_entry_num(BFS_WORKER_Q_CUR(w)) < lmn_env.bfs_small_layer);
+
+  vec_destroy(&new_ss);
+}
+
+/* Primary Workerが展開を進めた深さに追従し, 深さを返す.
+ * Layer Queueは全Workerで共有しているが, 付け替えは各Workerが行う */
+static inline unsigned long bfs_small_layers_follow(LmnWorker *w, unsigned long d)
+{
+  McExpandBFS *primary;
+
+  primary = BFS_PRIMARY_OBJ(w);
+  if (worker_id(w) != LMN_PRIMARY_ID && (primary->depth - d) % 2 == 1) {
+    BFS_WORKER_Q_SWAP(w);
+  }
+  return primary->depth;
+}
+
+static void bfs_partition_merge(LmnWorker *w)
+{
+  statespace_partition_merge(worker_states(w));
+}
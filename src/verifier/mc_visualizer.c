@@ -61,7 +61,7 @@ void dump_dot_state_edges(State* s) {
 void dump_dot_state_attr(State* s, Automata* a, int* colors) {
   int color = is_expanded(s) ? colors[state_expander_id(s)] : 0x999999;
   printf("  %lu [label=\"", state_hash(s));
-  if (is_expanded(s)) printf("%lu", state_expander_id(s));
+  if (is_expanded(s)) printf("%u", state_expander_id(s));
   printf("\", ");
   if (state_is_accept(*a, s)) printf("peripheries = 2, ");
   if (is_on_cycle(s)) printf("color = \"#ff0000\", ");
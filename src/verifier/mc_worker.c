@@ -46,10 +46,13 @@
 #include "mc_explorer.h"
 #include "state.h"
 #include "statespace.h"
+#include "binstr_spill.h"
+#include "binstr_compress.h"
 #include "error.h"
 #include "runtime_status.h"
 
 #include <limits.h>
+#include <sys/time.h>
 
 /** -------------------------------------
  *  MC object
@@ -72,6 +75,11 @@ static void lmn_worker_start(void *arg);
 static void worker_TLS_init(unsigned int id);
 static void worker_TLS_finalize(void);
 static void worker_set_env(LmnWorker *w);
+static void worker_init_on_owner(LmnWorker *w);
+
+/* --numaで2つ以上のWorkerを使う場合, Workerの初期化(アルゴリズム固有データの確保)を
+ * 割り当てたスレッドのCPU固定後まで遅らせる */
+#define workers_init_on_owner(WP)  (lmn_env.numa && workers_entried_num(WP) >= 2)
 
 
 /* まっさらなLmnWorkerオブジェクトをmallocして返す */
@@ -80,10 +88,10 @@ inline LmnWorker *lmn_worker_make_minimal()
   LmnWorker *w = LMN_MALLOC(LmnWorker);
 
   w->id        = 0;
+  w->node      = 0;
   w->f_safe    = 0x00U;
   w->f_exec    = 0x00U;
-  w->f_end     = FALSE;
-  w->f_end2    = FALSE;
+  w->busy      = FALSE;
   w->wait      = FALSE;
   w->states    = NULL;
   w->next      = NULL;
@@ -110,7 +118,6 @@ LmnWorker *lmn_worker_make(StateSpace     ss,
   w->id     = id;
   worker_flags_set(w, flags);
   worker_set_active(w);
-  worker_set_white(w);
 
   return w;
 }
@@ -134,6 +141,14 @@ static void lmn_worker_start(void *arg)
   id = worker_id(w);
   worker_TLS_init(id);
 
+  if (workers_init_on_owner(wp)) {
+    /* --numa: CPUを固定した後に各Workerのスタック/キュー/デックを確保し, first-touchで
+     * 自ノードに置く. 他のWorkerの初期化はPrimary Workerのデータを参照するため, Primaryが先 */
+    lmn_workers_synchronization(w, worker_init_on_owner);
+    if (id != LMN_PRIMARY_ID) worker_init_on_owner(w);
+    lmn_workers_synchronization(w, NULL);
+  }
+
   mc_react_cxt_init(&worker_rc(w));
 
   if (worker_id(w) == LMN_PRIMARY_ID && mc_is_dump(worker_flags(w))) {
@@ -166,6 +181,12 @@ LmnWorker* worker_next_generator(LmnWorker* w)
   return next; 
 }
 
+/* workers_genで初期化を省略したWorkerを, 割り当てたスレッド上で初期化する */
+static void worker_init_on_owner(LmnWorker *w)
+{
+  worker_init(w);
+}
+
 static void worker_TLS_init(unsigned int inc_id)
 {
   /* 各スレッド毎に, 自分のTLS idを設定する */
@@ -233,6 +254,37 @@ static BOOL workers_flags_init(LmnWorkerGroup *wp, Automata property_a)
 #endif
   }
 
+  /* --- 1-4. 状態空間の分割 (並列BFS) ---
+   * 遷移先状態の登録は担当スレッドが後から行うため, 展開直後にサクセッサを辿る機能とは併用できない.
+   * 登録前に状態空間を参照する最適化や, 状態空間全体を共有する前提の機能は無効にする. */
+  if (lmn_env.bfs_partition) {
+    if (lmn_env.core_num < 2) {
+      lmn_env.bfs_partition = FALSE;
+    } else {
+      if (lmn_env.ltl) {
+        lmn_fatal("unsupported combination partitioned state space & LTL model checking.");
+      }
+      if (lmn_env.mem_enc) {
+        lmn_fatal("unsupported combination partitioned state space & canonical membrane.");
+      }
+      if (lmn_env.enable_por || lmn_env.enable_por_old) {
+        lmn_fatal("unsupported combination partitioned state space & partial order reduction.");
+      }
+      if (lmn_env.bitstate_mb > 0 || lmn_env.hash_compaction) {
+        lmn_fatal("unsupported combination partitioned state space & bitstate hashing/hash compaction.");
+      }
+#ifdef KWBT_OPT
+      if (lmn_env.opt_mode != OPT_NONE) {
+        lmn_fatal("unsupported combination partitioned state space & cost optimization.");
+      }
+#endif
+      lmn_env.delta_mem           = FALSE;
+      lmn_env.d_compress          = FALSE;
+      lmn_env.optimize_hash       = FALSE;
+      lmn_env.enable_lockfree_tbl = FALSE;
+      lmn_env.memory_limit        = 0;
+    }
+  }
 
   /* === 2. 状態空間構築オプション === */
 
@@ -274,6 +326,43 @@ static BOOL workers_flags_init(LmnWorkerGroup *wp, Automata property_a)
   /* --- 2-5. binstr compressor --- */
   if (lmn_env.z_compress) {
     lmn_env.d_compress = FALSE;
+    if (lmn_env.z_dict) {
+      lmn_bscomp_z_dict_init();
+    }
+  }
+
+  /* --- 2-6. bitstate hashing / hash compaction ---
+   * 展開済みの状態を解放するため, 状態を辿る機能とは併用できない.
+   * 差分圧縮(d-compress)は遷移元状態のバイナリストリングを参照するため無効にする. */
+  if (lmn_env.bitstate_mb > 0 && lmn_env.hash_compaction) {
+    lmn_fatal("unsupported combination bitstate hashing & hash compaction.");
+  }
+  if (lmn_env.bitstate_mb > 0 || lmn_env.hash_compaction) {
+    if (lmn_env.ltl) {
+      lmn_fatal("unsupported combination bitstate hashing/hash compaction & LTL model checking.");
+    }
+    if (lmn_env.enable_por || lmn_env.enable_por_old) {
+      lmn_fatal("unsupported combination bitstate hashing/hash compaction & partial order reduction.");
+    }
+#ifdef KWBT_OPT
+    if (lmn_env.opt_mode != OPT_NONE) {
+      lmn_fatal("unsupported combination bitstate hashing/hash compaction & cost optimization.");
+    }
+#endif
+    lmn_env.d_compress    = FALSE;
+    lmn_env.optimize_hash = FALSE;
+  }
+
+  /* --- 2-7. バイナリストリングのディスク退避 ---
+   * 退避するのはバイナリストリングのため, バイト列エンコードを使用する場合に限る.
+   * bitstate hashing/hash compactionでは展開済みの状態を解放するため退避しない. */
+  if (lmn_env.spill_dir) {
+    if (!lmn_env.enable_compress_mem ||
+        lmn_env.bitstate_mb > 0 || lmn_env.hash_compaction) {
+      lmn_env.spill_dir = NULL;
+    } else if (!binstr_spill_enabled()) {
+      binstr_spill_init(lmn_env.spill_dir);
+    }
   }
 
   /* === 3. 状態空間探索(LTLモデル検査)オプション === */
@@ -329,6 +418,13 @@ LmnWorkerGroup *lmn_workergroup_make(Automata a, Vector *psyms, int thread_num)
 
   wp->opt_end_state = NULL;
 
+  /* 初期状態を公開済みのタスクとして数えておく */
+  wp->pending       = 1;
+  wp->idle_num      = 0;
+  wp->idle_seq      = 0;
+  lmn_mutex_init(&wp->idle_mtx);
+  lmn_cond_init(&wp->idle_cond);
+
 #ifdef KWBT_OPT
   if (thread_num >= 2 && lmn_env.opt_mode != OPT_NONE) {
     wp->ewlock = ewlock_make(1U, DEFAULT_WLOCK_NUM);
@@ -336,11 +432,22 @@ LmnWorkerGroup *lmn_workergroup_make(Automata a, Vector *psyms, int thread_num)
 #endif
     wp->ewlock = NULL;
 
+  /* 状態毎にmutexを持たせると1状態あたりの領域が大きくなるため, 状態展開の排他制御はロック表で行う */
+  if (lmn_env.enable_mcndfs) {
+    wp->expand_lock = ewlock_make(1U, DEFAULT_WLOCK_NUM);
+  } else {
+    wp->expand_lock = NULL;
+  }
+
   flags = workers_flags_init(wp, a);
+  if (lmn_env.numa && thread_num >= 2) {
+    /* スレッドの起動前にノードへの割り当てを決めておく */
+    lmn_numa_init(thread_num);
+  }
 #ifdef OPT_WORKERS_SYNC
   wp->synchronizer  = thread_num;
 #else
-  lmn_barrier_init(&wp->synchronizer, workers_entried_num(wp));
+  spin_barrier_init(&wp->synchronizer, workers_entried_num(wp));
 #endif
   workers_gen(wp, workers_entried_num(wp), a, psyms, flags);
   workers_ring_alignment(wp);
@@ -353,13 +460,20 @@ LmnWorkerGroup *lmn_workergroup_make(Automata a, Vector *psyms, int thread_num)
 void lmn_workergroup_free(LmnWorkerGroup *wp)
 {
 #ifndef OPT_WORKERS_SYNC
-  lmn_barrier_destroy(&workers_synchronizer(wp));
+  spin_barrier_destroy(&workers_synchronizer(wp));
 #endif
+  lmn_mutex_destroy(&wp->idle_mtx);
+  lmn_cond_destroy(&wp->idle_cond);
+  lmn_numa_finalize();
   workers_free(wp->workers, workers_entried_num(wp));
+  state_D_rcache_clear();
 
   if (wp->ewlock) {
     ewlock_free(wp->ewlock);
   }
+  if (wp->expand_lock) {
+    ewlock_free(wp->expand_lock);
+  }
   LMN_FREE(wp);
 }
 
@@ -388,57 +502,99 @@ void launch_lmn_workers(LmnWorkerGroup *wp)
 }
 
 
-#define TERMINATION_CONDITION(W) \
- (worker_is_idle(W) && worker_is_white(W) && worker_check(w))
-
+/* 休止中のWorkerが起床を取りこぼした場合に備えた待ち時間の上限 (10ms) */
+#define WORKERS_IDLE_WAIT_NSEC   (10 * 1000 * 1000L)
 
 /* 全てのWorkerオブジェクトが実行を停止している場合に真を返す. */
-BOOL lmn_workers_termination_detection_for_rings(LmnWorker *root)
+BOOL lmn_workers_termination_detection(LmnWorker *w)
 {
   LmnWorkerGroup *wp;
   /** 概要:
-   *  LmnWorkerは論理的に輪を形成しており, フラグチェックを輪に沿って実施する.
-   *  is_activeかどうかをチェックする他にis_stealer, is_whiteもチェックする.
-   *    is_white  :
-   *       自idより小さいidのworkerにタスクを送信した場合の不正終了を判定するフラグ.
-   *       (チェック済みのworkerに対するタスク送信が発生することで不正終了する)
-   *       @see Dijkstra's Token Termination Detection (parallel computing)
-   *    is_steaker:
-   *       異なるWorkerからタスクを横取りしたこを示すフラグ.
-   *       (チェック済のworkerが未チェックのworkerからタスクを横取りした場合に不正終了する)
-   *
-   *  Dijkstraの手法を一部参考にしてはいるが, Dijkstraの手法ではないため注意.
+   *  公開済みで未取得のタスク数と処理中のWorker数の和(pending)をアトミックに数える.
+   *  タスクを公開するWorkerは処理中であり, 公開前に加算するため,
+   *  pendingが一度0になれば以降タスクが生じることはない.
+   *  (Workerを輪に沿って走査する必要がなく, 任意のWorkerが判定してよい)
    */
+  wp = worker_group(w);
+  if (!workers_are_terminated(wp) && wp->pending == 0) {
+    workers_set_terminated(wp);
+  }
+
+  return workers_are_terminated(wp);
+}
 
-  /* Primary Worker(id==LMN_PRIMARY_ID)が判定した検知結果をグローバル変数に書込む.
-   * 他のWorkerはグローバル変数に書き込まれた終了フラグを読み出す. */
-  wp = worker_group(root);
-  if (worker_id(root) == LMN_PRIMARY_ID && !workers_are_terminated(wp)) {
-    int i, n;
-    BOOL ret;
 
-    ret = TRUE;
-    n   = workers_entried_num(wp);
+/* Worker wが取得可能なタスクが存在する場合に真を返す */
+static inline BOOL workers_task_exist(LmnWorker *w)
+{
+  if (!worker_check(w)) return TRUE;
+
+  if (worker_on_dynamic_lb(w)) {
+    LmnWorkerGroup *wp;
+    unsigned long i, n;
+    wp = worker_group(w);
+    n  = workers_entried_num(wp);
     for (i = 0; i < n; i++) {
-      LmnWorker *w = workers_get_worker(wp, i);
-      ret = ret && TERMINATION_CONDITION(w);
-      worker_set_white(w);
-      if (!ret) return FALSE;
+      LmnWorker *v = workers_get_worker(wp, i);
+      if (v != w && v->check && !worker_check(v)) return TRUE;
     }
+  }
 
-    for (i = 0; i < n; i++) {
-      LmnWorker *w = workers_get_worker(wp, i);
-      ret = ret && !worker_is_stealer(w);
-      worker_unset_stealer(w);
-      if (!ret) return FALSE;
+  return FALSE;
+}
+
+
+/* タスクが公開されるか探索が終了するまで, Worker wを休止させる.
+ * 起床の取りこぼしに備えて一定時間で必ず戻る. (呼び出し側で改めて終了検知とタスク取得を行う) */
+void lmn_workers_idle_wait(LmnWorker *w)
+{
+  LmnWorkerGroup *wp;
+  unsigned long seq;
+
+  wp = worker_group(w);
+  lmn_mutex_lock(&wp->idle_mtx);
+  wp->idle_num++;
+  seq = wp->idle_seq;
+  lmn_mutex_unlock(&wp->idle_mtx);
+
+  WORKERS_FENCE(); /* 休止中のWorker数を公開してからタスクの有無を読む */
+
+  if (!workers_task_exist(w) &&
+      !lmn_workers_termination_detection(w) &&
+      !wp->mc_exit) {
+    struct timeval now;
+    struct timespec ts;
+
+    gettimeofday(&now, NULL);
+    ts.tv_sec  = now.tv_sec;
+    ts.tv_nsec = now.tv_usec * 1000 + WORKERS_IDLE_WAIT_NSEC;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
     }
-    workers_set_terminated(wp);
+
+    lmn_mutex_lock(&wp->idle_mtx);
+    while (seq == wp->idle_seq) {
+      if (lmn_cond_timedwait(&wp->idle_cond, &wp->idle_mtx, &ts) != 0) break;
+    }
+    lmn_mutex_unlock(&wp->idle_mtx);
   }
 
-  return workers_are_terminated(wp);
+  lmn_mutex_lock(&wp->idle_mtx);
+  wp->idle_num--;
+  lmn_mutex_unlock(&wp->idle_mtx);
 }
 
 
+/* 休止中の全てのWorkerを起こす */
+void lmn_workers_wakeup(LmnWorkerGroup *wp)
+{
+  lmn_mutex_lock(&wp->idle_mtx);
+  wp->idle_seq++;
+  lmn_cond_broadcast(&wp->idle_cond);
+  lmn_mutex_unlock(&wp->idle_mtx);
+}
+
 
 /* 全てのWorkerオブジェクトで同期を取り, Primary Workerが関数funcを実行する.
  * 全てのWorkerがbarrierに到達したとき処理を再開する. */
@@ -446,11 +602,11 @@ void lmn_workers_synchronization(LmnWorker *me, void (*func)(LmnWorker *w))
 {
   LmnWorkerGroup *wp = worker_group(me);
 
-  lmn_barrier_wait(&workers_synchronizer(wp));
+  spin_barrier_wait(&workers_synchronizer(wp));
   if (worker_id(me) == LMN_PRIMARY_ID && func) {
     (*func)(me);
   }
-  lmn_barrier_wait(&workers_synchronizer(wp));
+  spin_barrier_wait(&workers_synchronizer(wp));
 }
 
 
@@ -487,11 +643,20 @@ static void workers_gen(LmnWorkerGroup *owner,
     if (i == 0) {
       states = worker_num > 1 ? statespace_make_for_parallel(worker_num, a, psyms)
                               : statespace_make(a, psyms);
+      if (lmn_env.bitstate_mb > 0) {
+        statespace_enable_bitstate(states, lmn_env.bitstate_mb, lmn_env.bitstate_k);
+      } else if (lmn_env.hash_compaction) {
+        statespace_enable_hcompact(states, lmn_env.hash_compaction_mb);
+      }
+      if (lmn_env.bfs_partition) {
+        statespace_enable_partition(states);
+      }
     } else {
       states = worker_states(workers_get_worker(owner, 0));
     }
 
     w = lmn_worker_make(states, i, flags);
+    w->node = lmn_numa_node_of(i);
     owner->workers[i] = w;
     w->group = owner;
 
@@ -502,7 +667,9 @@ static void workers_gen(LmnWorkerGroup *owner,
 
     /* アルゴリズムの割り当てと初期化 */
     worker_set_env(w);
-    worker_init(w);
+    if (!workers_init_on_owner(owner)) {
+      worker_init(w);
+    }
   }
 }
 
@@ -68,7 +68,7 @@ struct LmnWorkerGroup {
   volatile
   unsigned int   synchronizer;
 #else
-  lmn_barrier_t  synchronizer;       /* 待ち合わせ用オブジェクト */
+  LmnSpinBarrier synchronizer;       /* 待ち合わせ用オブジェクト */
 #endif
   BOOL           terminated;         /* 終了した場合に真 */
   volatile
@@ -84,8 +84,21 @@ struct LmnWorkerGroup {
   State          *opt_end_state;     /* the state has optimized cost */
   EWLock         *ewlock;            /* elock: 最適状態用ロック
                                       * wlock: 各状態のコストアップデート用 */
+  EWLock         *expand_lock;       /* wlock: 状態展開用(MCNDFS). 状態のハッシュ値で選択する */
 
   FILE           *out;               /* 出力先 */
+
+  /* 終了検知用. 公開済みで未取得のタスク数と, タスクを処理中のWorker数の和を数える.
+   * 処理中のWorkerがタスクを公開する前に加算するため, 0になれば以降タスクは生じない.
+   * 全Workerが頻繁に更新するため, 他のメンバとキャッシュラインを分ける */
+  char           pad0[64];
+  volatile long  pending;
+  char           pad1[64 - sizeof(long)];
+  volatile
+  unsigned int   idle_num;           /* タスクを待って休止中のWorker数 */
+  unsigned long  idle_seq;           /* 休止中のWorkerを起こした回数 (idle_mtxで保護) */
+  lmn_mutex_t    idle_mtx;
+  lmn_cond_t     idle_cond;
 };
 
 #define workers_are_exit(WP)         ((WP)->mc_exit)
@@ -104,6 +117,8 @@ struct LmnWorkerGroup {
 #define workers_opt_end_unlock(WP)   (ewlock_release_enter((WP)->ewlock, 0U))
 #define workers_state_lock(WP, id)   (ewlock_acquire_write((WP)->ewlock, id))
 #define workers_state_unlock(WP, id) (ewlock_release_write((WP)->ewlock, id))
+#define workers_expand_lock(WP, S)   (ewlock_acquire_write((WP)->expand_lock, (mtx_data_t)state_hash(S)))
+#define workers_expand_unlock(WP, S) (ewlock_release_write((WP)->expand_lock, (mtx_data_t)state_hash(S)))
 
 #define workers_are_terminated(WP)   ((WP)->terminated)
 #define workers_set_terminated(WP)   ((WP)->terminated = TRUE)
@@ -147,9 +162,9 @@ struct LmnWorker {
   lmn_thread_t    pth;           /* スレッド識別子(pthread_t) */
   volatile
   unsigned int    id;            /* Natural integer id (lmn_thread_id) */
+  unsigned int    node;          /* --numa: 割り当てたNUMAノード番号 */
 
-  BOOL            f_end;         /* Workerの終了検知判定用フラグ. 任意のWorkerが操作可能 */
-  BOOL            f_end2;        /* Workerの終了検知判定用フラグ. 任意のWorkerが操作可能 */
+  BOOL            busy;          /* タスクを処理中(pendingに計上済み)ならば真. 自身のみが操作する */
   BYTE            f_safe;        /* Workerに割り当てられたスレッドのみWritableなフラグ */
   BYTE            f_exec;        /* 実行時オプションをローカルに記録 */
 
@@ -179,6 +194,7 @@ struct LmnWorker {
  * Macros for data access
  */
 #define worker_id(W)                    ((W)->id)
+#define worker_node(W)                  ((W)->node)
 #define worker_pid(W)                   ((W)->pth)
 #define worker_flags(W)                 ((W)->f_exec)
 #define worker_flags_set(W, F)          ((W)->f_exec |= (F))
@@ -249,20 +265,6 @@ static inline BOOL worker_check(LmnWorker *w) {
 #define worker_is_idle(W)             (!(worker_is_active(W)))
 
 
-/** Macros for f_end
- */
-#define worker_set_black(W)           ((W)->f_end = FALSE)
-#define worker_set_white(W)           ((W)->f_end = TRUE)
-#define worker_is_white(W)            ((W)->f_end)
-
-
-/** Macros for f_end2
- */
-#define worker_set_stealer(W)         ((W)->f_end2 = TRUE)
-#define worker_unset_stealer(W)       ((W)->f_end2 = FALSE)
-#define worker_is_stealer(W)          ((W)->f_end2)
-
-
 /** Macros for f_exec
  *
  * ---- ---1  incremental state dumper
@@ -396,7 +398,9 @@ static inline BOOL worker_check(LmnWorker *w) {
 LmnWorkerGroup *lmn_workergroup_make(Automata a, Vector *psyms, int thread_num);
 void lmn_workergroup_free(LmnWorkerGroup *wg);
 void launch_lmn_workers(LmnWorkerGroup *wg);
-BOOL lmn_workers_termination_detection_for_rings(LmnWorker *root);
+BOOL lmn_workers_termination_detection(LmnWorker *w);
+void lmn_workers_idle_wait(LmnWorker *w);
+void lmn_workers_wakeup(LmnWorkerGroup *wp);
 void lmn_workers_synchronization(LmnWorker *root, void (*func)(LmnWorker *w));
 inline LmnWorker *lmn_worker_make_minimal(void);
 LmnWorker *lmn_worker_make(StateSpace     ss,
@@ -412,4 +416,52 @@ void lmn_update_opt_cost(LmnWorkerGroup *wp, State *new_s, BOOL f);
 
 LmnWorker *worker_next_generator(LmnWorker* w);
 
+
+/** -----------
+ *  終了検知用のタスク計数
+ *  タスクを他のWorkerが取得できる場所(キューやデック)へ積む前にworker_tasks_publishで数を加算し,
+ *  積んだ後にworker_tasks_notifyで休止中のWorkerを起こす.
+ *  Workerは取得したタスク毎にworker_task_takenを, 処理するタスクが尽きたらworker_tasks_exhaustedを呼ぶ.
+ */
+
+#if defined(ENABLE_PARALLEL) && defined(HAVE_BUILTIN_MBARRIER)
+# define WORKERS_FENCE() MEM_BARRIER()
+#else
+# define WORKERS_FENCE()
+#endif
+
+static inline void worker_tasks_publish(LmnWorker *w, unsigned long n) {
+  if (worker_on_parallel(w) && n > 0) {
+    ADD_AND_FETCH(worker_group(w)->pending, (long)n);
+  }
+}
+
+static inline void worker_tasks_notify(LmnWorker *w) {
+  if (worker_on_parallel(w)) {
+    WORKERS_FENCE(); /* タスクを積んでから休止中のWorker数を読む */
+    if (worker_group(w)->idle_num > 0) {
+      lmn_workers_wakeup(worker_group(w));
+    }
+  }
+}
+
+/* 取得したタスクは処理中のWorkerの分として数え直す */
+static inline void worker_task_taken(LmnWorker *w) {
+  if (!worker_on_parallel(w)) return;
+  if (!w->busy) {
+    w->busy = TRUE;
+  } else {
+    SUB_AND_FETCH(worker_group(w)->pending, 1L);
+  }
+}
+
+static inline void worker_tasks_exhausted(LmnWorker *w) {
+  if (!worker_on_parallel(w) || !w->busy) return;
+  w->busy = FALSE;
+  if (SUB_AND_FETCH(worker_group(w)->pending, 1L) == 0) {
+    /* 最後のタスクを処理し終えた. 休止中のWorkerに終了を知らせる */
+    lmn_workers_wakeup(worker_group(w));
+  }
+}
+
 #endif
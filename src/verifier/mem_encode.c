@@ -121,6 +121,7 @@
 #include "delta_membrane.h"
 #include "lmntal_thread.h"
 #include "binstr_compress.h"
+#include "binstr_spill.h"
 #include "visitlog.h"
 #include "dumper.h"
 #include "error.h"
@@ -131,6 +132,7 @@
 #include "dumper.h"
 #include "util.h"
 #include "st.h"
+#include "memory_pool.h"
 #ifdef PROFILE
 #  include "../runtime_status.h"
 #endif
@@ -155,19 +157,20 @@
 #define TAG_HLINK              0xf
 
 /* Binary Stringのpositionを進めるためのカウンタ群. */
-#define BS_PROC_REF_SIZE       (TAG_IN_BYTE * sizeof(uint32_t))         /* 訪問番号(4byteへ拡張したが, sizeof(ProcessID)とするのが好ましいはず) */
 #define BS_ATOM_REF_ARG_SIZE   (TAG_IN_BYTE * sizeof(LmnArity))         /* アトムあたりのリンク本数は127本までなので1Byteで良い */
 #define BS_FUNCTOR_SIZE        (TAG_IN_BYTE * sizeof(LmnFunctor))       /* Functor ID */
-#define BS_INT_SIZE            (TAG_IN_BYTE * SIZEOF_LONG)              /* lmntalにおける整数データは1wordであるためlongで良い */
-#define BS_MEM_NAME_SIZE       (TAG_IN_BYTE * sizeof(lmn_interned_str)) /* 膜名 */
-#define BS_RULESET_SIZE        (TAG_IN_BYTE * sizeof(LmnRulesetId))     /* ルールセットID */
-#define BS_RULESET_NUM_SIZE    (TAG_IN_BYTE * sizeof(uint32_t))         /* ルールセット数 */
-#define BS_RULE_NUM_SIZE       (TAG_IN_BYTE * sizeof(uint32_t))         /* ルール数 */
 #define BS_DBL_SIZE            (TAG_IN_BYTE * sizeof(double))           /* 浮動小数点数 */
-#define BS_STR_ID_SIZE         (TAG_IN_BYTE * sizeof(lmn_interned_str)) /* 文字列に対応させたID */
-#define BS_HISTORY_NUM_SIZE    (BS_RULE_NUM_SIZE)
-#define BS_HISTORY_SIZE        (BS_STR_ID_SIZE)                         /* UNIQ制約が管理する履歴型のサイズ. lmn_histroy_tみたいな型にしたい */
-#define BS_HLINK_NUM_SIZE      (TAG_IN_BYTE * sizeof(LmnHlinkRank))     /* ハイパーリンクの接続個数. 同型性判定で使う */
+
+/* 訪問番号, 整数データ, 膜名, 文字列ID, ルールセットID/数, 履歴数/履歴, ハイパーリンクの接続個数は
+ * 可変長(varint)で書き込む. 殆どの値は小さいため, 固定長で書き込むよりも短くなる.
+ * 4bit毎に下位3bitを値の下位から順に詰め, 最上位bitを後続の有無に用いる.
+ * 整数データは負数も短くなるよう, zigzag変換してから書き込む.
+ * (ファンクタは優先度に応じた値FUNCTOR_MAX - fを書き込むため固定長のままとする) */
+#define BS_VARINT_BITS         (TAG_BIT_SIZE - 1)
+#define BS_VARINT_MASK         ((1U << BS_VARINT_BITS) - 1)
+#define BS_VARINT_CONT         (1U << BS_VARINT_BITS)
+#define BS_ZIGZAG(N)           (((unsigned long)(N) << 1) ^ (unsigned long)((long)(N) >> (SIZEOF_LONG * 8 - 1)))
+#define BS_UNZIGZAG(V)         ((long)((V) >> 1) ^ -(long)((V) & 1))
 
 struct BsDecodeLog {
   LmnWord v;
@@ -180,6 +183,40 @@ typedef struct BsDecodeLog BsDecodeLog;
 #define BS_LOG_TYPE_MEM   (0x2U)
 #define BS_LOG_TYPE_HLINK (0x3U)
 
+/* 展開中の状態のバイナリストリング中で, ルート膜直下の閉じた子膜(膜の外へのリンクを
+ * 持たない子膜)をエンコードした区間.
+ * 閉じた子膜はdump_memsによって他のプロセスとは独立に書き込まれ, 区間内の参照番号は
+ * 区間内のプロセスのみを指す. 従って, 参照番号を付け替えるだけで別のダンプ中に複写できる. */
+struct BinStrSeg {
+  int           start, end;  /* 区間[start, end)の位置 (4bit単位) */
+  int           ref_base;    /* 区間の先頭(子膜自身)に割り当てられた参照番号 */
+  int           ref_num;     /* 区間内で割り当てられた参照番号の数 */
+  unsigned int  refs_begin;  /* 区間内の参照番号の位置のBinStrDumpRef::refs中の範囲 */
+  unsigned int  refs_end;
+  unsigned long touched;     /* 区間の子膜を変更した差分のダンプ番号 */
+};
+
+/* 展開中の状態のバイナリストリングと, それをデコードした階層グラフ構造の対応.
+ * 差分(delta-membrane)を適用したサクセッサをダンプする際に, 差分による変更のない
+ * 閉じた子膜は, 対応する区間を展開中の状態のバイナリストリングから複写する.
+ * 展開はスレッド毎に行うため, スレッド毎に保持する. */
+struct BinStrDumpRef {
+  LmnMembrane         *root;      /* デコードしたルート膜 */
+  LmnBinStr           bs;         /* デコード元 (展開中の状態が所有する) */
+  struct MemDeltaRoot *delta;     /* ルート膜に適用中の差分 */
+  Vector              refs;       /* デコード時に参照番号を読み出した位置 (昇順) */
+  unsigned int        hlink_num;  /* デコードしたハイパーリンクの数 */
+  struct BinStrSeg    *segs;
+  unsigned int        seg_num, seg_cap;
+  struct ProcessTbl   seg_tbl;    /* 子膜 -> segsの添字 */
+  unsigned long       gen;        /* ダンプ番号 */
+};
+
+typedef struct BinStrDumpRef BinStrDumpRef;
+#define BS_DUMP_REF_SEG_INIT_CAP  (16U)
+
+static BinStrDumpRef *dump_refs; /* スレッド数分の配列 */
+
 typedef struct BinStr      *BinStr;
 typedef struct BinStrPtr   *BinStrPtr;
 
@@ -201,6 +238,19 @@ static void dump_mols(Vector *atoms,
 static void dump_mems(LmnMembrane *mem,
                       BinStrPtr bsp,
                       VisitLog visited);
+static void dump_ref_mems(LmnMembrane *mem,
+                          BinStrPtr bsp,
+                          VisitLog visited,
+                          struct BinStrDumpRef *ref);
+static void dump_refs_init(void);
+static void dump_refs_finalize(void);
+static void dump_collapse_mems(LmnMembrane *mem,
+                               BinStrPtr bsp,
+                               VisitLog visited,
+                               Vector *holes);
+static void collapse_init(void);
+static void collapse_finalize(void);
+static LmnBinStr binstr_collapse_expand(const LmnBinStr bs);
 
 static int comp_functor_greater_f(const void *a_, const void *b_);
 
@@ -208,13 +258,143 @@ static int comp_functor_greater_f(const void *a_, const void *b_);
  * Initialization
  */
 
+/* バイナリストリングはスレッド毎のメモリプールから確保する.
+ * 状態の生成と重複状態の破棄を繰り返すため, mallocとfreeの呼び出しを避ける.
+ * バイト列vはBINSTR_POOL_MIN_SIZEから2倍刻みのサイズクラスで管理し,
+ * 最大のサイズクラスを越えるものはmallocで確保する. */
+#define BINSTR_POOL_CLS_NUM     (7U)
+#define BINSTR_POOL_MIN_SIZE    (16U)
+#define BINSTR_POOL_MALLOC      (0xffU)
+#define BINSTR_POOL_SPILLED     (0xfeU) /* バイト列vをディスク上の退避領域へ移したもの */
+#define BINSTR_POOL_BLOCK_SIZE  (512)
+
+static memory_pool **binstr_pools;                       /* struct LmnBinStr用 */
+static memory_pool **binstr_v_pools[BINSTR_POOL_CLS_NUM]; /* バイト列v用 */
+
+static void binstr_pool_init()
+{
+  unsigned int i, j;
+  binstr_pools = LMN_NALLOC(memory_pool *, lmn_env.core_num);
+  for (i = 0; i < BINSTR_POOL_CLS_NUM; i++) {
+    binstr_v_pools[i] = LMN_NALLOC(memory_pool *, lmn_env.core_num);
+  }
+  for (j = 0; j < lmn_env.core_num; j++) {
+    binstr_pools[j] = NULL;
+    for (i = 0; i < BINSTR_POOL_CLS_NUM; i++) {
+      binstr_v_pools[i][j] = NULL;
+    }
+  }
+}
+
+static void binstr_pool_finalize()
+{
+  unsigned int i, j;
+  for (j = 0; j < lmn_env.core_num; j++) {
+    if (binstr_pools[j]) memory_pool_delete(binstr_pools[j]);
+    for (i = 0; i < BINSTR_POOL_CLS_NUM; i++) {
+      if (binstr_v_pools[i][j]) memory_pool_delete(binstr_v_pools[i][j]);
+    }
+  }
+  LMN_FREE(binstr_pools);
+  for (i = 0; i < BINSTR_POOL_CLS_NUM; i++) {
+    LMN_FREE(binstr_v_pools[i]);
+  }
+}
+
+/* 全スレッドのメモリプールを破棄する. 以降の確保では新たにメモリプールを作成する.
+ * 子膜の置き換え表(--collapse)はプールから確保したバイナリストリングを保持するため, 先に破棄する. */
+void lmn_binstr_mpool_release()
+{
+  unsigned int i, j;
+
+  collapse_finalize();
+  for (j = 0; j < lmn_env.core_num; j++) {
+    if (binstr_pools[j]) {
+      memory_pool_delete(binstr_pools[j]);
+      binstr_pools[j] = NULL;
+    }
+    for (i = 0; i < BINSTR_POOL_CLS_NUM; i++) {
+      if (binstr_v_pools[i][j]) {
+        memory_pool_delete(binstr_v_pools[i][j]);
+        binstr_v_pools[i][j] = NULL;
+      }
+    }
+  }
+}
+
+/* 長さlen(byte)のバイト列を確保するサイズクラスを返す */
+static inline BYTE binstr_pool_cls(unsigned int len)
+{
+  BYTE cls = 0;
+  unsigned int size = BINSTR_POOL_MIN_SIZE;
+  while (size < len) {
+    if (++cls >= BINSTR_POOL_CLS_NUM) return BINSTR_POOL_MALLOC;
+    size <<= 1;
+  }
+  return cls;
+}
+
+/* 自スレッドのメモリプールを返す. 未作成の場合は作成する */
+static inline memory_pool *binstr_pool_of_me(memory_pool **pools, int elem_size)
+{
+  unsigned int id = env_my_thread_id();
+  if (!pools[id]) {
+    pools[id] = memory_pool_new_with_blocksize(elem_size, BINSTR_POOL_BLOCK_SIZE);
+  }
+  return pools[id];
+}
+
+static inline struct LmnBinStr *binstr_alloc(unsigned int real_len)
+{
+  struct LmnBinStr *bs;
+  bs = (struct LmnBinStr *)memory_pool_malloc(
+          binstr_pool_of_me(binstr_pools, sizeof(struct LmnBinStr)));
+  bs->pool_cls = binstr_pool_cls(real_len);
+  if (bs->pool_cls == BINSTR_POOL_MALLOC) {
+    bs->v = LMN_NALLOC(BYTE, real_len);
+  } else {
+    bs->v = (BYTE *)memory_pool_malloc(
+              binstr_pool_of_me(binstr_v_pools[bs->pool_cls],
+                                BINSTR_POOL_MIN_SIZE << bs->pool_cls));
+  }
+  return bs;
+}
+
+/* バイト列vのみを解放する */
+static inline void binstr_v_dealloc(struct LmnBinStr *bs)
+{
+  if (bs->pool_cls == BINSTR_POOL_SPILLED) {
+    /* 退避領域は追記専用のため, 解放しない */
+  } else if (bs->pool_cls == BINSTR_POOL_MALLOC) {
+    LMN_FREE(bs->v);
+  } else {
+    memory_pool_free(binstr_pool_of_me(binstr_v_pools[bs->pool_cls],
+                                       BINSTR_POOL_MIN_SIZE << bs->pool_cls),
+                     bs->v);
+  }
+}
+
+static inline void binstr_dealloc(struct LmnBinStr *bs)
+{
+  binstr_v_dealloc(bs);
+  memory_pool_free(binstr_pool_of_me(binstr_pools, sizeof(struct LmnBinStr)), bs);
+}
+
 void mem_isom_init()
 {
   memset(functor_priority, 0xff, sizeof(uint16_t) * FUNCTOR_MAX + 1);
+  binstr_pool_init();
+  dump_refs_init();
+  if (lmn_env.collapse) collapse_init();
 }
 
 void mem_isom_finalize()
 {
+  dump_refs_finalize();
+  collapse_finalize();
+  lmn_bscomp_z_dict_finalize();
+  binstr_spill_finalize();
+  binstr_pool_finalize();
 }
 
 void set_functor_priority(LmnFunctor f, int priority)
@@ -228,10 +408,9 @@ void set_functor_priority(LmnFunctor f, int priority)
  */
 inline LmnBinStr lmn_binstr_make(unsigned int real_len)
 {
-  LmnBinStr bs = LMN_MALLOC(struct LmnBinStr);
+  LmnBinStr bs = binstr_alloc(real_len);
   bs->len  = real_len * TAG_IN_BYTE;
   bs->type = 0x00U;
-  bs->v    = LMN_NALLOC(BYTE, real_len);
   memset(bs->v, 0x0U, sizeof(BYTE) * real_len);
   return bs;
 }
@@ -259,8 +438,39 @@ void lmn_binstr_free(struct LmnBinStr *bs)
     profile_remove_space(PROFILE_SPACE__STATE_BINSTR, lmn_binstr_space(bs));
   }
 #endif
-  LMN_FREE(bs->v);
-  LMN_FREE(bs);
+  binstr_dealloc(bs);
+}
+
+
+/* バイナリストリングbsのうち, メモリプールの外から確保したバイト列のみを解放する.
+ * lmn_binstr_mpool_releaseでプールごと破棄するバイナリストリングに用いる. */
+void lmn_binstr_free_unpooled(struct LmnBinStr *bs)
+{
+  if (bs->pool_cls == BINSTR_POOL_MALLOC) {
+    LMN_FREE(bs->v);
+  }
+}
+
+
+/* バイナリストリングbsのバイト列を, ディスク上の退避領域(binstr_spill.c)へ移す.
+ * 以降のbs->vへの参照は退避領域をmmapしたページを指す.
+ * 退避済みの場合や, 退避を使用しない場合は何もしない.
+ * バイト列を付け替えるため, 他スレッドから参照される前(状態表への登録前)に呼び出すこと. */
+void lmn_binstr_spill(struct LmnBinStr *bs)
+{
+  unsigned long v_len_real;
+  BYTE *p;
+
+  if (bs->pool_cls == BINSTR_POOL_SPILLED) return;
+
+  v_len_real = (bs->len + 1) / TAG_IN_BYTE;
+  p = binstr_spill_alloc(v_len_real);
+  if (p) {
+    memcpy(p, bs->v, v_len_real);
+    binstr_v_dealloc(bs);
+    bs->v        = p;
+    bs->pool_cls = BINSTR_POOL_SPILLED;
+  }
 }
 
 
@@ -322,7 +532,7 @@ unsigned long binstr_hash(const LmnBinStr a)
   if (lmn_env.profile_level >= 3) profile_start_timer(PROFILE_TIME__STATE_HASH_MID);
 #endif
 
-  hval = lmn_byte_hash(a->v, (a->len + 1) / TAG_IN_BYTE);
+  hval = lmn_byte_hash_wide(a->v, (a->len + 1) / TAG_IN_BYTE);
 
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) profile_finish_timer(PROFILE_TIME__STATE_HASH_MID);
@@ -421,16 +631,30 @@ static inline uint64_t binstr_get_uint64(BYTE *bs, int pos)
 }
 
 
+/* bsの位置*posから可変長の値を読み込み, *posを値の直後へ進める */
+static inline unsigned long binstr_get_varint(BYTE *bs, int *pos)
+{
+  unsigned long v;
+  unsigned int b, shift;
+
+  v     = 0;
+  shift = 0;
+  do {
+    b = BS_GET(bs, *pos);
+    (*pos)++;
+    v |= (unsigned long)(b & BS_VARINT_MASK) << shift;
+    shift += BS_VARINT_BITS;
+  } while (b & BS_VARINT_CONT);
+
+  return v;
+}
+
+
 /* LMNtal言語はinteger valueの範囲を1wordとしている(型がない)ため, long型で良い */
-static inline long binstr_get_int(BYTE *bs, int pos)
+static inline long binstr_get_int(BYTE *bs, int *pos)
 {
-#if SIZEOF_LONG == 4
-  return (long)binstr_get_uint32(bs, pos);
-#elif SIZEOF_LONG == 8
-  return (long)binstr_get_uint64(bs, pos);
-#else
-#  error "not supported"
-#endif
+  unsigned long v = binstr_get_varint(bs, pos);
+  return BS_UNZIGZAG(v);
 }
 
 
@@ -470,10 +694,9 @@ static inline LmnFunctor binstr_get_functor(BYTE *bs, int pos)
 }
 
 
-static inline unsigned int binstr_get_ref_num(BYTE *bs, int pos)
+static inline unsigned int binstr_get_ref_num(BYTE *bs, int *pos)
 {
-  LMN_ASSERT(BS_PROC_REF_SIZE == (sizeof(uint32_t) * TAG_IN_BYTE));
-  return (unsigned int)binstr_get_uint32(bs, pos);
+  return (unsigned int)binstr_get_varint(bs, pos);
 }
 
 
@@ -484,43 +707,47 @@ static inline unsigned int binstr_get_arg_ref(BYTE *bs, int pos)
 }
 
 
-static inline lmn_interned_str binstr_get_mem_name(BYTE *bs, int pos)
+static inline lmn_interned_str binstr_get_mem_name(BYTE *bs, int *pos)
 {
-  return binstr_get_uint32(bs, pos);
+  return (lmn_interned_str)binstr_get_varint(bs, pos);
 }
 
 
-static inline long binstr_get_ruleset_num(BYTE *bs, int pos)
+static inline long binstr_get_ruleset_num(BYTE *bs, int *pos)
 {
-  return binstr_get_uint32(bs, pos);
+  return (long)binstr_get_varint(bs, pos);
 }
 
 
-/* ruleset id(2byte)の取得 */
-static inline long binstr_get_ruleset(BYTE *bs, int pos)
+/* ruleset idの取得 */
+static inline long binstr_get_ruleset(BYTE *bs, int *pos)
 {
-  return binstr_get_uint16(bs, pos);
+  return (long)binstr_get_varint(bs, pos);
 }
 
-static inline lmn_interned_str binstr_get_strid(BYTE *bs, int pos)
+static inline lmn_interned_str binstr_get_strid(BYTE *bs, int *pos)
 {
-  LMN_ASSERT(BS_HISTORY_SIZE == 8);
-  return binstr_get_uint32(bs, pos);
+  return (lmn_interned_str)binstr_get_varint(bs, pos);
 }
 
-static inline long binstr_get_history_num(BYTE *bs, int pos)
+static inline long binstr_get_history_num(BYTE *bs, int *pos)
 {
-  LMN_ASSERT(BS_HISTORY_NUM_SIZE == 8);
-  return binstr_get_uint32(bs, pos);
+  return (long)binstr_get_varint(bs, pos);
 }
 
 
-static inline lmn_interned_str binstr_get_history(BYTE *bs, int pos)
+static inline lmn_interned_str binstr_get_history(BYTE *bs, int *pos)
 {
   return binstr_get_strid(bs, pos);
 }
 
 
+static inline LmnHlinkRank binstr_get_hlink_num(BYTE *bs, int *pos)
+{
+  return (LmnHlinkRank)binstr_get_varint(bs, pos);
+}
+
+
 /* start以降を指すポインタをすべて無効にする */
 static void binstr_invalidate_ptrs(struct BinStr *p, int start)
 {
@@ -577,8 +804,7 @@ static inline struct LmnBinStr *binstr_to_lmn_binstr(BinStr bs)
 {
   struct LmnBinStr *ret_bs;
   int size     = (bs->cur + 1) / 2;
-  ret_bs       = LMN_MALLOC(struct LmnBinStr);
-  ret_bs->v    = LMN_NALLOC(BYTE, size);
+  ret_bs       = binstr_alloc(size);
   ret_bs->type = 0x00U;
   memcpy(ret_bs->v, bs->v, size);
   ret_bs->len  = bs->cur;
@@ -595,8 +821,7 @@ static inline void binstr_dump_data_atom(BYTE *bs, int *pos, unsigned int tag)
   switch (tag) {
   case TAG_INT_DATA:
     {
-      long n = binstr_get_int(bs, *pos);
-      (*pos) += BS_INT_SIZE;
+      long n = binstr_get_int(bs, pos);
       printf("_INT%ld_ ", n);
     }
     break;
@@ -609,8 +834,7 @@ static inline void binstr_dump_data_atom(BYTE *bs, int *pos, unsigned int tag)
     break;
   case TAG_STR_DATA:
     {
-      lmn_interned_str n = binstr_get_strid(bs, *pos);
-      (*pos) += BS_STR_ID_SIZE;
+      lmn_interned_str n = binstr_get_strid(bs, pos);
       printf("\"%s\"", lmn_id_to_name(n));
     }
     break;
@@ -655,8 +879,7 @@ static void binstr_dump(BYTE *bs, int len)
           printf("_%d{ ", v_i);
         } else {
           lmn_interned_str name;
-          name = binstr_get_mem_name(bs, pos);
-          pos += BS_MEM_NAME_SIZE;
+          name = binstr_get_mem_name(bs, &pos);
           printf("%s_%d{ ", lmn_id_to_name(name), v_i);
         }
 
@@ -672,8 +895,7 @@ static void binstr_dump(BYTE *bs, int len)
       {
         LmnHlinkRank hl_num;
 
-        hl_num = binstr_get_ref_num(bs, pos);
-        pos   += BS_HLINK_NUM_SIZE;
+        hl_num = binstr_get_hlink_num(bs, &pos);
 
         log[v_i].v    = 0; /* とりあえずゼロクリア */
         log[v_i].type = BS_LOG_TYPE_HLINK;
@@ -714,8 +936,7 @@ static void binstr_dump(BYTE *bs, int len)
       {
         unsigned int ref;
 
-        ref = binstr_get_ref_num(bs, pos);
-        pos += BS_PROC_REF_SIZE;
+        ref = binstr_get_ref_num(bs, &pos);
 
         switch (log[ref].type) {
         case BS_LOG_TYPE_ATOM:
@@ -762,8 +983,7 @@ static void binstr_dump(BYTE *bs, int len)
       {
         int rs_id;
 
-        rs_id = binstr_get_ruleset(bs, pos);
-        pos += BS_RULESET_SIZE;
+        rs_id = binstr_get_ruleset(bs, &pos);
         printf("@%d", rs_id);
       }
       break;
@@ -771,11 +991,9 @@ static void binstr_dump(BYTE *bs, int len)
       {
         int j, n, rs_id;
 
-        n = binstr_get_ruleset_num(bs, pos);
-        pos += BS_RULESET_NUM_SIZE;
+        n = binstr_get_ruleset_num(bs, &pos);
         for (j = 0; j < n; j++) {
-          rs_id = binstr_get_ruleset(bs, pos);
-          pos += BS_RULESET_SIZE;
+          rs_id = binstr_get_ruleset(bs, &pos);
           printf("@%d", rs_id);
         }
       }
@@ -786,11 +1004,9 @@ static void binstr_dump(BYTE *bs, int len)
         lmn_interned_str id;
         unsigned int j, k, l, n, rs_id, rule_num, his_num;
 
-        n = binstr_get_ruleset_num(bs, pos);
-        pos += BS_RULESET_NUM_SIZE;
+        n = binstr_get_ruleset_num(bs, &pos);
         for (j = 0; j < n; j++) {
-          rs_id = binstr_get_ruleset(bs, pos);
-          pos += BS_RULESET_SIZE;
+          rs_id = binstr_get_ruleset(bs, &pos);
           printf("@%d/", rs_id);
 
           /* dump applied histories of uniq constraint rules */
@@ -801,11 +1017,9 @@ static void binstr_dump(BYTE *bs, int len)
           for (k = 0; k < rule_num; k++) {
             printf("[%s", lmn_id_to_name(lmn_rule_get_name(lmn_ruleset_get_rule(rs, k))));
 
-            his_num = binstr_get_history_num(bs, pos);
-            pos += BS_HISTORY_NUM_SIZE;
+            his_num = binstr_get_history_num(bs, &pos);
             for (l = 0; l < his_num; l++) {
-              id = binstr_get_history(bs, pos);
-              pos += BS_HISTORY_SIZE;
+              id = binstr_get_history(bs, &pos);
               printf("\"%s\"", lmn_id_to_name(id));
 
             }
@@ -845,6 +1059,7 @@ struct BinStrPtr {
   int pos;               /* bit (0で初期化) */
   BOOL valid;            /* TRUEで初期化 */
   BOOL direct;           /* FALSEで初期化, directメソッドを用いた場合はTRUEで初期化 */
+  Vector *refs;          /* NULLで初期化. NULLでなければ参照番号を書き込んだ位置を記録する */
 };
 
 static inline void bsptr_init(struct BinStrPtr *p, struct BinStr *bs)
@@ -854,6 +1069,7 @@ static inline void bsptr_init(struct BinStrPtr *p, struct BinStr *bs)
   p->valid  = TRUE;
   binstr_add_ptr(bs, p);
   p->direct = FALSE;
+  p->refs   = NULL;
 }
 
 /* 1度のみ呼ばれる. BinStrPtrとBinStrをセットで初期化する(双方向なポインタにする) */
@@ -874,6 +1090,7 @@ static inline void bsptr_copy_to(const BinStrPtr from, BinStrPtr to)
   to->pos    = from->pos;
   to->valid  = from->valid;
   to->direct = from->direct;
+  to->refs   = from->refs;
 }
 
 static inline void bsptr_destroy(struct BinStrPtr *p)
@@ -935,6 +1152,23 @@ static inline int bsptr_push1(struct BinStrPtr *p, const BYTE v)
   }
 }
 
+/* pのBinStrのバイト列へ値vを可変長で書き込む. 書き込みに成功した場合は1を, 失敗した場合は0を返す */
+static inline int bsptr_push_varint(struct BinStrPtr *p, unsigned long v)
+{
+  while (v > BS_VARINT_MASK) {
+    if (!bsptr_push1(p, (v & BS_VARINT_MASK) | BS_VARINT_CONT)) return 0;
+    v >>= BS_VARINT_BITS;
+  }
+  return bsptr_push1(p, v);
+}
+
+/* pのBinStrのバイト列へ参照番号nを書き込む. p->refsが指定されていれば書き込む位置を記録する */
+static inline int bsptr_push_ref_num(struct BinStrPtr *p, unsigned long n)
+{
+  if (p->refs) vec_push(p->refs, (vec_data_t)p->pos);
+  return bsptr_push_varint(p, n);
+}
+
 /* ポインタを無効にする */
 static inline void bsptr_invalidate(BinStrPtr p)
 {
@@ -948,7 +1182,7 @@ static inline int bsptr_push_start_mem(BinStrPtr p, lmn_interned_str name)
   } else {
     return
       bsptr_push1(p, TAG_NAMED_MEM_START) &&
-      bsptr_push(p, (BYTE*)&name, sizeof(lmn_interned_str)*TAG_IN_BYTE);
+      bsptr_push_varint(p, name);
   }
 }
 
@@ -980,12 +1214,12 @@ static inline int bsptr_push_hlink(BinStrPtr p, LmnAtom atom, VisitLog log)
   hl_num  = lmn_hyperlink_element_num(hl_root);
   if (visitlog_get_hlink(log, hl_root, &ref)) {
     return bsptr_push1(p, TAG_VISITED_ATOMHLINK) &&
-           bsptr_push(p, (BYTE*)&ref, BS_PROC_REF_SIZE);
+           bsptr_push_ref_num(p, ref);
   }
   else {
     visitlog_put_hlink(log, hl_root);   /* 訪問済みにした */
     bsptr_push1(p, TAG_HLINK);
-    bsptr_push(p, (const BYTE*)&hl_num, BS_HLINK_NUM_SIZE);
+    bsptr_push_varint(p, hl_num);
 
     if (LMN_HL_HAS_ATTR(hl_root)) {
       LmnLinkAttr attr = LMN_HL_ATTRATOM_ATTR(hl_root);
@@ -1019,7 +1253,7 @@ static inline int bsptr_push_data_atom(BinStrPtr p,
   switch (attr) {
   case LMN_INT_ATTR:
     return bsptr_push1(p, TAG_INT_DATA) &&
-           bsptr_push(p, (const BYTE*)&atom, BS_INT_SIZE);
+           bsptr_push_varint(p, BS_ZIGZAG((long)atom));
   case LMN_DBL_ATTR:
     return bsptr_push1(p, TAG_DBL_DATA) &&
            bsptr_push(p, (const BYTE*)(double*)atom, BS_DBL_SIZE);
@@ -1029,7 +1263,7 @@ static inline int bsptr_push_data_atom(BinStrPtr p,
     if (lmn_is_string(atom, attr)) {
       lmn_interned_str id = lmn_intern(lmn_string_c_str(LMN_STRING(atom)));
       return bsptr_push1(p, TAG_STR_DATA) &&
-             bsptr_push(p, (const BYTE*)&id, BS_STR_ID_SIZE);
+             bsptr_push_varint(p, id);
     } /*
     else
       FALLTHROUGH  */
@@ -1043,15 +1277,15 @@ static inline int bsptr_push_data_atom(BinStrPtr p,
 /* 書き込んだ"順番"を参照IDとして書き込む */
 static inline int bsptr_push_visited_atom(BinStrPtr p, int n, int arg)
 {
-  return bsptr_push1(p, TAG_VISITED_ATOMHLINK)      &&
-         bsptr_push(p, (BYTE*)&n, BS_PROC_REF_SIZE) &&
+  return bsptr_push1(p, TAG_VISITED_ATOMHLINK) &&
+         bsptr_push_ref_num(p, n)              &&
          bsptr_push(p, (BYTE*)&arg, BS_ATOM_REF_ARG_SIZE);
 }
 
 static inline int bsptr_push_visited_mem(BinStrPtr p, int n)
 {
-  return bsptr_push1(p, TAG_VISITED_MEM)         &&
-         bsptr_push(p, (BYTE*)&n, BS_PROC_REF_SIZE);
+  return bsptr_push1(p, TAG_VISITED_MEM) &&
+         bsptr_push_ref_num(p, n);
 }
 
 static inline int bsptr_push_escape_mem(BinStrPtr p)
@@ -1078,7 +1312,7 @@ static inline int bsptr_push_start_rulesets(BinStrPtr p, int n)
   else {
     return
       bsptr_push1(p, TAG_RULESET) &&
-      bsptr_push(p, (BYTE*)&n, BS_RULESET_NUM_SIZE);
+      bsptr_push_varint(p, n);
   }
 }
 
@@ -1087,7 +1321,7 @@ static inline int bsptr_push_ruleset(BinStrPtr p, LmnRuleSet rs)
   int id ;
 
   id = lmn_ruleset_get_id(rs);
-  return bsptr_push(p, (BYTE*)&id, BS_RULESET_SIZE);
+  return bsptr_push_varint(p, id);
 }
 
 /* 履歴表は, interned_idをkeyに, valueを0にしている */
@@ -1098,7 +1332,7 @@ static inline int bsptr_push_history_f(st_data_t _key, st_data_t _value, st_data
 
   bsp = (BinStrPtr)_arg;
   id  = (lmn_interned_str)_key;
-  bsptr_push(bsp, (BYTE*)&id, BS_HISTORY_SIZE);
+  bsptr_push_varint(bsp, id);
 
   return ST_CONTINUE;
 }
@@ -1110,7 +1344,7 @@ static inline void bsptr_push_rule_histories(BinStrPtr bsp, LmnRule r)
 
   his_tbl = lmn_rule_get_history_tbl(r);
   his_num = his_tbl ? st_num(his_tbl) : 0;
-  bsptr_push(bsp, (BYTE*)&his_num, BS_HISTORY_NUM_SIZE); /* write history num */
+  bsptr_push_varint(bsp, his_num); /* write history num */
 
   if (his_num > 0) { /* write each id of histories */
     st_foreach(his_tbl, bsptr_push_history_f, (st_data_t)bsp);
@@ -1123,7 +1357,7 @@ static inline void bsptr_push_ruleset_uniq(BinStrPtr bsp, LmnMembrane *mem, int
 
   /* write UNIQ_TAG and Number of All Rulesets */
   bsptr_push1(bsp, TAG_RULESET_UNIQ);
-  bsptr_push(bsp, (BYTE*)&n, BS_RULESET_NUM_SIZE);
+  bsptr_push_varint(bsp, n);
 
   for (i = 0; i < n; i++) { /* foreach ruleset */
     LmnRuleSet rs = lmn_mem_get_ruleset(mem, i);
@@ -1135,6 +1369,308 @@ static inline void bsptr_push_ruleset_uniq(BinStrPtr bsp, LmnMembrane *mem, int
   }
 }
 
+/*----------------------------------------------------------------------
+ * Partition Refinement
+ * 膜中のシンボルアトムと膜を, 同型写像で不変な色(ハッシュ値)で分類する.
+ * 色は「ファンクタ」から始め, 隣接アトムの色と接続先のリンク番号を取り込む
+ * 精緻化をクラス数が増えなくなるまで繰り返す. 膜の色は膜名と含まれる
+ * アトム/子膜の色の多重集合から求める.
+ * 同型な膜同士では対応するプロセスの色が一致するため, write_mols/write_mems
+ * で分子を書き始める起点の候補を最小の色クラスに絞り込んでも,
+ * 得られるバイナリストリングは一意に定まる.
+ */
+
+#define MEM_COLOR_ROUND_MAX (16U)
+
+typedef struct MemColoring *MemColoring;
+struct MemColoring {
+  struct ProcessTbl atom_idx;  /* アトムID --> colors配列の添字 */
+  struct ProcessTbl mem_color; /* 膜ID --> 膜の色 */
+  Vector   atoms;              /* 色付けの対象としたシンボルアトム(proxy含む) */
+  LmnWord *colors;             /* atomsの各アトムの色 */
+};
+
+static inline LmnWord mem_color_mix(LmnWord h, LmnWord v)
+{
+  return h ^ (v + (LmnWord)0x9e3779b9UL + (h << 6) + (h >> 2));
+}
+
+static int mem_color_comp_f(const void *a_, const void *b_)
+{
+  LmnWord a = *(const LmnWord *)a_;
+  LmnWord b = *(const LmnWord *)b_;
+  return a > b ? 1 : (a == b ? 0 : -1);
+}
+
+/* データアトムの色を返す.
+ * ハイパーリンクは書き込み時に訪問順の番号で表されるため, 種類だけで色を決める */
+static inline LmnWord mem_color_data(LmnAtom atom, LmnLinkAttr attr)
+{
+  switch (attr) {
+  case LMN_INT_ATTR:
+    return mem_color_mix(attr, (LmnWord)atom);
+  case LMN_DBL_ATTR:
+    return mem_color_mix(attr, lmn_byte_hash((unsigned char *)atom, sizeof(double)));
+  case LMN_SP_ATOM_ATTR:
+    if (lmn_is_string(atom, attr)) {
+      return mem_color_mix(attr, lmn_string_hash(LMN_STRING(atom)));
+    }
+    return attr;
+  default:
+    return attr;
+  }
+}
+
+/* 膜mem以下の全てのシンボルアトムを登録し, ファンクタを初期色とする */
+static void mem_coloring_collect(MemColoring c, LmnMembrane *mem)
+{
+  AtomListEntry *ent;
+  LmnFunctor f;
+  LmnMembrane *m;
+
+  EACH_ATOMLIST_WITH_FUNC(mem, ent, f, ({
+    LmnSAtom a;
+    if (LMN_FUNC_IS_HL(f)) continue;
+    EACH_ATOM(a, ent, ({
+      proc_tbl_put_atom(&c->atom_idx, a, vec_num(&c->atoms));
+      vec_push(&c->atoms, (vec_data_t)a);
+    }));
+  }));
+
+  for (m = mem->child_head; m; m = m->next) {
+    mem_coloring_collect(c, m);
+  }
+}
+
+/* 色の種類数を返す. tmpは作業領域 */
+static unsigned long mem_color_class_num(const LmnWord *colors,
+                                         LmnWord *tmp,
+                                         unsigned long n)
+{
+  unsigned long i, num;
+
+  if (n == 0) return 0;
+  memcpy(tmp, colors, sizeof(LmnWord) * n);
+  qsort(tmp, n, sizeof(LmnWord), mem_color_comp_f);
+  for (i = 1, num = 1; i < n; i++) {
+    if (tmp[i] != tmp[i - 1]) num++;
+  }
+  return num;
+}
+
+/* 隣接アトムの色とリンク番号を取り込んでアトムの色を1段階精緻化する */
+static void mem_coloring_refine(MemColoring c, LmnWord *next)
+{
+  unsigned long i, n;
+
+  n = vec_num(&c->atoms);
+  for (i = 0; i < n; i++) {
+    LmnSAtom a;
+    LmnWord h, j;
+    unsigned int k, arity;
+
+    a     = LMN_SATOM(vec_get(&c->atoms, i));
+    h     = c->colors[i];
+    arity = LMN_FUNCTOR_GET_LINK_NUM(LMN_SATOM_GET_FUNCTOR(a));
+    for (k = 0; k < arity; k++) {
+      LmnLinkAttr attr = LMN_SATOM_GET_ATTR(a, k);
+      LmnAtom     link = LMN_SATOM_GET_LINK(a, k);
+
+      if (LMN_ATTR_IS_DATA(attr)) {
+        h = mem_color_mix(h, mem_color_data(link, attr));
+      } else if (proc_tbl_get_by_atom(&c->atom_idx, LMN_SATOM(link), &j)) {
+        h = mem_color_mix(h, c->colors[j]);
+        h = mem_color_mix(h, LMN_ATTR_GET_VALUE(attr));
+      } else {
+        h = mem_color_mix(h, LMN_ATTR_GET_VALUE(attr));
+      }
+    }
+    next[i] = h;
+  }
+}
+
+/* 膜memの色を, 膜名と含まれるアトム/子膜の色の多重集合から求めて登録する */
+static LmnWord mem_coloring_mem(MemColoring c, LmnMembrane *mem)
+{
+  AtomListEntry *ent;
+  LmnFunctor f;
+  LmnMembrane *m;
+  Vector v;
+  LmnWord h, j;
+  unsigned int i;
+
+  vec_init(&v, 16);
+  EACH_ATOMLIST_WITH_FUNC(mem, ent, f, ({
+    LmnSAtom a;
+    if (LMN_FUNC_IS_HL(f)) continue;
+    EACH_ATOM(a, ent, ({
+      if (proc_tbl_get_by_atom(&c->atom_idx, a, &j)) {
+        vec_push(&v, c->colors[j]);
+      }
+    }));
+  }));
+  for (m = mem->child_head; m; m = m->next) {
+    vec_push(&v, mem_coloring_mem(c, m));
+  }
+  vec_sort(&v, mem_color_comp_f);
+
+  h = mem_color_mix(1, LMN_MEM_NAME_ID(mem));
+  for (i = 0; i < vec_num(&v); i++) {
+    h = mem_color_mix(h, vec_get(&v, i));
+  }
+  vec_destroy(&v);
+
+  proc_tbl_put_mem(&c->mem_color, mem, h);
+  return h;
+}
+
+/* 膜mem以下の全プロセスを色付けする */
+static void mem_coloring_init(MemColoring c, LmnMembrane *mem, unsigned long tbl_size)
+{
+  LmnWord *next, *tmp;
+  unsigned long i, n, classes, round;
+
+  proc_tbl_init_with_size(&c->atom_idx, tbl_size);
+  proc_tbl_init_with_size(&c->mem_color, tbl_size);
+  vec_init(&c->atoms, 128);
+  mem_coloring_collect(c, mem);
+
+  n = vec_num(&c->atoms);
+  c->colors = LMN_NALLOC(LmnWord, n + 1);
+  next      = LMN_NALLOC(LmnWord, n + 1);
+  tmp       = LMN_NALLOC(LmnWord, n + 1);
+
+  for (i = 0; i < n; i++) {
+    c->colors[i] = mem_color_mix(1, LMN_SATOM_GET_FUNCTOR(vec_get(&c->atoms, i)));
+  }
+
+  /* クラス数は単調に増加するため, 増えなくなった時点で安定している */
+  classes = mem_color_class_num(c->colors, tmp, n);
+  for (round = 0; round < MEM_COLOR_ROUND_MAX && classes < n; round++) {
+    LmnWord *swap;
+    unsigned long next_classes;
+
+    mem_coloring_refine(c, next);
+    next_classes = mem_color_class_num(next, tmp, n);
+    swap = c->colors; c->colors = next; next = swap;
+    if (next_classes <= classes) break;
+    classes = next_classes;
+  }
+
+  LMN_FREE(next);
+  LMN_FREE(tmp);
+
+  mem_coloring_mem(c, mem);
+}
+
+static void mem_coloring_destroy(MemColoring c)
+{
+  proc_tbl_destroy(&c->atom_idx);
+  proc_tbl_destroy(&c->mem_color);
+  vec_destroy(&c->atoms);
+  LMN_FREE(c->colors);
+}
+
+static inline LmnWord mem_coloring_atom_color(MemColoring c, LmnSAtom a)
+{
+  LmnWord j;
+  if (proc_tbl_get_by_atom(&c->atom_idx, a, &j)) return c->colors[j];
+  return 0;
+}
+
+static inline LmnWord mem_coloring_mem_color(MemColoring c, LmnMembrane *m)
+{
+  LmnWord h;
+  if (proc_tbl_get_by_mem(&c->mem_color, m, &h)) return h;
+  return 0;
+}
+
+/* 色の列vから, 要素数最小(同数なら色の値が最小)のクラスの色を返す. vは整列される */
+static LmnWord mem_color_smallest_class(Vector *v)
+{
+  unsigned int i, start, best_n;
+  LmnWord best;
+
+  vec_sort(v, mem_color_comp_f);
+  best   = vec_get(v, 0);
+  best_n = vec_num(v) + 1;
+  for (start = 0, i = 1; i <= vec_num(v); i++) {
+    if (i == vec_num(v) || vec_get(v, i) != vec_get(v, start)) {
+      if (i - start < best_n) {
+        best_n = i - start;
+        best   = vec_get(v, start);
+      }
+      start = i;
+    }
+  }
+  return best;
+}
+
+/* atoms中の未訪問アトムのうち, 先頭のファンクタを持つアトムを色で分類し,
+ * 最小の色クラスをファンクタfと色colorに返す. 候補が存在しない場合は偽を返す */
+static BOOL mem_coloring_atom_target(MemColoring c,
+                                     Vector *atoms,
+                                     VisitLog visited,
+                                     LmnFunctor *f,
+                                     LmnWord *color)
+{
+  Vector v;
+  unsigned int i;
+  BOOL found;
+
+  if (!c) return FALSE;
+
+  found = FALSE;
+  vec_init(&v, 16);
+  for (i = 0; i < vec_num(atoms); i++) {
+    LmnSAtom atom = LMN_SATOM(vec_get(atoms, i));
+
+    if (!atom || LMN_IS_HL(atom) || visitlog_get_atom(visited, atom, NULL)) {
+      continue;
+    }
+    if (!found) {
+      *f = LMN_SATOM_GET_FUNCTOR(atom);
+      found = TRUE;
+    } else if (LMN_SATOM_GET_FUNCTOR(atom) != *f) {
+      break; /* atomsはファンクタ順に並んでいる */
+    }
+    vec_push(&v, mem_coloring_atom_color(c, atom));
+  }
+
+  if (found) {
+    *color = mem_color_smallest_class(&v);
+  }
+  vec_destroy(&v);
+  return found;
+}
+
+/* 膜memの未訪問の子膜を色で分類し, 最小の色クラスをcolorに返す */
+static BOOL mem_coloring_mem_target(MemColoring c,
+                                    LmnMembrane *mem,
+                                    VisitLog visited,
+                                    LmnWord *color)
+{
+  Vector v;
+  LmnMembrane *m;
+  BOOL found;
+
+  if (!c) return FALSE;
+
+  vec_init(&v, 16);
+  for (m = mem->child_head; m; m = m->next) {
+    if (!visitlog_get_mem(visited, m, NULL)) {
+      vec_push(&v, mem_coloring_mem_color(c, m));
+    }
+  }
+
+  found = !vec_is_empty(&v);
+  if (found) {
+    *color = mem_color_smallest_class(&v);
+  }
+  vec_destroy(&v);
+  return found;
+}
+
 /*----------------------------------------------------------------------
  * Membrane Encode
  * 膜を一意なバイナリストリングにエンコードする
@@ -1143,30 +1679,38 @@ static inline void bsptr_push_ruleset_uniq(BinStrPtr bsp, LmnMembrane *mem, int
 
 /* prototypes */
 
-static void encode_root_mem(LmnMembrane *mem, BinStrPtr bsp, VisitLog visited);
+static void encode_root_mem(LmnMembrane *mem,
+                            BinStrPtr bsp,
+                            VisitLog visited,
+                            MemColoring colors);
 static Vector *mem_atoms(LmnMembrane *mem);
 static Vector *mem_functors(LmnMembrane *mem);
 static void write_mem_atoms(LmnMembrane *mem,
                             BinStrPtr bsp,
-                            VisitLog visited);
+                            VisitLog visited,
+                            MemColoring colors);
 static void write_mols(Vector *atoms,
                        BinStrPtr bsp,
-                       VisitLog visited);
+                       VisitLog visited,
+                       MemColoring colors);
 static void write_mem(LmnMembrane *mem,
                       LmnAtom from_atom,
                       LmnLinkAttr attr,
                       int from,
                       BinStrPtr bsp,
                       VisitLog visited,
+                      MemColoring colors,
                       BOOL is_id);
 static void write_mems(LmnMembrane *mem,
                        BinStrPtr bsp,
-                       VisitLog visited);
+                       VisitLog visited,
+                       MemColoring colors);
 static void write_mol(LmnAtom atom,
                       LmnLinkAttr attr,
                       int from,
                       BinStrPtr bsp,
                       VisitLog visited,
+                      MemColoring colors,
                       BOOL is_id);
 static void write_rulesets(LmnMembrane *mem, BinStrPtr bsp);
 static LmnBinStr lmn_mem_encode_sub(LmnMembrane *mem, unsigned long tbl_size);
@@ -1211,14 +1755,16 @@ static LmnBinStr lmn_mem_encode_sub(LmnMembrane *mem, unsigned long tbl_size)
 {
   struct BinStrPtr bsp;
   struct VisitLog visited;
+  struct MemColoring colors;
   LmnBinStr ret_bs;
   BinStr bs;
 
   bs = binstr_make();
   bsptr_init(&bsp, bs);
   visitlog_init_with_size(&visited, tbl_size);
+  mem_coloring_init(&colors, mem, tbl_size);
 
-  encode_root_mem(mem, &bsp, &visited);
+  encode_root_mem(mem, &bsp, &visited, &colors);
 
   /* 最後に、ポインタの位置を修正する */
   bs->cur = bsp.pos;
@@ -1227,14 +1773,18 @@ static LmnBinStr lmn_mem_encode_sub(LmnMembrane *mem, unsigned long tbl_size)
   binstr_free(bs);
   bsptr_destroy(&bsp);
   visitlog_destroy(&visited);
+  mem_coloring_destroy(&colors);
 
   return ret_bs;
 }
 
-static void encode_root_mem(LmnMembrane *mem, BinStrPtr bsp, VisitLog visited)
+static void encode_root_mem(LmnMembrane *mem,
+                            BinStrPtr bsp,
+                            VisitLog visited,
+                            MemColoring colors)
 {
-  write_mem_atoms(mem, bsp, visited);
-  write_mems(mem, bsp, visited);
+  write_mem_atoms(mem, bsp, visited, colors);
+  write_mems(mem, bsp, visited, colors);
   write_rulesets(mem, bsp);
 }
 
@@ -1246,6 +1796,7 @@ static void write_mem(LmnMembrane *mem,
                       int from,
                       BinStrPtr bsp,
                       VisitLog visited,
+                      MemColoring colors,
                       BOOL is_id)
 {
   LmnWord n_visited;
@@ -1259,7 +1810,7 @@ static void write_mem(LmnMembrane *mem,
     bsptr_push_visited_mem(bsp, n_visited);
 
     if (from_atom) { /* 引き続きアトムをたどる */
-      write_mol(from_atom, attr, from, bsp, visited, is_id);
+      write_mol(from_atom, attr, from, bsp, visited, colors, is_id);
     }
     return;
   }
@@ -1270,13 +1821,13 @@ static void write_mem(LmnMembrane *mem,
   if (!bsptr_valid(bsp)) return;
 
   if (from_atom) {
-    write_mol(from_atom, attr, from, bsp, visited, is_id);
+    write_mol(from_atom, attr, from, bsp, visited, colors, is_id);
   }
 
   /* アトム・膜・ルールセットの順に書込み */
   if (is_id) { /* 膜に対して一意なIDとなるバイナリストリングへエンコードする場合 */
-    write_mem_atoms(mem, bsp, visited);
-    write_mems(mem, bsp, visited);
+    write_mem_atoms(mem, bsp, visited, colors);
+    write_mems(mem, bsp, visited, colors);
   }
   else { /* 単なるバイナリストリングへエンコードする場合 */
     dump_mem_atoms(mem, bsp, visited);
@@ -1307,6 +1858,7 @@ static void write_mem(LmnMembrane *mem,
                     LMN_ATTR_GET_VALUE(LMN_SATOM_GET_ATTR(out, 1)),
                     bsp,
                     visited,
+                    colors,
                     is_id);
         }));
       }
@@ -1321,7 +1873,8 @@ static void write_mem(LmnMembrane *mem,
 
 static void write_mem_atoms(LmnMembrane *mem,
                             BinStrPtr bsp,
-                            VisitLog visited)
+                            VisitLog visited,
+                            MemColoring colors)
 {
   Vector *atoms;
 
@@ -1329,7 +1882,7 @@ static void write_mem_atoms(LmnMembrane *mem,
 
   atoms = mem_atoms(mem);
 
-  write_mols(atoms, bsp, visited);
+  write_mols(atoms, bsp, visited, colors);
   vec_free(atoms);
 }
 
@@ -1340,7 +1893,7 @@ static void write_mem_atoms(LmnMembrane *mem,
  *   エンコード領域bsp, 訪問管理visited, is_idは計算するバイナリストリングがmem_idならば真 */
 static void write_mol(LmnAtom atom, LmnLinkAttr attr, int from,
                       BinStrPtr bsp, VisitLog visited,
-                      BOOL is_id)
+                      MemColoring colors, BOOL is_id)
 {
   int i_arg;
   int arity;
@@ -1372,6 +1925,7 @@ static void write_mol(LmnAtom atom, LmnLinkAttr attr, int from,
               LMN_ATTR_GET_VALUE(LMN_SATOM_GET_ATTR(in, 1)),
               bsp,
               visited,
+              colors,
               is_id);
   }
   else if (f == LMN_IN_PROXY_FUNCTOR) {
@@ -1389,6 +1943,7 @@ static void write_mol(LmnAtom atom, LmnLinkAttr attr, int from,
               LMN_ATTR_GET_VALUE(LMN_SATOM_GET_ATTR(out, 1)),
               bsp,
               visited,
+              colors,
               is_id);
   }
   else if (!visitlog_get_atom(visited, LMN_SATOM(atom), &n_visited)) {
@@ -1408,6 +1963,7 @@ static void write_mol(LmnAtom atom, LmnLinkAttr attr, int from,
                 LMN_ATTR_GET_VALUE(LMN_SATOM_GET_ATTR(atom, i_arg)),
                 bsp,
                 visited,
+                colors,
                 is_id);
     }
   }
@@ -1421,15 +1977,22 @@ static void write_mol(LmnAtom atom, LmnLinkAttr attr, int from,
    最小となるように書き込む */
 static void write_mols(Vector *atoms,
                        BinStrPtr bsp,
-                       VisitLog visited)
+                       VisitLog visited,
+                       MemColoring colors)
 {
   int i, natom;
   struct BinStrPtr last_valid_bsp;
   int last_valid_i, first_func=0;
   Checkpoint last_valid_checkpoint = NULL;
+  LmnFunctor target_func = 0;
+  LmnWord target_color = 0;
+  BOOL has_target;
 
   if (!bsptr_valid(bsp)) return;
 
+  has_target = mem_coloring_atom_target(colors, atoms, visited,
+                                        &target_func, &target_color);
+
   /* atoms中の未訪問のアトムを起点とする分子を、それぞれ試みる */
   natom = vec_num(atoms);
   last_valid_i = -1;
@@ -1442,13 +2005,19 @@ static void write_mols(Vector *atoms,
       break;
     else if (visitlog_get_atom(visited, atom, NULL)) {
       continue;
+    }
+    /* 最適化: 先頭のファンクタについては最小の色クラス以外は試す必要なし */
+    else if (has_target &&
+             LMN_SATOM_GET_FUNCTOR(atom) == target_func &&
+             mem_coloring_atom_color(colors, atom) != target_color) {
+      continue;
     } else {
       struct BinStrPtr new_bsptr;
 
       bsptr_copy_to(bsp, &new_bsptr);
       visitlog_set_checkpoint(visited);
 
-      write_mol((LmnAtom)atom, LMN_ATTR_MAKE_LINK(0), -1, &new_bsptr, visited, TRUE);
+      write_mol((LmnAtom)atom, LMN_ATTR_MAKE_LINK(0), -1, &new_bsptr, visited, colors, TRUE);
       if (bsptr_valid(&new_bsptr)) {
         /* atomからたどった分子が書き込みに成功したので、last_validに記憶する */
         if (last_valid_i < 0) {
@@ -1473,7 +2042,7 @@ static void write_mols(Vector *atoms,
     vec_data_t t = vec_get(atoms, last_valid_i);
     vec_set(atoms, last_valid_i, 0);
     visitlog_push_checkpoint(visited, last_valid_checkpoint);
-    write_mols(atoms, &last_valid_bsp, visited);
+    write_mols(atoms, &last_valid_bsp, visited, colors);
     vec_set(atoms, last_valid_i, t);
 
     if (bsptr_valid(&last_valid_bsp)) {
@@ -1490,24 +2059,33 @@ static void write_mols(Vector *atoms,
  * ここで書き込む計算する分子には膜のみが含まれている */
 static void write_mems(LmnMembrane *mem,
                        BinStrPtr bsp,
-                       VisitLog visited)
+                       VisitLog visited,
+                       MemColoring colors)
 {
   LmnMembrane *m;
   struct BinStrPtr last_valid_bsp;
   BOOL last_valid;
   Checkpoint last_valid_checkpoint = NULL;
+  LmnWord target_color = 0;
+  BOOL has_target;
 
   if (!bsptr_valid(bsp)) return;
 
+  has_target = mem_coloring_mem_target(colors, mem, visited, &target_color);
+
   last_valid = FALSE;
   for (m = mem->child_head; m; m = m->next) {
+    /* 最適化: 最小の色クラス以外の膜は試す必要なし */
+    if (has_target && mem_coloring_mem_color(colors, m) != target_color) {
+      continue;
+    }
     if (!visitlog_get_mem(visited, m, NULL)) {
       struct BinStrPtr new_bsptr;
 
       bsptr_copy_to(bsp, &new_bsptr);
       visitlog_set_checkpoint(visited);
 
-      write_mem(m, 0, -1, -1, &new_bsptr, visited, TRUE);
+      write_mem(m, 0, -1, -1, &new_bsptr, visited, colors, TRUE);
 
       if (bsptr_valid(&new_bsptr)) {
         /* mからたどった分子が書き込みに成功したので、last_validに記憶する */
@@ -1528,7 +2106,7 @@ static void write_mems(LmnMembrane *mem,
   if (last_valid) {
     /* 書き込みに成功した分子をログに記録して、次の分子に進む */
     visitlog_push_checkpoint(visited, last_valid_checkpoint);
-    write_mems(mem, &last_valid_bsp, visited);
+    write_mems(mem, &last_valid_bsp, visited, colors);
 
     if (bsptr_valid(&last_valid_bsp)) {
       bsptr_copy_to(&last_valid_bsp, bsp);
@@ -1643,30 +2221,49 @@ static int binstr_decode_cell(LmnBinStr bs,
                               int *nvisit,
                               LmnMembrane *mem,
                               LmnSAtom from_atom,
-                              int from_arg);
+                              int from_arg,
+                              BinStrDumpRef *ref);
 static int binstr_decode_mol(LmnBinStr bs,
                              int pos,
                              BsDecodeLog *log,
                              int *nvisit,
                              LmnMembrane *mem,
                              LmnSAtom from_atom,
-                             int from_arg);
+                             int from_arg,
+                             BinStrDumpRef *ref);
 static int binstr_decode_atom(LmnBinStr bs,
                               int pos,
                               BsDecodeLog *log,
                               int *nvisit,
                               LmnMembrane *mem,
                               LmnSAtom from_atom,
-                              int from_arg);
+                              int from_arg,
+                              BinStrDumpRef *ref);
+static void dump_ref_add_seg(BinStrDumpRef *ref,
+                             BsDecodeLog *log,
+                             int start,
+                             int end,
+                             int ref_base,
+                             int ref_end,
+                             unsigned int refs_begin,
+                             unsigned int hlink_num);
 static void binstr_decode_rulesets(LmnBinStr bs,
                                    int *i_bs,
                                    Vector *rulesets,
                                    int rs_num);
-static void dump_root_mem(LmnMembrane *mem, BinStrPtr bsp, VisitLog visitlog);
-static LmnBinStr lmn_mem_to_binstr_sub(LmnMembrane *mem, unsigned long tbl_size);
-
-/* エンコードされた膜をデコードし、構造を再構築する */
-static inline LmnMembrane *lmn_binstr_decode_sub(const LmnBinStr bs)
+static void dump_root_mem(LmnMembrane *mem,
+                          BinStrPtr bsp,
+                          VisitLog visitlog,
+                          BinStrDumpRef *ref,
+                          Vector *holes);
+static LmnBinStr lmn_mem_to_binstr_sub(LmnMembrane *mem,
+                                       unsigned long tbl_size,
+                                       BinStrDumpRef *ref);
+
+/* エンコードされた膜をデコードし、構造を再構築する.
+ * refがNULLでなければ, ルート膜直下の閉じた子膜の区間をrefに記録する */
+static inline LmnMembrane *lmn_binstr_decode_sub(const LmnBinStr bs,
+                                                 BinStrDumpRef *ref)
 {
   LmnMembrane *groot;
   BsDecodeLog *log;
@@ -1683,50 +2280,69 @@ static inline LmnMembrane *lmn_binstr_decode_sub(const LmnBinStr bs)
   lmn_mem_set_active(groot, TRUE); /* globalだから恒真 */
   nvisit = VISITLOG_INIT_N;        /* カウンタ(== 1): 順序付けを記録しながらデコードする.
                                     * (0はグローバルルート膜なので1から) */
-  binstr_decode_cell(bs, 0, log, &nvisit, groot, NULL, 0);
+  binstr_decode_cell(bs, 0, log, &nvisit, groot, NULL, 0, ref);
   LMN_FREE(log);
 
   return groot;
 }
 
 
-LmnMembrane *lmn_binstr_decode(const LmnBinStr bs)
+/* z圧縮やcollapse圧縮を解いた, デコード可能なバイナリストリングを返す.
+ * bsと異なるものを返した場合は, 呼出し側で解放する */
+static LmnBinStr binstr_uncompress(const LmnBinStr bs)
 {
-  LmnMembrane *ret;
-  LmnBinStr target;
+  LmnBinStr ret;
 
   if (is_comp_z(bs)) {
-    target = lmn_bscomp_z_decode(bs);
+    ret = lmn_bscomp_z_decode(bs);
   } else {
-    target = bs;
+    ret = bs;
+  }
+
+  if (is_comp_collapse(ret)) {
+    LmnBinStr expanded = binstr_collapse_expand(ret);
+    if (ret != bs) lmn_binstr_free(ret);
+    ret = expanded;
   }
 
+  return ret;
+}
+
+
+LmnMembrane *lmn_binstr_decode(const LmnBinStr bs)
+{
+  LmnMembrane *ret;
+  LmnBinStr target;
+
+  target = binstr_uncompress(bs);
+
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
     profile_start_timer(PROFILE_TIME__MENC_RESTORE);
   }
 #endif
-  ret = lmn_binstr_decode_sub(target);
+  ret = lmn_binstr_decode_sub(target, NULL);
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
     profile_finish_timer(PROFILE_TIME__MENC_RESTORE);
   }
 #endif
 
-  if (is_comp_z(bs)) {
+  if (target != bs) {
     lmn_binstr_free(target);
   }
   return ret;
 }
 
 
-static int binstr_decode_cell(LmnBinStr   bs,
-                              int         pos,
-                              BsDecodeLog *log,
-                              int         *nvisit,
-                              LmnMembrane *mem,
-                              LmnSAtom    from_atom,
-                              int         from_arg)
+static int binstr_decode_cell(LmnBinStr     bs,
+                              int           pos,
+                              BsDecodeLog   *log,
+                              int           *nvisit,
+                              LmnMembrane   *mem,
+                              LmnSAtom      from_atom,
+                              int           from_arg,
+                              BinStrDumpRef *ref)
 {
   int i;
 
@@ -1742,19 +2358,16 @@ static int binstr_decode_cell(LmnBinStr   bs,
       /* ルールセット(only 1) */
       int rs_id;
       pos++;
-      rs_id = binstr_get_ruleset(bs->v, pos);
-      pos += BS_RULESET_SIZE;
+      rs_id = binstr_get_ruleset(bs->v, &pos);
       lmn_mem_add_ruleset(mem, lmn_ruleset_from_id(rs_id));
     }
     else if (tag == TAG_RULESET) {
       /* 複数のルールセット */
       int j, n, rs_id;
       pos++;
-      n = binstr_get_ruleset_num(bs->v, pos);
-      pos += BS_RULESET_NUM_SIZE;
+      n = binstr_get_ruleset_num(bs->v, &pos);
       for (j = 0; j < n; j++) {
-        rs_id = binstr_get_ruleset(bs->v, pos);
-        pos += BS_RULESET_SIZE;
+        rs_id = binstr_get_ruleset(bs->v, &pos);
         lmn_mem_add_ruleset(mem, lmn_ruleset_from_id(rs_id));
       }
     }
@@ -1762,17 +2375,30 @@ static int binstr_decode_cell(LmnBinStr   bs,
       int rs_num;
 
       pos++;
-      rs_num = binstr_get_ruleset_num(bs->v, pos);
-      pos += BS_RULESET_NUM_SIZE;
+      rs_num = binstr_get_ruleset_num(bs->v, &pos);
 
       binstr_decode_rulesets(bs, &pos, lmn_mem_get_rulesets(mem), rs_num);
     }
     else {
+      int start, ref_base;
+      unsigned int refs_begin, hlink_num;
+
+      start      = pos;
+      ref_base   = *nvisit;
+      refs_begin = ref ? vec_num(&ref->refs) : 0;
+      hlink_num  = ref ? ref->hlink_num : 0;
+
       if (i == 0) {
         /* 最初の要素は膜の外からアトムをたどって来た可能性がある */
-        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, from_atom, from_arg);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, from_atom, from_arg, ref);
       } else { /* それ以外は、アトムからたどられて到達されていない */
-        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, NULL, from_arg);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, NULL, from_arg, ref);
+      }
+
+      if (ref && !lmn_mem_parent(mem) &&
+          (tag == TAG_MEM_START || tag == TAG_NAMED_MEM_START)) {
+        /* ルート膜直下の子膜 */
+        dump_ref_add_seg(ref, log, start, pos, ref_base, *nvisit, refs_begin, hlink_num);
       }
     }
   }
@@ -1791,8 +2417,7 @@ static void binstr_decode_rulesets(LmnBinStr bs,
     LmnRuleSet rs;
     lmn_interned_str id;
 
-    rs = lmn_ruleset_copy(lmn_ruleset_from_id(binstr_get_ruleset(bs->v, *i_bs)));
-    (*i_bs) += BS_RULESET_SIZE;
+    rs = lmn_ruleset_copy(lmn_ruleset_from_id(binstr_get_ruleset(bs->v, i_bs)));
 
     for (j = 0; j < lmn_ruleset_rule_num(rs); j++) {
       LmnRule r;
@@ -1804,13 +2429,11 @@ static void binstr_decode_rulesets(LmnBinStr bs,
        *       上記コメントは考慮しなくてよい. */
 
       r = lmn_ruleset_get_rule(rs, j);
-      his_num = binstr_get_history_num(bs->v, *i_bs);
-      (*i_bs) += BS_HISTORY_NUM_SIZE;
+      his_num = binstr_get_history_num(bs->v, i_bs);
 
       if (his_num > 0) {
         for (k = 0; k < his_num; k++) {
-          id = binstr_get_history(bs->v, *i_bs);
-          (*i_bs) += BS_HISTORY_SIZE;
+          id = binstr_get_history(bs->v, i_bs);
           st_add_direct(lmn_rule_get_history_tbl(r), (st_data_t)id, 0);
         }
       }
@@ -1821,13 +2444,14 @@ static void binstr_decode_rulesets(LmnBinStr bs,
 }
 
 
-static int binstr_decode_mol(LmnBinStr   bs,
-                             int         pos,
-                             BsDecodeLog *log,
-                             int         *nvisit,
-                             LmnMembrane *mem,
-                             LmnSAtom    from_atom,
-                             int         from_arg)
+static int binstr_decode_mol(LmnBinStr     bs,
+                             int           pos,
+                             BsDecodeLog   *log,
+                             int           *nvisit,
+                             LmnMembrane   *mem,
+                             LmnSAtom      from_atom,
+                             int           from_arg,
+                             BinStrDumpRef *ref)
 {
   unsigned int tag;
   lmn_interned_str mem_name;
@@ -1841,10 +2465,9 @@ static int binstr_decode_mol(LmnBinStr   bs,
 
   switch (tag) {
   case TAG_ATOM_START:
-    return binstr_decode_atom(bs, pos, log, nvisit, mem, from_atom, from_arg);
+    return binstr_decode_atom(bs, pos, log, nvisit, mem, from_atom, from_arg, ref);
   case TAG_NAMED_MEM_START:
-    mem_name = binstr_get_mem_name(bs->v, pos);
-    pos += BS_MEM_NAME_SIZE;
+    mem_name = binstr_get_mem_name(bs->v, &pos);
     /* FALL THROUGH */
   case TAG_MEM_START:
     {
@@ -1864,9 +2487,9 @@ static int binstr_decode_mol(LmnBinStr   bs,
         out = lmn_mem_newatom(mem, LMN_OUT_PROXY_FUNCTOR);
         lmn_newlink_in_symbols(in, 0, out, 0);
         lmn_newlink_in_symbols(out, 1, from_atom, from_arg);
-        pos = binstr_decode_cell(bs, pos, log, nvisit, new_mem, in, 1);
+        pos = binstr_decode_cell(bs, pos, log, nvisit, new_mem, in, 1, ref);
       } else {
-        pos = binstr_decode_cell(bs, pos, log, nvisit, new_mem, from_atom, from_arg);
+        pos = binstr_decode_cell(bs, pos, log, nvisit, new_mem, from_atom, from_arg, ref);
       }
     }
     break;
@@ -1885,9 +2508,8 @@ static int binstr_decode_mol(LmnBinStr   bs,
       pos++;
 
       if (sub_tag == TAG_INT_DATA) {
-        n = (LmnWord)binstr_get_int(bs->v, pos);
+        n = (LmnWord)binstr_get_int(bs->v, &pos);
         n_attr = LMN_INT_ATTR;
-        pos += BS_INT_SIZE;
       }
       else if (sub_tag == TAG_DBL_DATA) {
         n = (LmnWord)binstr_get_dbl(bs->v, pos);
@@ -1895,10 +2517,9 @@ static int binstr_decode_mol(LmnBinStr   bs,
         pos += BS_DBL_SIZE;
       }
       else if (sub_tag == TAG_STR_DATA) {
-        lmn_interned_str n_id = binstr_get_strid(bs->v, pos);
+        lmn_interned_str n_id = binstr_get_strid(bs->v, &pos);
         n = (LmnWord)lmn_string_make(lmn_id_to_name(n_id));
         n_attr = LMN_STRING_ATTR;
-        pos += BS_STR_ID_SIZE;
       }
       else {
         n = 0; n_attr = 0; /* false positive対策 */
@@ -1913,7 +2534,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
       LMN_SATOM_SET_LINK(in, 1, n);
       LMN_SATOM_SET_ATTR(in, 1, n_attr);
       lmn_mem_push_atom(mem, n, n_attr);
-      pos = binstr_decode_mol(bs, pos, log, nvisit, lmn_mem_parent(mem), out, 1);
+      pos = binstr_decode_mol(bs, pos, log, nvisit, lmn_mem_parent(mem), out, 1, ref);
     }
     break;
   case TAG_ESCAPE_MEM:
@@ -1927,15 +2548,16 @@ static int binstr_decode_mol(LmnBinStr   bs,
         lmn_newlink_in_symbols(in, 0, out, 0);
         lmn_newlink_in_symbols(in, 1, from_atom, from_arg);
 
-        pos = binstr_decode_mol(bs, pos, log, nvisit, parent, out, 1);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, parent, out, 1, ref);
       } else {
-        pos = binstr_decode_mol(bs, pos, log, nvisit, parent, NULL, 1);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, parent, NULL, 1, ref);
       }
     }
     break;
   case TAG_HLINK:
     {
       LmnSAtom hl_atom    = lmn_hyperlink_new();
+      if (ref) ref->hlink_num++;
       log[(*nvisit)].v    = (LmnWord)hl_atom;
       log[(*nvisit)].type = BS_LOG_TYPE_HLINK;
       (*nvisit)++;
@@ -1943,7 +2565,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
       lmn_mem_push_atom(mem, LMN_ATOM(hl_atom), LMN_HL_ATTR);
       lmn_mem_newlink(mem, LMN_ATOM(from_atom), LMN_ATTR_GET_VALUE(LMN_ATOM(from_atom)),
                       from_arg, LMN_ATOM(hl_atom), LMN_HL_ATTR, 0);
-      pos += BS_HLINK_NUM_SIZE;
+      binstr_get_hlink_num(bs->v, &pos); /* 読み飛ばす */
 
       tag = BS_GET(bs->v, pos);
       pos++;
@@ -1966,8 +2588,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
         case TAG_INT_DATA:
           {
             long n;
-            n = binstr_get_int(bs->v, pos);
-            pos += BS_INT_SIZE;
+            n = binstr_get_int(bs->v, &pos);
             lmn_hyperlink_put_attr(lmn_hyperlink_at_to_hl(hl_atom),
                                    LMN_ATOM(n),
                                    LMN_INT_ATTR);
@@ -1989,8 +2610,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
             LmnString str;
             lmn_interned_str n;
 
-            n    = binstr_get_strid(bs->v, pos);
-            pos += BS_STR_ID_SIZE;
+            n    = binstr_get_strid(bs->v, &pos);
             str  = lmn_string_make(lmn_id_to_name(n));
             lmn_hyperlink_put_attr(lmn_hyperlink_at_to_hl(hl_atom),
                                    (LmnAtom)str,
@@ -2007,18 +2627,18 @@ static int binstr_decode_mol(LmnBinStr   bs,
   case TAG_VISITED_ATOMHLINK:
   case TAG_VISITED_MEM:
     {
-      unsigned int ref;
-      ref  = binstr_get_ref_num(bs->v, pos);
-      pos += BS_PROC_REF_SIZE;
+      unsigned int ref_n;
+      if (ref) vec_push(&ref->refs, pos);
+      ref_n = binstr_get_ref_num(bs->v, &pos);
 
-      switch (log[ref].type) {
+      switch (log[ref_n].type) {
       case BS_LOG_TYPE_ATOM:
         {
           LmnSAtom atom;
           unsigned int arg;
           arg  = binstr_get_arg_ref(bs->v, pos);
           pos += BS_ATOM_REF_ARG_SIZE;
-          atom = (LmnSAtom)log[ref].v;
+          atom = (LmnSAtom)log[ref_n].v;
           if (from_atom) {
             lmn_newlink_in_symbols(atom, arg, from_atom, from_arg);
           }
@@ -2026,9 +2646,9 @@ static int binstr_decode_mol(LmnBinStr   bs,
         break;
       case BS_LOG_TYPE_MEM:
         {
-          LmnMembrane *ref_mem = (LmnMembrane *)log[ref].v;
+          LmnMembrane *ref_mem = (LmnMembrane *)log[ref_n].v;
           if (!from_atom) {
-            pos = binstr_decode_mol(bs, pos, log, nvisit, ref_mem, NULL, from_arg);
+            pos = binstr_decode_mol(bs, pos, log, nvisit, ref_mem, NULL, from_arg, ref);
           }
           else {
             LmnMembrane *in, *out;
@@ -2038,7 +2658,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
 
             lmn_newlink_in_symbols(in, 0, out, 0);
             lmn_newlink_in_symbols(out, 1, from_atom, from_arg);
-            pos = binstr_decode_mol(bs, pos, log, nvisit, ref_mem, in, 1);
+            pos = binstr_decode_mol(bs, pos, log, nvisit, ref_mem, in, 1, ref);
           }
         }
         break;
@@ -2047,7 +2667,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
           LmnSAtom hl_atom;
           LmnAtom  ref_hl_atom;
 
-          ref_hl_atom = (LmnAtom)log[ref].v;
+          ref_hl_atom = (LmnAtom)log[ref_n].v;
           hl_atom     = (LmnSAtom)lmn_copy_atom(ref_hl_atom, LMN_HL_ATTR);
 
           lmn_newlink_in_symbols(hl_atom, 0, from_atom, from_arg);
@@ -2066,8 +2686,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
   case TAG_INT_DATA:
     {
       long n;
-      n = binstr_get_int(bs->v, pos);
-      pos += BS_INT_SIZE;
+      n = binstr_get_int(bs->v, &pos);
       LMN_SATOM_SET_LINK(from_atom, from_arg, n);
       LMN_SATOM_SET_ATTR(from_atom, from_arg, LMN_INT_ATTR);
       lmn_mem_push_atom(mem, n, LMN_INT_ATTR);
@@ -2089,8 +2708,7 @@ static int binstr_decode_mol(LmnBinStr   bs,
       LmnString str;
       lmn_interned_str n;
 
-      n    = binstr_get_strid(bs->v, pos);
-      pos += BS_STR_ID_SIZE;
+      n    = binstr_get_strid(bs->v, &pos);
       str  = lmn_string_make(lmn_id_to_name(n));
       LMN_SATOM_SET_LINK(from_atom, from_arg, str);
       LMN_SATOM_SET_ATTR(from_atom, from_arg, LMN_SP_ATOM_ATTR);
@@ -2110,13 +2728,14 @@ static int binstr_decode_mol(LmnBinStr   bs,
 /* bsの位置posから膜memにデコードしたアトムを書き込む
  * *nvisitは出現番号
  * 辿って来た場合, from_atomとそのリンク番号が渡される */
-static int binstr_decode_atom(LmnBinStr   bs,
-                              int         pos,
-                              BsDecodeLog *log,
-                              int         *nvisit,
-                              LmnMembrane *mem,
-                              LmnSAtom    from_atom,
-                              int         from_arg)
+static int binstr_decode_atom(LmnBinStr     bs,
+                              int           pos,
+                              BsDecodeLog   *log,
+                              int           *nvisit,
+                              LmnMembrane   *mem,
+                              LmnSAtom      from_atom,
+                              int           from_arg,
+                              BinStrDumpRef *ref)
 {
   LmnFunctor f;
   int arity, i;
@@ -2148,9 +2767,9 @@ static int binstr_decode_atom(LmnBinStr   bs,
     default:
       if (LMN_SATOM_GET_LINK(atom, i)) {
         /* すでにリンクが設定されているので、相手側から訪問済み */
-        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, NULL, i);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, NULL, i, ref);
       } else {
-        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, atom, i);
+        pos = binstr_decode_mol(bs, pos, log, nvisit, mem, atom, i, ref);
       }
       break;
     }
@@ -2160,6 +2779,537 @@ static int binstr_decode_atom(LmnBinStr   bs,
 }
 
 
+/*----------------------------------------------------------------------
+ * Reuse of Binary String Segments
+ */
+
+static void dump_refs_init()
+{
+  unsigned int i;
+
+  dump_refs = LMN_NALLOC(BinStrDumpRef, lmn_env.core_num);
+  for (i = 0; i < lmn_env.core_num; i++) {
+    BinStrDumpRef *ref = &dump_refs[i];
+    ref->root      = NULL;
+    ref->bs        = NULL;
+    ref->delta     = NULL;
+    ref->hlink_num = 0;
+    ref->seg_num   = 0;
+    ref->seg_cap   = BS_DUMP_REF_SEG_INIT_CAP;
+    ref->segs      = LMN_NALLOC(struct BinStrSeg, ref->seg_cap);
+    ref->gen       = 0;
+    vec_init(&ref->refs, 64);
+  }
+}
+
+static void dump_refs_finalize()
+{
+  unsigned int i;
+
+  for (i = 0; i < lmn_env.core_num; i++) {
+    BinStrDumpRef *ref = &dump_refs[i];
+    if (ref->bs) {
+      proc_tbl_destroy(&ref->seg_tbl);
+    }
+    vec_destroy(&ref->refs);
+    LMN_FREE(ref->segs);
+  }
+  LMN_FREE(dump_refs);
+}
+
+static inline BinStrDumpRef *dump_ref_get()
+{
+  return &dump_refs[env_my_thread_id()];
+}
+
+/* デコード中に読み出したルート膜直下の子膜の区間[start, end)を, 複写可能であればrefに登録する.
+ * 区間内でハイパーリンクを生成しておらず, 子膜が膜の外へのリンクを持たず,
+ * 区間内の参照番号が全て区間内のプロセスを指す場合に複写可能とする */
+static void dump_ref_add_seg(BinStrDumpRef *ref,
+                             BsDecodeLog   *log,
+                             int           start,
+                             int           end,
+                             int           ref_base,
+                             int           ref_end,
+                             unsigned int  refs_begin,
+                             unsigned int  hlink_num)
+{
+  LmnMembrane *m;
+  AtomListEntry *ent;
+  struct BinStrSeg *seg;
+  unsigned int i, refs_end;
+
+  if (ref->hlink_num != hlink_num) return;
+
+  m = (LmnMembrane *)log[ref_base].v;
+  ent = lmn_mem_get_atomlist(m, LMN_IN_PROXY_FUNCTOR);
+  if (ent && !atomlist_is_empty(ent)) return;
+
+  refs_end = vec_num(&ref->refs);
+  for (i = refs_begin; i < refs_end; i++) {
+    int pos = (int)vec_get(&ref->refs, i);
+    if ((int)binstr_get_ref_num(ref->bs->v, &pos) < ref_base) return;
+  }
+
+  if (ref->seg_num == ref->seg_cap) {
+    ref->seg_cap *= 2;
+    ref->segs = LMN_REALLOC(struct BinStrSeg, ref->segs, ref->seg_cap);
+  }
+
+  seg = &ref->segs[ref->seg_num];
+  seg->start      = start;
+  seg->end        = end;
+  seg->ref_base   = ref_base;
+  seg->ref_num    = ref_end - ref_base;
+  seg->refs_begin = refs_begin;
+  seg->refs_end   = refs_end;
+  seg->touched    = ref->gen;
+  proc_tbl_put_mem(&ref->seg_tbl, m, ref->seg_num);
+  ref->seg_num++;
+}
+
+/* 差分適用後のダンプのために, 状態のバイナリストリングbsをデコードする.
+ * ルート膜直下の閉じた子膜のbs中の区間を記録しておき,
+ * 返した膜に差分を適用してダンプする際には, 変更のない子膜の区間をbsから複写する.
+ * 返した膜を解放する前にlmn_mem_dump_ref_clearを呼び出すこと. bsはそれまで解放しないこと */
+LmnMembrane *lmn_binstr_decode_as_dump_ref(const LmnBinStr bs)
+{
+  BinStrDumpRef *ref;
+  LmnMembrane *ret;
+
+  lmn_mem_dump_ref_clear();
+  if (is_comp_z(bs) || is_comp_collapse(bs)) {
+    return lmn_binstr_decode(bs);
+  }
+
+  ref = dump_ref_get();
+  ref->bs = bs;
+  proc_tbl_init_with_size(&ref->seg_tbl, 64);
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) {
+    profile_start_timer(PROFILE_TIME__MENC_RESTORE);
+  }
+#endif
+  ret = lmn_binstr_decode_sub(bs, ref);
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) {
+    profile_finish_timer(PROFILE_TIME__MENC_RESTORE);
+  }
+#endif
+
+  ref->root = ret;
+  return ret;
+}
+
+/* lmn_binstr_decode_as_dump_refで記録した区間を破棄する */
+void lmn_mem_dump_ref_clear()
+{
+  BinStrDumpRef *ref = dump_ref_get();
+
+  if (ref->bs) {
+    proc_tbl_destroy(&ref->seg_tbl);
+  }
+  ref->root      = NULL;
+  ref->bs        = NULL;
+  ref->delta     = NULL;
+  ref->hlink_num = 0;
+  ref->seg_num   = 0;
+  vec_clear(&ref->refs);
+}
+
+/* 以降のダンプで, ルート膜に差分dを適用中であることを通知する. dがNULLならば解除する */
+void lmn_mem_dump_ref_set_delta(struct MemDeltaRoot *d)
+{
+  dump_ref_get()->delta = d;
+}
+
+/* 膜memを含むルート膜直下の子膜の区間に, 変更のあった印を付ける */
+static inline void dump_ref_touch(BinStrDumpRef *ref, LmnMembrane *mem)
+{
+  LmnWord i;
+
+  while (mem && lmn_mem_parent(mem) != ref->root) {
+    mem = lmn_mem_parent(mem);
+  }
+
+  if (mem && proc_tbl_get_by_mem(&ref->seg_tbl, mem, &i)) {
+    ref->segs[i].touched = ref->gen;
+  }
+}
+
+/* 差分dで変更された膜を含む区間に印を付ける. 区間の複写ができない差分ならば偽を返す */
+static BOOL dump_ref_mark(BinStrDumpRef *ref, struct MemDeltaRoot *d)
+{
+  unsigned int i;
+
+  ref->gen++;
+
+  /* uniq制約の履歴の追加や膜の移動は, 区間の外の参照番号を変えうるため扱わない */
+  if (d->applied_history != ANONYMOUS) return FALSE;
+  for (i = 0; i < vec_num(&d->mem_deltas); i++) {
+    struct MemDelta *md = (struct MemDelta *)vec_get(&d->mem_deltas, i);
+    if (md->new_parent) return FALSE;
+  }
+
+  for (i = 0; i < vec_num(&d->mem_deltas); i++) {
+    struct MemDelta *md = (struct MemDelta *)vec_get(&d->mem_deltas, i);
+    dump_ref_touch(ref, md->mem);
+  }
+  for (i = 0; i < vec_num(&d->new_mems); i++) {
+    struct NewMemInfo *mi = (struct NewMemInfo *)vec_get(&d->new_mems, i);
+    dump_ref_touch(ref, mi->mem);
+  }
+
+  return TRUE;
+}
+
+
+/*----------------------------------------------------------------------
+ * Collapse Compression
+ */
+
+/* --collapse指定時は, ルート膜直下の子膜のダンプを大域表に一度だけ格納し,
+ * 状態のバイナリストリングには子膜の区間の代わりに表のIDを記録する.
+ * 同じ子膜を多くの状態が共有するモデルで, 状態の記録に必要なメモリ量を減らす.
+ *
+ * collapse圧縮したバイナリストリングは次の列を4bit単位で並べたもの.
+ *   1. 置き換えた子膜の数k (可変長)
+ *   2. k組の (直前の置き換え位置からの差分, ID, 子膜の参照番号の基点) (それぞれ可変長)
+ *   3. 置き換えた子膜を取り除いたダンプ
+ * 表には子膜の区間中の参照番号を基点からの相対値で格納するため,
+ * 子膜より前にダンプしたプロセスの数が異なる状態同士でも区間を共有できる. */
+
+#define COLLAPSE_STRIPE_NUM    (64U)   /* 表のロックの分割数 */
+#define COLLAPSE_TBL_INIT_CAP  (64U)
+#define COLLAPSE_CHUNK_BITS    (12U)
+#define COLLAPSE_CHUNK_SIZE    (1U << COLLAPSE_CHUNK_BITS)
+#define COLLAPSE_CHUNK_NUM     (4096U) /* IDの上限はCOLLAPSE_CHUNK_SIZE * COLLAPSE_CHUNK_NUM */
+#define COLLAPSE_MIN_LEN       (16)    /* これより短い(4bit単位)子膜は置き換えない */
+
+struct CollapseEnt {
+  LmnBinStr          seg;     /* 参照番号を基点からの相対値にした子膜のダンプ */
+  unsigned long      hash;
+  unsigned int       id;
+  unsigned int       ref_num;
+  int                *refs;   /* seg中の参照番号の位置 (昇順) */
+  struct CollapseEnt *next;
+};
+
+/* 表はハッシュ値で分割し, 分割毎にロックを取る */
+struct CollapseStripe {
+  lmn_mutex_t        mtx;
+  struct CollapseEnt **tbl;
+  unsigned long      cap, num;
+};
+
+static struct CollapseStripe *collapse_stripes = NULL;
+/* ID -> エントリ. 登録済みのエントリは変更しないため, IDからの参照はロックを取らない */
+static struct CollapseEnt    **collapse_chunks[COLLAPSE_CHUNK_NUM];
+static lmn_mutex_t           collapse_mtx;     /* IDの割り当て */
+static volatile unsigned long collapse_num   = 0;
+static unsigned long         collapse_space  = 0;
+
+static void collapse_init()
+{
+  unsigned int i;
+
+  collapse_stripes = LMN_NALLOC(struct CollapseStripe, COLLAPSE_STRIPE_NUM);
+  for (i = 0; i < COLLAPSE_STRIPE_NUM; i++) {
+    struct CollapseStripe *st = &collapse_stripes[i];
+    lmn_mutex_init(&st->mtx);
+    st->cap = COLLAPSE_TBL_INIT_CAP;
+    st->num = 0;
+    st->tbl = LMN_NALLOC(struct CollapseEnt *, st->cap);
+    memset(st->tbl, 0x00U, sizeof(struct CollapseEnt *) * st->cap);
+  }
+  memset(collapse_chunks, 0x00U, sizeof(collapse_chunks));
+  lmn_mutex_init(&collapse_mtx);
+  collapse_num   = 0;
+  collapse_space = 0;
+}
+
+static void collapse_finalize()
+{
+  unsigned long i;
+
+  if (!collapse_stripes) return;
+
+  for (i = 0; i < collapse_num; i++) {
+    struct CollapseEnt *e = collapse_chunks[i >> COLLAPSE_CHUNK_BITS][i & (COLLAPSE_CHUNK_SIZE - 1)];
+    lmn_binstr_free(e->seg);
+    LMN_FREE(e->refs);
+    LMN_FREE(e);
+  }
+  for (i = 0; i < COLLAPSE_CHUNK_NUM && collapse_chunks[i]; i++) {
+    LMN_FREE(collapse_chunks[i]);
+    collapse_chunks[i] = NULL;
+  }
+  collapse_num   = 0;
+  collapse_space = 0;
+  for (i = 0; i < COLLAPSE_STRIPE_NUM; i++) {
+    LMN_FREE(collapse_stripes[i].tbl);
+    lmn_mutex_destroy(&collapse_stripes[i].mtx);
+  }
+  LMN_FREE(collapse_stripes);
+  collapse_stripes = NULL;
+  lmn_mutex_destroy(&collapse_mtx);
+}
+
+BOOL lmn_mem_collapse_enabled()
+{
+  return collapse_stripes != NULL;
+}
+
+/* 表に格納した子膜の数 */
+unsigned long lmn_mem_collapse_num()
+{
+  return collapse_num;
+}
+
+/* 表が使用しているメモリ量(byte) */
+unsigned long lmn_mem_collapse_space()
+{
+  return collapse_space
+    + sizeof(struct CollapseStripe) * COLLAPSE_STRIPE_NUM
+    + sizeof(struct CollapseEnt *) * COLLAPSE_CHUNK_SIZE * ((collapse_num + COLLAPSE_CHUNK_SIZE - 1) >> COLLAPSE_CHUNK_BITS);
+}
+
+static inline struct CollapseEnt *collapse_get(unsigned int id)
+{
+  LMN_ASSERT(id < collapse_num);
+  return collapse_chunks[id >> COLLAPSE_CHUNK_BITS][id & (COLLAPSE_CHUNK_SIZE - 1)];
+}
+
+/* 新しいエントリeにIDを割り当てて公開する. IDを使い切った場合はFALSEを返す */
+static BOOL collapse_publish(struct CollapseEnt *e)
+{
+  unsigned long id;
+  BOOL ret = FALSE;
+
+  if (lmn_env.core_num >= 2) lmn_mutex_lock(&collapse_mtx);
+  id = collapse_num;
+  if (id < (unsigned long)COLLAPSE_CHUNK_SIZE * COLLAPSE_CHUNK_NUM) {
+    struct CollapseEnt ***chunk = &collapse_chunks[id >> COLLAPSE_CHUNK_BITS];
+    if (!*chunk) {
+      *chunk = LMN_NALLOC(struct CollapseEnt *, COLLAPSE_CHUNK_SIZE);
+    }
+    e->id = id;
+    (*chunk)[id & (COLLAPSE_CHUNK_SIZE - 1)] = e;
+    collapse_space += sizeof(struct CollapseEnt) + sizeof(int) * e->ref_num +
+                      lmn_binstr_space(e->seg);
+
+    /* エントリを書き込んでからIDを公開する */
+#ifdef HAVE_BUILTIN_MBARRIER
+    if (lmn_env.core_num >= 2) MEM_BARRIER();
+#endif
+    collapse_num = id + 1;
+    ret = TRUE;
+  }
+  if (lmn_env.core_num >= 2) lmn_mutex_unlock(&collapse_mtx);
+
+  return ret;
+}
+
+static void collapse_stripe_resize(struct CollapseStripe *st)
+{
+  struct CollapseEnt **tbl;
+  unsigned long i, cap;
+
+  cap = st->cap * 2;
+  tbl = LMN_NALLOC(struct CollapseEnt *, cap);
+  memset(tbl, 0x00U, sizeof(struct CollapseEnt *) * cap);
+  for (i = 0; i < st->cap; i++) {
+    struct CollapseEnt *e, *next;
+    for (e = st->tbl[i]; e; e = next) {
+      unsigned long b = (e->hash / COLLAPSE_STRIPE_NUM) & (cap - 1);
+      next = e->next;
+      e->next = tbl[b];
+      tbl[b] = e;
+    }
+  }
+  LMN_FREE(st->tbl);
+  st->tbl = tbl;
+  st->cap = cap;
+}
+
+/* ダンプsrcの区間[start, end)に書き込んだ子膜を表に格納し, そのIDをidに返す.
+ * refsは区間中の参照番号の位置, baseは子膜の参照番号の基点.
+ * 区間が短い場合や, 区間外のプロセスへの参照を持つ場合はFALSEを返す */
+static BOOL collapse_intern(BinStr src, int start, int end, int base,
+                            Vector *refs, unsigned int *id)
+{
+  struct CollapseStripe *st;
+  struct CollapseEnt *e;
+  struct BinStrPtr p;
+  BinStr tmp;
+  LmnBinStr seg;
+  unsigned long hash, b;
+  unsigned int i, k, ref_num;
+  int pos, *seg_refs;
+  BOOL ret;
+
+  if (end - start < COLLAPSE_MIN_LEN) return FALSE;
+
+  ref_num = vec_num(refs);
+  for (i = 0; i < ref_num; i++) {
+    pos = (int)vec_get(refs, i);
+    if ((int)binstr_get_ref_num(src->v, &pos) < base) return FALSE;
+  }
+
+  /* 参照番号を基点からの相対値に付け替えながら区間を取り出す */
+  seg_refs = ref_num > 0 ? LMN_NALLOC(int, ref_num) : NULL;
+  tmp = binstr_make();
+  bsptr_init_direct(&p, tmp);
+  pos = start;
+  k   = 0;
+  while (pos < end) {
+    if (k < ref_num && (int)vec_get(refs, k) == pos) {
+      seg_refs[k++] = bsptr_pos(&p);
+      bsptr_push_varint(&p, binstr_get_ref_num(src->v, &pos) - base);
+    } else {
+      bsptr_push1(&p, BS_GET(src->v, pos));
+      pos++;
+    }
+  }
+  tmp->cur = bsptr_pos(&p);
+  seg = binstr_to_lmn_binstr(tmp);
+  bsptr_destroy(&p);
+  binstr_free(tmp);
+
+  hash = lmn_byte_hash_wide(seg->v, (seg->len + 1) / TAG_IN_BYTE) ^ seg->len;
+  st   = &collapse_stripes[hash & (COLLAPSE_STRIPE_NUM - 1)];
+
+  if (lmn_env.core_num >= 2) lmn_mutex_lock(&st->mtx);
+  b = (hash / COLLAPSE_STRIPE_NUM) & (st->cap - 1);
+  for (e = st->tbl[b]; e; e = e->next) {
+    if (e->hash == hash && e->seg->len == seg->len &&
+        memcmp(e->seg->v, seg->v, (seg->len + 1) / TAG_IN_BYTE) == 0) {
+      break;
+    }
+  }
+
+  if (e) {
+    *id = e->id;
+    ret = TRUE;
+  } else {
+    e = LMN_MALLOC(struct CollapseEnt);
+    e->seg     = seg;
+    e->hash    = hash;
+    e->ref_num = ref_num;
+    e->refs    = seg_refs;
+    ret = collapse_publish(e);
+    if (ret) {
+      e->next = st->tbl[b];
+      st->tbl[b] = e;
+      if (++st->num > st->cap) {
+        collapse_stripe_resize(st);
+      }
+      *id = e->id;
+      seg = NULL;
+      seg_refs = NULL;
+    } else {
+      LMN_FREE(e);
+    }
+  }
+  if (lmn_env.core_num >= 2) lmn_mutex_unlock(&st->mtx);
+
+  if (seg) lmn_binstr_free(seg);
+  LMN_FREE(seg_refs);
+  return ret;
+}
+
+/* 子膜を取り除いたダンプbsと, 置き換えた子膜の (位置, ID, 基点) の列holesから,
+ * collapse圧縮したバイナリストリングを作る */
+static LmnBinStr binstr_collapse_make(BinStr bs, Vector *holes)
+{
+  struct BinStrPtr p;
+  BinStr tmp;
+  LmnBinStr ret;
+  unsigned int i;
+  int pos, prev;
+
+  tmp = binstr_make();
+  bsptr_init_direct(&p, tmp);
+  bsptr_push_varint(&p, vec_num(holes) / 3);
+  prev = 0;
+  for (i = 0; i < vec_num(holes); i += 3) {
+    int hole = (int)vec_get(holes, i);
+    bsptr_push_varint(&p, hole - prev);
+    bsptr_push_varint(&p, vec_get(holes, i + 1));
+    bsptr_push_varint(&p, vec_get(holes, i + 2));
+    prev = hole;
+  }
+  for (pos = 0; pos < bs->cur; pos++) {
+    bsptr_push1(&p, BS_GET(bs->v, pos));
+  }
+
+  tmp->cur = bsptr_pos(&p);
+  ret = binstr_to_lmn_binstr(tmp);
+  set_comp_collapse(ret);
+  bsptr_destroy(&p);
+  binstr_free(tmp);
+  return ret;
+}
+
+/* collapse圧縮したバイナリストリングbsの子膜を表から埋め戻したダンプを返す */
+static LmnBinStr binstr_collapse_expand(const LmnBinStr bs)
+{
+  struct BinStrPtr p;
+  BinStr tmp;
+  LmnBinStr ret;
+  unsigned int i, k, hole_num;
+  int pos, root, root_pos, hole;
+
+  pos      = 0;
+  hole_num = binstr_get_varint(bs->v, &pos);
+  root     = pos;
+  for (i = 0; i < hole_num * 3; i++) {
+    binstr_get_varint(bs->v, &root); /* 置き換えた子膜の列を読み飛ばす */
+  }
+
+  tmp = binstr_make();
+  bsptr_init_direct(&p, tmp);
+  root_pos = root;
+  hole     = root;
+  for (i = 0; i < hole_num; i++) {
+    struct CollapseEnt *e;
+    int seg_pos, base;
+
+    hole += binstr_get_varint(bs->v, &pos);
+    e     = collapse_get(binstr_get_varint(bs->v, &pos));
+    base  = binstr_get_varint(bs->v, &pos);
+
+    for (; root_pos < hole; root_pos++) {
+      bsptr_push1(&p, BS_GET(bs->v, root_pos));
+    }
+
+    seg_pos = 0;
+    k       = 0;
+    while (seg_pos < e->seg->len) {
+      if (k < e->ref_num && e->refs[k] == seg_pos) {
+        bsptr_push_varint(&p, binstr_get_ref_num(e->seg->v, &seg_pos) + base);
+        k++;
+      } else {
+        bsptr_push1(&p, BS_GET(e->seg->v, seg_pos));
+        seg_pos++;
+      }
+    }
+  }
+  for (; root_pos < bs->len; root_pos++) {
+    bsptr_push1(&p, BS_GET(bs->v, root_pos));
+  }
+
+  tmp->cur = bsptr_pos(&p);
+  ret = binstr_to_lmn_binstr(tmp);
+  ret->type = bs->type;
+  unset_comp_collapse(ret);
+  bsptr_destroy(&p);
+  binstr_free(tmp);
+  return ret;
+}
+
+
 /*----------------------------------------------------------------------
  * Dump Membrane to Binary String
  */
@@ -2167,13 +3317,21 @@ static int binstr_decode_atom(LmnBinStr   bs,
 LmnBinStr lmn_mem_to_binstr(LmnMembrane *mem)
 {
   LmnBinStr ret;
+  BinStrDumpRef *ref;
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
     profile_start_timer(PROFILE_TIME__MENC_DUMP);
   }
 #endif
+  /* 展開中の状態に差分を適用した膜であれば, 変更のない子膜の区間を複写する */
+  ref = dump_ref_get();
+  if (lmn_env.collapse || !ref->delta || ref->root != mem ||
+      DMEM_ROOT_MEM(ref->delta) != mem || !dump_ref_mark(ref, ref->delta)) {
+    ref = NULL;
+  }
+
   //ret = lmn_mem_to_binstr_sub(mem, 128);
-  ret = lmn_mem_to_binstr_sub(mem, round2up(env_next_id() + 1));
+  ret = lmn_mem_to_binstr_sub(mem, round2up(env_next_id() + 1), ref);
 
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
@@ -2185,23 +3343,55 @@ LmnBinStr lmn_mem_to_binstr(LmnMembrane *mem)
 }
 
 
+/* 差分dを適用した膜のdumpを計算する.
+ * dを適用する膜がlmn_binstr_decode_as_dump_refで得た膜ならば, 変更のない子膜の区間を複写する */
+LmnBinStr lmn_mem_to_binstr_delta(struct MemDeltaRoot *d)
+{
+  BinStrDumpRef *ref;
+  struct MemDeltaRoot *org_d;
+  LmnBinStr ret;
+  BOOL commit;
+
+  commit = !d->committed;
+  if (commit) dmem_root_commit(d);
+
+  ref        = dump_ref_get();
+  org_d      = ref->delta;
+  ref->delta = d;
+  ret = lmn_mem_to_binstr(DMEM_ROOT_MEM(d));
+  ref->delta = org_d;
+
+  if (commit) dmem_root_revert(d);
+  return ret;
+}
+
+
 /* 膜のdumpを計算する. dump_root_memとかから名称変更したみたい */
-static LmnBinStr lmn_mem_to_binstr_sub(LmnMembrane *mem, unsigned long tbl_size)
+static LmnBinStr lmn_mem_to_binstr_sub(LmnMembrane *mem,
+                                       unsigned long tbl_size,
+                                       BinStrDumpRef *ref)
 {
   LmnBinStr ret_bs;
   BinStr bs;
   struct BinStrPtr bsp;
   struct VisitLog visitlog;
+  Vector holes;
 
   bs = binstr_make();
   bsptr_init_direct(&bsp, bs);
   visitlog_init_with_size(&visitlog, tbl_size);
+  vec_init(&holes, 4);
 
-  dump_root_mem(mem, &bsp, &visitlog);
+  dump_root_mem(mem, &bsp, &visitlog, ref, lmn_mem_collapse_enabled() ? &holes : NULL);
 
   /* 最後に、ポインタの位置を修正する */
   bs->cur = bsp.pos;
-  ret_bs  = binstr_to_lmn_binstr(bs);
+  if (vec_is_empty(&holes)) {
+    ret_bs = binstr_to_lmn_binstr(bs);
+  } else {
+    ret_bs = binstr_collapse_make(bs, &holes);
+  }
+  vec_destroy(&holes);
 
   binstr_free(bs);
   bsptr_destroy(&bsp);
@@ -2211,11 +3401,21 @@ static LmnBinStr lmn_mem_to_binstr_sub(LmnMembrane *mem, unsigned long tbl_size)
 }
 
 
-static void dump_root_mem(LmnMembrane *mem, BinStrPtr bsp, VisitLog visitlog)
+static void dump_root_mem(LmnMembrane *mem,
+                          BinStrPtr bsp,
+                          VisitLog visitlog,
+                          BinStrDumpRef *ref,
+                          Vector *holes)
 {
-  dump_mem_atoms(mem, bsp, visitlog); /* 1. アトムから */
-  dump_mems(mem, bsp, visitlog);      /* 2. 子膜から */
-  write_rulesets(mem, bsp);           /* 3. 最後にルール */
+  dump_mem_atoms(mem, bsp, visitlog);          /* 1. アトムから */
+  if (ref) {
+    dump_ref_mems(mem, bsp, visitlog, ref);    /* 2. 子膜から (変更のない子膜は複写) */
+  } else if (holes) {
+    dump_collapse_mems(mem, bsp, visitlog, holes); /* 2. 子膜から (大域表に格納した子膜はIDで置き換える) */
+  } else {
+    dump_mems(mem, bsp, visitlog);             /* 2. 子膜から */
+  }
+  write_rulesets(mem, bsp);                    /* 3. 最後にルール */
 }
 
 
@@ -2249,7 +3449,7 @@ static void dump_mols(Vector *atoms,
     if (visitlog_get_atom(visited, atom, NULL) || LMN_IS_HL(atom)) {
       continue;
     } else {
-      write_mol((LmnAtom)atom, LMN_ATTR_MAKE_LINK(0), -1, bsp, visited, FALSE);
+      write_mol((LmnAtom)atom, LMN_ATTR_MAKE_LINK(0), -1, bsp, visited, NULL, FALSE);
     }
   }
 }
@@ -2265,9 +3465,96 @@ static void dump_mems(LmnMembrane *mem,
 
   for (m = mem->child_head; m; m = m->next) {
     if (!visitlog_get_mem(visited, m, NULL)) {
-      write_mem(m, 0, -1, -1, bsp, visited, FALSE);
+      write_mem(m, 0, -1, -1, bsp, visited, NULL, FALSE);
+    }
+  }
+}
+
+
+
+/* 区間segを, 参照番号を付け替えながらref->bsから複写する */
+static void dump_ref_copy_seg(BinStrDumpRef *ref,
+                              struct BinStrSeg *seg,
+                              BinStrPtr bsp,
+                              VisitLog visited)
+{
+  unsigned int k;
+  int pos, base;
+  BYTE *src;
+
+  src  = ref->bs->v;
+  base = visitlog_skip_ref(visited, seg->ref_num);
+  k    = seg->refs_begin;
+  pos  = seg->start;
+
+  while (pos < seg->end) {
+    if (k < seg->refs_end && (int)vec_get(&ref->refs, k) == pos) {
+      int n = (int)binstr_get_ref_num(src, &pos) - seg->ref_base + base;
+      bsptr_push_ref_num(bsp, n);
+      k++;
+    } else {
+      bsptr_push1(bsp, BS_GET(src, pos));
+      pos++;
+    }
+  }
+}
+
+/* dump_memsと同様に子膜を書き込むが, 変更のない閉じた子膜はref->bsから複写する */
+static void dump_ref_mems(LmnMembrane *mem,
+                          BinStrPtr bsp,
+                          VisitLog visited,
+                          BinStrDumpRef *ref)
+{
+  LmnMembrane *m;
+
+  for (m = mem->child_head; m; m = m->next) {
+    if (!visitlog_get_mem(visited, m, NULL)) {
+      LmnWord i;
+      if (proc_tbl_get_by_mem(&ref->seg_tbl, m, &i) &&
+          ref->segs[i].touched != ref->gen) {
+        dump_ref_copy_seg(ref, &ref->segs[i], bsp, visited);
+      } else {
+        write_mem(m, 0, -1, -1, bsp, visited, NULL, FALSE);
+      }
+    }
+  }
+}
+
+
+
+/* dump_memsと同様に子膜を書き込むが, 書き込んだ子膜を表に格納できた場合は区間を取り除き,
+ * 取り除いた位置, ID, 参照番号の基点をholesに積む */
+static void dump_collapse_mems(LmnMembrane *mem,
+                               BinStrPtr bsp,
+                               VisitLog visited,
+                               Vector *holes)
+{
+  LmnMembrane *m;
+  Vector refs;
+
+  vec_init(&refs, 16);
+  for (m = mem->child_head; m; m = m->next) {
+    if (!visitlog_get_mem(visited, m, NULL)) {
+      int start, base;
+      unsigned int id;
+
+      start = bsptr_pos(bsp);
+      base  = visited->ref_n;
+      vec_clear(&refs);
+      bsp->refs = &refs;
+      write_mem(m, 0, -1, -1, bsp, visited, NULL, FALSE);
+      bsp->refs = NULL;
+
+      if (collapse_intern(bsp->binstr, start, bsptr_pos(bsp), base, &refs, &id)) {
+        bsp->pos = start;
+        bsp->binstr->cur = start;
+        vec_push(holes, (vec_data_t)start);
+        vec_push(holes, (vec_data_t)id);
+        vec_push(holes, (vec_data_t)base);
+      }
     }
   }
+  vec_destroy(&refs);
 }
 
 
@@ -2353,8 +3640,8 @@ inline BOOL lmn_mem_equals_enc(LmnBinStr bs, LmnMembrane *mem)
 {
   BOOL ret;
 
-  if (is_comp_z(bs)) {
-    LmnBinStr target = lmn_bscomp_z_decode(bs);
+  if (is_comp_z(bs) || is_comp_collapse(bs)) {
+    LmnBinStr target = binstr_uncompress(bs);
     ret = mem_equals_enc_sub(target, mem, round2up(env_next_id() + 1));
     lmn_binstr_free(target);
   }
@@ -2513,8 +3800,7 @@ static int mem_eq_enc_mols(LmnBinStr   bs,
         lmn_interned_str mem_name = ANONYMOUS;
 
         if (tag == TAG_NAMED_MEM_START) {
-          mem_name = binstr_get_mem_name(bs->v, *i_bs);
-          (*i_bs) += BS_MEM_NAME_SIZE;
+          mem_name = binstr_get_mem_name(bs->v, i_bs);
         }
 
         ok = FALSE;
@@ -2746,8 +4032,7 @@ BOOL mem_eq_enc_traced_mem(BOOL is_named,
   in = LMN_SATOM_GET_LINK(atom, 0);
 
   if (is_named) {
-    const lmn_interned_str mem_name = binstr_get_mem_name(bs->v, *i_bs);
-    (*i_bs) += BS_MEM_NAME_SIZE;
+    const lmn_interned_str mem_name = binstr_get_mem_name(bs->v, i_bs);
     if (mem_name != LMN_MEM_NAME_ID(LMN_PROXY_GET_MEM(in))) {
       return FALSE;
     }
@@ -2830,8 +4115,7 @@ static inline BOOL mem_eq_enc_data_atom(unsigned int tag,
    *
    * @see struct LmnMembrane: アトムの記録方式を変更 */
   if (tag == TAG_INT_DATA) {
-    long n = binstr_get_int(bs->v, *i_bs);
-    (*i_bs) += BS_INT_SIZE;
+    long n = binstr_get_int(bs->v, i_bs);
 
     if ((attr == LMN_INT_ATTR) && (n == atom)) {
 #ifdef BS_MEMEQ_OLD
@@ -2852,8 +4136,7 @@ static inline BOOL mem_eq_enc_data_atom(unsigned int tag,
     }
   }
   else if (tag == TAG_STR_DATA) {
-    lmn_interned_str n = binstr_get_strid(bs->v, *i_bs);
-    (*i_bs) += BS_STR_ID_SIZE;
+    lmn_interned_str n = binstr_get_strid(bs->v, i_bs);
     if (lmn_is_string(atom, attr) &&
         (n == lmn_intern(lmn_string_c_str(LMN_STRING(atom))))) {
 #ifdef BS_MEMEQ_OLD
@@ -2921,11 +4204,10 @@ static inline BOOL mem_eq_enc_ruleset(LmnBinStr bs, int *i_bs, LmnRuleSet rs)
 {
   long id;
 
-  id = binstr_get_ruleset(bs->v, *i_bs);
+  id = binstr_get_ruleset(bs->v, i_bs);
   if (id != lmn_ruleset_get_id(rs)) {
     return FALSE;
   }
-  (*i_bs) += BS_RULESET_SIZE;
   return TRUE;
 }
 
@@ -2935,9 +4217,8 @@ static inline BOOL mem_eq_enc_rulesets(LmnBinStr bs, int *i_bs, LmnMembrane *mem
   long n;
   int i;
 
-  n = binstr_get_ruleset_num(bs->v, *i_bs);
+  n = binstr_get_ruleset_num(bs->v, i_bs);
   if (n != lmn_mem_ruleset_num(mem)) return FALSE;
-  (*i_bs) += BS_RULESET_NUM_SIZE;
 
   for (i = 0; i < n; i++) {
     if (!mem_eq_enc_ruleset(bs, i_bs, lmn_mem_get_ruleset(mem, i))) return FALSE;
@@ -2952,9 +4233,8 @@ static inline BOOL mem_eq_enc_rulesets_uniq(LmnBinStr bs, int *i_bs, LmnMembrane
   Vector *rulesets;
   BOOL result;
 
-  rs_num = binstr_get_ruleset_num(bs->v, *i_bs);
+  rs_num = binstr_get_ruleset_num(bs->v, i_bs);
   if (rs_num != lmn_mem_ruleset_num(mem)) return FALSE;
-  (*i_bs) += BS_RULESET_NUM_SIZE;
 
   /* TODO: on-the-flyにできるはず */
   rulesets = vec_make(rs_num + 1);
@@ -2992,8 +4272,7 @@ static inline BOOL mem_eq_enc_visited(unsigned int tag,
   unsigned int ref;
   BOOL ret;
 
-  ref      = binstr_get_ref_num(bs->v, *i_bs);
-  (*i_bs) += BS_PROC_REF_SIZE;
+  ref      = binstr_get_ref_num(bs->v, i_bs);
 
 #ifndef BS_MEMEQ_OLD
   if (tag == TAG_VISITED_MEM) {
@@ -3167,8 +4446,7 @@ static inline BOOL mem_eq_enc_hlink(LmnBinStr   bs,
     LmnHlinkRank bs_hl_num;
 
     hl_root   = lmn_hyperlink_get_root(lmn_hyperlink_at_to_hl((LmnSAtom)atom));
-    bs_hl_num = binstr_get_ref_num(bs->v, *i_bs);
-    (*i_bs)  += BS_HLINK_NUM_SIZE;
+    bs_hl_num = binstr_get_hlink_num(bs->v, i_bs);
 
     if (lmn_hyperlink_element_num(hl_root) == bs_hl_num) {
 
@@ -3201,8 +4479,7 @@ static inline BOOL mem_eq_enc_hlink(LmnBinStr   bs,
           case TAG_INT_DATA:
             {
               long n;
-              n = binstr_get_int(bs->v, *i_bs);
-              *i_bs += BS_INT_SIZE;
+              n = binstr_get_int(bs->v, i_bs);
               if (LMN_HL_ATTRATOM_ATTR(hl_root) != LMN_INT_ATTR ||
                   n!=LMN_HL_ATTRATOM(hl_root)) {
                 return FALSE;
@@ -3226,9 +4503,8 @@ static inline BOOL mem_eq_enc_hlink(LmnBinStr   bs,
               LmnString str;
               lmn_interned_str n;
 
-              n    = binstr_get_strid(bs->v, *i_bs);
+              n    = binstr_get_strid(bs->v, i_bs);
               str  = lmn_string_make(lmn_id_to_name(n));
-              *i_bs += BS_STR_ID_SIZE;
               if (LMN_HL_ATTRATOM_ATTR(hl_root) != LMN_STRING_ATTR ||
                   !lmn_string_eq(str, (LmnString)LMN_HL_ATTRATOM(hl_root))) {
                 return FALSE;
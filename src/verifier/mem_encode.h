@@ -48,12 +48,16 @@ typedef struct LmnBinStr *LmnBinStr;
 struct LmnBinStr {
   BOOL type;          /* バイト列への記録方式を記録しておくためのbit field. 圧縮方式のメモ用に用いる.
                        * (64bit環境ではアラインメントの隙間に配置されるのでメモリ使用量は増えないはず) */
+  BYTE pool_cls;      /* バイト列vを確保したメモリプールのサイズクラス (同じく隙間に配置される) */
   unsigned int len;   /* 確保したbyte型の数(列の長さ) */
   BYTE *v;            /* 1byte(8bit)の可変列へのポインタ */
 };
 
 #define BS_COMP_Z                 (0x01U)
 #define BS_COMP_D                 (0x01U << 1)
+#define BS_COMP_ZDICT             (0x01U << 2) /* 共有辞書を用いたz圧縮 (BS_COMP_Zと併せて立てる) */
+#define BS_COMP_D_REF             (0x01U << 3) /* 差分の参照先状態を先頭に埋め込んだd圧縮 (BS_COMP_Dと併せて立てる) */
+#define BS_COMP_COLLAPSE          (0x01U << 4) /* ルート膜直下の子膜を大域表のIDで置き換えたダンプ */
 
 #define is_comp_z(BS)             (((BS)->type) & BS_COMP_Z)
 #define set_comp_z(BS)            (((BS)->type) |= BS_COMP_Z)
@@ -61,6 +65,15 @@ struct LmnBinStr {
 #define is_comp_d(BS)             (((BS)->type) & BS_COMP_D)
 #define set_comp_d(BS)            (((BS)->type) |= BS_COMP_D)
 #define unset_comp_d(BS)          (((BS)->type) &= ~(BS_COMP_D))
+#define is_comp_zdict(BS)         (((BS)->type) & BS_COMP_ZDICT)
+#define set_comp_zdict(BS)        (((BS)->type) |= BS_COMP_ZDICT)
+#define unset_comp_zdict(BS)      (((BS)->type) &= ~(BS_COMP_ZDICT))
+#define is_comp_d_ref(BS)         (((BS)->type) & BS_COMP_D_REF)
+#define set_comp_d_ref(BS)        (((BS)->type) |= BS_COMP_D_REF)
+#define unset_comp_d_ref(BS)      (((BS)->type) &= ~(BS_COMP_D_REF))
+#define is_comp_collapse(BS)      (((BS)->type) & BS_COMP_COLLAPSE)
+#define set_comp_collapse(BS)     (((BS)->type) |= BS_COMP_COLLAPSE)
+#define unset_comp_collapse(BS)   (((BS)->type) &= ~(BS_COMP_COLLAPSE))
 
 #define TAG_BIT_SIZE      4
 #define TAG_DATA_TYPE_BIT 2
@@ -82,9 +95,18 @@ LmnMembrane *lmn_binstr_decode(const LmnBinStr bs);
 BOOL lmn_mem_equals_enc(LmnBinStr bs, LmnMembrane *mem);
 
 void lmn_binstr_free(LmnBinStr p);
+void lmn_binstr_free_unpooled(LmnBinStr bs);
+void lmn_binstr_mpool_release(void);
+void lmn_binstr_spill(LmnBinStr bs);
 void lmn_binstr_dump(const LmnBinStr bs);
 unsigned long lmn_binstr_space(struct LmnBinStr *bs);
 LmnBinStr lmn_mem_to_binstr(LmnMembrane *mem);
 LmnBinStr lmn_mem_to_binstr_delta(struct MemDeltaRoot *d);
+LmnMembrane *lmn_binstr_decode_as_dump_ref(const LmnBinStr bs);
+void lmn_mem_dump_ref_clear(void);
+void lmn_mem_dump_ref_set_delta(struct MemDeltaRoot *d);
+BOOL lmn_mem_collapse_enabled(void);
+unsigned long lmn_mem_collapse_num(void);
+unsigned long lmn_mem_collapse_space(void);
 
 #endif /* LMN_MEM_ENCODE_H */
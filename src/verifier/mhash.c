@@ -42,6 +42,7 @@
 
 
 #include "mhash.h"
+#include "delta_membrane.h"
 #include "atom.h"
 #include "membrane.h"
 #include "rule.h"
@@ -64,6 +65,7 @@
 #define MHASH_MEM_MUL_0         (3412)
 #define MHASH_CALCULATING_MEM      (1)
 #define MHASH_TREE_D               (2)
+#define MHASH_ADDITIVE_SEED     (3412)
 
 typedef unsigned long mhash_t;
 
@@ -72,20 +74,46 @@ static inline mhash_t mhash_membrane(LmnMembrane *mem,
                                      LmnMembrane *calc_mem,
                                      ProcessTbl  ctx);
 
+static mhash_t mhash_additive(LmnMembrane *mem);
+
 static int mhash_depth = MHASH_TREE_D;
+static BOOL mhash_use_additive = FALSE;
 
 void mhash_set_depth(int depth)
 {
   if (depth > 0 && depth < 5) mhash_depth = depth;
 }
 
+/* TRUEを設定すると, 差分から更新可能な加法的なハッシュ関数を用いる.
+ * 同じ状態空間に登録する状態のハッシュ値は同じ方式で求める必要があるため,
+ * 状態空間の構築を開始する前に設定する */
+void mhash_set_additive(BOOL flag)
+{
+  mhash_use_additive = flag;
+}
+
 mhash_t mhash(LmnMembrane *mem)
 {
+  if (mhash_use_additive) {
+    return mhash_additive(mem);
+  }
   return mhash_sub(mem, round2up(env_next_id()));
   //return mhash_sub(mem, 1024);
   //return 10;
 }
 
+/* 膜mem以下の各膜にハッシュ値を記録しておく.
+ * バイナリストリングから復元した膜はハッシュ値を持たないため, サクセッサの生成前に
+ * 一度計算しておき, 各サクセッサ(のコピー)で変化のない子膜の値を再利用させる. */
+void mhash_prepare(LmnMembrane *mem)
+{
+#ifdef TIME_OPT
+  if (!mhash_use_additive && lmn_mem_child_head(mem) && !mem->hash_valid) {
+    mhash(mem);
+  }
+#endif
+}
+
 static mhash_t mhash_sub(LmnMembrane *mem, unsigned long tbl_size)
 {
   struct ProcessTbl c;
@@ -117,6 +145,32 @@ static inline mhash_t memunit(LmnMembrane *mem,
                               int         depth);
 static mhash_t mhash_rulesets(Vector *rulesets);
 
+/* 膜memのハッシュ値を膜に記録し, 以降の計算やコピー先の膜で再利用してよいならば真を返す.
+ * 膜のハッシュ値はmem以下の階層のみから決まる(トレースはin-proxyで打ち切られ,
+ * calc_memに到達するのは親膜側からの場合に限られる)が, 次の膜は例外とする.
+ *   - ハイパーリンクを含む膜: ハッシュ値が膜の外部のハイパーリンクの集合に依存する.
+ *   - uniqルールを持つ膜: 適用履歴が膜の操作とは無関係に変化する.
+ *   - 記録できない子膜を持つ膜 */
+static BOOL mhash_membrane_cacheable(LmnMembrane *mem)
+{
+  AtomListEntry *ent;
+  LmnMembrane *m;
+  unsigned int i;
+
+  ent = lmn_mem_get_atomlist(mem, LMN_HL_FUNC);
+  if (ent && !atomlist_is_empty(ent)) return FALSE;
+
+  for (i = 0; i < lmn_mem_ruleset_num(mem); i++) {
+    if (lmn_ruleset_has_uniqrule(lmn_mem_get_ruleset(mem, i))) return FALSE;
+  }
+
+  for (m = lmn_mem_child_head(mem); m; m = lmn_mem_next(m)) {
+    if (!m->hash_valid) return FALSE;
+  }
+
+  return TRUE;
+}
+
 /* 膜memのハッシュ値を返す.
  * 計算の根となる膜をcalc_memとして渡す.  */
 static inline mhash_t mhash_membrane(LmnMembrane *mem,
@@ -134,6 +188,13 @@ static inline mhash_t mhash_membrane(LmnMembrane *mem,
     /* memのハッシュ値を計算済みなら, それを返す */
     return (mhash_t)t;
   }
+#ifdef TIME_OPT
+  else if (lmn_mem_hash_get(mem, &t)) {
+    /* 以前の計算(コピー元の膜を含む)で記録したハッシュ値が有効なら, それを返す */
+    proc_tbl_put_mem(ctx, mem, t);
+    return (mhash_t)t;
+  }
+#endif
   else {
     mhash_t ret, hash_sum, hash_mul;
 
@@ -192,6 +253,11 @@ static inline mhash_t mhash_membrane(LmnMembrane *mem,
     /* finalzie */
     ret = hash_sum ^ hash_mul;
     proc_tbl_put_mem(ctx, mem, ret);
+#ifdef TIME_OPT
+    if (mhash_membrane_cacheable(mem)) {
+      lmn_mem_hash_set(mem, ret);
+    }
+#endif
     return ret;
   }
 }
@@ -530,3 +596,176 @@ static inline int mhash_multiply_rhistories_f(st_data_t _key,
 
   return ST_CONTINUE;
 }
+
+
+/*----------------------------------------------------------------------
+ * Additive Hash
+ * 膜のハッシュ値を, 各シンボルアトムと各膜の寄与の総和として求める.
+ *   アトムの寄与: 所属膜の文脈, ファンクタ, 各引数の接続先(ファンクタとリンク番号,
+ *                 またはデータアトムの値)から求める.
+ *   膜の寄与    : 膜の文脈とルールセットから求める.
+ *   膜の文脈    : ルート膜から膜までの膜名の列から求める.
+ * アトムの寄与は接続先の値を含むが, delta-membraneではリンクを書き換えた既存アトムは
+ * 必ず複製(del_atomsとnew_atomsの組)として記録されるため, 差分に現れないアトムの寄与は
+ * 変化しない. 従って, 差分を適用した膜のハッシュ値は, 親状態のハッシュ値に
+ * new_atomsの寄与を加え, del_atomsの寄与を引くだけで求まる.
+ * 膜の追加/削除/移動, 膜名やルールセットの変更を含む差分の場合は全体を計算し直す.
+ */
+
+static inline mhash_t mhash_additive_mix(mhash_t h)
+{
+  const int half = sizeof(mhash_t) * 4; /* 語長の半分 */
+
+  h ^= h >> half;
+  h *= (mhash_t)0xff51afd7ed558ccdULL;
+  h ^= h >> half;
+  h *= (mhash_t)0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> half;
+  return h;
+}
+
+/* 親膜の文脈parent_ctxから膜memの文脈を求める */
+static inline mhash_t mhash_additive_ctx_step(mhash_t parent_ctx, LmnMembrane *mem)
+{
+  return mhash_additive_mix(parent_ctx * MHASH_C + LMN_MEM_NAME_ID(mem) + 1);
+}
+
+/* ルート膜から辿って膜memの文脈を求める */
+static mhash_t mhash_additive_ctx(LmnMembrane *mem)
+{
+  mhash_t parent_ctx;
+
+  parent_ctx = mem->parent ? mhash_additive_ctx(mem->parent)
+                           : MHASH_ADDITIVE_SEED;
+  return mhash_additive_ctx_step(parent_ctx, mem);
+}
+
+/* 文脈ctxの膜に所属するシンボルアトムatomの寄与を返す */
+static mhash_t mhash_additive_atom(LmnSAtom atom, mhash_t ctx)
+{
+  mhash_t hash;
+  int i_arg, arity;
+
+  hash  = mhash_additive_mix(ctx + mhash_symbol(atom));
+  arity = LMN_SATOM_GET_LINK_NUM(atom);
+  for (i_arg = 0; i_arg < arity; i_arg++) {
+    LmnLinkAttr attr = LMN_SATOM_GET_ATTR(atom, i_arg);
+    LmnAtom     link = LMN_SATOM_GET_LINK(atom, i_arg);
+    mhash_t t;
+
+    if (LMN_ATTR_IS_HL(attr)) {
+      /* ハイパーリンクのハッシュ値は接続先以外の変化でも変わるため, 種類だけを用いる */
+      t = attr;
+    } else if (LMN_ATTR_IS_DATA(attr)) {
+      t = mhash_data(link, attr) * MHASH_B + attr;
+    } else {
+      t = mhash_symbol(LMN_SATOM(link)) * MHASH_B + LMN_ATTR_GET_VALUE(attr);
+    }
+    hash = mhash_additive_mix(hash * MHASH_C + t);
+  }
+
+  return hash;
+}
+
+/* 親膜の文脈がparent_ctxである膜mem以下の寄与の総和を返す */
+static mhash_t mhash_additive_mem(LmnMembrane *mem, mhash_t parent_ctx)
+{
+  AtomListEntry *ent;
+  LmnMembrane *child_mem;
+  mhash_t ctx, sum;
+
+  ctx = mhash_additive_ctx_step(parent_ctx, mem);
+  sum = mhash_additive_mix(ctx ^ mhash_rulesets(lmn_mem_get_rulesets(mem)));
+
+  EACH_ATOMLIST(mem, ent, ({
+    LmnSAtom atom;
+    EACH_ATOM(atom, ent, ({
+      sum += mhash_additive_atom(atom, ctx);
+    }));
+  }));
+
+  for (child_mem = lmn_mem_child_head(mem);
+       child_mem;
+       child_mem = lmn_mem_next(child_mem)) {
+    sum += mhash_additive_mem(child_mem, ctx);
+  }
+
+  return sum;
+}
+
+static mhash_t mhash_additive(LmnMembrane *mem)
+{
+  mhash_t t;
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3)  profile_start_timer(PROFILE_TIME__STATE_HASH_MEM);
+#endif
+
+  t = mhash_additive_mem(mem,
+                         mem->parent ? mhash_additive_ctx(mem->parent)
+                                     : MHASH_ADDITIVE_SEED);
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) profile_finish_timer(PROFILE_TIME__STATE_HASH_MEM);
+#endif
+  return t;
+}
+
+/* 差分dが膜の構造やルールセットを変更せず, アトムの追加/削除のみからなる場合は真を返す */
+static BOOL mhash_delta_is_atomic(struct MemDeltaRoot *d)
+{
+  unsigned int i;
+
+  if (vec_num(&d->new_mems) > 0 || d->applied_history != ANONYMOUS) {
+    return FALSE;
+  }
+
+  for (i = 0; i < vec_num(&d->mem_deltas); i++) {
+    struct MemDelta *md = (struct MemDelta *)vec_get(&d->mem_deltas, i);
+    if (vec_num(&md->del_mems) > 0 || vec_num(&md->new_mems) > 0 ||
+        md->new_rulesets || md->ruleset_removed ||
+        md->new_name != md->org_name) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* 加法的なハッシュ関数を使用している場合に, ハッシュ値がorg_hashの膜へ
+ * 差分dを適用した膜のハッシュ値をretへ設定して真を返す.
+ * 差分から求められない場合は偽を返す (呼出し側で膜全体から計算する). */
+BOOL mhash_delta(struct MemDeltaRoot *d, unsigned long org_hash, unsigned long *ret)
+{
+  mhash_t hash;
+  unsigned int i, j;
+
+  if (!mhash_use_additive || !mhash_delta_is_atomic(d)) return FALSE;
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3)  profile_start_timer(PROFILE_TIME__STATE_HASH_MEM);
+#endif
+
+  hash = org_hash;
+  for (i = 0; i < vec_num(&d->mem_deltas); i++) {
+    struct MemDelta *md = (struct MemDelta *)vec_get(&d->mem_deltas, i);
+    mhash_t ctx;
+
+    if (vec_is_empty(&md->new_atoms) && vec_is_empty(&md->del_atoms)) continue;
+
+    ctx = mhash_additive_ctx(md->mem);
+    for (j = 0; j < vec_num(&md->new_atoms); j++) {
+      hash += mhash_additive_atom(LMN_SATOM(vec_get(&md->new_atoms, j)), ctx);
+    }
+    for (j = 0; j < vec_num(&md->del_atoms); j++) {
+      hash -= mhash_additive_atom(LMN_SATOM(vec_get(&md->del_atoms, j)), ctx);
+    }
+  }
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) profile_finish_timer(PROFILE_TIME__STATE_HASH_MEM);
+#endif
+
+  *ret = hash;
+  return TRUE;
+}
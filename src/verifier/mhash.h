@@ -41,7 +41,12 @@
 #include "lmntal.h"
 #include "membrane.h"
 
+struct MemDeltaRoot;
+
 unsigned long mhash(LmnMembrane *mem);
 void mhash_set_depth(int depth);
+void mhash_set_additive(BOOL flag);
+void mhash_prepare(LmnMembrane *mem);
+BOOL mhash_delta(struct MemDeltaRoot *d, unsigned long org_hash, unsigned long *ret);
 
 #endif
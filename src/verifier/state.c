@@ -51,12 +51,183 @@
 #include "task.h"
 #include "binstr_compress.h"
 #include "runtime_status.h"
+#include "memory_pool.h"
 
 #ifdef KWBT_OPT
 # include <limits.h>
 #endif
 
-static inline LmnBinStr state_binstr_D_compress(LmnBinStr org, State *ref_s);
+static LmnBinStr state_binstr_D_compress(LmnBinStr org, State *s);
+static LmnBinStr state_D_rcache_lookup(State *s);
+static void      state_D_rcache_insert(State *s, LmnBinStr org);
+
+/* State構造体はスレッド毎のメモリプールから確保する.
+ * 重複と判定された状態は生成直後に解放されるため, 空きリストの先頭から即座に再利用される.
+ * 状態空間を破棄する際は, 登録済みの状態を1つずつプールへ返さず, プールごと破棄する(state_mpool_release). */
+#define STATE_POOL_BLOCK_SIZE  (1024)
+static memory_pool **state_pools;
+
+/* 参照頻度の低いフィールド(struct StateCold)の配列. 添字の上位ビットでチャンクを, 下位ビットでチャンク内の位置を引く.
+ * 各スレッドは添字を1チャンク分ずつ予約して順に割り当て, 解放された添字はスレッド毎の空きリストから再利用する.
+ * チャンクは一度確保すると移動しないため, 添字からの参照はロックを取らない. */
+struct StateCold *state_cold_chunks[STATE_COLD_CHUNK_NUM];
+static unsigned long state_cold_chunk_num; /* 確保済みのチャンク数 */
+static lmn_mutex_t   state_cold_mtx;       /* チャンクの確保 */
+
+typedef struct StateColdCxt {
+  unsigned long next, end; /* 予約済みで未割り当ての添字の範囲[next, end) */
+  Vector        free;      /* 解放された添字 */
+} StateColdCxt;
+
+static StateColdCxt *state_cold_cxts; /* スレッド数分の配列 */
+
+/* 差分圧縮(--d-compress)した状態のバイナリストリングは, 参照先の状態から順に復号して再構築する.
+ * 直近に再構築したバイナリストリングはスレッド毎のLRUキャッシュに保持し,
+ * 同じ祖先を共有する状態との比較で復号の連鎖を繰り返さないようにする.
+ * 状態のメモリは再利用され得るため, キャッシュは登録時の差分バイナリストリングと併せて照合する. */
+#define STATE_D_RCACHE_SIZE   (8U)
+#define STATE_D_REF_CAND_MAX  (4U)
+
+struct StateDRCacheEntry {
+  State        *s;
+  LmnBinStr     dif;  /* 登録時の状態sのバイナリストリング */
+  LmnBinStr     org;  /* 再構築したバイナリストリング */
+  unsigned long tick;
+};
+
+typedef struct StateDCxt {
+  struct StateDRCacheEntry rcache[STATE_D_RCACHE_SIZE];
+  unsigned long            tick;
+  State                   *cands[STATE_D_REF_CAND_MAX]; /* --d-ref-best: 展開中に登録した兄弟状態 */
+  unsigned int             cand_num;
+} StateDCxt;
+
+static StateDCxt *state_d_cxts; /* スレッド数分の配列 */
+
+void state_mpool_init()
+{
+  unsigned int i;
+  state_pools = LMN_NALLOC(memory_pool *, lmn_env.core_num);
+  for (i = 0; i < lmn_env.core_num; i++) {
+    state_pools[i] = NULL;
+  }
+
+  state_d_cxts = LMN_NALLOC(StateDCxt, lmn_env.core_num);
+  memset(state_d_cxts, 0, sizeof(StateDCxt) * lmn_env.core_num);
+
+  state_cold_cxts = LMN_NALLOC(StateColdCxt, lmn_env.core_num);
+  for (i = 0; i < lmn_env.core_num; i++) {
+    state_cold_cxts[i].next = 0;
+    state_cold_cxts[i].end  = 0;
+    vec_init(&state_cold_cxts[i].free, 64);
+  }
+  memset(state_cold_chunks, 0x00U, sizeof(state_cold_chunks));
+  state_cold_chunk_num = 0;
+  lmn_mutex_init(&state_cold_mtx);
+}
+
+/* 参照頻度の低いフィールドの配列を全て解放する. 以降の割り当てでは添字0から使用する */
+static void state_cold_clear()
+{
+  unsigned long i;
+  for (i = 0; i < state_cold_chunk_num; i++) {
+    LMN_FREE(state_cold_chunks[i]);
+    state_cold_chunks[i] = NULL;
+  }
+  state_cold_chunk_num = 0;
+  for (i = 0; i < lmn_env.core_num; i++) {
+    state_cold_cxts[i].next = 0;
+    state_cold_cxts[i].end  = 0;
+    vec_clear(&state_cold_cxts[i].free);
+  }
+}
+
+void state_mpool_finalize()
+{
+  unsigned int i;
+  for (i = 0; i < lmn_env.core_num; i++) {
+    if (state_pools[i]) {
+      memory_pool_delete(state_pools[i]);
+    }
+  }
+  LMN_FREE(state_pools);
+  LMN_FREE(state_d_cxts); /* キャッシュの中身はstate_D_rcache_clearで解放済み */
+
+  state_cold_clear();
+  for (i = 0; i < lmn_env.core_num; i++) {
+    vec_destroy(&state_cold_cxts[i].free);
+  }
+  LMN_FREE(state_cold_cxts);
+  lmn_mutex_destroy(&state_cold_mtx);
+}
+
+/* 全スレッドのState構造体とバイナリストリングのメモリプールを破棄する.
+ * 以降の確保では新たにメモリプールを作成する.
+ * 状態空間の破棄(statespace_free)から呼び出す. 呼び出し時点で, プールから確保した
+ * 状態とバイナリストリングを他に保持していてはならない. */
+void state_mpool_release()
+{
+  unsigned int i;
+
+  /* 差分圧縮のキャッシュはプールから確保したバイナリストリングを保持する */
+  state_D_rcache_clear();
+  for (i = 0; i < lmn_env.core_num; i++) {
+    if (state_pools[i]) {
+      memory_pool_delete(state_pools[i]);
+      state_pools[i] = NULL;
+    }
+  }
+  state_cold_clear();
+  lmn_binstr_mpool_release();
+}
+
+/* 自スレッドのメモリプールを返す. 未作成の場合は作成する */
+static inline memory_pool *state_pool_of_me()
+{
+  unsigned int id = env_my_thread_id();
+  if (!state_pools[id]) {
+    state_pools[id] = memory_pool_new_with_blocksize(sizeof(struct State),
+                                                     STATE_POOL_BLOCK_SIZE);
+  }
+  return state_pools[id];
+}
+
+/* 自スレッドに添字を1チャンク分予約する */
+static void state_cold_reserve(StateColdCxt *c)
+{
+  unsigned long n;
+
+  if (lmn_env.core_num >= 2) lmn_mutex_lock(&state_cold_mtx);
+  n = state_cold_chunk_num;
+  if (n >= STATE_COLD_CHUNK_NUM) {
+    lmn_fatal("too many states: the index of struct StateCold exceeds 32 bits");
+  }
+  state_cold_chunks[n] = LMN_NALLOC(struct StateCold, STATE_COLD_CHUNK_SIZE);
+  state_cold_chunk_num = n + 1;
+  if (lmn_env.core_num >= 2) lmn_mutex_unlock(&state_cold_mtx);
+
+  c->next = n << STATE_COLD_CHUNK_BITS;
+  c->end  = c->next + STATE_COLD_CHUNK_SIZE;
+}
+
+/* 参照頻度の低いフィールドの添字を割り当てる */
+static inline unsigned int state_cold_alloc()
+{
+  StateColdCxt *c = &state_cold_cxts[env_my_thread_id()];
+  if (!vec_is_empty(&c->free)) {
+    return (unsigned int)vec_pop(&c->free);
+  }
+  if (c->next == c->end) {
+    state_cold_reserve(c);
+  }
+  return (unsigned int)c->next++;
+}
+
+/* 状態sの参照頻度の低いフィールドの添字を, 自スレッドの空きリストへ返す */
+static inline void state_cold_free(State *s)
+{
+  vec_push(&state_cold_cxts[env_my_thread_id()].free, (vec_data_t)s->cold);
+}
 
 /*----------------------------------------------------------------------
  * State
@@ -85,10 +256,29 @@ State *state_make(LmnMembrane *mem, BYTE property_label, BOOL do_encode)
 }
 
 
+/* ハッシュ値hashを計算済みの階層グラフ構造memから状態を生成して返す.
+ * (canonical membraneを使用しない場合に限る) */
+State *state_make_with_hash(LmnMembrane *mem, BYTE property_label, unsigned long hash)
+{
+  State *new_s = state_make_minimal();
+
+  state_set_mem(new_s, mem);
+  new_s->state_name = property_label;
+  new_s->hash       = hash;
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) {
+    profile_add_space(PROFILE_SPACE__STATE_MEMBRANE, lmn_mem_space(mem));
+  }
+#endif
+
+  return new_s;
+}
+
+
 /* まっさらなState構造体をmallocして返してもらう */
 State *state_make_minimal()
 {
-  State *new_s = LMN_MALLOC(State);
+  State *new_s = (State *)memory_pool_malloc(state_pool_of_me());
   new_s->data             = NULL;
   new_s->state_name       = 0x00U;
   new_s->flags            = 0x00U;
@@ -98,26 +288,26 @@ State *state_make_minimal()
   new_s->next             = NULL;
   new_s->successors       = NULL;
   new_s->successor_num    = 0;
-  new_s->parent           = NULL;
   new_s->state_id         = 0;
-  new_s->map              = NULL;
+  new_s->cold             = state_cold_alloc();
+  state_set_parent(new_s, NULL);
+  state_map(new_s)        = NULL;
 
 #ifndef MINIMAL_STATE
-  state_set_expander_id(new_s, LONG_MAX);
+  state_set_expander_id(new_s, UINT_MAX);
   new_s->local_flags      = 0x00U;
-  state_expand_lock_init(new_s);
 #endif
   s_set_fresh(new_s);
 
 #ifdef KWBT_OPT
   if (lmn_env.opt_mode != OPT_NONE) {
-    new_s->cost = lmn_env.opt_mode == OPT_MINIMIZE ? ULONG_MAX : 0;
+    state_cost(new_s) = lmn_env.opt_mode == OPT_MINIMIZE ? ULONG_MAX : 0;
   }
 #endif
 
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
-    profile_add_space(PROFILE_SPACE__STATE_OBJECT, sizeof(struct State));
+    profile_add_space(PROFILE_SPACE__STATE_OBJECT, STATE_OBJ_SPACE);
   }
 #endif
   return new_s;
@@ -138,6 +328,28 @@ void state_calc_hash(State *s, LmnMembrane *mem, BOOL canonical)
 }
 
 
+/* 差分オブジェクトdをcommitした階層グラフ構造を用いて状態sのハッシュ値を計算する.
+ * 親状態のハッシュ値と差分dから求められる場合は, 膜全体をトレースしない.
+ * 差分の加算は膜のハッシュ値(s->hash)に対して行う. state_hashは性質オートマトンの
+ * 状態番号を掛けた値を返すため使わない. また, 親状態がエンコード済みの場合,
+ * 親状態のs->hashはバイナリストリングのハッシュ値であるため, 膜全体から計算する */
+void state_calc_hash_delta(State *s, struct MemDeltaRoot *d, BOOL canonical)
+{
+  State *parent = state_get_parent(s);
+
+  if (canonical || !parent || is_encoded(parent) ||
+      !mhash_delta(d, parent->hash, &s->hash)) {
+    state_calc_hash(s, state_mem(s), canonical);
+  }
+#ifdef DEBUG
+  else if (mhash(state_mem(s)) != s->hash) {
+    /* 差分から更新したハッシュ値と, 膜全体から計算し直したハッシュ値は一致しなければならない */
+    lmn_fatal("additive mhash: the value updated by a delta differs from the recomputed one");
+  }
+#endif
+}
+
+
 /* 状態srcと等価な状態を新たに構築して返す.
  * srcに階層グラフ構造が割り当てられている場合, その階層グラフ構造までを,
  * else: srcにバイナリストリングが割り当てられている場合, そのバイナリストリングを,
@@ -173,7 +385,7 @@ State *state_copy(State *src, LmnMembrane *mem)
     }
 #ifdef PROFILE
     if (lmn_env.profile_level >= 3) {
-      profile_add_space(PROFILE_SPACE__STATE_OBJECT, sizeof(struct State));
+      profile_add_space(PROFILE_SPACE__STATE_OBJECT, STATE_OBJ_SPACE);
     }
 #endif
   }
@@ -191,10 +403,8 @@ State *state_copy(State *src, LmnMembrane *mem)
 }
 
 
-/**
- * デストラクタ
- */
-void state_free(State *s)
+/* 状態sが保持する, State構造体とバイナリストリング以外のメモリを解放する */
+static inline void state_free_inner(State *s)
 {
   if (s->successors) {
 #ifdef PROFILE
@@ -216,19 +426,38 @@ void state_free(State *s)
   }
 #endif
 
-  state_expand_lock_destroy(s);
-
   state_free_mem(s);
+}
+
+/**
+ * デストラクタ
+ */
+void state_free(State *s)
+{
+  state_free_inner(s);
   state_free_binstr(s);
-  LMN_FREE(s);
+  state_cold_free(s);
+  memory_pool_free(state_pool_of_me(), s);
 
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
-    profile_remove_space(PROFILE_SPACE__STATE_OBJECT, sizeof(struct State));
+    profile_remove_space(PROFILE_SPACE__STATE_OBJECT, STATE_OBJ_SPACE);
   }
 #endif
 }
 
+/* 状態空間を一括で破棄する際のデストラクタ.
+ * State構造体(参照頻度の低いフィールドを含む)とバイナリストリングは
+ * state_mpool_releaseでプールごと破棄するため,
+ * プールの外から確保したメモリのみを解放する. */
+void state_free_in_bulk(State *s)
+{
+  state_free_inner(s);
+  if (state_binstr(s)) {
+    lmn_binstr_free_unpooled(state_binstr(s));
+  }
+}
+
 void state_free_mem(State *s)
 {
   if (state_mem(s)) {
@@ -321,6 +550,20 @@ LmnMembrane *state_mem_copy(State *s)
 }
 
 
+/* 差分バイナリストリングdifから, 埋め込んだ参照先の状態を除いた差分本体を返す.
+ * 戻り値がtmpを指す場合, そのバイト列はdifと共有している. */
+static inline LmnBinStr state_D_payload(LmnBinStr dif, struct LmnBinStr *tmp)
+{
+  if (!is_comp_d_ref(dif)) {
+    return dif;
+  }
+  *tmp = *dif;
+  tmp->len -= sizeof(State *) * TAG_IN_BYTE;
+  tmp->v   += sizeof(State *);
+  unset_comp_d_ref(tmp);
+  return tmp;
+}
+
 /* 状態sに対応するバイナリストリングを, sがrefする状態を基に再構築して返す. */
 LmnBinStr state_binstr_reconstructor(State *s)
 {
@@ -328,14 +571,17 @@ LmnBinStr state_binstr_reconstructor(State *s)
   if (!s_is_d(s)) {
     ret = state_binstr(s);
   }
-  else {
+  else if (!(ret = state_D_rcache_lookup(s))) {
     LmnBinStr ref;
-    LMN_ASSERT(state_D_ref(s));
-    ref = state_binstr_reconstructor(state_D_ref(s));
-    ret = lmn_bscomp_d_decode(ref, state_binstr(s));
-    if (s_is_d(state_D_ref(s))) {
+    struct LmnBinStr tmp;
+    State *ref_s = state_D_ref(s);
+    LMN_ASSERT(ref_s);
+    ref = state_binstr_reconstructor(ref_s);
+    ret = lmn_bscomp_d_decode(ref, state_D_payload(state_binstr(s), &tmp));
+    if (s_is_d(ref_s)) {
       lmn_binstr_free(ref);
     }
+    state_D_rcache_insert(s, ret);
   }
 
   return ret;
@@ -548,10 +794,11 @@ void state_calc_mem_encode(State *s)
 /**/
 void state_calc_binstr_delta(State *s)
 {
-  LmnBinStr org = state_binstr(s);
-  if (org && state_D_ref(s)) {
-    LmnBinStr dif;
-    dif = state_binstr_D_compress(org, state_D_ref(s));
+  LmnBinStr org, dif;
+
+  org = state_binstr(s);
+  dif = (org && state_D_ref(s)) ? state_binstr_D_compress(org, s) : NULL;
+  if (dif) {
     state_D_cache(s, org);
     state_set_binstr(s, dif);
   }
@@ -561,9 +808,26 @@ void state_calc_binstr_delta(State *s)
 }
 
 
-/* バイナリストリングorgと状態ref_sのバイナリストリングとの差分バイナリストリングを返す.
- * orgのメモリ管理は呼出し側で行う. */
-static inline LmnBinStr state_binstr_D_compress(LmnBinStr org, State *ref_s)
+/* 状態sのバイナリストリングを再構築するために辿る差分の数を返す. lim以上は数えない. */
+static inline unsigned int state_D_chain_len(State *s, unsigned int lim)
+{
+  unsigned int n = 0;
+  while (n < lim && s_is_d(s)) {
+    s = state_D_ref(s);
+    n++;
+  }
+  return n;
+}
+
+/* 状態ref_sを参照状態とした場合に, 差分圧縮の連鎖がlmn_env.d_chain_maxを越えなければ真を返す */
+static inline BOOL state_D_ref_acceptable(State *ref_s)
+{
+  return !lmn_env.d_chain_max ||
+         state_D_chain_len(ref_s, lmn_env.d_chain_max) < lmn_env.d_chain_max;
+}
+
+/* バイナリストリングorgと状態ref_sのバイナリストリングとの差分バイナリストリングを返す. */
+static inline LmnBinStr state_D_encode_with(LmnBinStr org, State *ref_s)
 {
   LmnBinStr ref, dif;
 
@@ -582,6 +846,157 @@ static inline LmnBinStr state_binstr_D_compress(LmnBinStr org, State *ref_s)
   return dif;
 }
 
+/* 差分バイナリストリングdifの先頭に参照先の状態ref_sを埋め込んだバイナリストリングを返す.
+ * difは解放する. */
+static LmnBinStr state_D_embed_ref(LmnBinStr dif, State *ref_s)
+{
+  LmnBinStr ret;
+  unsigned int dif_8len = dif->len / TAG_IN_BYTE;
+
+  ret = lmn_binstr_make(sizeof(State *) + dif_8len);
+  memcpy(ret->v, &ref_s, sizeof(State *));
+  memcpy(ret->v + sizeof(State *), dif->v, dif_8len);
+  ret->len  = dif->len + sizeof(State *) * TAG_IN_BYTE;
+  ret->type = dif->type;
+  set_comp_d_ref(ret);
+  lmn_binstr_free(dif);
+
+  return ret;
+}
+
+/* 状態sのバイナリストリングorgの差分バイナリストリングを返す.
+ * 参照先は親状態とし, --d-ref-bestの場合は展開中に登録した兄弟状態のうち差分が最小となる状態とする.
+ * 差分の連鎖がlmn_env.d_chain_maxに達する場合や, 差分を取らない方が小さい場合はNULLを返し,
+ * 状態sはorgをそのまま保持する(keyframe).
+ * orgのメモリ管理は呼出し側で行う. */
+static LmnBinStr state_binstr_D_compress(LmnBinStr org, State *s)
+{
+  StateDCxt *cxt;
+  State *ref_s, *best_s;
+  LmnBinStr dif;
+  unsigned int i;
+
+  ref_s  = state_D_ref(s);
+  best_s = NULL;
+  dif    = NULL;
+  if (state_D_ref_acceptable(ref_s)) {
+    dif    = state_D_encode_with(org, ref_s);
+    best_s = ref_s;
+  }
+
+  if (!lmn_env.d_ref_best) {
+    return dif;
+  }
+
+  cxt = &state_d_cxts[env_my_thread_id()];
+  for (i = 0; i < cxt->cand_num; i++) {
+    State *c = cxt->cands[i];
+    LmnBinStr d;
+    if (c == ref_s || !state_D_ref_acceptable(c)) continue;
+    d = state_D_encode_with(org, c);
+    if (!dif || d->len + sizeof(State *) * TAG_IN_BYTE < dif->len) {
+      if (dif) lmn_binstr_free(dif);
+      dif    = d;
+      best_s = c;
+    } else {
+      lmn_binstr_free(d);
+    }
+  }
+
+  if (dif && best_s != ref_s) {
+    dif = state_D_embed_ref(dif, best_s);
+  }
+  if (dif && dif->len >= org->len) {
+    lmn_binstr_free(dif);
+    dif = NULL;
+  }
+
+  return dif;
+}
+
+
+/* --d-ref-best: 展開中の状態から新たに登録した状態sを, 以降の兄弟状態の差分の参照候補に加える.
+ * 登録した状態の非圧縮バイナリストリングは展開を終えるまでstate_D_cacheに保持されている */
+void state_D_ref_cand_add(State *s)
+{
+  StateDCxt *cxt;
+
+  if (!lmn_env.d_ref_best || !state_binstr(s)) return;
+
+  cxt = &state_d_cxts[env_my_thread_id()];
+  if (cxt->cand_num == STATE_D_REF_CAND_MAX) {
+    memmove(&cxt->cands[0], &cxt->cands[1], sizeof(State *) * (STATE_D_REF_CAND_MAX - 1));
+    cxt->cand_num--;
+  }
+  cxt->cands[cxt->cand_num++] = s;
+}
+
+/* 状態の展開を終えた時点で, 兄弟状態の参照候補をクリアする */
+void state_D_ref_cand_clear()
+{
+  state_d_cxts[env_my_thread_id()].cand_num = 0;
+}
+
+
+/* 状態sを再構築したバイナリストリングのコピーをキャッシュから返す. キャッシュにない場合はNULLを返す. */
+static LmnBinStr state_D_rcache_lookup(State *s)
+{
+  StateDCxt *cxt = &state_d_cxts[env_my_thread_id()];
+  unsigned int i;
+
+  for (i = 0; i < STATE_D_RCACHE_SIZE; i++) {
+    struct StateDRCacheEntry *e = &cxt->rcache[i];
+    if (e->org && e->s == s && e->dif == state_binstr(s)) {
+      LmnBinStr ret = lmn_binstr_copy(e->org);
+      ret->type = e->org->type;
+      e->tick = ++cxt->tick;
+      return ret;
+    }
+  }
+
+  return NULL;
+}
+
+/* 状態sを再構築したバイナリストリングorgのコピーを, 最も古いエントリと置き換えてキャッシュする */
+static void state_D_rcache_insert(State *s, LmnBinStr org)
+{
+  StateDCxt *cxt = &state_d_cxts[env_my_thread_id()];
+  struct StateDRCacheEntry *victim;
+  unsigned int i;
+
+  victim = &cxt->rcache[0];
+  for (i = 1; i < STATE_D_RCACHE_SIZE; i++) {
+    if (cxt->rcache[i].tick < victim->tick) {
+      victim = &cxt->rcache[i];
+    }
+  }
+
+  if (victim->org) {
+    lmn_binstr_free(victim->org);
+  }
+  victim->s    = s;
+  victim->dif  = state_binstr(s);
+  victim->org  = lmn_binstr_copy(org);
+  victim->org->type = org->type;
+  victim->tick = ++cxt->tick;
+}
+
+/* 全スレッドのキャッシュを解放する. 状態空間を破棄した後に呼び出す. */
+void state_D_rcache_clear()
+{
+  unsigned int i, j;
+
+  for (i = 0; i < lmn_env.core_num; i++) {
+    StateDCxt *cxt = &state_d_cxts[i];
+    for (j = 0; j < STATE_D_RCACHE_SIZE; j++) {
+      if (cxt->rcache[j].org) {
+        lmn_binstr_free(cxt->rcache[j].org);
+      }
+    }
+    memset(cxt, 0, sizeof(StateDCxt));
+  }
+}
+
 
 /* 状態sに対応した階層グラフ構造のバイナリストリングをzlibで圧縮して返す.
  * 状態sはread only */
@@ -618,10 +1033,10 @@ LmnBinStr state_calc_mem_dump(State *s)
     ret = state_binstr(s);
   }
   else if (state_mem(s)) {
+    LmnBinStr dif;
     ret = lmn_mem_to_binstr(state_mem(s));
-    if (s_is_d(s) && state_D_ref(s)) {
-      LmnBinStr dif;
-      dif = state_binstr_D_compress(ret, state_D_ref(s));
+    dif = (s_is_d(s) && state_D_ref(s)) ? state_binstr_D_compress(ret, s) : NULL;
+    if (dif) {
       /* 元のバイト列は直ちに破棄せず, 一時的にキャッシュしておく. */
       state_D_cache(s, ret);
       ret = dif;
@@ -69,7 +69,7 @@ typedef void*  state_data_t;
 //};
 
 /* Descriptor */
-struct State {                 /* Total:64(36)byte */
+struct State {                 /* Total:64(40)byte */
   unsigned int       successor_num;   /*  4(4)byte: サクセッサの数 */
   BYTE               state_name;      /*  1(1)byte: 同期積オートマトンの性質ラベル */
   BYTE               flags;           /*  1(1)byte: フラグ管理用ビットフィールド */
@@ -79,19 +79,39 @@ struct State {                 /* Total:64(36)byte */
   succ_data_t       *successors;      /*  8(4)byte: サクセッサポインタの配列 */
   state_data_t       data;            /*  8(4)byte: 膜, バイナリストリングのどちらか */
   State             *next;            /*  8(4)byte: 状態管理表に登録する際に必要なポインタ */
-  State             *parent;          /*  8(4)byte: 自身を生成した状態へのポインタを持たせておく */
   unsigned long      state_id;        /*  8(4)byte: 生成順に割り当てる状態の整数ID */
-  State             *map;             /*  8(4)byte: MAP値 or 最適化実行時の前状態 */
 #ifndef MINIMAL_STATE 
   BYTE              *local_flags;     /*  8(4)byte: 並列実行時、スレッド事に保持しておきたいフラグ(mcndfsのcyanフラグ等) */
-  pthread_mutex_t    expand_lock;
-  unsigned long      expander_id;
+  unsigned int       expander_id;     /*  4(4)byte: 状態を展開したスレッドのID.
+                                       *            (展開時の排他制御は状態毎のmutexではなく, LmnWorkerGroupのロック表で行う) */
 #endif
+  unsigned int       cold;            /*  4(4)byte: 参照頻度の低いフィールド(struct StateCold)の添字 */
+};
+
+/* 状態の等価性判定や展開で参照しないフィールド.
+ * State構造体を1キャッシュラインに収めるため, 状態とは別の配列(state_cold_chunks)に置き,
+ * State構造体には32bitの添字(cold)のみを持たせる. 添字は状態の生成時に割り当て, 解放時に再利用する. */
+struct StateCold {
+  State             *parent;          /*  8(4)byte: 自身を生成した状態へのポインタを持たせておく */
+  State             *map;             /*  8(4)byte: MAP値 or 最適化実行時の前状態 */
 #ifdef KWBT_OPT
   LmnCost            cost;            /*  8(4)byte: cost */
 #endif
 };
 
+#define STATE_COLD_CHUNK_BITS          (16U)
+#define STATE_COLD_CHUNK_SIZE          (1UL << STATE_COLD_CHUNK_BITS)
+#define STATE_COLD_CHUNK_NUM           (1UL << (32 - STATE_COLD_CHUNK_BITS)) /* 添字の上限は2^32 */
+extern struct StateCold *state_cold_chunks[STATE_COLD_CHUNK_NUM];
+
+/* 状態sの参照頻度の低いフィールドを返す */
+static inline struct StateCold *state_cold(State *s) {
+  return &state_cold_chunks[s->cold >> STATE_COLD_CHUNK_BITS][s->cold & (STATE_COLD_CHUNK_SIZE - 1)];
+}
+
+/* 状態1つあたりのState構造体の大きさ(別の配列に置くフィールドを含む) */
+#define STATE_OBJ_SPACE                (sizeof(struct State) + sizeof(struct StateCold))
+
 #define state_flags(S)                 ((S)->flags)
 #define state_flags2(S)                ((S)->flags2)
 #define state_flags3(S)                ((S)->flags3)
@@ -107,17 +127,9 @@ struct State {                 /* Total:64(36)byte */
 #ifndef MINIMAL_STATE
 #define state_set_expander_id(S, ID)          ((S)->expander_id = (ID))
 #define state_expander_id(S)                  ((S)->expander_id)
-#define state_expand_lock_init(S)             (lmn_mutex_init(&((S)->expand_lock)))
-#define state_expand_lock_destroy(S)          (lmn_mutex_destroy(&((S)->expand_lock)))
-#define state_expand_lock(S)                  (lmn_mutex_lock(&((S)->expand_lock)))
-#define state_expand_unlock(S)                (lmn_mutex_unlock(&((S)->expand_lock)))
 #else
 #define state_set_expander_id(S, ID)          (NULL)
 #define state_expander_id(S)                  (0)
-#define state_expand_lock_init(S)             (NULL)
-#define state_expand_lock_destroy(S)          (NULL)
-#define state_expand_lock(S)                  (NULL)
-#define state_expand_unlock(S)                (NULL)
 #endif
 
 /** Flags (8bit)
@@ -227,17 +239,20 @@ struct State {                 /* Total:64(36)byte */
  *  0000 1000  
  *  0001 0000  
  *  0010 0000  
- *  0100 0000  
+ *  0100 0000  最終状態として登録済みであることを示すフラグ (bitstate hashingで使用)
  *  1000 0000
  */
 
 
 #define STATE_FRESH_MASK             (0x01U)
+#define STATE_END_MASK               (0x01U << 6)
 
 /* manipulation for flags2 */
 #define s_set_fresh(S)                     ((S)->flags3 |=   STATE_FRESH_MASK)
 #define s_unset_fresh(S)                   ((S)->flags3 &= (~STATE_FRESH_MASK))
 #define s_is_fresh(S)                      ((S)->flags3 &    STATE_FRESH_MASK)
+#define s_set_end(S)                       ((S)->flags3 |=   STATE_END_MASK)
+#define s_is_end(S)                        ((S)->flags3 &    STATE_END_MASK)
 
 
 /** local flags (8bit)
@@ -265,8 +280,13 @@ struct State {                 /* Total:64(36)byte */
 
 State       *state_make(LmnMembrane *mem, BYTE state_name, BOOL encode);
 State       *state_make_minimal(void);
+State       *state_make_with_hash(LmnMembrane *mem, BYTE state_name, unsigned long hash);
+void         state_mpool_init(void);
+void         state_mpool_finalize(void);
+void         state_mpool_release(void);
 State       *state_copy(State *src, LmnMembrane *src_mem);
 void         state_free(State *s);
+void         state_free_in_bulk(State *s);
 void         state_succ_set(State *s, Vector *v);
 void         state_succ_add(State *s, succ_data_t succ);
 void         state_succ_clear(State *s);
@@ -277,6 +297,7 @@ LmnBinStr    state_calc_mem_dump(State *s);
 LmnBinStr    state_calc_mem_dump_with_z(State *s);
 LmnBinStr    state_calc_mem_dummy(State *s);
 void         state_calc_hash(State *s, LmnMembrane *mem, BOOL encode);
+void         state_calc_hash_delta(State *s, struct MemDeltaRoot *d, BOOL encode);
 void         state_free_compress_mem(State *s);
 LmnMembrane *state_mem_copy(State *state);
 int          state_cmp(State *s1, State *s2);
@@ -284,6 +305,9 @@ int          state_cmp_with_compress(State *s1, State *s2);
 void         state_binstr_d_compress(State *s);
 LmnBinStr    state_binstr_reconstructor(State *s);
 void         state_calc_binstr_delta(State *s);
+void         state_D_rcache_clear(void);
+void         state_D_ref_cand_add(State *s);
+void         state_D_ref_cand_clear(void);
 
 static inline LmnMembrane   *state_restore_mem(State *s);
 static inline LmnMembrane   *state_restore_mem_inner(State *s, BOOL flag);
@@ -304,6 +328,7 @@ static inline State         *state_get_parent(State *s);
 static inline void           state_set_parent(State *s, State *parent);
 static inline unsigned int   state_succ_num(State *s);
 static inline State         *state_succ_state(State *s, int idx);
+static inline void           state_succ_replace(State *s, int idx, State *succ);
 static inline BOOL           state_succ_contains(State *s, State *t);
 static inline BOOL           state_is_accept(Automata a, State *s);
 static inline BOOL           state_is_end(Automata a, State *s);
@@ -321,10 +346,10 @@ static inline void           state_update_cost(State *s,
                                                EWLock *ewlock);
 static inline void           state_set_cost(State *s, LmnCost cost, State * pre);
 
-#define state_map(S)         ((S)->map)
+#define state_map(S)         (state_cold(S)->map)
 
 #ifdef KWBT_OPT
-# define state_cost(S)        ((S)->cost)
+# define state_cost(S)        (state_cold(S)->cost)
 #else
 # define state_cost(S)        0U
 #endif
@@ -512,12 +537,12 @@ static inline void state_unset_binstr(State *s) {
 
 /* 状態sを生成した状態(親ノード)へのアドレスを返す. */
 static inline State *state_get_parent(State *s) {
-  return s->parent;
+  return state_cold(s)->parent;
 }
 
 /* 状態sに, sを生成した状態(親ノード)へのアドレスを割り当てる. */
 static inline void state_set_parent(State *s, State *parent) {
-  s->parent = parent;
+  state_cold(s)->parent = parent;
 }
 
 /* 状態sから遷移可能な状態数を返す. */
@@ -535,6 +560,15 @@ static inline State *state_succ_state(State *s, int idx) {
   }
 }
 
+/* 状態sから遷移可能な状態の集合のidx番目を, 状態succに置き換える. */
+static inline void state_succ_replace(State *s, int idx, State *succ) {
+  if (has_trans_obj(s)) {
+    transition_set_state((Transition)s->successors[idx], succ);
+  } else {
+    s->successors[idx] = (succ_data_t)succ;
+  }
+}
+
 /* 状態sから遷移可能な状態集合に, 状態tが含まれている場合に真を返す.
  * O(state_succ_num(s))と効率的ではないため, 可能な限り利用しない. */
 static inline BOOL state_succ_contains(State *s, State *t) {
@@ -580,6 +614,13 @@ static inline BYTE state_scc_id(Automata a, State *s) {
 
 /* 状態sとの差分計算の対象とする状態に対する参照を返す. */
 static inline State *state_D_ref(State *s) {
+  LmnBinStr b = state_binstr(s);
+  if (s_is_d(s) && b && is_comp_d_ref(b)) {
+    /* --d-ref-best: 親ノード以外を参照する差分は, 参照先の状態をバイト列の先頭に埋め込む */
+    State *ref;
+    memcpy(&ref, b->v, sizeof(State *));
+    return ref;
+  }
   /* とりあえず親ノードにした */
   return state_get_parent(s);
 }
@@ -613,14 +654,18 @@ void state_D_flush(State *s) {
 static inline void state_D_progress(State *s, LmnReactCxt *rc) {
   RC_D_PROGRESS(rc);
   state_D_flush(s);
+  if (RC_MC_USE_D(rc)) {
+    state_D_ref_cand_clear();
+  }
 }
 
 /* MT-unsafe */
 static inline void state_set_cost(State *s, LmnCost cost, State * pre) {
+  struct StateCold *c = state_cold(s);
 #ifdef KWBT_OPT
-  s->cost = cost;
+  c->cost = cost;
 #endif
-  s->map  = pre;
+  c->map  = pre;
 }
 
 /* 状態sのcostが最適ならば更新し、状態sを遷移先更新状態にする
@@ -38,7 +38,8 @@
  */
 
 /** @author Masato Gocho
- *  Closed Address Hash Table / Parallel Hash Table for State Management Table
+ *  Closed Address Hash Table / Parallel Hash Table / Lock-Free Open Address Hash Table
+ *  for State Management Table
  */
 
 #include "statespace.h"
@@ -55,7 +56,10 @@
 #include "delta_membrane.h"
 #include "vector.h"
 #include "queue.h"
+#include "util.h"
+#include "binstr_compress.h"
 #include "lmntal.h"
+#include <math.h>
 
 /** ProtoTypes
  */
@@ -66,7 +70,7 @@ void statespace_add_memid_hash(StateSpace states, unsigned long hash);
 static StateTable *statetable_make(int thread_num);
 static StateTable *statetable_make_with_size(unsigned long size, int thread_num);
 static inline void statetable_clear(StateTable *st);
-static void statetable_free(StateTable *st, int nPEs);
+static void statetable_free(StateTable *st, int nPEs, BOOL bulk);
 static inline unsigned long statetable_num(StateTable *st);
 static inline unsigned long statetable_num_by_me(StateTable *st);
 static inline unsigned long statetable_cap_density(StateTable *st);
@@ -86,21 +90,71 @@ static inline BOOL statetable_use_rehasher(StateTable *st);
 static inline unsigned long statetable_space(StateTable *st);
 static inline void statetable_set_lock(StateTable *st, EWLock *lock);
 static inline unsigned long table_new_size(unsigned long old_size);
+static inline BOOL statetable_need_resize(StateTable *st);
 static void statetable_resize(StateTable *st, unsigned long old_size);
+static void statetable_resize_lockfree(StateTable *st, unsigned long old_cap);
+#ifdef PROFILE
+static State *statetable_insert_lockfree(StateTable *st, State *s, unsigned long *hash_col);
+#else
+static State *statetable_insert_lockfree(StateTable *st, State *s);
+#endif
+static void statetable_add_direct_lockfree(StateTable *st, State *s);
+static void statetable_lf_complete(StateTable *st);
+static void statetable_lf_retire(StateTable *st, State **tbl, struct StateTableMigrate *mig);
+static State *statetable_lookup_hash_eq(StateTable *st, State *ins, State *str,
+                                        LmnBinStr compress, unsigned long *col);
 static void statetable_set_rehash_tbl(StateTable *st, StateTable *rehash_tbl);
 static inline StateTable *statetable_rehash_tbl(StateTable *st);
 static void statetable_memid_rehash(State *pred, StateTable *ss);
+static BOOL statespace_bitstate_test_and_set(StateSpace ss, unsigned long hash);
+static State *statespace_insert_bitstate(StateSpace ss, State *s);
+static State *statespace_insert_hcompact(StateSpace ss, State *s);
+static void statetable_prefetch(StateTable *st, State **ss, unsigned int n, unsigned long *bucket);
+static inline void statespace_mem_account(StateSpace ss, State *s);
+static inline unsigned int statespace_partition_owner(StateSpace ss, State *s);
+static State *statespace_insert_partition(StateSpace ss, State *s);
+static void statespace_partition_free(struct StatePartition *p, BOOL bulk);
+static void statetable_move_all(StateTable *dst, StateTable *src);
 
 /** Macros
  */
 #define TABLE_DEFAULT_INIT_SIZE     (1U << 15)  /* TODO: テーブルの初期サイズはいくつが適当か. (固定サイズにしているモデル検査器は多い) */
 #define TABLE_DEFAULT_MAX_DENSITY      (5U)  /* 1バケットあたりの平均長がこの値を越えた場合にresizeする */
 #define MEM_EQ_FAIL_THRESHOLD          (2U)  /* 膜の同型性判定にこの回数以上失敗すると膜のエンコードを行う */
+#define BITSTATE_WORD_BITS             (sizeof(unsigned long) * 8)
+#define BITSTATE_COVERAGE_STEPS        (1024U) /* 推定カバレッジを数値積分する際の分割数 */
+#define MEM_LIMIT_CHECK_RATIO          (64U) /* 各スレッドが上限の1/64のメモリ量を登録する度にメモリ量を確認する */
 
 #define need_resize(EntryNum, Capacity)  (((EntryNum) / (Capacity)) > TABLE_DEFAULT_MAX_DENSITY)
+/* open addressing表は, 各スレッドの登録数がスレッドあたりの容量の1/2を越えた時点でresizeする.
+ * (全スレッドの合計でも充填率はおよそ1/2以下に収まる) */
+#define need_resize_lockfree(EntryNum, Capacity)  (((EntryNum) << 1) > (Capacity))
 #define STATE_EQUAL(Tbl, Check, Stored)  (state_hash(Check) == state_hash(Stored) \
                                           && ((Tbl)->type->compare)(Check, Stored))
 
+/* --bfs-partition用. 部分表と, 部分表を担当するスレッド間で状態を受け渡す経路 */
+#define SS_MSG_BATCH_SIZE   (64U)   /* 1バッチあたりの状態数 */
+#define SS_MSG_RING_SIZE    (256U)  /* 1本のリングバッファに積めるバッチ数 */
+
+typedef struct SsMsg {
+  State        *s;      /* 登録候補の状態 */
+  State        *parent; /* sの遷移元状態 */
+  unsigned int  idx;    /* parentのサクセッサのうちsを指す位置 */
+} SsMsg;
+
+typedef struct SsMsgBatch {
+  unsigned int num;
+  SsMsg        msg[SS_MSG_BATCH_SIZE];
+} SsMsgBatch;
+
+struct StatePartition {
+  unsigned int  n;       /* 分割数(スレッド数) */
+  StateTable  **shards;  /* shards[i]: スレッドiが担当する部分表 */
+  SpscRing     *rings;   /* rings[from * n + to]: スレッドfromからスレッドtoへの経路 */
+  SsMsgBatch  **cur;     /* cur[from * n + to]: 追記中のバッチ */
+  Vector       *pending; /* pending[from * n + to]: リングバッファに積めずに残っているバッチ */
+};
+
 /* 状態管理表stに登録されているcompress関数を用いて, 状態sのバイナリストリングbsを計算して返す.
  * (--disable-compressの場合はdummy関数がNULLを返す.)
  * bsが計算済みの場合(NULLでない場合)は, 何もしない */
@@ -111,6 +165,10 @@ static inline LmnBinStr statetable_compress_state(StateTable *st, State *s, LmnB
     LMN_ASSERT(!is_encoded(s));
     bs = (*((st)->type->compress))(s);
   }
+  if (bs && lmn_env.spill_dir) {
+    /* 登録前(他スレッドから参照される前)にバイト列をディスク上の退避領域へ移す */
+    lmn_binstr_spill(bs);
+  }
   return bs;
 }
 
@@ -155,6 +213,18 @@ static unsigned long primes[] = {
 };
 
 
+static inline BOOL table_size_is_prime(unsigned long n)
+{
+  unsigned long d;
+  if (n < 2) return FALSE;
+  if (n % 2 == 0) return n == 2;
+  for (d = 3; d <= n / d; d += 2) {
+    if (n % d == 0) return FALSE;
+  }
+  return TRUE;
+}
+
+
 static inline unsigned long table_new_size(unsigned long old_size)
 {
   unsigned long i, n;
@@ -165,14 +235,35 @@ static inline unsigned long table_new_size(unsigned long old_size)
       return primes[i];
     }
   }
-  lmn_fatal("Size of StateSpace exceeded the limiting value");
-  return 0; /* exception */
+
+  /* 素数表の上限を越えた場合は, 2倍より大きい最小の素数を計算する.
+   * (resize時に1度だけ計算するため, 試し割りで十分) */
+  n = (old_size << 1) + 1;
+  while (!table_size_is_prime(n)) {
+    n += 2;
+  }
+  return n;
+}
+
+
+static inline BOOL statetable_need_resize(StateTable *st)
+{
+  if (statetable_use_lockfree(st)) {
+    return need_resize_lockfree(statetable_num_by_me(st), statetable_cap_density(st));
+  } else {
+    return need_resize(statetable_num_by_me(st), statetable_cap_density(st));
+  }
 }
 
 
 /* テーブルのサイズを1段階拡張する */
 static void statetable_resize(StateTable *st, unsigned long old_cap)
 {
+  if (statetable_use_lockfree(st)) {
+    statetable_resize_lockfree(st, old_cap);
+    return;
+  }
+
 #ifdef PROFILE
   if (lmn_env.profile_level >= 3) {
     profile_countup(PROFILE_COUNT__HASH_RESIZE_TRIAL);
@@ -212,7 +303,7 @@ static void statetable_resize(StateTable *st, unsigned long old_cap)
     LMN_FREE(st->tbl);
     st->tbl = new_tbl;
     st->cap = new_cap;
-    st->cap_density = new_cap / st->thread_num;
+    st->cap_density = st->owner_only ? new_cap : new_cap / st->thread_num;
 
 #ifdef PROFILE
     if (lmn_env.profile_level >= 3) {
@@ -227,11 +318,17 @@ static void statetable_resize(StateTable *st, unsigned long old_cap)
 
 /** StateSpace
  */
+/* 状態のメモリプールを所有する状態空間が存在する場合に真.
+ * 最初に作成した状態空間のみがプールを所有し, その探索中に作成する状態空間(atomic step等)は所有しない. */
+static BOOL statespace_pools_owned = FALSE;
+
 static inline StateSpace statespace_make_minimal()
 {
   struct StateSpace *ss = LMN_MALLOC(struct StateSpace);
   ss->tbl_type          = 0x00U;
   ss->is_formated       = FALSE;
+  ss->own_pools         = !statespace_pools_owned;
+  statespace_pools_owned = TRUE;
   ss->thread_num        = 1;
   ss->out               = stdout; /* TOFIX: LmnPortで書き直したいところ */
   ss->init_state        = NULL;
@@ -242,22 +339,50 @@ static inline StateSpace statespace_make_minimal()
   ss->acc_memid_tbl     = NULL;
   ss->property_automata = NULL;
   ss->propsyms          = NULL;
+  ss->bits              = NULL;
+  ss->bits_len          = 0;
+  ss->bits_k            = 0;
+  ss->bits_num          = NULL;
+  ss->bits_set          = NULL;
+  ss->fps               = NULL;
+  ss->fps_cap           = 0;
+  ss->fps_num           = NULL;
+  ss->fps_lost          = NULL;
+  ss->fps_warned        = FALSE;
+  ss->fps_full          = FALSE;
+  ss->mem_used          = NULL;
+  ss->mem_unchecked     = NULL;
+  ss->mem_level         = SS_MEM_LEVEL_NONE;
+  ss->part              = NULL;
   return ss;
 }
 
 
 static inline void statespace_make_table(StateSpace ss)
 {
+  /* lock-free表はEWLockを使用しない */
+  BOOL use_lock = ss->thread_num > 1 && !lmn_env.enable_lockfree_tbl;
+
+  if (lmn_env.memory_limit > 0) {
+    unsigned int i;
+    ss->mem_used      = LMN_NALLOC(unsigned long, ss->thread_num);
+    ss->mem_unchecked = LMN_NALLOC(unsigned long, ss->thread_num);
+    for (i = 0; i < ss->thread_num; i++) {
+      ss->mem_used[i] = 0;
+      ss->mem_unchecked[i] = 0;
+    }
+  }
+
   if (lmn_env.mem_enc) {
     statespace_set_memenc(ss);
     ss->memid_tbl = statetable_make(ss->thread_num);
-    if (ss->thread_num > 1) {
+    if (use_lock) {
       statetable_set_lock(ss->memid_tbl, ewlock_make(ss->thread_num, DEFAULT_WLOCK_NUM));
     }
 
     if (statespace_has_property(ss)) {
       ss->acc_memid_tbl = statetable_make(ss->thread_num);
-      if (ss->thread_num > 1) {
+      if (use_lock) {
         statetable_set_lock(statespace_accept_memid_tbl(ss), ewlock_make(ss->thread_num, DEFAULT_WLOCK_NUM));
       }
     }
@@ -281,7 +406,7 @@ static inline void statespace_make_table(StateSpace ss)
       }
     }
 
-    if (ss->thread_num > 1) {
+    if (use_lock) {
       statetable_set_lock(statespace_tbl(ss), ewlock_make(ss->thread_num, DEFAULT_WLOCK_NUM));
 
       if (statespace_accept_tbl(ss)) {
@@ -348,6 +473,33 @@ void statespace_clear(StateSpace ss)
   }
 
   ss->init_state = NULL;
+  if (statespace_use_bitstate(ss)) {
+    memset(ss->bits, 0, ss->bits_len / 8);
+    for (i = 0; i < ss->thread_num; i++) {
+      ss->bits_num[i] = 0;
+      ss->bits_set[i] = 0;
+    }
+  }
+  if (statespace_use_hcompact(ss)) {
+    memset(ss->fps, 0, ss->fps_cap * sizeof(uint64_t));
+    for (i = 0; i < ss->thread_num; i++) {
+      ss->fps_num[i]  = 0;
+      ss->fps_lost[i] = 0;
+    }
+    ss->fps_warned = FALSE;
+    ss->fps_full   = FALSE;
+  }
+  if (statespace_use_mem_limit(ss)) {
+    for (i = 0; i < ss->thread_num; i++) {
+      ss->mem_used[i] = 0;
+      ss->mem_unchecked[i] = 0;
+    }
+  }
+  if (statespace_use_partition(ss)) {
+    for (i = 0; i < ss->part->n; i++) {
+      statetable_clear(ss->part->shards[i]);
+    }
+  }
   statetable_clear(statespace_tbl(ss));
   statetable_clear(statespace_memid_tbl(ss));
   statetable_clear(statespace_accept_tbl(ss));
@@ -356,13 +508,12 @@ void statespace_clear(StateSpace ss)
 
 void statespace_free(StateSpace ss)
 {
-  /* MEMO: openmpで並列freeすると, tcmallocがsegmentation faultする. */
-  //int nPEs = ss->thread_num;
-  int nPEs = 1;
-  statetable_free(statespace_tbl(ss),              nPEs);
-  statetable_free(statespace_memid_tbl(ss),        nPEs);
-  statetable_free(statespace_accept_tbl(ss),       nPEs);
-  statetable_free(statespace_accept_memid_tbl(ss), nPEs);
+  int nPEs = ss->thread_num;
+  BOOL bulk = ss->own_pools;
+  statetable_free(statespace_tbl(ss),              nPEs, bulk);
+  statetable_free(statespace_memid_tbl(ss),        nPEs, bulk);
+  statetable_free(statespace_accept_tbl(ss),       nPEs, bulk);
+  statetable_free(statespace_accept_memid_tbl(ss), nPEs, bulk);
 
   if (ss->thread_num > 1) {
     unsigned int i;
@@ -375,11 +526,38 @@ void statespace_free(StateSpace ss)
     vec_free(ss->end_states);
   }
 
+  if (statespace_use_bitstate(ss)) {
+    LMN_FREE(ss->bits);
+    LMN_FREE(ss->bits_num);
+    LMN_FREE(ss->bits_set);
+  }
+
+  if (statespace_use_hcompact(ss)) {
+    LMN_FREE(ss->fps);
+    LMN_FREE(ss->fps_num);
+    LMN_FREE(ss->fps_lost);
+  }
+
+  if (statespace_use_mem_limit(ss)) {
+    LMN_FREE(ss->mem_used);
+    LMN_FREE(ss->mem_unchecked);
+  }
+
+  if (statespace_use_partition(ss)) {
+    statespace_partition_free(ss->part, bulk);
+  }
+
 #ifdef PROFILE
   if (lmn_env.optimize_hash_old) {
     hashset_destroy(&ss->memid_hashes);
   }
 #endif
+
+  /* 登録済みの状態とバイナリストリングは, プールごと解放する */
+  if (ss->own_pools) {
+    state_mpool_release();
+    statespace_pools_owned = FALSE;
+  }
   LMN_FREE(ss);
 }
 
@@ -453,7 +631,8 @@ inline BOOL statespace_is_memid_hash(StateSpace states, unsigned long hash)
  * このとき, 状態sのメモリ領域を階層グラフ構造とバイナリストリングとでunionしているため,
  * 本関数の呼び出し側でs_memのメモリ管理を行う必要がある.
  * なお, 既にsのバイナリストリングを計算済みの場合,
- * バイナリストリングへのエンコード処理はskipするため, s_memはNULLで構わない. */
+ * バイナリストリングへのエンコード処理はskipするため, s_memはNULLで構わない.
+ * bitstate hashing/hash compaction使用時は既出の状態を保持していないため, 既出と判定した場合はNULLを返す. */
 State *statespace_insert(StateSpace ss, State *s)
 {
   StateTable *insert_dst;
@@ -466,6 +645,14 @@ State *statespace_insert(StateSpace ss, State *s)
   hashv = state_hash(s);
 #endif
 
+  if (statespace_use_bitstate(ss)) {
+    return statespace_insert_bitstate(ss, s);
+  } else if (statespace_use_hcompact(ss)) {
+    return statespace_insert_hcompact(ss, s);
+  } else if (statespace_use_partition(ss)) {
+    return statespace_insert_partition(ss, s);
+  }
+
   is_accept = statespace_has_property(ss) &&
               state_is_accept(statespace_automata(ss), s);
 
@@ -512,11 +699,14 @@ State *statespace_insert(StateSpace ss, State *s)
     }
   }
 
-  if (need_resize(statetable_num_by_me(insert_dst),
-                  statetable_cap_density(insert_dst))) {  /* tableのresize処理 */
+  if (statetable_need_resize(insert_dst)) {  /* tableのresize処理 */
     statetable_resize(insert_dst, insert_dst->cap);
   }
 
+  if (ret == s && statespace_use_mem_limit(ss)) {
+    statespace_mem_account(ss, s);
+  }
+
   return ret;
 }
 
@@ -542,7 +732,7 @@ State *statespace_insert_delta(StateSpace ss, State *s, struct MemDeltaRoot *d)
   state_set_mem(s, DMEM_ROOT_MEM(d));
 
   /* Xを基に, ハッシュ値/mem_idなどの状態データを計算する */
-  state_calc_hash(s, state_mem(s), statespace_use_memenc(ss));
+  state_calc_hash_delta(s, d, statespace_use_memenc(ss));
 
   /* 既にバイナリストリング計算済みとなるcanonical membrane使用時は,
    * この時点でdelta-stringを計算する */
@@ -550,7 +740,10 @@ State *statespace_insert_delta(StateSpace ss, State *s, struct MemDeltaRoot *d)
     state_calc_binstr_delta(s);
   }
 
+  /* ダンプ時に, 差分による変更のない子膜のエンコードを親状態から複写させる */
+  lmn_mem_dump_ref_set_delta(d);
   ret = statespace_insert(ss, s);
+  lmn_mem_dump_ref_set_delta(NULL);
 
   /* X(sに対応する階層グラフ構造)をparentに対応する階層グラフ構造に戻す */
   dmem_root_revert(d);
@@ -564,12 +757,142 @@ State *statespace_insert_delta(StateSpace ss, State *s, struct MemDeltaRoot *d)
 }
 
 
+/* statespace_insert_batchで一度に整列/prefetchする状態数の上限 */
+#define STATESPACE_BATCH_MAX  (64U)
+
+/* 状態の配列succs[0..n-1]を状態空間ssへまとめて登録し,
+ * 各succs[i]をstatespace_insert(ss, succs[i])の返り値で置き換える.
+ * 登録先バケットへのprefetchを全状態分先に発行し, ロックの区画(stripe), バケットの順に
+ * 整列してから登録するため, 分岐数の多い状態の展開時にキャッシュミスが減る.
+ * succs内に等価な状態が複数ある場合は, 先に登録された状態が残りの要素の返り値となる.
+ * (多重辺の除去は呼び出し側で行う) */
+void statespace_insert_batch(StateSpace ss, State **succs, unsigned int n)
+{
+  unsigned long bucket[STATESPACE_BATCH_MAX];
+  unsigned int  order[STATESPACE_BATCH_MAX];
+  unsigned int i, j, k, m;
+  unsigned long mask;
+  StateTable *st;
+
+  if (n < 2 || statespace_is_stateless(ss) || statespace_has_property(ss)) {
+    for (i = 0; i < n; i++) {
+      succs[i] = statespace_insert(ss, succs[i]);
+    }
+    return;
+  }
+
+  for (i = 0; i < n; i += m) {
+    m  = n - i < STATESPACE_BATCH_MAX ? n - i : STATESPACE_BATCH_MAX;
+    st = is_encoded(succs[i]) ? statespace_memid_tbl(ss) : statespace_tbl(ss);
+
+    if (!st || statetable_use_lockfree(st)) {
+      for (j = 0; j < m; j++) {
+        succs[i + j] = statespace_insert(ss, succs[i + j]);
+      }
+      continue;
+    }
+
+    statetable_prefetch(st, succs + i, m, bucket);
+
+    /* (stripe, bucket)の昇順に挿入ソート */
+    mask = st->lock ? st->lock->wlock_num - 1 : 0UL;
+    for (j = 0; j < m; j++) {
+      for (k = j; k > 0; k--) {
+        unsigned long b = bucket[order[k - 1]];
+        if ((b & mask) < (bucket[j] & mask) ||
+            ((b & mask) == (bucket[j] & mask) && b <= bucket[j])) {
+          break;
+        }
+        order[k] = order[k - 1];
+      }
+      order[k] = j;
+    }
+
+    for (j = 0; j < m; j++) {
+      State **p = &succs[i + order[j]];
+      *p = statespace_insert(ss, *p);
+    }
+  }
+}
+
+
+/* 状態を生成する前の階層グラフ構造で状態空間ssを検索できる場合に真を返す.
+ * 通常の状態管理表(statespace_tbl)で検索する構成に限る. (rehash先の表は検索しない) */
+BOOL statespace_lookup_mem_enable(StateSpace ss)
+{
+  StateTable *st = statespace_tbl(ss);
+  return st
+      && !statespace_has_property(ss)
+      && !statespace_use_memenc(ss)
+      && !statespace_is_stateless(ss)
+      && !statespace_use_partition(ss)
+      && !statetable_use_lockfree(st)
+#ifdef PROFILE
+      && !lmn_env.optimize_hash_old
+#endif
+      ;
+}
+
+
+/* 階層グラフ構造memとそのハッシュ値hashで状態空間ssを検索し,
+ * 等価な状態が登録済みならばその状態を, 未登録ならばNULLを返す.
+ * 遷移先の状態(とバイナリストリング)を生成する前に既出か否かを判定するために用いる.
+ * statespace_lookup_mem_enableが真の場合に限り使用できる.
+ * NULLを返した後に他のスレッドが等価な状態を登録することがあるため,
+ * 新規の状態はstatespace_insertで登録すること. */
+State *statespace_lookup_mem(StateSpace ss, LmnMembrane *mem, unsigned long hash)
+{
+  StateTable *st;
+  struct State probe;
+  State *str, *ret;
+
+  /* 比較関数に渡すためだけの状態. 膜memとハッシュ値だけを持たせる */
+  memset(&probe, 0, sizeof(struct State));
+  state_set_mem(&probe, mem);
+  probe.hash = hash;
+
+  st  = statespace_tbl(ss);
+  ret = NULL;
+  START__CRITICAL_SECTION(st->lock, ewlock_acquire_enter, env_my_thread_id());
+  {
+    for (str = st->tbl[state_hash(&probe) % statetable_cap(st)]; str; str = str->next) {
+      if (state_hash(&probe) != state_hash(str)) continue;
+
+      if (statetable_use_rehasher(st) && is_dummy(str)) {
+        /* ハッシュ値の衝突によりrehashされた状態: 等価な状態はrehash先の表にあり,
+         * 検索には膜のエンコードが必要になる. また, dummy状態のバイト列は任意のタイミングで
+         * 破棄されるため比較できない. 未登録として扱い, statespace_insertに判定させる */
+        break;
+      }
+
+      if (!STATE_EQUAL(st, &probe, str)) {
+        ret = str;
+        break;
+      }
+    }
+  }
+  FINISH_CRITICAL_SECTION(st->lock, ewlock_release_enter, env_my_thread_id());
+
+  return ret;
+}
+
+
 /* 重複検査や排他制御なしに状態sを状態表ssに登録する */
 void statespace_add_direct(StateSpace ss, State *s)
 {
   StateTable *add_dst;
 
-  if (is_encoded(s)) {
+  if (statespace_use_bitstate(ss)) {
+    statespace_insert_bitstate(ss, s);
+    return;
+  } else if (statespace_use_hcompact(ss)) {
+    statespace_insert_hcompact(ss, s);
+    return;
+  }
+
+  if (statespace_use_partition(ss)) {
+    add_dst = ss->part->shards[statespace_partition_owner(ss, s)];
+  } else if (is_encoded(s)) {
     add_dst = statespace_memid_tbl(ss);
   } else {
     add_dst = statespace_tbl(ss);
@@ -577,128 +900,995 @@ void statespace_add_direct(StateSpace ss, State *s)
 
   statetable_add_direct(add_dst, s);
 
-  if (need_resize(statetable_num_by_me(add_dst), statetable_cap_density(add_dst))) {
+  if (statetable_need_resize(add_dst)) {
     statetable_resize(add_dst, add_dst->cap);
   }
 }
 
 
-/* 高階関数 */
-void statespace_foreach(StateSpace ss, void (*func) ( ),
-                        LmnWord _arg1, LmnWord _arg2)
+/** -----------
+ *  Bitstate Hashing (supertrace)
+ *  状態そのものは保持せず, ハッシュ値から求めたbits_k個のビットをビット配列に立てて訪問済みとする.
+ *  異なる状態のビットが全て重なった場合は未訪問の状態を取りこぼすため, 探索は確率的になる.
+ */
+
+/* mhashの下位ビットは偏りがあるため, 全体を混ぜる */
+static inline unsigned long statespace_bitstate_mix(unsigned long h)
 {
-  statetable_foreach(statespace_tbl(ss),              func, _arg1, _arg2);
-  statetable_foreach(statespace_memid_tbl(ss),        func, _arg1, _arg2);
-  statetable_foreach(statespace_accept_tbl(ss),       func, _arg1, _arg2);
-  statetable_foreach(statespace_accept_memid_tbl(ss), func, _arg1, _arg2);
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  return h;
 }
 
-void statespace_foreach_parallel(StateSpace ss, void (*func) ( ),
-                                 LmnWord _arg1, LmnWord _arg2, int nPE)
+/* ハッシュ値hashに対応するbits_k個のビット(double hashing: h1 + i*h2)を立てる.
+ * 新たに立てたビットが1つでもあれば新規状態として真を返す.
+ * 並列実行時は同じ状態を複数のスレッドが新規と判定することがあるが, 重複して展開するだけで済む.
+ * 各ビットを新たに立てたと数えるのは, アトミックなORで立てたスレッドただ1つである */
+static BOOL statespace_bitstate_test_and_set(StateSpace ss, unsigned long hash)
 {
-  statetable_foreach_parallel(statespace_tbl(ss),
-                              func, _arg1, _arg2, nPE);
-  statetable_foreach_parallel(statespace_memid_tbl(ss),
-                              func, _arg1, _arg2, nPE);
-  statetable_foreach_parallel(statespace_accept_tbl(ss),
-                              func, _arg1, _arg2, nPE);
-  statetable_foreach_parallel(statespace_accept_memid_tbl(ss),
-                              func, _arg1, _arg2, nPE);
+  unsigned long h1, h2, mask, set;
+  unsigned int i;
+
+  h1   = statespace_bitstate_mix(hash);
+  h2   = statespace_bitstate_mix(h1) | 1UL; /* 刻み幅は奇数にする */
+  mask = ss->bits_len - 1;
+  set  = 0;
+
+  for (i = 0; i < ss->bits_k; i++) {
+    unsigned long b, w, m;
+    b = (h1 + i * h2) & mask;
+    w = b / BITSTATE_WORD_BITS;
+    m = 1UL << (b % BITSTATE_WORD_BITS);
+    if (!(ss->bits[w] & m)) {
+      if (ss->thread_num > 1) {
+        /* 他スレッドが同時に立てたビットは数えない. 更新前のワードにビットが無い場合に限り新規とする */
+        if (!(FETCH_AND_OR(ss->bits[w], m) & m)) set++;
+      } else {
+        ss->bits[w] |= m;
+        set++;
+      }
+    }
+  }
+
+  if (set > 0) {
+    ss->bits_set[env_my_thread_id()] += set;
+    ss->bits_num[env_my_thread_id()]++;
+    return TRUE;
+  } else {
+    return FALSE;
+  }
 }
 
+/* bitstate hashing用のstatespace_insert.
+ * 新規ならば状態管理表へは登録せずにs自身を, 既出ならばNULLを返す.
+ * 状態管理表へ登録する場合と同様に, 新規状態sにはバイナリストリングを設定する */
+static State *statespace_insert_bitstate(StateSpace ss, State *s)
+{
+  if (!statespace_bitstate_test_and_set(ss, state_hash(s))) {
+    return NULL;
+  }
 
-/*----------------------------------------------------------------------
- * StateTable
+  if (!is_encoded(s)) {
+    LmnBinStr compress = is_binstr_user(s) ? state_binstr(s) : NULL;
+    compress = statetable_compress_state(statespace_tbl(ss), s, compress);
+    state_set_compress_for_table(s, compress);
+  }
+  return s;
+}
+
+/* 状態空間ssでbitstate hashingを使用する.
+ * ビット配列はmbytesメガバイトに収まる最大の2のべき乗ビットとする.
+ * 初期状態を登録する前に呼び出すこと. (MT-unsafe) */
+void statespace_enable_bitstate(StateSpace ss, unsigned long mbytes, unsigned int k)
+{
+  unsigned long len, words;
+  unsigned int i;
+
+  len = BITSTATE_WORD_BITS;
+  while ((len << 1) / 8 <= (mbytes << 20)) {
+    len <<= 1;
+  }
+  words = len / BITSTATE_WORD_BITS;
+
+  ss->bits     = LMN_NALLOC(unsigned long, words);
+  memset(ss->bits, 0, sizeof(unsigned long) * words);
+  ss->bits_len = len;
+  ss->bits_k   = k;
+  ss->bits_num = LMN_NALLOC(unsigned long, ss->thread_num);
+  ss->bits_set = LMN_NALLOC(unsigned long, ss->thread_num);
+  for (i = 0; i < ss->thread_num; i++) {
+    ss->bits_num[i] = 0;
+    ss->bits_set[i] = 0;
+  }
+  statespace_set_bitstate(ss);
+}
+
+/* 探索終了時点のビット配列の充填率から, 未訪問の状態を既出と誤判定する確率を返す */
+double statespace_bitstate_omission(StateSpace ss)
+{
+  double fill = (double)statespace_bitstate_set(ss) / (double)ss->bits_len;
+  return pow(fill, (double)ss->bits_k);
+}
+
+/* 到達可能な状態のうち探索できた割合の推定値を返す.
+ * x個の状態を登録した時点の誤判定確率を(1 - e^{-kx/m})^kで近似し,
+ * 取りこぼした状態数の期待値を数値積分で求める. */
+double statespace_bitstate_coverage(StateSpace ss)
+{
+  double n, m, k, lost, step;
+  unsigned int i;
+
+  n = (double)statespace_num(ss);
+  m = (double)ss->bits_len;
+  k = (double)ss->bits_k;
+  if (n <= 0.0) return 1.0;
+
+  lost = 0.0;
+  step = n / BITSTATE_COVERAGE_STEPS;
+  for (i = 0; i < BITSTATE_COVERAGE_STEPS; i++) {
+    double x = (i + 0.5) * step;
+    lost += pow(1.0 - exp(-k * x / m), k) * step;
+  }
+  return n / (n + lost);
+}
+
+
+/** -----------
+ *  Memory Limit (--memory-limit)
+ *  登録した状態のメモリ量(状態管理表を含む)をスレッド毎に数え, 上限に近づくにつれて圧縮方式を強める.
+ *  プロファイラのPeakCounterはPROFILE時にしか存在しないため, 独自に計数する.
+ *   SS_MEM_LEVEL_Z    : 上限の3/4を越えた時点で, 以降に登録する状態のバイナリストリングをz圧縮する.
+ *   SS_MEM_LEVEL_COLD : 上限を越えた時点で, 展開済みの状態のバイナリストリングもz圧縮し直す.
+ *                       登録済みの状態を書き換えるため, 1スレッド実行時に限る.
+ *   SS_MEM_LEVEL_OVER : それでも上限を越える場合は, 警告を出して探索を続ける.
+ *  差分圧縮(--d-compress)は参照先の状態のバイナリストリングを非圧縮のまま参照するため, z圧縮に切り替えない.
  */
 
-static StateTable *statetable_make(int thread_num)
+/* 状態空間ssが保持する状態と状態管理表のメモリ量(byte)を返す */
+unsigned long statespace_mem_used(StateSpace ss)
 {
-  return statetable_make_with_size(TABLE_DEFAULT_INIT_SIZE, thread_num);
+  unsigned long ret;
+  unsigned int i;
+
+  ret = statespace_space(ss);
+  if (statespace_use_mem_limit(ss)) {
+    for (i = 0; i < ss->thread_num; i++) {
+      ret += ss->mem_used[i];
+    }
+  }
+  return ret;
 }
 
+/* 以降に登録する状態のバイナリストリングをz圧縮するよう, 状態管理表の圧縮関数を差し替える.
+ * 比較関数は変わらないため, 差し替え前後の状態が混在しても構わない */
+static void statespace_mem_use_z(StateSpace ss)
+{
+  StateTable *tbls[4];
+  unsigned int i;
 
-static StateTable *statetable_make_with_size(unsigned long size, int thread_num)
+  tbls[0] = statespace_tbl(ss);
+  tbls[1] = statespace_memid_tbl(ss);
+  tbls[2] = statespace_accept_tbl(ss);
+  tbls[3] = statespace_accept_memid_tbl(ss);
+  for (i = 0; i < ARY_SIZEOF(tbls); i++) {
+    if (tbls[i] && tbls[i]->type == &type_state_compress) {
+      tbls[i]->type = &type_state_compress_z;
+    }
+  }
+}
+
+/* 展開済みの状態sのバイナリストリングをz圧縮し直す. 圧縮しても小さくならない場合は何もしない */
+static void statespace_mem_recompress(State *s, LmnWord _ss)
 {
-  unsigned long i;
-  StateTable *st = LMN_MALLOC(StateTable);
-  st->thread_num = thread_num;
+  StateSpace ss = (StateSpace)_ss;
+  LmnBinStr bs, cmp;
+  unsigned long old_space, cmp_space;
+
+  bs = state_binstr(s);
+  if (!bs || is_encoded(s) || is_dummy(s) || s_is_d(s) ||
+      !is_expanded(s) || is_comp_z(bs)) {
+    return;
+  }
 
-  if (lmn_env.enable_compress_mem) {
-    if (lmn_env.z_compress) {
-      st->type = &type_state_compress_z;
-    } else {
-      st->type = &type_state_compress;
+  cmp = lmn_bscomp_z_encode(bs);
+  if (cmp == bs) return; /* zlibを使用できない */
+
+  old_space = lmn_binstr_space(bs);
+  cmp_space = lmn_binstr_space(cmp);
+  if (cmp_space < old_space) {
+    if (lmn_env.spill_dir) {
+      lmn_binstr_spill(cmp);
     }
+    state_set_binstr(s, cmp);
+    lmn_binstr_free(bs);
+    ss->mem_used[env_my_thread_id()] -= old_space - cmp_space;
   } else {
-    st->type = &type_state_default;
+    lmn_binstr_free(cmp);
   }
+}
 
-  st->use_rehasher = FALSE;
-  size             = table_new_size(size);
-  st->tbl          = LMN_NALLOC(State *, size);
-  st->cap          = size;
-  st->cap_density  = size / thread_num;
-  st->num          = LMN_NALLOC(unsigned long, thread_num);
-  st->num_dummy    = LMN_NALLOC(unsigned long, thread_num);
-  st->lock         = NULL;
-  st->rehash_tbl   = NULL;
+/* 状態空間ssのメモリ量を確認し, 必要に応じて圧縮レベルを上げる */
+static void statespace_mem_update(StateSpace ss)
+{
+  unsigned long used, limit;
+  BYTE org_lv, lv;
 
-  memset(st->tbl, 0x00, size * (sizeof(State*)));
+  org_lv = lv = statespace_mem_level(ss);
+  if (lv == SS_MEM_LEVEL_OVER) return;
 
-  for (i = 0; i < thread_num; i++) {
-    st->num[i]       = 0UL;
-    st->num_dummy[i] = 0UL;
+  limit  = lmn_env.memory_limit;
+  used   = statespace_mem_used(ss);
+  if (used < limit / 4 * 3) return;
+
+  if (lv == SS_MEM_LEVEL_NONE) {
+    if (!lmn_env.d_compress) {
+      statespace_mem_use_z(ss);
+    }
+    lv = SS_MEM_LEVEL_Z;
   }
 
-  return st;
-}
+  if (used >= limit && lv == SS_MEM_LEVEL_Z) {
+    if (ss->thread_num == 1 && !lmn_env.d_compress) {
+      statespace_foreach(ss, statespace_mem_recompress, (LmnWord)ss, DEFAULT_ARGS);
+      used = statespace_mem_used(ss);
+    }
+    lv = SS_MEM_LEVEL_COLD;
+  }
 
+  if (used >= limit && lv == SS_MEM_LEVEL_COLD) {
+    /* 警告は1度だけ出す */
+    if (CAS(ss->mem_level, org_lv, SS_MEM_LEVEL_OVER)) {
+      fprintf(stderr, "warning: state space exceeds --memory-limit (%lu bytes), "
+                      "continuing with the most compact encoding available\n", used);
+    }
+    return;
+  }
 
-static inline void statetable_clear(StateTable *st)
+  ss->mem_level = lv;
+}
+
+/* 新たに登録した状態sのメモリ量を計数する */
+static inline void statespace_mem_account(StateSpace ss, State *s)
 {
-  if (st) {
-    unsigned long i;
+  unsigned int id;
+  unsigned long space;
+
+  space = STATE_OBJ_SPACE;
+  if (state_binstr(s)) {
+    space += lmn_binstr_space(state_binstr(s));
+  } else if (state_mem(s)) {
+    space += lmn_mem_space(state_mem(s));
+  }
 
-    for (i = 0; i < st->thread_num; i++) {
-      st->num[i]       = 0;
-      st->num_dummy[i] = 0;
-    }
+  /* 確認の間隔を状態数ではなくメモリ量で決めるため, 状態数が少なくても上限を越えれば圧縮方式を強める */
+  id = env_my_thread_id();
+  ss->mem_used[id]      += space;
+  ss->mem_unchecked[id] += space;
+  if (ss->mem_unchecked[id] >= lmn_env.memory_limit / MEM_LIMIT_CHECK_RATIO) {
+    ss->mem_unchecked[id] = 0;
+    statespace_mem_update(ss);
+  }
+}
 
-    memset(st->tbl, 0x00, statetable_cap(st) * (sizeof(State*)));
+
+/** -----------
+ *  Hash Compaction
+ *  状態そのものは保持せず, 正規化したバイナリストリング(lmn_mem_encode)から求めた
+ *  64bitのfingerprintだけをopen addressing表に記録して訪問済みとする.
+ *  fingerprintはmhashとは独立に計算するため, 取りこぼしはfingerprintが一致した場合に限られる.
+ *  1状態あたりの記録量はfingerprint表の1要素(8byte)を充填率で割った値になる.
+ */
+
+/* バイト列から64bitのfingerprintを計算する. (FNV-1aの後に全ビットを混ぜる) */
+static inline uint64_t statespace_fingerprint(LmnBinStr bs)
+{
+  uint64_t h;
+  unsigned long i, n;
+
+  h = 0xcbf29ce484222325ULL;
+  n = (bs->len + 1) / TAG_IN_BYTE;
+  for (i = 0; i < n; i++) {
+    h ^= (uint64_t)bs->v[i];
+    h *= 0x100000001b3ULL;
   }
+  h ^= (uint64_t)bs->len;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h ? h : 1ULL; /* 0は空き要素を表すため使わない */
 }
 
+#define HCOMPACT_CHECK_INTERVAL  (4096UL)  /* 充填率を調べる間隔(スレッド毎の新規状態数) */
+#define HCOMPACT_WARN_FILL       (0.9)     /* 充填率がこの値を超えたら警告する */
 
-static void statetable_free(StateTable *st, int nPEs)
+/* fingerprint表の充填率が高い場合に1度だけ警告する.
+ * 表を拡張すると--hash-compactionで指定したメモリ量を超えるため, 拡張はしない */
+static void statespace_hcompact_check(StateSpace ss)
 {
-  if (st) {
+  if (!ss->fps_warned && statespace_hcompact_fill(ss) >= HCOMPACT_WARN_FILL &&
+      CAS(ss->fps_warned, FALSE, TRUE)) {
+    fprintf(stderr, "warning: hash compaction table is %.0f%% full, "
+                    "states will be omitted once it is full: increase --hash-compaction=<MB>\n",
+                    100.0 * statespace_hcompact_fill(ss));
+  }
+}
+
+/* fingerprint fpを表に記録する. 新たに記録した場合に真を返す.
+ * 並列実行時はCASで空き要素を確保する.
+ * 表が満杯の場合は記録できないため既出として扱い, 取りこぼした可能性のある状態として数える.
+ * (満杯の表の探索は表全体の走査になるため, 満杯になった後は探索しない) */
+static BOOL statespace_hcompact_test_and_set(StateSpace ss, uint64_t fp)
+{
+  unsigned long i, mask, n;
+  unsigned int id;
 
-    statetable_foreach_parallel(st, state_free, DEFAULT_ARGS, DEFAULT_ARGS, nPEs);
+  if (ss->fps_full) {
+    ss->fps_lost[env_my_thread_id()]++;
+    return FALSE;
+  }
 
-    if (st->lock) {
-      ewlock_free(st->lock);
+  mask = ss->fps_cap - 1;
+  i    = (unsigned long)fp & mask;
+  for (n = 0; n < ss->fps_cap; n++, i = (i + 1) & mask) {
+    uint64_t cur = ss->fps[i];
+    if (cur == fp) {
+      return FALSE;
     }
-    LMN_FREE(st->num_dummy);
-    LMN_FREE(st->num);
-    LMN_FREE(st->tbl);
-    LMN_FREE(st);
+    if (cur == 0) {
+      if (ss->thread_num == 1) {
+        ss->fps[i] = fp;
+      } else if (!CAS(ss->fps[i], 0, fp)) {
+        /* 他のスレッドが先に埋めた. 同じfingerprintか否かをもう一度調べる */
+        if (ss->fps[i] == fp) return FALSE;
+        continue;
+      }
+      id = env_my_thread_id();
+      if (++ss->fps_num[id] % HCOMPACT_CHECK_INTERVAL == 0) {
+        statespace_hcompact_check(ss);
+      }
+      return TRUE;
+    }
+  }
+
+  if (!ss->fps_full && CAS(ss->fps_full, FALSE, TRUE)) {
+    fprintf(stderr, "warning: hash compaction table is full, "
+                    "further new states are omitted: increase --hash-compaction=<MB>\n");
   }
+  ss->fps_lost[env_my_thread_id()]++;
+  return FALSE;
 }
 
+/* hash compaction用のstatespace_insert.
+ * 新規ならばs自身を, 既出ならばNULLを返す.
+ * fingerprintの計算に用いた正規化バイナリストリングは, 新規状態sのバイナリストリングとして使用する.
+ * (--disable-compressの場合は破棄して, 階層グラフ構造を保持させたままにする) */
+static State *statespace_insert_hcompact(StateSpace ss, State *s)
+{
+  LmnBinStr mid;
+  BOOL is_new;
 
+  if (is_encoded(s)) {
+    mid = state_binstr(s);
+  } else {
+    mid = lmn_mem_encode(state_mem(s));
+  }
 
+  is_new = statespace_hcompact_test_and_set(ss, statespace_fingerprint(mid));
 
-/* statetable_insert: 状態sが状態空間stに既出ならばその状態を, 新規ならばs自身を返す.
- *
- * 以下, ハッシュ値が等しい状態を検出した場合の振舞いに関するメモ
- * - 膜のハッシュ関数(mhash)から膜のIDのハッシュ関数(memid_hash)へのrehash:
- * -- (用語) 膜のハッシュ関数によるテーブル   : オリジナルテーブル
- * -- (用語) 膜IDのハッシュ関数によるテーブル : memidテーブル
- *
- * - 状態をRehashするケース
- * -- その1
- *  サクセッサ状態の展開時, 展開元と展開先とでハッシュ値が衝突する場合
- *  展開先状態のメモリはまだハッシュ表に登録していないため, 呼出しスレッドからの操作は全てMT-safe
+  if (!is_encoded(s)) {
+    if (is_new && lmn_env.enable_compress_mem) {
+      state_set_binstr(s, mid);
+      set_encoded(s);
+    } else {
+      lmn_binstr_free(mid);
+    }
+  }
+
+  return is_new ? s : NULL;
+}
+
+/* 状態空間ssでhash compactionを使用する.
+ * fingerprint表はmbytesメガバイトに収まる最大の2のべき乗要素とする.
+ * 初期状態を登録する前に呼び出すこと. (MT-unsafe) */
+void statespace_enable_hcompact(StateSpace ss, unsigned long mbytes)
+{
+  unsigned long cap;
+  unsigned int i;
+
+  cap = 1;
+  while ((cap << 1) * sizeof(uint64_t) <= (mbytes << 20)) {
+    cap <<= 1;
+  }
+
+  ss->fps     = LMN_NALLOC(uint64_t, cap);
+  memset(ss->fps, 0, sizeof(uint64_t) * cap);
+  ss->fps_cap = cap;
+  ss->fps_num  = LMN_NALLOC(unsigned long, ss->thread_num);
+  ss->fps_lost = LMN_NALLOC(unsigned long, ss->thread_num);
+  for (i = 0; i < ss->thread_num; i++) {
+    ss->fps_num[i]  = 0;
+    ss->fps_lost[i] = 0;
+  }
+  statespace_set_hcompact(ss);
+}
+
+/* fingerprint表の充填率を返す */
+double statespace_hcompact_fill(StateSpace ss)
+{
+  return (double)statespace_num_raw(ss) / (double)ss->fps_cap;
+}
+
+/* 探索終了時点の充填率から, 未訪問の状態を1つ以上取りこぼした確率を返す.
+ * n = 充填率 * 表の要素数 個の状態を登録する間に, 新規状態のfingerprintが
+ * 登録済みのいずれかと一致する確率の総和は n(n-1)/2^65 で近似できる. */
+double statespace_hcompact_omission(StateSpace ss)
+{
+  double n;
+
+  if (statespace_hcompact_lost(ss) > 0) {
+    return 1.0; /* 表が満杯になり, 状態を取りこぼした可能性がある */
+  }
+  n = statespace_hcompact_fill(ss) * (double)ss->fps_cap;
+  return 1.0 - exp(-(n * (n - 1.0)) / ldexp(1.0, 65));
+}
+
+/* fingerprint表が満杯になった後に既出として扱った状態数(取りこぼした状態数の上限)を返す */
+unsigned long statespace_hcompact_lost(StateSpace ss)
+{
+  unsigned long ret;
+  unsigned int i;
+
+  ret = 0;
+  for (i = 0; i < ss->thread_num; i++) {
+    ret += ss->fps_lost[i];
+  }
+  return ret;
+}
+
+
+/** -----------
+ *  Partitioned State Space (--bfs-partition)
+ *  状態のハッシュ値で状態空間をスレッド数の部分表(shard)に分割し, 各部分表は担当スレッドのみが
+ *  排他制御なしに操作する. 担当外の遷移先状態は送信側でバイナリストリングへ圧縮してから,
+ *  (送信元, 受信先)の組毎に用意したSPSCリングバッファを通してバッチ単位で担当スレッドへ送る.
+ *  スレッド間で共有するデータはリングバッファとバッチだけなので,
+ *  部分表を別プロセスへ置く場合もこの経路を置き換えれば済む.
+ */
+
+/* 状態sを担当するスレッドのIDを返す */
+static inline unsigned int statespace_partition_owner(StateSpace ss, State *s)
+{
+  return (unsigned int)(statespace_bitstate_mix(state_hash(s)) % ss->part->n);
+}
+
+/* 状態空間ssをスレッド数の部分表に分割する.
+ * 初期状態を登録する前に呼び出すこと. (MT-unsafe) */
+void statespace_enable_partition(StateSpace ss)
+{
+  struct StatePartition *p;
+  unsigned int i, n;
+
+  n = ss->thread_num;
+  p = LMN_MALLOC(struct StatePartition);
+  p->n       = n;
+  p->shards  = LMN_NALLOC(StateTable *, n);
+  p->rings   = LMN_NALLOC(SpscRing, n * n);
+  p->cur     = LMN_NALLOC(SsMsgBatch *, n * n);
+  p->pending = LMN_NALLOC(struct Vector, n * n);
+
+  for (i = 0; i < n; i++) {
+    /* 部分表は担当スレッドのみが登録するため, 容量をスレッド数で割らずに拡張判定を行う */
+    p->shards[i] = statetable_make(n);
+    p->shards[i]->owner_only  = TRUE;
+    p->shards[i]->cap_density = statetable_cap(p->shards[i]);
+  }
+  for (i = 0; i < n * n; i++) {
+    spscq_init(&p->rings[i], SS_MSG_RING_SIZE);
+    p->cur[i] = NULL;
+    vec_init(&p->pending[i], 4);
+  }
+
+  ss->part = p;
+  statespace_set_partition(ss);
+}
+
+/* bulkが真の場合, 状態はstate_mpool_releaseでプールごと解放するものとして, 1つずつプールへ返さない */
+static void statespace_partition_free(struct StatePartition *p, BOOL bulk)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < p->n * p->n; i++) {
+    /* 未配送のバッチが残っている場合(探索を中断した場合)は, 状態ごと破棄する */
+    SsMsgBatch *b;
+    while ((b = (SsMsgBatch *)spscq_pop(&p->rings[i]))) {
+      vec_push(&p->pending[i], (vec_data_t)b);
+    }
+    if (p->cur[i]) {
+      vec_push(&p->pending[i], (vec_data_t)p->cur[i]);
+    }
+    while (!vec_is_empty(&p->pending[i])) {
+      b = (SsMsgBatch *)vec_pop(&p->pending[i]);
+      for (j = 0; j < b->num; j++) {
+        if (bulk) {
+          state_free_in_bulk(b->msg[j].s);
+        } else {
+          state_free(b->msg[j].s);
+        }
+      }
+      LMN_FREE(b);
+    }
+    vec_destroy(&p->pending[i]);
+    spscq_destroy(&p->rings[i]);
+  }
+
+  for (i = 0; i < p->n; i++) {
+    statetable_free(p->shards[i], 1, bulk);
+  }
+
+  LMN_FREE(p->pending);
+  LMN_FREE(p->cur);
+  LMN_FREE(p->rings);
+  LMN_FREE(p->shards);
+  LMN_FREE(p);
+}
+
+/* 状態sを呼び出したスレッドが担当する場合に真を返す */
+BOOL statespace_partition_is_mine(StateSpace ss, State *s)
+{
+  return statespace_partition_owner(ss, s) == env_my_thread_id();
+}
+
+/* 分割時のstatespace_insert. 状態sは呼び出したスレッドの担当でなければならない */
+static State *statespace_insert_partition(StateSpace ss, State *s)
+{
+  StateTable *st;
+  State *ret;
+
+  LMN_ASSERT(statespace_partition_is_mine(ss, s));
+  st = ss->part->shards[env_my_thread_id()];
+#ifndef PROFILE
+  ret = statetable_insert(st, s);
+#else
+  {
+    unsigned long col = 0;
+    ret = statetable_insert(st, s, &col);
+  }
+#endif
+
+  if (statetable_need_resize(st)) {
+    statetable_resize(st, st->cap);
+  }
+  return ret;
+}
+
+/* 担当外の状態sを, 担当スレッドへ送るバッチに追加する.
+ * sは遷移元状態parentのidx番目のサクセッサとし, 送信前にバイナリストリングへ圧縮する.
+ * 同じparentから同じ担当スレッドへ送る状態の中にsと等価な状態があれば, その状態を返す.
+ * (sは送らないため, 呼び出し側で多重辺として扱う) それ以外はsを返す.
+ * バッチはstatespace_partition_sendで送信する */
+State *statespace_partition_forward(StateSpace ss, State *s,
+                                    State *parent, unsigned int idx)
+{
+  struct StatePartition *p;
+  StateTable *st;
+  SsMsgBatch *b;
+  unsigned int to, k, i, j;
+
+  p  = ss->part;
+  to = statespace_partition_owner(ss, s);
+  k  = env_my_thread_id() * p->n + to;
+  st = p->shards[to];
+
+  /* parentの遷移先は同じスレッドが連続して追加しているため, 末尾から辿って比較する */
+  b = p->cur[k];
+  i = b ? b->num : 0;
+  j = vec_num(&p->pending[k]);
+  while (TRUE) {
+    SsMsg *m;
+    if (i == 0) {
+      if (j == 0) break;
+      b = (SsMsgBatch *)vec_get(&p->pending[k], --j);
+      i = b->num;
+    }
+    m = &b->msg[--i];
+    if (m->parent != parent) break;
+    if (state_hash(m->s) == state_hash(s) && !(st->type->compare)(s, m->s)) {
+      return m->s;
+    }
+  }
+
+  if (!is_binstr_user(s)) {
+    state_set_compress_for_table(s, statetable_compress_state(st, s, NULL));
+  }
+
+  b = p->cur[k];
+  if (!b || b->num == SS_MSG_BATCH_SIZE) {
+    if (b) vec_push(&p->pending[k], (vec_data_t)b);
+    b = LMN_MALLOC(SsMsgBatch);
+    b->num = 0;
+    p->cur[k] = b;
+  }
+  b->msg[b->num].s      = s;
+  b->msg[b->num].parent = parent;
+  b->msg[b->num].idx    = idx;
+  b->num++;
+
+  return s;
+}
+
+/* 呼び出したスレッドが溜めたバッチを, 担当スレッドへのリングバッファに積む.
+ * flushが真ならば追記中のバッチも送る.
+ * リングバッファが満杯で送れなかったバッチが残る場合に真を返す.
+ * (受信側が取り出すまで待たずに戻るため, 真の場合は後で再度呼び出すこと) */
+BOOL statespace_partition_send(StateSpace ss, BOOL flush)
+{
+  struct StatePartition *p;
+  unsigned int to, k;
+  BOOL remain;
+
+  p = ss->part;
+  remain = FALSE;
+  for (to = 0; to < p->n; to++) {
+    k = env_my_thread_id() * p->n + to;
+    if (flush && p->cur[k] && p->cur[k]->num > 0) {
+      vec_push(&p->pending[k], (vec_data_t)p->cur[k]);
+      p->cur[k] = NULL;
+    }
+    while (!vec_is_empty(&p->pending[k])) {
+      if (!spscq_push(&p->rings[k], vec_peek(&p->pending[k]))) {
+        remain = TRUE;
+        break;
+      }
+      vec_pop(&p->pending[k]);
+    }
+  }
+  return remain;
+}
+
+/* いずれかのスレッドに, リングバッファに積めずに残っているバッチがある場合に真を返す.
+ * 全スレッドが送信を止めている間に呼び出すこと */
+BOOL statespace_partition_has_pending(StateSpace ss)
+{
+  unsigned int i;
+  for (i = 0; i < ss->part->n * ss->part->n; i++) {
+    if (!vec_is_empty(&ss->part->pending[i])) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* 呼び出したスレッド宛てに届いた状態を, 自身の部分表へ登録する.
+ * 登録結果ret, 受け取った状態s, sの遷移元状態parentとサクセッサ番号idxを引数にfuncを呼び出す.
+ * (ret == sならば新規状態, それ以外はsと等価な登録済みの状態retを検出したことを表す)
+ * 受け取った状態数を返す */
+unsigned long statespace_partition_receive(StateSpace ss,
+                                           void (*func)(State *, State *, State *, unsigned int, LmnWord),
+                                           LmnWord arg)
+{
+  struct StatePartition *p;
+  unsigned int from, i;
+  unsigned long ret;
+
+  p = ss->part;
+  ret = 0;
+  for (from = 0; from < p->n; from++) {
+    SpscRing *r;
+    SsMsgBatch *b;
+
+    if (from == env_my_thread_id()) continue;
+    r = &p->rings[from * p->n + env_my_thread_id()];
+    while ((b = (SsMsgBatch *)spscq_pop(r))) {
+      for (i = 0; i < b->num; i++) {
+        SsMsg *m = &b->msg[i];
+        (*func)(statespace_insert_partition(ss, m->s), m->s, m->parent, m->idx, arg);
+      }
+      ret += b->num;
+      LMN_FREE(b);
+    }
+  }
+  return ret;
+}
+
+/* 部分表に登録された状態数を返す */
+unsigned long statespace_partition_num(StateSpace ss)
+{
+  unsigned long ret = 0;
+  unsigned int i;
+  for (i = 0; i < ss->part->n; i++) {
+    ret += statetable_num(ss->part->shards[i]);
+  }
+  return ret;
+}
+
+/* 部分表の全状態を通常の状態管理表へ移し, 分割を解除する.
+ * 以降は分割しない場合と同じ関数で状態空間を走査できる.
+ * 全スレッドが送受信を終えた後に1スレッドから呼び出すこと. (MT-unsafe) */
+void statespace_partition_merge(StateSpace ss)
+{
+  unsigned int i;
+  for (i = 0; i < ss->part->n; i++) {
+    statetable_move_all(statespace_tbl(ss), ss->part->shards[i]);
+  }
+  statespace_partition_free(ss->part, FALSE);
+  ss->part = NULL;
+  statespace_unset_partition(ss);
+}
+
+
+/* 高階関数 */
+void statespace_foreach(StateSpace ss, void (*func) ( ),
+                        LmnWord _arg1, LmnWord _arg2)
+{
+  statetable_foreach(statespace_tbl(ss),              func, _arg1, _arg2);
+  statetable_foreach(statespace_memid_tbl(ss),        func, _arg1, _arg2);
+  statetable_foreach(statespace_accept_tbl(ss),       func, _arg1, _arg2);
+  statetable_foreach(statespace_accept_memid_tbl(ss), func, _arg1, _arg2);
+}
+
+void statespace_foreach_parallel(StateSpace ss, void (*func) ( ),
+                                 LmnWord _arg1, LmnWord _arg2, int nPE)
+{
+  statetable_foreach_parallel(statespace_tbl(ss),
+                              func, _arg1, _arg2, nPE);
+  statetable_foreach_parallel(statespace_memid_tbl(ss),
+                              func, _arg1, _arg2, nPE);
+  statetable_foreach_parallel(statespace_accept_tbl(ss),
+                              func, _arg1, _arg2, nPE);
+  statetable_foreach_parallel(statespace_accept_memid_tbl(ss),
+                              func, _arg1, _arg2, nPE);
+}
+
+
+/*----------------------------------------------------------------------
+ * StateTable
+ */
+
+static StateTable *statetable_make(int thread_num)
+{
+  return statetable_make_with_size(TABLE_DEFAULT_INIT_SIZE, thread_num);
+}
+
+
+static StateTable *statetable_make_with_size(unsigned long size, int thread_num)
+{
+  unsigned long i;
+  StateTable *st = LMN_MALLOC(StateTable);
+  st->thread_num = thread_num;
+
+  if (lmn_env.enable_compress_mem) {
+    if (lmn_env.z_compress) {
+      st->type = &type_state_compress_z;
+    } else {
+      st->type = &type_state_compress;
+    }
+  } else {
+    st->type = &type_state_default;
+  }
+
+  st->use_rehasher = FALSE;
+  st->use_lockfree = lmn_env.enable_lockfree_tbl;
+  st->owner_only   = FALSE;
+  if (st->use_lockfree) {
+    /* open addressingではハッシュ値のマスクでindexを求めるため2のべき乗にする */
+    size           = round2up(size);
+    st->lf_epoch   = LMN_NALLOC(unsigned long, thread_num * STATETABLE_LF_STRIDE);
+    memset((void *)st->lf_epoch, 0x00,
+           thread_num * STATETABLE_LF_STRIDE * sizeof(unsigned long));
+  } else {
+    size           = table_new_size(size);
+    st->lf_epoch   = NULL;
+  }
+  st->tbl          = LMN_NALLOC(State *, size);
+  st->cap          = size;
+  st->cap_density  = size / thread_num;
+  st->num          = LMN_NALLOC(unsigned long, thread_num);
+  st->num_dummy    = LMN_NALLOC(unsigned long, thread_num);
+  st->lock         = NULL;
+  st->rehash_tbl   = NULL;
+  st->resizing     = FALSE;
+  st->old_tbl      = NULL;
+  st->old_cap      = 0UL;
+  st->migrate      = NULL;
+  st->lf_seq       = 0UL;
+  st->retired      = NULL;
+  st->reclaiming   = FALSE;
+
+  memset(st->tbl, 0x00, size * (sizeof(State*)));
+
+  for (i = 0; i < thread_num; i++) {
+    st->num[i]       = 0UL;
+    st->num_dummy[i] = 0UL;
+  }
+
+  return st;
+}
+
+
+static inline void statetable_clear(StateTable *st)
+{
+  if (st) {
+    unsigned long i;
+
+    if (statetable_use_lockfree(st)) {
+      statetable_lf_complete(st);
+    }
+
+    for (i = 0; i < st->thread_num; i++) {
+      st->num[i]       = 0;
+      st->num_dummy[i] = 0;
+    }
+
+    memset(st->tbl, 0x00, statetable_cap(st) * (sizeof(State*)));
+  }
+}
+
+
+/* bulkが真の場合, 状態はstate_mpool_releaseでプールごと解放するものとして,
+ * 状態が保持する遷移や膜のみを解放する */
+static void statetable_free(StateTable *st, int nPEs, BOOL bulk)
+{
+  if (st) {
+
+    statetable_foreach_parallel(st, bulk ? state_free_in_bulk : state_free,
+                                DEFAULT_ARGS, DEFAULT_ARGS, nPEs);
+
+    if (st->lock) {
+      ewlock_free(st->lock);
+    }
+    if (st->lf_epoch) {
+      LMN_FREE(st->lf_epoch);
+    }
+    LMN_FREE(st->num_dummy);
+    LMN_FREE(st->num);
+    LMN_FREE(st->tbl);
+    LMN_FREE(st);
+  }
+}
+
+
+/* 表srcの全エントリを, 重複検査や排他制御なしに表dstへ付け替える. srcは空になる. (MT-unsafe) */
+static void statetable_move_all(StateTable *dst, StateTable *src)
+{
+  unsigned long i, n;
+
+  n = 0;
+  for (i = 0; i < statetable_cap(src); i++) {
+    State *ptr, *next;
+    for (ptr = src->tbl[i]; ptr; ptr = next) {
+      unsigned long bucket = state_hash(ptr) % statetable_cap(dst);
+      next = ptr->next;
+      ptr->next = dst->tbl[bucket];
+      dst->tbl[bucket] = ptr;
+      n++;
+    }
+    src->tbl[i] = NULL;
+  }
+
+  for (i = 0; i < src->thread_num; i++) {
+    src->num[i] = 0;
+  }
+  statetable_num_add(dst, n);
+
+  while (statetable_need_resize(dst)) {
+    statetable_resize(dst, dst->cap);
+  }
+}
+
+
+
+
+/* ハッシュ値が等しい登録済みの状態strと状態insとを比較する.
+ * insの探索を終える場合は, insと等価な状態(もしくはrehash先テーブルへの登録結果)を返す.
+ * 後続エントリの探索を継続する場合はNULLを返す.
+ * 処理の詳細はstatetable_insertのコメントを参照.
+ * (chain表とlock-free表の両方のinsert処理から呼び出す) */
+static State *statetable_lookup_hash_eq(StateTable *st, State *ins, State *str,
+                                        LmnBinStr compress, unsigned long *col)
+{
+  State *ret = NULL;
+
+  if (statetable_use_rehasher(st) && is_dummy(str) && !is_encoded(str)) {
+    /* A. オリジナルテーブルにおいて, dummy状態が比較対象
+     * 　 --> memidテーブル側の探索へ切り替える.
+     *    (オリジナルテーブルのdummy状態のバイト列は任意のタイミングで破棄されるため,
+     *     直接dummy状態上のメモリを比較対象とするとスレッドセーフでなくなる) */
+
+    if (is_binstr_user(ins)) {
+      state_free_binstr(ins);
+    } else if (compress) {
+      lmn_binstr_free(compress);
+    }
+    s_unset_d(ins);
+    state_calc_mem_encode(ins);
+
+#ifndef PROFILE
+    ret = statetable_insert(statetable_rehash_tbl(st), ins);
+#else
+    ret = statetable_insert(statetable_rehash_tbl(st), ins, col);
+#endif
+  }
+  else if (!STATE_EQUAL(st, ins, str)) {
+    /** B. memidテーブルへのlookupの場合,
+     *     もしくはオリジナルテーブルへのlookupで非dummy状態と等価な場合 */
+    if (is_dummy(str) && is_encoded(str)) {
+      /* rehashテーブル側に登録されたデータ(オリジナル側のデータ:parentを返す) */
+      ret = state_get_parent(str);
+    } else {
+      ret = str;
+    }
+    LMN_ASSERT(ret);
+  }
+  else if (is_encoded(str)){
+    /** C. memidテーブルへのlookupでハッシュ値が衝突した場合. (同形成判定結果が偽) */
+#ifdef PROFILE
+    if (lmn_env.profile_level >= 3) {
+      profile_countup(PROFILE_COUNT__HASH_CONFLICT_HASHV);
+    }
+#endif
+  }
+  else {
+    /** D. オリジナルテーブルへのlookupで非dummy状態とハッシュ値が衝突した場合. */
+    LMN_ASSERT(!is_encoded(str));
+#ifdef PROFILE
+    (*col)++;
+    if (lmn_env.profile_level >= 3) {
+      profile_countup(PROFILE_COUNT__HASH_CONFLICT_HASHV);
+    }
+#endif
+    if (statetable_use_rehasher(st)) {
+      if (state_get_parent(ins) == str) {
+        /* 1step遷移した状態insの親状態とでハッシュ値が衝突している場合:
+         *  + 状態insだけでなくその親状態もrehashする.
+         *  + ただし, encodeした親状態をmemidテーブルへ突っ込んだ後,
+         *    親状態の従来のバイト列の破棄は実施しない.
+         *    これは, 他のスレッドによる状態比較処理が本スレッドの処理と競合した際に,
+         *    本スレッドが立てるdummyフラグを他のスレッドが見逃す恐れがあるため  */
+        statetable_memid_rehash(str, st);
+        set_dummy(str);
+      }
+
+      /* 比較元をencode */
+      if (is_binstr_user(ins)) {
+        state_free_binstr(ins);
+      } else if (compress) {
+        lmn_binstr_free(compress);
+      }
+      s_unset_d(ins);
+      state_calc_mem_encode(ins);
+
+#ifndef PROFILE
+      ret = statetable_insert(statetable_rehash_tbl(st), ins);
+#else
+      ret = statetable_insert(statetable_rehash_tbl(st), ins, col);
+#endif
+
+      LMN_ASSERT(ret);
+    }
+  }
+
+  return ret;
+}
+
+
+/* statetable_insert: 状態sが状態空間stに既出ならばその状態を, 新規ならばs自身を返す.
+ *
+ * 以下, ハッシュ値が等しい状態を検出した場合の振舞いに関するメモ
+ * - 膜のハッシュ関数(mhash)から膜のIDのハッシュ関数(memid_hash)へのrehash:
+ * -- (用語) 膜のハッシュ関数によるテーブル   : オリジナルテーブル
+ * -- (用語) 膜IDのハッシュ関数によるテーブル : memidテーブル
+ *
+ * - 状態をRehashするケース
+ * -- その1
+ *  サクセッサ状態の展開時, 展開元と展開先とでハッシュ値が衝突する場合
+ *  展開先状態のメモリはまだハッシュ表に登録していないため, 呼出しスレッドからの操作は全てMT-safe
  * -- その2
  *  既にハッシュ表(オリジナルテーブル)に登録してある状態をrehashできる条件は,
  *  >> 状態空間に対して全サクセッサの登録が完了した状態 << に対する場合(即ち, 展開済み状態)のみ.
@@ -762,6 +1952,14 @@ static State *statetable_insert(StateTable *st, State *ins)
   State *ret;
   LmnBinStr compress;
 
+  if (statetable_use_lockfree(st)) {
+#ifndef PROFILE
+    return statetable_insert_lockfree(st, ins);
+#else
+    return statetable_insert_lockfree(st, ins, col);
+#endif
+  }
+
   if (is_binstr_user(ins)) {
     /* 既に状態insがバイナリストリングを保持している場合 */
     compress = state_binstr(ins);
@@ -817,100 +2015,12 @@ static State *statetable_insert(StateTable *st, State *ins)
 #endif
 
       if (hash == state_hash(str)) {
-        /* >>>>>>> ハッシュ値が等しい状態に対する処理ここから <<<<<<<<　*/
-        if (lmn_env.hash_compaction) {
-          if (is_dummy(str) && is_encoded(str)) {
-            /* rehashテーブル側に登録されたデータ(オリジナル側のデータ:parentを返す) */
-            ret = state_get_parent(str);
-          } else {
-            ret = str;
-          }
-          break;
-        }
-
-        if (statetable_use_rehasher(st) && is_dummy(str) && !is_encoded(str)) {
-          /* A. オリジナルテーブルにおいて, dummy状態が比較対象
-           * 　 --> memidテーブル側の探索へ切り替える.
-           *    (オリジナルテーブルのdummy状態のバイト列は任意のタイミングで破棄されるため,
-           *     直接dummy状態上のメモリを比較対象とするとスレッドセーフでなくなる) */
-
-          if (is_binstr_user(ins)) {
-            state_free_binstr(ins);
-          } else if (compress) {
-            lmn_binstr_free(compress);
-          }
-          s_unset_d(ins);
-          state_calc_mem_encode(ins);
-          /*compress = NULL;*/
-
 #ifndef PROFILE
-          ret = statetable_insert(statetable_rehash_tbl(st), ins);
+        ret = statetable_lookup_hash_eq(st, ins, str, compress, NULL);
 #else
-          ret = statetable_insert(statetable_rehash_tbl(st), ins, col);
+        ret = statetable_lookup_hash_eq(st, ins, str, compress, col);
 #endif
-          break;
-        }
-        else if (!STATE_EQUAL(st, ins, str)) {
-          /** B. memidテーブルへのlookupの場合,
-           *     もしくはオリジナルテーブルへのlookupで非dummy状態と等価な場合 */
-          if (is_dummy(str) && is_encoded(str)) {
-            /* rehashテーブル側に登録されたデータ(オリジナル側のデータ:parentを返す) */
-            ret = state_get_parent(str);
-          } else {
-            ret = str;
-          }
-          LMN_ASSERT(ret);
-          break;
-        }
-        else if (is_encoded(str)){
-          /** C. memidテーブルへのlookupでハッシュ値が衝突した場合. (同形成判定結果が偽) */
-#ifdef PROFILE
-          if (lmn_env.profile_level >= 3) {
-            profile_countup(PROFILE_COUNT__HASH_CONFLICT_HASHV);
-          }
-#endif
-        }
-        else {
-          /** D. オリジナルテーブルへのlookupで非dummy状態とハッシュ値が衝突した場合. */
-          LMN_ASSERT(!is_encoded(str));
-#ifdef PROFILE
-          (*col)++;
-          if (lmn_env.profile_level >= 3) {
-            profile_countup(PROFILE_COUNT__HASH_CONFLICT_HASHV);
-          }
-#endif
-          if (statetable_use_rehasher(st)) {
-            if (state_get_parent(ins) == str) {
-              /* 1step遷移した状態insの親状態とでハッシュ値が衝突している場合:
-               *  + 状態insだけでなくその親状態もrehashする.
-               *  + ただし, encodeした親状態をmemidテーブルへ突っ込んだ後,
-               *    親状態の従来のバイト列の破棄は実施しない.
-               *    これは, 他のスレッドによる状態比較処理が本スレッドの処理と競合した際に,
-               *    本スレッドが立てるdummyフラグを他のスレッドが見逃す恐れがあるため  */
-              statetable_memid_rehash(str, st);
-              set_dummy(str);
-            }
-
-            /* 比較元をencode */
-            if (is_binstr_user(ins)) {
-              state_free_binstr(ins);
-            } else if (compress) {
-              lmn_binstr_free(compress);
-            }
-            s_unset_d(ins);
-            state_calc_mem_encode(ins);
-
-#ifndef PROFILE
-            ret = statetable_insert(statetable_rehash_tbl(st), ins);
-#else
-            ret = statetable_insert(statetable_rehash_tbl(st), ins, col);
-#endif
-
-            LMN_ASSERT(ret);
-            break;
-          }
-        }
-        /* >>>>>>> ハッシュ値が等しい状態に対する処理ここまで <<<<<<<< */
+        if (ret) break;
       }
 
       /** エントリリストへの状態追加操作:
@@ -966,9 +2076,38 @@ static State *statetable_insert(StateTable *st, State *ins)
 }
 
 
+/* 状態ss[0..n-1]の登録先バケット番号をbucketへ求め, バケットと先頭エントリをprefetchする.
+ * 先頭エントリの参照はテーブル拡張と競合しないようenter lockの内側で行う */
+static void statetable_prefetch(StateTable *st, State **ss, unsigned int n, unsigned long *bucket)
+{
+  unsigned int i;
+
+  START__CRITICAL_SECTION(st->lock, ewlock_acquire_enter, env_my_thread_id());
+  {
+    unsigned long cap = statetable_cap(st);
+
+    for (i = 0; i < n; i++) {
+      bucket[i] = state_hash(ss[i]) % cap;
+      LMN_PREFETCH(&st->tbl[bucket[i]]);
+    }
+
+    for (i = 0; i < n; i++) {
+      State *head = st->tbl[bucket[i]];
+      if (head) LMN_PREFETCH(head);
+    }
+  }
+  FINISH_CRITICAL_SECTION(st->lock, ewlock_release_enter, env_my_thread_id());
+}
+
+
 /* 重複検査なしに状態sを状態表stに登録する */
 static void statetable_add_direct(StateTable *st, State *s)
 {
+  if (statetable_use_lockfree(st)) {
+    statetable_add_direct_lockfree(st, s);
+    return;
+  }
+
   START__CRITICAL_SECTION(st->lock, ewlock_acquire_enter, env_my_thread_id());
   {
     LmnBinStr compress;
@@ -1018,45 +2157,531 @@ static void statetable_add_direct(StateTable *st, State *s)
   FINISH_CRITICAL_SECTION(st->lock, ewlock_release_enter, env_my_thread_id());
 }
 
+/*----------------------------------------------------------------------
+ * Lock-Free StateTable (open addressing)
+ *
+ * --lockfree-tbl指定時に使用する. 状態は(chainを構成せず)スロット配列に直接登録する.
+ *  - 登録: 空スロットに対するCASで状態のアドレスを書き込む. CASに失敗した場合は,
+ *          他のスレッドが書き込んだ状態と比較した後, 線形探索を継続する.
+ *  - 探索: スロットを線形に辿り, ハッシュ値が等しい状態と比較する. ロックは取得しない.
+ *  - 拡張: 2倍のスロット配列を確保して公開した後, 移送元のスロットを一定数(チャンク)ずつ,
+ *          表を操作する全スレッドが協調して移送する. 全スレッドを停止させることはない.
+ *
+ * 拡張中のスロット配列は, tbl(移送先)とold_tbl(移送元)の2つになる.
+ *  - 新しい状態は常にtblへ登録する.
+ *  - 探索はold_tbl, tblの順に行う. old_tblの探索列の末尾の空スロットは
+ *    LF_MOVED_EMPTYで閉じ, 拡張前の表を参照しているスレッドが登録できないようにする.
+ *  - 移送済みのスロットにはLF_MOVED_FULL(状態を移送した)かLF_MOVED_EMPTY(空だった)を書き込む.
+ *    これらを読んだスレッドは, 表の参照を取り直して操作をやり直す.
+ *  - 移送元の解放は, 移送完了時点で表を操作中だった全スレッドが抜けた後に行う.
+ *    スレッド毎の操作カウンタlf_epochの移送完了時点の値を記録しておき,
+ *    各スレッドが表の操作を終える度に解放可能かを調べる(待ち合わせはしない).
+ */
+
+#define LF_MOVED_EMPTY                ((State *)0x1)
+#define LF_MOVED_FULL                 ((State *)0x2)
+#define LF_IS_MOVED(S)                ((S) == LF_MOVED_EMPTY || (S) == LF_MOVED_FULL)
+#define STATETABLE_LF_MIGRATE_CHUNK   (1024UL)  /* 1回の操作で移送する移送元スロット数 */
+
+/* 拡張1回分の移送の進捗. 拡張毎に確保し, 移送元と一緒に解放する.
+ * (前回の拡張の表の組を参照したままのスレッドが, 今回の拡張の進捗を書き換えないようにする) */
+struct StateTableMigrate {
+  volatile unsigned long pos;   /* 次に移送を担当する移送元スロットの位置 */
+  volatile unsigned long done;  /* 移送を完了した移送元スロット数 */
+};
+
+/* 移送を終えて解放待ちのスロット配列 */
+struct StateTableRetired {
+  State         **tbl;
+  struct StateTableMigrate *mig;
+  unsigned long *epoch;   /* 移送完了時点の各スレッドの操作カウンタ */
+  struct StateTableRetired *next;
+};
+
+/* スレッドが参照する表の組 */
+typedef struct LFView {
+  State         **tbl;
+  unsigned long cap;
+  State         **old_tbl;
+  unsigned long old_cap;
+  struct StateTableMigrate *mig;
+} LFView;
+
+/* mhashの下位ビットは偏りがあるため, 上位ビットを混ぜてからマスクを取る */
+static inline unsigned long statetable_lf_index(unsigned long hash, unsigned long cap)
+{
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3bUL;
+  hash ^= hash >> 16;
+  return hash & (cap - 1);
+}
+
+#define statetable_lf_next_index(I, Cap)  (((I) + 1) & ((Cap) - 1))
+#define statetable_lf_epoch(St, Id)       ((St)->lf_epoch[(Id) * STATETABLE_LF_STRIDE])
+
+/* 表の参照を取得する. 公開中(シーケンス番号が奇数)の場合や, 読み出し中に公開が行われた場合は読み直す */
+static inline void statetable_lf_view(StateTable *st, LFView *v)
+{
+  unsigned long seq;
+  do {
+    seq = st->lf_seq;
+    MEM_BARRIER();
+    v->tbl     = st->tbl;
+    v->cap     = st->cap;
+    v->old_tbl = st->old_tbl;
+    v->old_cap = st->old_cap;
+    v->mig     = st->migrate;
+    MEM_BARRIER();
+  } while ((seq & 1UL) || seq != st->lf_seq);
+}
+
+/* 状態sを(移送先の)スロット配列tblへ重複検査なしに登録する */
+static inline void statetable_lf_put(State **tbl, unsigned long cap, State *s)
+{
+  unsigned long idx = statetable_lf_index(state_hash(s), cap);
+  while (tbl[idx] || !CAS(tbl[idx], NULL, s)) {
+    idx = statetable_lf_next_index(idx, cap);
+  }
+}
+
+/* 移送元のi番目のスロットを移送する. 担当範囲はチャンク単位で排他的に割り当てるため,
+ * 状態を保持するスロットを書き換えるのは本関数の呼出しスレッドのみ */
+static inline void statetable_lf_migrate_slot(LFView *v, unsigned long i)
+{
+  while (1) {
+    State *s = v->old_tbl[i];
+    if (LF_IS_MOVED(s)) {
+      return;
+    } else if (!s) {
+      if (CAS(v->old_tbl[i], NULL, LF_MOVED_EMPTY)) return;
+    } else {
+      /* 先に移送先へ登録してから移送元を閉じる. 閉じるまでの間は移送元の探索で発見される */
+      statetable_lf_put(v->tbl, v->cap, s);
+      MEM_BARRIER();
+      v->old_tbl[i] = LF_MOVED_FULL;
+      return;
+    }
+  }
+}
+
+/* 移送元の1チャンク分の移送を手伝う. 最後のチャンクを移送したスレッドが移送元を表から外す */
+static void statetable_lf_migrate(StateTable *st, LFView *v)
+{
+  unsigned long from, to, i;
+
+  from = ADD_AND_FETCH(v->mig->pos, STATETABLE_LF_MIGRATE_CHUNK)
+       - STATETABLE_LF_MIGRATE_CHUNK;
+  if (from >= v->old_cap) return;
+
+  to = from + STATETABLE_LF_MIGRATE_CHUNK;
+  if (to > v->old_cap) to = v->old_cap;
+  for (i = from; i < to; i++) {
+    statetable_lf_migrate_slot(v, i);
+  }
+
+  if (ADD_AND_FETCH(v->mig->done, to - from) == v->old_cap) {
+    ADD_AND_FETCH(st->lf_seq, 1);
+    st->old_tbl = NULL;
+    st->old_cap = 0UL;
+    st->migrate = NULL;
+    ADD_AND_FETCH(st->lf_seq, 1);
+    statetable_lf_retire(st, v->old_tbl, v->mig);
+    st->resizing = FALSE;
+#ifdef PROFILE
+    if (lmn_env.profile_level >= 3) {
+      profile_countup(PROFILE_COUNT__HASH_RESIZE_APPLY);
+    }
+#endif
+  }
+}
+
+/* 移送を終えたスロット配列tblを解放待ちリストへ追加する */
+static void statetable_lf_retire(StateTable *st, State **tbl, struct StateTableMigrate *mig)
+{
+  struct StateTableRetired *r;
+  unsigned int n;
+
+  r        = LMN_MALLOC(struct StateTableRetired);
+  r->tbl   = tbl;
+  r->mig   = mig;
+  r->epoch = LMN_NALLOC(unsigned long, st->thread_num);
+  for (n = 0; n < st->thread_num; n++) {
+    r->epoch[n] = statetable_lf_epoch(st, n);
+  }
+
+  while (!CAS(st->reclaiming, FALSE, TRUE)) {
+    lmn_thread_yield_CPU();
+  }
+  r->next     = st->retired;
+  st->retired = r;
+  MEM_BARRIER();
+  st->reclaiming = FALSE;
+}
+
+/* 解放待ちのスロット配列のうち, 移送完了時点で表を操作中だった全スレッドが
+ * その操作を抜けたものを解放する. 他のスレッドが解放処理中ならば何もしない */
+static void statetable_lf_reclaim(StateTable *st)
+{
+  struct StateTableRetired **p;
+
+  if (st->reclaiming || !CAS(st->reclaiming, FALSE, TRUE)) return;
+
+  p = &st->retired;
+  while (*p) {
+    struct StateTableRetired *r = *p;
+    BOOL quiescent = TRUE;
+    unsigned int n;
+
+    for (n = 0; n < st->thread_num; n++) {
+      if ((r->epoch[n] & 1UL) && statetable_lf_epoch(st, n) == r->epoch[n]) {
+        quiescent = FALSE;
+        break;
+      }
+    }
+
+    if (quiescent) {
+      *p = r->next;
+      LMN_FREE(r->tbl);
+      LMN_FREE(r->mig);
+      LMN_FREE(r->epoch);
+      LMN_FREE(r);
+    } else {
+      p = &r->next;
+    }
+  }
+
+  MEM_BARRIER();
+  st->reclaiming = FALSE;
+}
+
+/* 表の操作を開始する */
+static inline void statetable_lf_enter(StateTable *st)
+{
+  statetable_lf_epoch(st, env_my_thread_id())++;
+  MEM_BARRIER();
+}
+
+/* 表の操作を終了する. 解放待ちの移送元があれば解放を試みる */
+static inline void statetable_lf_exit(StateTable *st)
+{
+  MEM_BARRIER();
+  statetable_lf_epoch(st, env_my_thread_id())++;
+  if (st->retired) {
+    statetable_lf_reclaim(st);
+  }
+}
+
+/* 拡張中であれば残りの移送を全て行い, 移送元を解放する. MT-Unsafe */
+static void statetable_lf_complete(StateTable *st)
+{
+  if (st->old_tbl) {
+    LFView v;
+    unsigned long i;
+    statetable_lf_view(st, &v);
+    for (i = 0; i < v.old_cap; i++) {
+      statetable_lf_migrate_slot(&v, i);
+    }
+    LMN_FREE(st->old_tbl);
+    LMN_FREE(st->migrate);
+    st->old_tbl = NULL;
+    st->old_cap = 0UL;
+    st->migrate = NULL;
+    st->resizing = FALSE;
+  }
+  while (st->retired) {
+    struct StateTableRetired *r = st->retired;
+    st->retired = r->next;
+    LMN_FREE(r->tbl);
+    LMN_FREE(r->mig);
+    LMN_FREE(r->epoch);
+    LMN_FREE(r);
+  }
+}
+
+
+#ifdef PROFILE
+static State *statetable_insert_lockfree(StateTable *st, State *ins, unsigned long *col)
+#else
+static State *statetable_insert_lockfree(StateTable *st, State *ins)
+#endif
+{
+  State *ret, *str;
+  LmnBinStr compress;
+  unsigned long idx, hash;
+  LFView v;
+
+  if (is_binstr_user(ins)) {
+    /* 既に状態insがバイナリストリングを保持している場合 */
+    compress = state_binstr(ins);
+  } else {
+    compress = NULL;
+  }
+
+  ret  = NULL;
+  hash = state_hash(ins);
+  statetable_lf_enter(st);
+
+retry:
+  statetable_lf_view(st, &v);
+
+  if (v.old_tbl) {
+    statetable_lf_migrate(st, &v);
+
+    /* 移送元の探索: 探索列の末尾の空スロットは閉じる */
+    idx = statetable_lf_index(hash, v.old_cap);
+    while (1) {
+      str = v.old_tbl[idx];
+      if (!str) {
+        if (CAS(v.old_tbl[idx], NULL, LF_MOVED_EMPTY)) break;
+        continue;
+      }
+      if (str == LF_MOVED_EMPTY) break;
+      if (str != LF_MOVED_FULL && hash == state_hash(str)) {
+#ifndef PROFILE
+        ret = statetable_lookup_hash_eq(st, ins, str, compress, NULL);
+#else
+        ret = statetable_lookup_hash_eq(st, ins, str, compress, col);
+#endif
+        if (ret) goto done;
+      }
+      idx = statetable_lf_next_index(idx, v.old_cap);
+    }
+  }
+
+  idx = statetable_lf_index(hash, v.cap);
+  while (!ret) {
+    str = v.tbl[idx];
+
+    if (!str) {
+      /* 空スロット: バイト列を設定してからCASで公開する.
+       * CASに失敗した場合は, 比較のために階層グラフ構造を戻し, 書き込まれた状態と比較する */
+      LmnMembrane *m = state_mem(ins);
+      compress = statetable_compress_state(st, ins, compress);
+      state_set_compress_for_table(ins, compress);
+      if (CAS(v.tbl[idx], NULL, ins)) {
+        statetable_num_add(st, 1);
+        ret = ins;
+        break;
+      }
+
+      if (m) {
+        state_set_mem(ins, m);
+      }
+      str = v.tbl[idx];
+#ifdef PROFILE
+      if (lmn_env.profile_level >= 3) {
+        profile_countup(PROFILE_COUNT__HASH_FAIL_TO_INSERT);
+      }
+#endif
+    }
+
+    if (LF_IS_MOVED(str)) {
+      /* 参照していた表が移送元になった */
+      goto retry;
+    }
+
+#ifdef PROFILE
+    if (lmn_env.profile_level >= 3) {
+      profile_countup(PROFILE_COUNT__HASH_CONFLICT_ENTRY);
+    }
+#endif
+
+    if (hash == state_hash(str)) {
+#ifndef PROFILE
+      ret = statetable_lookup_hash_eq(st, ins, str, compress, NULL);
+#else
+      ret = statetable_lookup_hash_eq(st, ins, str, compress, col);
+#endif
+      if (ret) break;
+    }
+
+    idx = statetable_lf_next_index(idx, v.cap);
+  }
+
+done:
+  statetable_lf_exit(st);
+
+  if (ret != ins) {
+    /* 別のスレッドの割込みで追加に失敗した場合, 計算したバイト列を破棄する.
+     * CASに失敗して階層グラフ構造を戻した場合, バイト列は状態insの管理から外れている */
+    if (is_binstr_user(ins)) {
+      state_free_binstr(ins);
+    } else if (compress) {
+      lmn_binstr_free(compress);
+    }
+  }
+
+  return ret;
+}
+
+
+/* 重複検査なしに状態sをlock-free表stに登録する */
+static void statetable_add_direct_lockfree(StateTable *st, State *s)
+{
+  LmnBinStr compress;
+  unsigned long idx;
+  LFView v;
+
+  if (is_binstr_user(s)) {
+    compress = state_binstr(s);
+  } else {
+    compress = NULL;
+  }
+  compress = statetable_compress_state(st, s, compress);
+  state_set_compress_for_table(s, compress);
+
+  statetable_lf_enter(st);
+retry:
+  statetable_lf_view(st, &v);
+  if (v.old_tbl) {
+    statetable_lf_migrate(st, &v);
+  }
+
+  idx = statetable_lf_index(state_hash(s), v.cap);
+  while (1) {
+    State *str = v.tbl[idx];
+    if (!str) {
+      if (CAS(v.tbl[idx], NULL, s)) break;
+      str = v.tbl[idx];
+    }
+    if (LF_IS_MOVED(str)) goto retry;
+    idx = statetable_lf_next_index(idx, v.cap);
+  }
+  statetable_num_add(st, 1);
+  statetable_lf_exit(st);
+}
+
+
+/* lock-free表のサイズを2倍に拡張する.
+ * 移送先を確保して公開するだけで, 移送は以降の表操作で協調して行う.
+ * 既に他のスレッドが拡張中の場合は何もしない(呼出し元は次回のinsert後に再判定する) */
+static void statetable_resize_lockfree(StateTable *st, unsigned long old_cap)
+{
+  unsigned long new_cap;
+  State **new_tbl;
+  struct StateTableMigrate *mig;
+
+  if (st->resizing || !CAS(st->resizing, FALSE, TRUE)) return;
+  if (st->cap != old_cap) {
+    /* 他のスレッドが既に拡張した */
+    st->resizing = FALSE;
+    return;
+  }
+
+#ifdef PROFILE
+  if (lmn_env.profile_level >= 3) {
+    profile_countup(PROFILE_COUNT__HASH_RESIZE_TRIAL);
+  }
+#endif
+
+  new_cap = old_cap << 1;
+  new_tbl = LMN_NALLOC(State *, new_cap);
+  memset(new_tbl, 0x00, new_cap * (sizeof(State*)));
+
+  mig       = LMN_MALLOC(struct StateTableMigrate);
+  mig->pos  = 0UL;
+  mig->done = 0UL;
+
+  ADD_AND_FETCH(st->lf_seq, 1);
+  st->migrate     = mig;
+  st->old_tbl     = st->tbl;
+  st->old_cap     = old_cap;
+  st->tbl         = new_tbl;
+  st->cap         = new_cap;
+  st->cap_density = new_cap / st->thread_num;
+  ADD_AND_FETCH(st->lf_seq, 1);
+}
+
+
+/* 状態表stのバケットをn分割したうちのid番目の範囲[*begin, *end)を求める */
+static inline void statetable_bucket_range(StateTable *st,
+                                           unsigned int id,
+                                           unsigned int n,
+                                           unsigned long *begin,
+                                           unsigned long *end)
+{
+  unsigned long cap, w;
+
+  cap    = statetable_cap(st);
+  w      = (cap + n - 1) / n;
+  *begin = w * id < cap ? w * id : cap;
+  *end   = *begin + w < cap ? *begin + w : cap;
+}
+
+
+/* 状態表stのバケット[begin, end)に登録された各状態にfuncを適用する */
+static inline void statetable_foreach_range(StateTable *st, void (*func) ( ),
+                                            LmnWord _arg1, LmnWord _arg2,
+                                            unsigned long begin,
+                                            unsigned long end)
+{
+  unsigned long i;
+  State *ptr, *next;
+
+  for (i = begin; i < end; i++) {
+    ptr = st->tbl[i];
+    while (ptr) {
+      next = ptr->next;
+      if (_arg2) {
+        func(ptr, _arg1, _arg2);
+      } else if (_arg1) {
+        func(ptr, _arg1);
+      } else {
+        func(ptr);
+      }
+      ptr = next;
+    }
+  }
+}
+
+
 /* 高階関数  */
 void statetable_foreach(StateTable *st, void (*func) ( ),
                                LmnWord _arg1, LmnWord _arg2)
 {
   if (st) {
-    unsigned long i, size;
-    State *ptr, *next;
-
-    size = st->cap;
-    for (i = 0; i < size; i++) {
-      ptr = st->tbl[i];
-      while (ptr) {
-        next = ptr->next;
-        if (_arg2) {
-          func(ptr, _arg1, _arg2);
-        } else if (_arg1) {
-          func(ptr, _arg1);
-        } else {
-          func(ptr);
-        }
-        ptr = next;
-      }
+    if (statetable_use_lockfree(st)) {
+      /* 拡張途中の場合は移送を完了させてから走査する */
+      statetable_lf_complete(st);
     }
+
+    statetable_foreach_range(st, func, _arg1, _arg2, 0, statetable_cap(st));
   }
 }
 
+
+/* 状態表stのバケットをnthreads個のスレッドで分割して走査し, 各状態にmt_safe_funcを適用する.
+ * 各スレッドには0から順にスレッドIDを割り当てるため, mt_safe_funcはスレッド毎のメモリプールを
+ * 用いた解放処理(state_free等)でも構わない.
+ * nthreadsはlmn_env.core_num以下であること. */
 void statetable_foreach_parallel(StateTable *st, void (*mt_safe_func) ( ),
                                  LmnWord _arg1, LmnWord _arg2, int nthreads)
 {
   if (st) {
-    if (nthreads == 1) {
+    if (nthreads > (int)lmn_env.core_num) {
+      nthreads = lmn_env.core_num;
+    }
+
+    if (nthreads <= 1) {
       statetable_foreach(st, mt_safe_func, _arg1, _arg2);
     }
     else {
+      if (statetable_use_lockfree(st)) {
+        statetable_lf_complete(st);
+      }
       lmn_OMP_set_thread_num(nthreads);
 #ifdef ENABLE_OMP
 # pragma omp parallel
 #endif
-      statetable_foreach(st, mt_safe_func, _arg1, _arg2);
+      {
+        unsigned long begin, end;
+        unsigned int id = lmn_OMP_get_my_id();
+
+        env_my_TLS_init(id);
+        statetable_bucket_range(st, id, lmn_OMP_get_threads_num(), &begin, &end);
+        statetable_foreach_range(st, mt_safe_func, _arg1, _arg2, begin, end);
+        env_my_TLS_finalize();
+      }
     }
   }
 }
@@ -1229,20 +2854,163 @@ static inline int statetable_cmp_state_id_gr_f(const void *a_, const void *b_)
 }
 
 
+/* 次に発行する整列後の状態ID (全テーブルで通し番号とする) */
+static unsigned long statetable_format_next_id = 1;
+
 static inline void statetable_issue_state_id_f(State *s, LmnWord _d)
 {
-  static unsigned long id = 1;
-  state_set_format_id(s, id++);
+  state_set_format_id(s, statetable_format_next_id++);
 }
 
 
-/* CAUTION: MT-Unsafe */
-void statetable_format_states(StateTable *st)
+/* 整列済みの区間src[lo, mid)とsrc[mid, hi)を併合してdst[lo, hi)へ書き込む */
+static inline void statetable_merge_buckets(State **src, State **dst,
+                                            unsigned long lo,
+                                            unsigned long mid,
+                                            unsigned long hi)
 {
-  if (st) {
+  unsigned long i, j, k;
+
+  i = lo;
+  j = mid;
+  for (k = lo; k < hi; k++) {
+    if (j >= hi ||
+        (i < mid && statetable_cmp_state_id_gr_f(&src[i], &src[j]) <= 0)) {
+      dst[k] = src[i++];
+    } else {
+      dst[k] = src[j++];
+    }
+  }
+}
+
+
+/* バケット配列をn個の区間に分けて各スレッドで整列し, 区間を2つずつ併合する.
+ * 併合には状態表と同じ大きさの作業領域を一時的に確保する. */
+static void statetable_sort_buckets(StateTable *st, unsigned int n)
+{
+  State **src, **dst, **tmp;
+  unsigned long *b;
+  unsigned int w;
+  int i;
+
+  if (n == 1) {
     qsort(st->tbl, st->cap, sizeof(struct State *), statetable_cmp_state_id_gr_f);
+    return;
+  }
+
+  b = LMN_NALLOC(unsigned long, n + 1);
+  for (i = 0; i < (int)n; i++) {
+    statetable_bucket_range(st, i, n, &b[i], &b[i + 1]);
+  }
+
+  lmn_OMP_set_thread_num(n);
+#ifdef ENABLE_OMP
+# pragma omp parallel for
+#endif
+  for (i = 0; i < (int)n; i++) {
+    qsort(st->tbl + b[i], b[i + 1] - b[i],
+          sizeof(struct State *), statetable_cmp_state_id_gr_f);
+  }
+
+  tmp = LMN_NALLOC(State *, st->cap);
+  src = st->tbl;
+  dst = tmp;
+  for (w = 1; w < n; w *= 2) {
+#ifdef ENABLE_OMP
+# pragma omp parallel for
+#endif
+    for (i = 0; i < (int)n; i += 2 * w) {
+      unsigned int m = i + w     < n ? i + w     : n;
+      unsigned int h = i + 2 * w < n ? i + 2 * w : n;
+      statetable_merge_buckets(src, dst, b[i], b[m], b[h]);
+    }
+    tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != st->tbl) {
+    memcpy(st->tbl, src, st->cap * sizeof(struct State *));
+    tmp = src;
+  } else {
+    tmp = dst;
+  }
+
+  LMN_FREE(tmp);
+  LMN_FREE(b);
+}
+
+
+/* 整列後のバケット順に状態IDを発行する.
+ * n個の区間毎に状態数を数えてから, 各区間の先頭IDを求めて並列に発行する. */
+static void statetable_issue_state_ids(StateTable *st, unsigned int n)
+{
+  unsigned long *base;
+  int i;
+
+  if (n == 1) {
     statetable_foreach(st, statetable_issue_state_id_f,
                        DEFAULT_ARGS, DEFAULT_ARGS);
+    return;
+  }
+
+  base = LMN_NALLOC(unsigned long, n + 1);
+
+  lmn_OMP_set_thread_num(n);
+#ifdef ENABLE_OMP
+# pragma omp parallel for
+#endif
+  for (i = 0; i < (int)n; i++) {
+    unsigned long begin, end, j, c;
+    State *s;
+
+    statetable_bucket_range(st, i, n, &begin, &end);
+    c = 0;
+    for (j = begin; j < end; j++) {
+      for (s = st->tbl[j]; s; s = s->next) c++;
+    }
+    base[i + 1] = c;
+  }
+
+  base[0] = statetable_format_next_id;
+  for (i = 0; i < (int)n; i++) {
+    base[i + 1] += base[i];
+  }
+
+#ifdef ENABLE_OMP
+# pragma omp parallel for
+#endif
+  for (i = 0; i < (int)n; i++) {
+    unsigned long begin, end, j, id;
+    State *s;
+
+    statetable_bucket_range(st, i, n, &begin, &end);
+    id = base[i];
+    for (j = begin; j < end; j++) {
+      for (s = st->tbl[j]; s; s = s->next) state_set_format_id(s, id++);
+    }
+  }
+
+  statetable_format_next_id = base[n];
+  LMN_FREE(base);
+}
+
+
+/* 状態表stのスレッド数で整列とID発行を並列に行う.
+ * CAUTION: 探索中のスレッドとはMT-Unsafe */
+void statetable_format_states(StateTable *st)
+{
+  if (st) {
+    unsigned int n;
+
+    if (statetable_use_lockfree(st)) {
+      statetable_lf_complete(st);
+    }
+
+    n = st->thread_num > 0 ? st->thread_num : 1;
+    if (n > st->cap) n = 1;
+    statetable_sort_buckets(st, n);
+    statetable_issue_state_ids(st, n);
   }
 }
 
@@ -38,7 +38,8 @@
  */
 
 /** @author Masato Gocho
- *  Closed Address Hash Table / Parallel Hash Table for State Management Table
+ *  Closed Address Hash Table / Parallel Hash Table / Lock-Free Open Address Hash Table
+ *  for State Management Table
  */
 
 #ifndef LMN_STATESPACE_H
@@ -54,6 +55,7 @@
 #include "lmntal_thread.h"
 #include "delta_membrane.h"
 #include "mem_encode.h"
+#include <stdint.h>
 
 struct statespace_type {
   int(*compare) ( );               /* 状態の等価性判定を行う関数 */
@@ -64,7 +66,8 @@ struct statespace_type {
 struct StateSpace {
   BYTE            tbl_type;       /* なんらかの特殊操作を行うためのフラグフィールド */
   BOOL            is_formated;    /* ハッシュ表の並びを崩した整列を行った場合に真 */
-  /* 2bytes alignment */
+  BOOL            own_pools;      /* 状態のメモリプールを所有し, 破棄時にプールごと解放する場合に真 */
+  /* 1byte alignment */
   unsigned int    thread_num;     /* 本テーブルの操作スレッド数 */
 
   FILE            *out;           /* dump先 */
@@ -78,6 +81,29 @@ struct StateSpace {
   Automata       property_automata;  /* Never Clainへのポインタ */
   Vector         *propsyms;          /* 命題記号定義へのポインタ */
 
+  /* bitstate hashing (supertrace)用. 状態を保持せず, 状態毎にbits_k個のビットを立てて訪問済みとする */
+  unsigned long  *bits;              /* ビット配列 */
+  unsigned long   bits_len;          /* ビット配列のビット数(2のべき乗) */
+  unsigned int    bits_k;            /* 1状態あたりに立てるビット数 */
+  unsigned long  *bits_num;          /* スレッド毎の新規と判定した状態数 */
+  unsigned long  *bits_set;          /* スレッド毎の新たに立てたビット数 */
+
+  /* hash compaction用. 状態を保持せず, 状態毎に64bitのfingerprintのみをopen addressing表に記録する */
+  uint64_t       *fps;               /* fingerprint表 (0は空きを表す) */
+  unsigned long   fps_cap;           /* fingerprint表の要素数(2のべき乗) */
+  unsigned long  *fps_num;           /* スレッド毎の新規と判定した状態数 */
+  unsigned long  *fps_lost;          /* スレッド毎の, 表が満杯のため検査せずに既出として扱った状態数 */
+  volatile BOOL   fps_warned;        /* 充填率に関する警告を出した場合に真 */
+  volatile BOOL   fps_full;          /* 表が満杯になった場合に真 */
+
+  /* --memory-limit用. 登録した状態のメモリ量に応じて, 新たに登録する状態の圧縮方式を切り替える */
+  unsigned long  *mem_used;          /* スレッド毎の登録した状態のメモリ量(byte) */
+  unsigned long  *mem_unchecked;     /* スレッド毎の前回の確認以降に登録した状態のメモリ量(確認間隔の計測用) */
+  volatile BYTE   mem_level;         /* 現在の圧縮レベル(SS_MEM_LEVEL_*) */
+
+  /* --bfs-partition用. ハッシュ値で状態空間を分割し, 各部分表は担当スレッドのみが操作する */
+  struct StatePartition *part;
+
 #ifdef PROFILE
   HashSet memid_hashes;   /* 膜のIDで同型性の判定を行うハッシュ値(mhash)のSet */
 #endif
@@ -90,6 +116,9 @@ struct StateSpace {
 /* the member "tbl_type" in struct StateSpace */
 #define SS_MEMID_MASK           (0x01U)
 #define SS_REHASHER_MASK        (0x01U << 1)
+#define SS_BITSTATE_MASK        (0x01U << 2)
+#define SS_HCOMPACT_MASK        (0x01U << 3)
+#define SS_PARTITION_MASK       (0x01U << 4)
 
 #define statespace_use_memenc(SS)       ((SS)->tbl_type &    SS_MEMID_MASK)
 #define statespace_set_memenc(SS)       ((SS)->tbl_type |=   SS_MEMID_MASK)
@@ -97,9 +126,29 @@ struct StateSpace {
 #define statespace_use_rehasher(SS)     ((SS)->tbl_type &    SS_REHASHER_MASK)
 #define statespace_set_rehasher(SS)     ((SS)->tbl_type |=   SS_REHASHER_MASK)
 #define statespace_unset_rehasher(SS)   ((SS)->tbl_type &= (~SS_REHASHER_MASK))
+#define statespace_use_bitstate(SS)     ((SS)->tbl_type &    SS_BITSTATE_MASK)
+#define statespace_set_bitstate(SS)     ((SS)->tbl_type |=   SS_BITSTATE_MASK)
+#define statespace_use_hcompact(SS)     ((SS)->tbl_type &    SS_HCOMPACT_MASK)
+#define statespace_set_hcompact(SS)     ((SS)->tbl_type |=   SS_HCOMPACT_MASK)
+#define statespace_use_partition(SS)    ((SS)->tbl_type &    SS_PARTITION_MASK)
+#define statespace_set_partition(SS)    ((SS)->tbl_type |=   SS_PARTITION_MASK)
+#define statespace_unset_partition(SS)  ((SS)->tbl_type &= (~SS_PARTITION_MASK))
+/* 状態そのものを保持しない(既出判定に用いる情報のみを記録する)場合に真 */
+#define statespace_is_stateless(SS)     ((SS)->tbl_type & (SS_BITSTATE_MASK | SS_HCOMPACT_MASK))
+
+/* the member "mem_level" in struct StateSpace */
+#define SS_MEM_LEVEL_NONE       (0U) /* 起動時に指定した圧縮方式のまま */
+#define SS_MEM_LEVEL_Z          (1U) /* 以降に登録する状態をz圧縮する */
+#define SS_MEM_LEVEL_COLD       (2U) /* 展開済みの状態もz圧縮し直した */
+#define SS_MEM_LEVEL_OVER       (3U) /* これ以上圧縮できずに上限を越えた */
+
+#define statespace_use_mem_limit(SS)    ((SS)->mem_used != NULL)
+#define statespace_mem_level(SS)        ((SS)->mem_level)
 
 struct StateTable {
   BOOL             use_rehasher;
+  BOOL             use_lockfree;  /* 真ならばCASで登録するopen addressing表として扱う */
+  BOOL             owner_only;    /* 真ならば担当スレッドのみが登録する部分表として扱う(--bfs-partition) */
   BYTE             thread_num;
   struct statespace_type *type;
   State            **tbl;
@@ -109,8 +158,21 @@ struct StateTable {
   unsigned long    *num_dummy;
   EWLock           *lock;
   StateTable       *rehash_tbl;   /* rehashした際に登録するテーブル */
+
+  /* 以下, lock-free表(use_lockfree)専用のメンバ */
+  volatile BOOL    resizing;      /* 拡張開始から移送完了までの間, 真 */
+  State            **old_tbl;     /* 拡張中の移送元スロット配列 (拡張中でなければNULL) */
+  unsigned long    old_cap;
+  struct StateTableMigrate *migrate; /* 拡張中の移送の進捗 (拡張中でなければNULL) */
+  volatile unsigned long lf_seq;  /* tbl/cap/old_tbl/old_capを公開する際のシーケンス番号 */
+  struct StateTableRetired *retired; /* 移送を終えて解放待ちのスロット配列のリスト */
+  volatile BOOL    reclaiming;    /* retiredを操作中ならば真 */
+  volatile unsigned long *lf_epoch; /* スレッド毎の表操作カウンタ(操作中は奇数). キャッシュライン単位で配置 */
 };
 
+/* lf_epochの各カウンタの配置間隔(要素数). false sharingを避けるためキャッシュラインサイズとする */
+#define STATETABLE_LF_STRIDE   (64U / sizeof(unsigned long))
+
 #define DEFAULT_ARGS  (LmnWord)NULL
 
 
@@ -130,6 +192,7 @@ void statetable_format_states(StateTable *st);
 static inline void          statetable_set_lock(StateTable *st, EWLock *lock);
 static inline void          statetable_set_rehasher(StateTable *st);
 static inline BOOL          statetable_use_rehasher(StateTable *st);
+static inline BOOL          statetable_use_lockfree(StateTable *st);
 static inline unsigned long statetable_num_by_me(StateTable *st);
 static inline unsigned long statetable_num(StateTable *st);
 static inline unsigned long statetable_cap(StateTable *st);
@@ -157,6 +220,10 @@ static inline BOOL statetable_use_rehasher(StateTable *st) {
   return st->use_rehasher;
 }
 
+static inline BOOL statetable_use_lockfree(StateTable *st) {
+  return st->use_lockfree;
+}
+
 static inline unsigned long statetable_num_by_me(StateTable *st) {
   return st->num[env_my_thread_id()];
 }
@@ -211,6 +278,8 @@ static inline unsigned long statetable_space(StateTable *tbl) {
     + (tbl->num ? tbl->thread_num * sizeof(unsigned long) : 0)
     + (tbl->num_dummy ? tbl->thread_num * sizeof(unsigned long) : 0)
     + (tbl->cap * sizeof(State *))
+    + (tbl->lf_epoch ? tbl->thread_num * STATETABLE_LF_STRIDE * sizeof(unsigned long) : 0)
+    + (tbl->old_tbl ? tbl->old_cap * sizeof(State *) : 0)
     + lmn_ewlock_space(tbl->lock);
 }
 
@@ -226,6 +295,9 @@ void       statespace_free(StateSpace ss);
 void       statespace_add_direct(StateSpace ss, State *s);
 State     *statespace_insert(StateSpace ss, State *s);
 State     *statespace_insert_delta(StateSpace ss, State *s, struct MemDeltaRoot *d);
+void       statespace_insert_batch(StateSpace ss, State **succs, unsigned int n);
+BOOL       statespace_lookup_mem_enable(StateSpace ss);
+State     *statespace_lookup_mem(StateSpace ss, LmnMembrane *mem, unsigned long hash);
 void       statespace_foreach(StateSpace ss, void (*func) ( ),
                               LmnWord _arg1, LmnWord _arg2);
 void       statespace_foreach_parallel(StateSpace ss, void (*func) ( ),
@@ -234,11 +306,31 @@ void       statespace_format_states(StateSpace ss);
 void       statespace_clear(StateSpace ss);
 void       statespace_ends_dumper(StateSpace ss);
 void       statespace_dumper(StateSpace ss);
+void       statespace_enable_bitstate(StateSpace ss, unsigned long mbytes, unsigned int k);
+double     statespace_bitstate_omission(StateSpace ss);
+double     statespace_bitstate_coverage(StateSpace ss);
+void       statespace_enable_hcompact(StateSpace ss, unsigned long mbytes);
+double     statespace_hcompact_fill(StateSpace ss);
+double     statespace_hcompact_omission(StateSpace ss);
+unsigned long statespace_hcompact_lost(StateSpace ss);
+unsigned long statespace_mem_used(StateSpace ss);
+void       statespace_enable_partition(StateSpace ss);
+BOOL       statespace_partition_is_mine(StateSpace ss, State *s);
+State     *statespace_partition_forward(StateSpace ss, State *s,
+                                        State *parent, unsigned int idx);
+BOOL       statespace_partition_send(StateSpace ss, BOOL flush);
+BOOL       statespace_partition_has_pending(StateSpace ss);
+unsigned long statespace_partition_receive(StateSpace ss,
+                                           void (*func)(State *, State *, State *, unsigned int, LmnWord),
+                                           LmnWord arg);
+void       statespace_partition_merge(StateSpace ss);
+unsigned long statespace_partition_num(StateSpace ss);
 
 static inline unsigned long statespace_num_raw(StateSpace ss);
 static inline unsigned long statespace_num(StateSpace ss);
 static inline unsigned long statespace_dummy_num(StateSpace ss);
 static inline unsigned long statespace_end_num(StateSpace ss);
+static inline unsigned long statespace_bitstate_set(StateSpace ss);
 static inline State        *statespace_init_state(StateSpace ss);
 static inline void          statespace_set_init_state(StateSpace ss,
                                                       State *init_state,
@@ -274,7 +366,24 @@ static inline unsigned long statespace_num(StateSpace ss) {
 
 /* dummyの状態数を含む, 管理している状態数を返す */
 static inline unsigned long statespace_num_raw(StateSpace ss) {
+  if (statespace_use_bitstate(ss)) {
+    unsigned long ret = 0;
+    unsigned int i;
+    for (i = 0; i < ss->thread_num; i++) {
+      ret += ss->bits_num[i];
+    }
+    return ret;
+  }
+  if (statespace_use_hcompact(ss)) {
+    unsigned long ret = 0;
+    unsigned int i;
+    for (i = 0; i < ss->thread_num; i++) {
+      ret += ss->fps_num[i];
+    }
+    return ret;
+  }
   return statetable_num(statespace_tbl(ss))
+       + (statespace_use_partition(ss) ? statespace_partition_num(ss) : 0UL)
        + statetable_num(statespace_memid_tbl(ss))
        + statetable_num(statespace_accept_tbl(ss))
        + statetable_num(statespace_accept_memid_tbl(ss));
@@ -320,6 +429,19 @@ static inline unsigned long statespace_end_num(StateSpace ss) {
 }
 
 
+/* bitstate hashingで立てたビット数を返す */
+static inline unsigned long statespace_bitstate_set(StateSpace ss) {
+  unsigned long ret = 0;
+  unsigned int i;
+  if (statespace_use_bitstate(ss)) {
+    for (i = 0; i < ss->thread_num; i++) {
+      ret += ss->bits_set[i];
+    }
+  }
+  return ret;
+}
+
+
 /* 状態空間に**すでに含まれている**状態sを最終状態として登録する */
 static inline void statespace_add_end_state(StateSpace ss, State *s) {
   LMN_ASSERT(env_my_thread_id() < env_threads_num());
@@ -366,6 +488,12 @@ static inline unsigned long statespace_space(StateSpace ss) {
   if (statespace_accept_memid_tbl(ss)) {
     ret += statetable_space(statespace_accept_memid_tbl(ss));
   }
+  if (statespace_use_bitstate(ss)) {
+    ret += ss->bits_len / 8 + ss->thread_num * 2 * sizeof(unsigned long);
+  }
+  if (statespace_use_hcompact(ss)) {
+    ret += ss->fps_cap * sizeof(uint64_t) + ss->thread_num * sizeof(unsigned long);
+  }
   if (ss->thread_num > 1) {
     unsigned int i;
     for (i = 0; i < ss->thread_num; i++)  ret += vec_space(&ss->end_states[i]);
@@ -0,0 +1,224 @@
+#!/bin/sh
+# 状態空間探索(--nd)のオプション間で結果が一致することを検査する.
+#
+#  - 状態数と遷移数(-p2の"Stored"と"Successors")が, 逐次BFS(--nd --bfs)と一致すること
+#  - 状態を取りこぼし得るオプション(--bitstate, --hash-compaction)の状態数が, 逐次BFS以下であること
+#  - 状態の内容(-tで出力する状態の集合)が, 逐次DFS(--nd)と一致すること
+#  - LTLモデル検査(--ltl)の状態数と遷移数が, 差分を使わない逐次DFSと一致すること
+#  - mc/<モデル>.expectの各行(正規化した状態)が, 状態の集合に含まれること
+#
+# モデルはmc/<モデル>.lmnをコンパイルした中間命令列(mc/<モデル>.il)を読み込むため,
+# コンパイラ(Java)を用意せずに処理系だけで実行できる.
+#
+# 使い方: ./check_mc.sh [slimのパス]
+
+pwd=`dirname $0`
+slim=${1:-$pwd/../../src/slim}
+tmp=${TMPDIR:-/tmp}/check_mc.$$
+ng=0
+
+models="
+$pwd/mc/counter.il
+$pwd/mc/mems.il
+$pwd/mc/nest.il
+"
+
+# 状態数と遷移数を逐次BFSと比べるオプション (1行に1組)
+count_opts="
+--delta-mem
+--mem-enc
+--collapse
+--delta-mem --collapse
+--use-Ncore=4
+--use-Ncore=4 --delta-mem
+--bfs --use-Ncore=4
+--bfs-partition --use-Ncore=4
+--bfs-partition --use-Ncore=4 --delta-mem
+--use-Ncore=4 --lockfree-tbl
+--use-Ncore=4 --lockfree-tbl --delta-mem
+--memory-limit=1
+--memory-limit=100K
+--spill-dir=$tmp.spill
+--z-dict
+--d-compress --d-chain-max=2
+--d-compress --d-ref-best
+--bfs-lsync --use-Ncore=4 --bfs-small-layer=4
+--use-Ncore=4 --numa
+"
+
+# 状態の集合を逐次DFSと比べるオプション (1行に1組)
+state_opts="
+--delta-mem
+--mem-enc
+--collapse
+--delta-mem --collapse
+--use-Ncore=4 --lockfree-tbl
+--use-Ncore=4 --lockfree-tbl --delta-mem
+--memory-limit=1
+--memory-limit=100K
+--spill-dir=$tmp.spill
+--z-dict
+--d-compress --d-chain-max=2
+--d-compress --d-ref-best
+--bfs-lsync --use-Ncore=4 --bfs-small-layer=4
+--use-Ncore=4 --numa
+"
+
+# 状態を取りこぼし得るオプション (1行に1組). 状態数が1以上, 逐次BFS以下であることを確かめる
+lossy_opts="
+--bitstate=1
+--hash-compaction
+"
+
+# LTLモデル検査で状態数と遷移数を逐次DFS(--ltl)と比べるオプション (1行に1組).
+# 性質オートマトンは受理状態を持たない3状態の閉路で, 積の状態空間を全て探索させ,
+# 性質オートマトンの状態番号が0でない状態を親に持つ状態を生成させる
+ltl="--ltl --nc $pwd/mc/cycle.nc --psym $pwd/mc/cycle.psym"
+ltl_opts="
+--delta-mem
+--delta-mem --collapse
+--use-Ncore=4 --delta-mem
+"
+
+trap 'rm -rf $tmp.*' 0 1 2 15
+mkdir $tmp.spill
+
+# 状態数と遷移数を "Stored Successors" の形で出力する
+counts() {
+  $slim --nd -p2 "$@" 2>&1 >/dev/null </dev/null | awk '
+    /Stored/     { s = $NF }
+    /Successors/ { t = $NF }
+    END          { print s, t }'
+}
+
+# 状態の集合を, 状態IDと膜内の要素の並びに依存しない形で出力する.
+# -tは状態を "ID::{アトム. {子膜}, ... @ルールセット. }" の形で出力する
+states() {
+  $slim --nd -t "$@" </dev/null 2>/dev/null | awk '
+    # リンク名(L<番号>)は状態全体での出現順に付くため, 膜ごとに出現順で付け直す
+    function relink(s,    out, name, map, k) {
+      out = ""; k = 0
+      while (match(s, /[(,]L[0-9]+[,)]/)) {
+        name = substr(s, RSTART + 1, RLENGTH - 2)
+        if (!(name in map)) map[name] = "L" k++
+        out = out substr(s, 1, RSTART) map[name]
+        s = substr(s, RSTART + RLENGTH - 1)
+      }
+      return out s
+    }
+    # 膜の中身sを, 要素(アトムと子膜)を整列した形にする. ルールセット(@N)は除く
+    function canon(s,    n, i, c, d, item, items, m, j, out) {
+      m = 0; d = 0; item = ""
+      n = length(s)
+      for (i = 1; i <= n + 1; i++) {
+        c = i <= n ? substr(s, i, 1) : "."
+        if (c == "(" || c == "{") d++
+        if (c == ")" || c == "}") d--
+        if (d == 0 && (c == "," || c == ".")) {
+          gsub(/^ +| +$/, "", item)
+          if (item ~ /^\{.*\}$/) item = "{" relink(canon(substr(item, 2, length(item) - 2))) "}"
+          if (item != "" && item !~ /^@/) {
+            for (j = m; j > 0 && items[j] > item; j--) items[j + 1] = items[j]
+            items[j + 1] = item
+            m++
+          }
+          item = ""
+        } else {
+          item = item c
+        }
+      }
+      out = ""
+      for (j = 1; j <= m; j++) out = out (j > 1 ? " " : "") items[j]
+      return out
+    }
+    /^States/ { on = 1; next }
+    /^$/      { on = 0 }
+    on {
+      sub(/^[0-9]+::\{/, "")
+      sub(/\} *$/, "")
+      print relink(canon($0))
+    }' | sort
+}
+
+result() {
+  if [ "$2" = "$3" ]; then
+    echo "ok : $1"
+  else
+    echo "ng : $1 ==> $2 <=> $3"
+    ng=1
+  fi
+}
+
+for m in $models; do
+  echo "model: `basename $m`"
+
+  ref=`counts --bfs $m`
+  if echo "$ref" | grep -q '^[1-9][0-9]* [0-9][0-9]*$'; then :; else
+    result "counts --bfs" "'$ref'" "<states> <transitions>"
+    continue
+  fi
+  result "counts" "`counts $m`" "$ref"
+  while read opt; do
+    [ -n "$opt" ] || continue
+    result "counts $opt" "`counts $opt $m`" "$ref"
+  done <<EOF
+$count_opts
+EOF
+
+  while read opt; do
+    [ -n "$opt" ] || continue
+    n=`counts $opt $m | awk '{ print $1 }'`
+    if [ -n "$n" ] && [ "$n" -ge 1 ] && [ "$n" -le "${ref% *}" ]; then
+      result "counts $opt" "$n <= ${ref% *}" "$n <= ${ref% *}"
+    else
+      result "counts $opt" "'$n'" "1..${ref% *}"
+    fi
+  done <<EOF
+$lossy_opts
+EOF
+
+  # 上限超過の警告はSS_MEM_LEVEL_COLD(展開済みの状態の再圧縮)を経た後にだけ出る
+  for opt in --memory-limit=1 --memory-limit=100K; do
+    if $slim --nd $opt $m 2>&1 >/dev/null </dev/null | grep -q 'exceeds --memory-limit'; then
+      result "cold $opt" warned warned
+    else
+      result "cold $opt" "no warning" warned
+    fi
+  done
+
+  ltlref=`counts $ltl $m`
+  if echo "$ltlref" | grep -q '^[1-9][0-9]* [0-9][0-9]*$'; then
+    while read opt; do
+      [ -n "$opt" ] || continue
+      result "counts --ltl $opt" "`counts $ltl $opt $m`" "$ltlref"
+    done <<EOF
+$ltl_opts
+EOF
+  else
+    result "counts --ltl" "'$ltlref'" "<states> <transitions>"
+  fi
+
+  states $m > $tmp.ref
+  if [ -f ${m%.il}.expect ]; then
+    while read expect; do
+      if grep -qxF "$expect" $tmp.ref; then
+        result "expect $expect" found found
+      else
+        result "expect $expect" "not found" found
+      fi
+    done < ${m%.il}.expect
+  fi
+  while read opt; do
+    [ -n "$opt" ] || continue
+    states $opt $m > $tmp.out
+    if cmp -s $tmp.ref $tmp.out; then
+      result "states $opt" same same
+    else
+      result "states $opt" "`diff $tmp.ref $tmp.out | sed -n 2,3p | tr '\n' ' '`" ""
+    fi
+  done <<EOF
+$state_opts
+EOF
+done
+
+exit $ng
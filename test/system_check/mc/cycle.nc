@@ -0,0 +1,14 @@
+never { /* 受理状態を持たない3状態の閉路. 積の状態空間を全て探索させる */
+T0_init:
+	if
+	:: (1) -> goto T1
+	fi;
+T1:
+	if
+	:: (1) -> goto T2
+	fi;
+T2:
+	if
+	:: (1) -> goto T0_init
+	fi;
+}